@@ -0,0 +1,903 @@
+/**
+ * @file bench.c
+ * @brief Latency and bandwidth benchmark implementation
+ *
+ * Implements the perftest-style benchmark:
+ * - Ping-pong latency with percentiles for send, write, write-with-imm and read
+ * - Streaming bandwidth through the send pipeline at a chosen queue depth
+ * - One connection and thread per requested thread, merged into one result
+ * - CSV or JSON output, one record per test point
+ *
+ * Only the library's own connection setup and posting paths are used, so the
+ * numbers reflect what applications built on it get. Runs over soft-RoCE
+ * (rdma_rxe) as well as real hardware.
+ */
+
+#include "bench.h"
+#include "../hugepage.h"
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+
+/**
+ * @brief Per-connection benchmark state
+ */
+struct bench_conn {
+    struct config_t config;      // Connection resources
+    struct qp_info_t remote;     // Peer buffer (target of writes and reads)
+    const struct bench_hello *hello;  // Test point
+    char *src;                   // Registered source of sends/writes, sink of reads
+    struct ibv_mr *src_mr;       // Registration of src
+    uint64_t *samples;           // Latency samples in ns (client, BENCH_LAT)
+    uint64_t start_ns;           // Start of the timed phase
+    uint64_t end_ns;             // End of the timed phase
+    pthread_barrier_t *barrier;  // Lines up the client threads before timing
+};
+
+static const char *const op_names[BENCH_OP_MAX] = { "send", "write", "write_imm", "read" };
+
+/*******************************************************************************
+ * Helpers
+ ******************************************************************************/
+
+/**
+ * @brief Monotonic clock in nanoseconds
+ * @return Current CLOCK_MONOTONIC time
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Waits until the peer reaches the same point
+ * @param conn Connection whose control socket carries the barrier
+ */
+static void bench_sync(struct bench_conn *conn)
+{
+    char token = 0;
+    if (sock_write_full(conn->config.sock_fd, &token, 1) || sock_read_full(conn->config.sock_fd, &token, 1)) {
+        die("Benchmark peer went away");
+    }
+}
+
+/**
+ * @brief Library mode whose access flags an operation needs
+ * @param op Benchmarked operation
+ * @return Mode to set the connection up in
+ */
+static rdma_mode_t op_mode(bench_op_t op)
+{
+    switch (op) {
+    case BENCH_OP_SEND: return MODE_SEND_RECV;
+    case BENCH_OP_READ: return MODE_READ;
+    default: return MODE_WRITE;
+    }
+}
+
+/**
+ * @brief Library operation posted for a benchmarked operation
+ * @param op Benchmarked operation
+ * @return Operation to pass to post_operation_mr / pipeline_post_mr
+ */
+static rdma_op_t op_post(bench_op_t op)
+{
+    switch (op) {
+    case BENCH_OP_SEND: return OP_SEND;
+    case BENCH_OP_WRITE: return OP_WRITE_PLAIN;
+    case BENCH_OP_WRITE_IMM: return OP_WRITE;
+    default: return OP_READ;
+    }
+}
+
+/**
+ * @brief Whether an operation consumes a receive at the target
+ * @param op Benchmarked operation
+ * @return Non-zero for send and write-with-imm
+ */
+static int op_needs_recv(bench_op_t op)
+{
+    return op == BENCH_OP_SEND || op == BENCH_OP_WRITE_IMM;
+}
+
+/**
+ * @brief Sets up one benchmark connection
+ * @param conn Connection to set up (zeroed)
+ * @param hello Test point
+ * @param server_name Server to connect to (NULL on the server)
+ * @param sock_fd Accepted control socket whose hello was read (server only)
+ *
+ * The client sends the hello right after connecting, ahead of the QP
+ * information exchange, so the server can size its buffer to match.
+ */
+static void bench_conn_setup(struct bench_conn *conn, const struct bench_hello *hello, const char *server_name,
+                             int sock_fd)
+{
+    conn->hello = hello;
+    conn->config.buf_size = hello->size;  // Per connection, so test points never resize each other
+
+    rdma_status_t status = init_resources(&conn->config, op_mode(hello->op));
+    if (status != RDMA_SUCCESS) {
+        die("Failed to initialize benchmark connection");
+    }
+
+    if (server_name) {
+        setup_socket(&conn->config, server_name);
+        if (sock_write_full(conn->config.sock_fd, hello, sizeof(*hello))) {
+            die_with_cleanup("Failed to send benchmark hello", &conn->config);
+        }
+    } else {
+        conn->config.sock_fd = sock_fd;
+    }
+    if (connect_qps(&conn->config, server_name, &conn->remote, op_mode(hello->op)) != RDMA_SUCCESS) {
+        die_with_cleanup("Failed to connect benchmark QP", &conn->config);
+    }
+
+    // Posts come from a buffer of their own; config->buf is where the peer's writes land
+    if (posix_memalign((void **)&conn->src, sysconf(_SC_PAGESIZE), hello->size)) {
+        die_with_cleanup("Failed to allocate benchmark buffer", &conn->config);
+    }
+    memset(conn->src, 0, hello->size);
+    conn->src_mr = register_buffer(&conn->config, conn->src, hello->size, 0);
+    if (!conn->src_mr) {
+        die_with_cleanup("Failed to register benchmark buffer", &conn->config);
+    }
+
+    if (op_needs_recv(hello->op) && (hello->kind == BENCH_LAT || !server_name)) {
+        size_t slot_size = hello->op == BENCH_OP_SEND ? hello->size : 0;
+        if (recv_ring_init(&conn->config, RECV_RING_DEFAULT_DEPTH, slot_size, RECV_RING_REPOST_BATCH)
+            != RDMA_SUCCESS) {
+            die_with_cleanup("Failed to set up the receive ring", &conn->config);
+        }
+    }
+
+    if (hello->kind == BENCH_BW && server_name) {
+        // Posts come from src, so the staging slots are never used
+        uint32_t depth = hello->depth;
+        if (pipeline_init(&conn->config, depth, sizeof(uint64_t), depth > 1 ? depth / 2 : 1) != RDMA_SUCCESS) {
+            die_with_cleanup("Failed to set up the send pipeline", &conn->config);
+        }
+        if (hello->batch && pipeline_set_batch(&conn->config, hello->batch, PIPELINE_DEFAULT_BATCH_USEC)
+            != RDMA_SUCCESS) {
+            die_with_cleanup("Failed to enable doorbell batching", &conn->config);
+        }
+    }
+}
+
+/**
+ * @brief Releases one benchmark connection
+ * @param conn Connection to release
+ */
+static void bench_conn_destroy(struct bench_conn *conn)
+{
+    if (conn->src_mr)
+        deregister_buffer(&conn->config, conn->src_mr);
+    free(conn->src);
+    free(conn->samples);
+    cleanup_resources(&conn->config);
+}
+
+/*******************************************************************************
+ * Latency
+ ******************************************************************************/
+
+/**
+ * @brief Posts one message of the test point and waits for its local completion
+ * @param conn Benchmark connection
+ */
+static void post_one(struct bench_conn *conn)
+{
+    bench_op_t op = conn->hello->op;
+    post_operation_mr(&conn->config, op_post(op), conn->src_mr, buffer_offset(conn->src_mr, conn->src),
+                      conn->hello->size, op == BENCH_OP_SEND ? NULL : &conn->remote, 0);
+    wait_completion(&conn->config);
+}
+
+/**
+ * @brief Waits for the peer's message of one ping-pong round
+ * @param conn Benchmark connection
+ * @param tag Value the last byte of a plain write carries this round
+ *
+ * Plain writes raise no completion at the target, so their arrival is
+ * detected by polling the last byte of the buffer, which is placed last.
+ */
+static void wait_one(struct bench_conn *conn, char tag)
+{
+    if (conn->hello->op == BENCH_OP_WRITE) {
+        volatile char *last = (volatile char *)conn->config.buf + conn->hello->size - 1;
+        while (*last != tag)
+            ;
+        return;
+    }
+
+    struct recv_msg_t msg;
+    if (recv_ring_next(&conn->config, &msg)) {
+        die("Benchmark receive failed");
+    }
+    recv_ring_release(&conn->config, msg.slot);
+}
+
+/**
+ * @brief Client side of a latency test point
+ * @param conn Benchmark connection
+ *
+ * Records half the round trip of each ping-pong; reads involve no remote
+ * CPU, so each read's full completion time is recorded instead.
+ */
+static void client_latency(struct bench_conn *conn)
+{
+    const struct bench_hello *hello = conn->hello;
+    uint64_t total = hello->warmup + hello->iters;
+
+    bench_sync(conn);
+    pthread_barrier_wait(conn->barrier);
+    conn->start_ns = now_ns();
+
+    for (uint64_t i = 0; i < total; i++) {
+        char tag = (char)(i % 255 + 1);
+        conn->src[hello->size - 1] = tag;
+
+        uint64_t t0 = now_ns();
+        post_one(conn);
+        if (hello->op != BENCH_OP_READ)
+            wait_one(conn, tag);
+        uint64_t elapsed = now_ns() - t0;
+
+        if (i >= hello->warmup)
+            conn->samples[i - hello->warmup] = hello->op == BENCH_OP_READ ? elapsed : elapsed / 2;
+    }
+
+    conn->end_ns = now_ns();
+    bench_sync(conn);
+}
+
+/**
+ * @brief Server side of a latency test point: echoes every message back
+ * @param conn Benchmark connection
+ */
+static void server_latency(struct bench_conn *conn)
+{
+    const struct bench_hello *hello = conn->hello;
+    uint64_t total = hello->warmup + hello->iters;
+
+    bench_sync(conn);
+    for (uint64_t i = 0; hello->op != BENCH_OP_READ && i < total; i++) {
+        char tag = (char)(i % 255 + 1);
+        wait_one(conn, tag);
+        conn->src[hello->size - 1] = tag;
+        post_one(conn);
+    }
+    bench_sync(conn);
+}
+
+/*******************************************************************************
+ * Bandwidth
+ ******************************************************************************/
+
+/**
+ * @brief Client side of a bandwidth test point
+ * @param conn Benchmark connection with an initialized pipeline
+ *
+ * Keeps depth WRs in flight; the last one is signaled so the drain sees the
+ * whole stream complete.
+ */
+static void client_bandwidth(struct bench_conn *conn)
+{
+    const struct bench_hello *hello = conn->hello;
+    rdma_op_t op = op_post(hello->op);
+    const struct qp_info_t *remote = hello->op == BENCH_OP_SEND ? NULL : &conn->remote;
+    size_t src_offset = buffer_offset(conn->src_mr, conn->src);
+
+    bench_sync(conn);
+    pthread_barrier_wait(conn->barrier);
+    conn->start_ns = now_ns();
+
+    for (uint64_t i = 0; i < hello->iters; i++) {
+        int flags = i + 1 == hello->iters ? PIPELINE_FLAG_SIGNAL : 0;
+        if (!pipeline_post_mr(&conn->config, op, conn->src_mr, src_offset, hello->size, remote, 0, flags)) {
+            die("Failed to post benchmark WR");
+        }
+    }
+    if (pipeline_drain(&conn->config)) {
+        die("Failed to drain the send pipeline");
+    }
+
+    conn->end_ns = now_ns();
+    bench_sync(conn);
+}
+
+/**
+ * @brief Server side of a bandwidth test point: consumes the receives, if any
+ * @param conn Benchmark connection
+ */
+static void server_bandwidth(struct bench_conn *conn)
+{
+    const struct bench_hello *hello = conn->hello;
+
+    bench_sync(conn);
+    for (uint64_t i = 0; op_needs_recv(hello->op) && i < hello->iters; i++) {
+        struct recv_msg_t msg;
+        if (recv_ring_next(&conn->config, &msg)) {
+            die("Benchmark receive failed");
+        }
+        recv_ring_release(&conn->config, msg.slot);
+    }
+    bench_sync(conn);
+}
+
+/*******************************************************************************
+ * Test Points
+ ******************************************************************************/
+
+/**
+ * @brief Thread running the client side of one connection
+ * @param arg Benchmark connection
+ * @return NULL
+ */
+static void *client_thread(void *arg)
+{
+    struct bench_conn *conn = arg;
+    if (conn->hello->kind == BENCH_LAT)
+        client_latency(conn);
+    else
+        client_bandwidth(conn);
+    return NULL;
+}
+
+/**
+ * @brief Thread running the server side of one connection
+ * @param arg Benchmark connection
+ * @return NULL
+ */
+static void *server_thread(void *arg)
+{
+    struct bench_conn *conn = arg;
+    if (conn->hello->kind == BENCH_LAT)
+        server_latency(conn);
+    else
+        server_bandwidth(conn);
+    return NULL;
+}
+
+/**
+ * @brief Runs one thread per connection and waits for all of them
+ * @param conns Connections
+ * @param count Number of connections
+ * @param fn Thread body
+ * @return 0 on success, -1 if a thread could not be started
+ */
+static int run_threads(struct bench_conn *conns, uint32_t count, void *(*fn)(void *))
+{
+    pthread_t threads[BENCH_MAX_THREADS];
+    uint32_t started = 0;
+    int result = 0;
+
+    for (; started < count; started++) {
+        if (pthread_create(&threads[started], NULL, fn, &conns[started])) {
+            ERROR_LOG("Failed to start benchmark thread %u", started);
+            result = -1;
+            break;
+        }
+    }
+    for (uint32_t i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    return result;
+}
+
+/**
+ * @brief Orders latency samples for qsort
+ * @param a First sample
+ * @param b Second sample
+ * @return Negative, zero or positive as a is below, equal to or above b
+ */
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Summarizes the client connections of a finished test point
+ * @param conns Client connections
+ * @param hello Test point
+ * @param result Receives the summary
+ * @return 0 on success, -1 if the samples cannot be merged
+ */
+static int summarize(struct bench_conn *conns, const struct bench_hello *hello, struct bench_result *result)
+{
+    memset(result, 0, sizeof(*result));
+
+    if (hello->kind == BENCH_BW) {
+        // Aggregate over the span from the first start to the last finish
+        uint64_t start = conns[0].start_ns, end = conns[0].end_ns;
+        for (uint32_t i = 1; i < hello->threads; i++) {
+            if (conns[i].start_ns < start) start = conns[i].start_ns;
+            if (conns[i].end_ns > end) end = conns[i].end_ns;
+        }
+        double msgs = (double)hello->iters * hello->threads;
+        double elapsed = (double)(end - start);
+        result->gbps = msgs * hello->size * 8 / elapsed;
+        result->mpps = msgs * 1000 / elapsed;
+        return 0;
+    }
+
+    size_t count = (size_t)hello->iters * hello->threads;
+    uint64_t *all = malloc(count * sizeof(*all));
+    if (!all) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < hello->threads; i++)
+        memcpy(all + (size_t)i * hello->iters, conns[i].samples, hello->iters * sizeof(*all));
+    qsort(all, count, sizeof(*all), compare_u64);
+
+    double sum = 0;
+    for (size_t i = 0; i < count; i++)
+        sum += all[i];
+    result->lat_min = all[0] / 1000.0;
+    result->lat_avg = sum / count / 1000.0;
+    result->lat_p50 = all[(size_t)((count - 1) * 0.50)] / 1000.0;
+    result->lat_p90 = all[(size_t)((count - 1) * 0.90)] / 1000.0;
+    result->lat_p99 = all[(size_t)((count - 1) * 0.99)] / 1000.0;
+    result->lat_p999 = all[(size_t)((count - 1) * 0.999)] / 1000.0;
+    result->lat_max = all[count - 1] / 1000.0;
+    free(all);
+    return 0;
+}
+
+/**
+ * @brief Runs one test point from the client side
+ * @param server_name Bench server
+ * @param hello Test point
+ * @param result Receives the summary
+ * @return 0 on success, -1 on failure
+ */
+static int run_point(const char *server_name, const struct bench_hello *hello, struct bench_result *result)
+{
+    struct bench_conn *conns = calloc(hello->threads, sizeof(*conns));
+    pthread_barrier_t barrier;
+    if (!conns) {
+        return -1;
+    }
+    pthread_barrier_init(&barrier, NULL, hello->threads);
+
+    // Connections are set up one at a time; the server accepts them in the same order
+    int result_code = 0;
+    for (uint32_t i = 0; i < hello->threads && result_code == 0; i++) {
+        bench_conn_setup(&conns[i], hello, server_name, -1);
+        conns[i].barrier = &barrier;
+        if (hello->kind == BENCH_LAT) {
+            conns[i].samples = calloc(hello->iters, sizeof(*conns[i].samples));
+            if (!conns[i].samples)
+                result_code = -1;
+        }
+    }
+
+    if (result_code == 0)
+        result_code = run_threads(conns, hello->threads, client_thread);
+    if (result_code == 0)
+        result_code = summarize(conns, hello, result);
+
+    for (uint32_t i = 0; i < hello->threads; i++)
+        bench_conn_destroy(&conns[i]);
+    pthread_barrier_destroy(&barrier);
+    free(conns);
+    return result_code;
+}
+
+/*******************************************************************************
+ * Output
+ ******************************************************************************/
+
+/**
+ * @brief Prints the column header (CSV) or opening bracket (JSON)
+ * @param json Non-zero for JSON output
+ */
+static void print_header(int json)
+{
+    if (json) {
+        printf("[\n");
+    } else {
+        printf("test,op,size,depth,threads,iters,batch,gbps,mpps,"
+               "lat_min_us,lat_avg_us,lat_p50_us,lat_p90_us,lat_p99_us,lat_p999_us,lat_max_us\n");
+    }
+}
+
+/**
+ * @brief Prints the result of one test point
+ * @param json Non-zero for JSON output
+ * @param first Non-zero for the first record (JSON separators)
+ * @param hello Test point
+ * @param r Result of the test point
+ */
+static void print_result(int json, int first, const struct bench_hello *hello, const struct bench_result *r)
+{
+    int lat = hello->kind == BENCH_LAT;
+    const char *test = lat ? "lat" : "bw";
+
+    if (json) {
+        printf("%s  {\"test\": \"%s\", \"op\": \"%s\", \"size\": %" PRIu64 ", \"depth\": %u, "
+               "\"threads\": %u, \"iters\": %" PRIu64 ", \"batch\": %u, ", first ? "" : ",\n", test,
+               op_names[hello->op], hello->size, hello->depth, hello->threads, hello->iters, hello->batch);
+        if (lat) {
+            printf("\"lat_min_us\": %.3f, \"lat_avg_us\": %.3f, \"lat_p50_us\": %.3f, \"lat_p90_us\": %.3f, "
+                   "\"lat_p99_us\": %.3f, \"lat_p999_us\": %.3f, \"lat_max_us\": %.3f}", r->lat_min, r->lat_avg,
+                   r->lat_p50, r->lat_p90, r->lat_p99, r->lat_p999, r->lat_max);
+        } else {
+            printf("\"gbps\": %.3f, \"mpps\": %.4f}", r->gbps, r->mpps);
+        }
+    } else {
+        printf("%s,%s,%" PRIu64 ",%u,%u,%" PRIu64 ",%u,", test, op_names[hello->op], hello->size, hello->depth,
+               hello->threads, hello->iters, hello->batch);
+        if (lat) {
+            printf(",,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n", r->lat_min, r->lat_avg, r->lat_p50, r->lat_p90,
+                   r->lat_p99, r->lat_p999, r->lat_max);
+        } else {
+            printf("%.3f,%.4f,,,,,,,\n", r->gbps, r->mpps);
+        }
+    }
+    fflush(stdout);
+}
+
+/*******************************************************************************
+ * Client and Server
+ ******************************************************************************/
+
+/**
+ * @brief Runs a benchmark sweep against a server
+ * @param server_name Hostname or IP address of the bench server
+ * @param plan Test points to run
+ * @return 0 on success, -1 on failure
+ */
+int bench_run_client(const char *server_name, const struct bench_plan *plan)
+{
+    int first = 1;
+    int result = 0;
+
+    print_header(plan->json);
+    for (int kind = BENCH_LAT; kind <= BENCH_BW && result == 0; kind++) {
+        if (!plan->kinds[kind]) continue;
+
+        uint32_t num_depths = kind == BENCH_LAT ? 1 : plan->num_depths;
+        for (uint32_t o = 0; o < plan->num_ops && result == 0; o++)
+        for (uint32_t s = 0; s < plan->num_sizes && result == 0; s++)
+        for (uint32_t d = 0; d < num_depths && result == 0; d++)
+        for (uint32_t t = 0; t < plan->num_threads && result == 0; t++) {
+            struct bench_hello hello = {
+                .magic = BENCH_MAGIC,
+                .kind = kind,
+                .op = plan->ops[o],
+                .threads = plan->threads[t],
+                .depth = kind == BENCH_LAT ? 1 : plan->depths[d],
+                .batch = kind == BENCH_LAT ? 0 : plan->batch,
+                .size = plan->sizes[s],
+                .iters = plan->iters,
+                .warmup = kind == BENCH_LAT ? plan->warmup : 0,
+            };
+            struct bench_result r;
+            result = run_point(server_name, &hello, &r);
+            if (result == 0) {
+                print_result(plan->json, first, &hello, &r);
+                first = 0;
+            }
+        }
+    }
+    if (plan->json)
+        printf("\n]\n");
+
+    // Let the server exit
+    struct config_t control = {};
+    struct bench_hello quit = { .magic = BENCH_MAGIC, .kind = BENCH_QUIT };
+    setup_socket(&control, server_name);
+    if (sock_write_full(control.sock_fd, &quit, sizeof(quit))) {
+        ERROR_LOG("Failed to stop the bench server");
+    }
+    close(control.sock_fd);
+    return result;
+}
+
+/**
+ * @brief Accepts one connection of a test point and reads its hello
+ * @param listen_fd Listening socket
+ * @param hello Receives the hello
+ * @return Accepted socket, -1 if the peer is not a bench client
+ */
+static int accept_hello(int listen_fd, struct bench_hello *hello)
+{
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return -1;
+    }
+    if (sock_read_full(fd, hello, sizeof(*hello)) || hello->magic != BENCH_MAGIC || hello->op >= BENCH_OP_MAX
+        || (hello->kind != BENCH_QUIT
+            && (hello->threads == 0 || hello->threads > BENCH_MAX_THREADS || hello->size == 0
+                || hello->size > MAX_MESSAGE_SIZE || hello->depth == 0))) {
+        ERROR_LOG("Rejected connection without a valid benchmark hello");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Runs the benchmark server
+ * @return 0 once a client ends its sweep, -1 on failure
+ */
+int bench_run_server(void)
+{
+    int listen_fd = create_listener(LISTEN_BACKLOG);
+
+    while (1) {
+        struct bench_hello hello;
+        int fd = accept_hello(listen_fd, &hello);
+        if (fd < 0) continue;
+        if (hello.kind == BENCH_QUIT) {
+            close(fd);
+            break;
+        }
+
+        struct bench_conn *conns = calloc(hello.threads, sizeof(*conns));
+        if (!conns) {
+            close(fd);
+            close(listen_fd);
+            return -1;
+        }
+        bench_conn_setup(&conns[0], &hello, NULL, fd);
+        for (uint32_t i = 1; i < hello.threads; i++) {
+            struct bench_hello more;
+            do {
+                fd = accept_hello(listen_fd, &more);
+            } while (fd < 0);
+            bench_conn_setup(&conns[i], &hello, NULL, fd);
+        }
+
+        DEBUG_LOG("Serving %s %s: size=%" PRIu64 " depth=%u threads=%u", hello.kind == BENCH_LAT ? "lat" : "bw",
+                  op_names[hello.op], hello.size, hello.depth, hello.threads);
+        run_threads(conns, hello.threads, server_thread);
+
+        for (uint32_t i = 0; i < hello.threads; i++)
+            bench_conn_destroy(&conns[i]);
+        free(conns);
+    }
+
+    close(listen_fd);
+    return 0;
+}
+
+/*******************************************************************************
+ * Entry Point
+ ******************************************************************************/
+
+/**
+ * @brief Displays program usage instructions
+ */
+static void print_usage(void)
+{
+    printf("Usage:\n");
+    printf("  ./rdma-bench [options]         - Run the benchmark server\n");
+    printf("  ./rdma-bench [options] <host>  - Run a benchmark sweep against <host>\n");
+    printf("\n");
+    printf("  Client options (lists are comma-separated):\n");
+    printf("    -k <tests>               - lat, bw (default: both)\n");
+    printf("    -o <ops>                 - send, write, write_imm, read (default: all)\n");
+    printf("    -s <sizes>               - Message sizes, K/M suffixes allowed (default: 8,64,512,4K,64K)\n");
+    printf("    -d <depths>              - Bandwidth WRs in flight per connection (default: %d)\n",
+           PIPELINE_DEFAULT_DEPTH);
+    printf("    -t <threads>             - Connections, one thread each (default: 1)\n");
+    printf("    -n <iters>               - Timed iterations per connection (default: %d)\n", BENCH_DEFAULT_ITERS);
+    printf("    -W <iters>               - Untimed latency warmup iterations (default: %d)\n", BENCH_DEFAULT_WARMUP);
+    printf("    -B <wrs>                 - Bandwidth: post up to <wrs> WRs per doorbell (default: off)\n");
+    printf("    -j                       - JSON output (default: CSV)\n");
+    printf("\n");
+    printf("  Common options:\n");
+    printf("    -e                       - Event mode: sleep on completion channels when idle\n");
+    printf("    -N                       - Skip NUMA placement (buffers and polling threads)\n");
+    printf("    -H <2M|1G|0>             - Largest hugepage for registered regions (default 2M, 0 = off)\n");
+}
+
+/**
+ * @brief Parses a byte count with an optional K/M/G suffix
+ * @param arg Text to parse (ends at a comma or the end of the string)
+ * @param end Receives the position after the number
+ * @param out Receives the value
+ * @return 0 on success, -1 if the value is malformed or zero
+ */
+static int parse_size(const char *arg, char **end, uint64_t *out)
+{
+    unsigned long long value = strtoull(arg, end, 10);
+    unsigned long long unit = 1;
+
+    switch (**end) {
+    case 'G': case 'g': unit = 1ULL << 30; (*end)++; break;
+    case 'M': case 'm': unit = 1ULL << 20; (*end)++; break;
+    case 'K': case 'k': unit = 1ULL << 10; (*end)++; break;
+    }
+    if (*end == arg || value == 0 || value > UINT64_MAX / unit) {
+        return -1;
+    }
+    *out = value * unit;
+    return 0;
+}
+
+/**
+ * @brief Parses a comma-separated list of sizes or counts
+ * @param arg Command line argument
+ * @param out Receives the values
+ * @param count Receives the number of values
+ * @param max Largest value allowed
+ * @return 0 on success, -1 if the list is malformed, too long or out of range
+ */
+static int parse_list(const char *arg, uint64_t *out, uint32_t *count, uint64_t max)
+{
+    *count = 0;
+    while (*arg) {
+        char *end;
+        if (*count == BENCH_MAX_LIST || parse_size(arg, &end, &out[*count]) || out[*count] > max) {
+            return -1;
+        }
+        (*count)++;
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -1;
+        arg = end;
+    }
+    return *count > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Parses a comma-separated list of names
+ * @param arg Command line argument
+ * @param names Known names, indexed by value
+ * @param num_names Entries in names
+ * @param selected Receives the index of each listed name
+ * @param count Receives the number of names listed
+ * @return 0 on success, -1 on an unknown name
+ */
+static int parse_names(const char *arg, const char *const *names, int num_names, int *selected, uint32_t *count)
+{
+    char list[256];
+    char *save;
+
+    snprintf(list, sizeof(list), "%s", arg);
+    *count = 0;
+    for (char *name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+        int found = -1;
+        for (int i = 0; i < num_names; i++) {
+            if (strcmp(name, names[i]) == 0)
+                found = i;
+        }
+        if (found < 0 || *count == (uint32_t)num_names) {
+            return -1;
+        }
+        selected[(*count)++] = found;
+    }
+    return *count > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Program entry point
+ * @param argc Number of command line arguments
+ * @param argv Array of command line argument strings
+ * @return 0 on success, non-zero on error
+ */
+int main(int argc, char *argv[])
+{
+    static const char *const kind_names[] = { "lat", "bw" };
+    struct bench_plan plan = {
+        .kinds = { 1, 1 },
+        .num_ops = BENCH_OP_MAX,
+        .ops = { BENCH_OP_SEND, BENCH_OP_WRITE, BENCH_OP_WRITE_IMM, BENCH_OP_READ },
+        .num_sizes = 5,
+        .sizes = { 8, 64, 512, 4096, 65536 },
+        .num_depths = 1,
+        .depths = { PIPELINE_DEFAULT_DEPTH },
+        .num_threads = 1,
+        .threads = { 1 },
+        .iters = BENCH_DEFAULT_ITERS,
+        .warmup = BENCH_DEFAULT_WARMUP,
+    };
+    int selected[BENCH_OP_MAX];
+    uint32_t count;
+    uint64_t value;
+    char *end;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "k:o:s:d:t:n:W:B:jeNH:")) != -1) {
+        switch (opt) {
+        case 'k':
+            if (parse_names(optarg, kind_names, 2, selected, &count)) {
+                fprintf(stderr, "Invalid test list: %s\n", optarg);
+                return 1;
+            }
+            plan.kinds[BENCH_LAT] = plan.kinds[BENCH_BW] = 0;
+            for (uint32_t i = 0; i < count; i++)
+                plan.kinds[selected[i]] = 1;
+            break;
+        case 'o':
+            if (parse_names(optarg, op_names, BENCH_OP_MAX, selected, &plan.num_ops)) {
+                fprintf(stderr, "Invalid operation list: %s\n", optarg);
+                return 1;
+            }
+            for (uint32_t i = 0; i < plan.num_ops; i++)
+                plan.ops[i] = selected[i];
+            break;
+        case 's':
+            if (parse_list(optarg, plan.sizes, &plan.num_sizes, MAX_MESSAGE_SIZE)) {
+                fprintf(stderr, "Invalid size list: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd':
+            if (parse_list(optarg, plan.depths, &plan.num_depths, SEND_QUEUE_DEPTH)) {
+                fprintf(stderr, "Invalid depth list: %s (at most %d)\n", optarg, SEND_QUEUE_DEPTH);
+                return 1;
+            }
+            break;
+        case 't':
+            if (parse_list(optarg, plan.threads, &plan.num_threads, BENCH_MAX_THREADS)) {
+                fprintf(stderr, "Invalid thread list: %s (at most %d)\n", optarg, BENCH_MAX_THREADS);
+                return 1;
+            }
+            break;
+        case 'n':
+            if (parse_size(optarg, &end, &plan.iters) || *end != '\0') {
+                fprintf(stderr, "Invalid iteration count: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'W':
+            if (strcmp(optarg, "0") == 0) {
+                plan.warmup = 0;
+            } else if (parse_size(optarg, &end, &plan.warmup) || *end != '\0') {
+                fprintf(stderr, "Invalid warmup count: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'B':
+            if (parse_size(optarg, &end, &value) || *end != '\0' || value > SEND_QUEUE_DEPTH) {
+                fprintf(stderr, "Invalid doorbell batch: %s\n", optarg);
+                return 1;
+            }
+            plan.batch = value;
+            break;
+        case 'j':
+            plan.json = 1;
+            break;
+        case 'e':
+            rdma_opts.event_mode = 1;
+            break;
+        case 'N':
+            rdma_opts.numa = 0;
+            break;
+        case 'H':
+            if (strcmp(optarg, "0") == 0) {
+                rdma_opts.hugepage_size = 0;
+            } else if (parse_size(optarg, &end, &value) || *end != '\0'
+                       || (value != HUGEPAGE_SIZE_2M && value != HUGEPAGE_SIZE_1G)) {
+                fprintf(stderr, "Invalid hugepage size: %s (2M, 1G or 0)\n", optarg);
+                return 1;
+            } else {
+                rdma_opts.hugepage_size = value;
+            }
+            break;
+        default:
+            print_usage();
+            return 1;
+        }
+    }
+    if (argc - optind > 1) {
+        print_usage();
+        return 1;
+    }
+
+    // Every point uses its message size as the buffer size; no message is split
+    rdma_opts.max_msg_size = MAX_MESSAGE_SIZE;
+    // The polling threads are the benchmark's own, so they may as well sit near the NIC
+    rdma_opts.numa_pin = 1;
+
+    int result = optind < argc ? bench_run_client(argv[optind], &plan) : bench_run_server();
+    return result ? 1 : 0;
+}
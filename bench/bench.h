@@ -0,0 +1,127 @@
+/**
+ * @file bench.h
+ * @brief Latency and bandwidth benchmark interface
+ *
+ * Defines the perftest-style benchmark built by `make bench`. A client sweeps
+ * operations, message sizes, queue depths and thread counts against a bench
+ * server; every test point runs over fresh connections (one QP and thread per
+ * connection) set up with the library's own init_resources()/connect_qps().
+ * Latency tests ping-pong one message at a time, bandwidth tests stream
+ * through the send pipeline. Results are printed as CSV or JSON.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "../common.h"
+
+/**
+ * Benchmark Configuration
+ * BENCH_MAGIC: First word of every hello, so stray connections to TCP_PORT are rejected
+ * BENCH_MAX_LIST: Entries in each sweep list (operations, sizes, depths, thread counts)
+ * BENCH_MAX_THREADS: Connections (and threads) per test point
+ * BENCH_DEFAULT_ITERS: Timed iterations per connection and test point
+ * BENCH_DEFAULT_WARMUP: Untimed latency iterations run first
+ */
+#define BENCH_MAGIC 0x52424e43  // "RBNC"
+#define BENCH_MAX_LIST 32
+#define BENCH_MAX_THREADS 64
+#define BENCH_DEFAULT_ITERS 10000
+#define BENCH_DEFAULT_WARMUP 100
+
+/**
+ * Benchmarked Operations
+ * BENCH_OP_SEND: Two-sided send into a pre-posted receive ring
+ * BENCH_OP_WRITE: RDMA write; latency is measured by polling the last byte of the target
+ * BENCH_OP_WRITE_IMM: RDMA write with immediate, consuming an imm-only receive
+ * BENCH_OP_READ: RDMA read; the server CPU takes no part
+ */
+typedef enum bench_op { BENCH_OP_SEND, BENCH_OP_WRITE, BENCH_OP_WRITE_IMM, BENCH_OP_READ, BENCH_OP_MAX } bench_op_t;
+
+/**
+ * Test Kinds
+ * BENCH_LAT: Ping-pong latency (half round trip; full round trip for reads)
+ * BENCH_BW: Streaming bandwidth with depth WRs in flight per connection
+ * BENCH_QUIT: Tells the server the sweep is over
+ */
+typedef enum bench_kind { BENCH_LAT, BENCH_BW, BENCH_QUIT } bench_kind_t;
+
+/**
+ * Test Point Hello
+ * Sent by the client on every connection before the QP information exchange,
+ * so the server can size its buffers and pick its role before connect_qps().
+ */
+struct bench_hello {
+	uint32_t magic;              // BENCH_MAGIC
+	uint32_t kind;               // bench_kind_t
+	uint32_t op;                 // bench_op_t
+	uint32_t threads;            // Connections in this test point
+	uint32_t depth;              // WRs in flight per connection (bandwidth)
+	uint32_t batch;              // WRs per doorbell (0 = no doorbell batching)
+	uint64_t size;               // Message size in bytes
+	uint64_t iters;              // Timed iterations per connection
+	uint64_t warmup;             // Untimed iterations per connection (latency)
+};
+
+/**
+ * Sweep Plan
+ * The client runs every combination of the lists below, latency tests first.
+ * Latency tests always use a depth of 1.
+ */
+struct bench_plan {
+	int kinds[2];                // Non-zero to run BENCH_LAT / BENCH_BW
+	uint32_t num_ops;            // Entries in ops
+	bench_op_t ops[BENCH_OP_MAX];  // Operations to measure
+	uint32_t num_sizes;          // Entries in sizes
+	uint64_t sizes[BENCH_MAX_LIST];  // Message sizes in bytes
+	uint32_t num_depths;         // Entries in depths
+	uint64_t depths[BENCH_MAX_LIST];  // Bandwidth queue depths
+	uint32_t num_threads;        // Entries in threads
+	uint64_t threads[BENCH_MAX_LIST];  // Connection counts
+	uint64_t iters;              // Timed iterations per connection
+	uint64_t warmup;             // Untimed latency iterations per connection
+	uint32_t batch;              // Doorbell batch for bandwidth tests (0 = off)
+	int json;                    // Non-zero: JSON output, CSV otherwise
+};
+
+/**
+ * Test Point Result
+ * Bandwidth fields are set by BENCH_BW points, latency fields (microseconds,
+ * over the samples of every connection) by BENCH_LAT points.
+ */
+struct bench_result {
+	double gbps;                 // Aggregate goodput in Gbit/s
+	double mpps;                 // Aggregate message rate in millions per second
+	double lat_min;              // Fastest sample
+	double lat_avg;              // Mean
+	double lat_p50;              // Median
+	double lat_p90;              // 90th percentile
+	double lat_p99;              // 99th percentile
+	double lat_p999;             // 99.9th percentile
+	double lat_max;              // Slowest sample
+};
+
+/**
+ * @brief Runs the benchmark server
+ *
+ * @return int 0 once a client ends its sweep, -1 on failure
+ *
+ * Listens on TCP_PORT and serves one test point at a time: accepts the
+ * point's connections, plays the passive side of each on its own thread and
+ * tears the connections down again, until a BENCH_QUIT hello arrives.
+ */
+int bench_run_server(void);
+
+/**
+ * @brief Runs a benchmark sweep against a server
+ *
+ * @param server_name Hostname or IP address of the bench server
+ * @param plan Test points to run
+ * @return int 0 on success, -1 on failure
+ *
+ * Prints one CSV row or JSON object per test point to stdout, then tells the
+ * server to exit.
+ */
+int bench_run_client(const char *server_name, const struct bench_plan *plan);
+
+#endif // BENCH_H
@@ -0,0 +1,200 @@
+/**
+ * @file buffer_pool.c
+ * @brief Registered buffer pool implementation
+ *
+ * Implements a slab allocator over a single registered region:
+ * - Page-aligned (optionally hugepage-backed) anonymous mapping
+ * - One Memory Region for the whole pool, registered once
+ * - Per size class lock-free free stacks with ABA tagging
+ */
+
+#include "buffer_pool.h"
+
+/*******************************************************************************
+ * Free Stack Helpers
+ ******************************************************************************/
+
+#define HEAD_TAG(head) ((uint32_t)((head) >> 32))
+#define HEAD_TOP(head) ((uint32_t)(head))
+#define HEAD_MAKE(tag, top) (((uint64_t)(tag) << 32) | (top))
+
+/**
+ * @brief Pushes slab index onto a class free stack
+ * @param cls Size class
+ * @param index Slab index within the class
+ */
+static void class_push(struct pool_class *cls, uint32_t index)
+{
+    uint64_t head = atomic_load_explicit(&cls->free_head, memory_order_relaxed);
+    uint64_t new_head;
+
+    do {
+        atomic_store_explicit(&cls->next[index], HEAD_TOP(head), memory_order_relaxed);
+        new_head = HEAD_MAKE(HEAD_TAG(head) + 1, index + 1);
+    } while (!atomic_compare_exchange_weak_explicit(
+        &cls->free_head, &head, new_head, memory_order_release, memory_order_relaxed));
+}
+
+/**
+ * @brief Pops a slab index from a class free stack
+ * @param cls Size class
+ * @return Slab index, or UINT32_MAX if the class is exhausted
+ */
+static uint32_t class_pop(struct pool_class *cls)
+{
+    uint64_t head = atomic_load_explicit(&cls->free_head, memory_order_acquire);
+    uint64_t new_head;
+
+    do {
+        if (HEAD_TOP(head) == 0)
+            return UINT32_MAX;
+        uint32_t below = atomic_load_explicit(&cls->next[HEAD_TOP(head) - 1], memory_order_relaxed);
+        new_head = HEAD_MAKE(HEAD_TAG(head) + 1, below);
+    } while (!atomic_compare_exchange_weak_explicit(
+        &cls->free_head, &head, new_head, memory_order_acquire, memory_order_acquire));
+
+    return HEAD_TOP(head) - 1;
+}
+
+/*******************************************************************************
+ * Pool Lifecycle
+ ******************************************************************************/
+
+/**
+ * @brief Creates and registers a buffer pool
+ * @param pd Protection Domain to register the region with
+ * @param classes Size classes
+ * @param num_classes Number of size classes
+ * @param access ibv_access_flags for the region
+ * @param flags POOL_FLAG_* options
+ * @param numa_node Node to place the region on (-1 = no preference)
+ * @return Pool on success, NULL on failure
+ */
+struct buffer_pool *buffer_pool_create(struct ibv_pd *pd, const struct pool_class_config *classes,
+                                       int num_classes, int access, int flags, int numa_node)
+{
+    if (!pd || !classes || num_classes <= 0 || num_classes > POOL_MAX_CLASSES) {
+        return NULL;
+    }
+
+    struct buffer_pool *pool = calloc(1, sizeof(*pool));
+    if (!pool) {
+        return NULL;
+    }
+
+    // Sort classes by slab size so allocation can take the first fit
+    for (int i = 0; i < num_classes; i++) {
+        if (classes[i].slab_size == 0 || classes[i].count == 0) {
+            free(pool);
+            return NULL;
+        }
+        int j = i;
+        while (j > 0 && pool->classes[j - 1].slab_size > classes[i].slab_size) {
+            pool->classes[j] = pool->classes[j - 1];
+            j--;
+        }
+        pool->classes[j].slab_size = classes[i].slab_size;
+        pool->classes[j].count = classes[i].count;
+    }
+    pool->num_classes = num_classes;
+
+    // Lay classes out back to back, each starting on a page boundary
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t class_offset[POOL_MAX_CLASSES];
+    size_t total = 0;
+    for (int i = 0; i < num_classes; i++) {
+        class_offset[i] = total;
+        total += (pool->classes[i].slab_size * pool->classes[i].count + page_size - 1) & ~(page_size - 1);
+    }
+
+    size_t hugepage_size = flags & POOL_FLAG_HUGEPAGE ? rdma_opts.hugepage_size : 0;
+    if (hugepage_map(&pool->region, total, PROT_READ | PROT_WRITE, hugepage_size, numa_node)) {
+        free(pool);
+        return NULL;
+    }
+
+    for (int i = 0; i < num_classes; i++) {
+        struct pool_class *cls = &pool->classes[i];
+        cls->base = (char *)pool->region.addr + class_offset[i];
+        cls->next = calloc(cls->count, sizeof(*cls->next));
+        if (!cls->next) {
+            buffer_pool_destroy(pool);
+            return NULL;
+        }
+        atomic_init(&cls->free_head, 0);
+        for (uint32_t idx = cls->count; idx-- > 0;)
+            class_push(cls, idx);
+    }
+
+    pool->mr = ibv_reg_mr(pd, pool->region.addr, pool->region.size, access | IBV_ACCESS_LOCAL_WRITE);
+    if (!pool->mr) {
+        ERROR_LOG("Failed to register %zu byte pool region: %s", pool->region.size, strerror(errno));
+        buffer_pool_destroy(pool);
+        return NULL;
+    }
+
+    DEBUG_LOG("Buffer pool ready: %zu bytes, %d classes, %zu KB pages", pool->region.size, num_classes,
+        pool->region.page_size >> 10);
+    return pool;
+}
+
+/**
+ * @brief Deregisters and unmaps a buffer pool
+ * @param pool Pool to destroy
+ */
+void buffer_pool_destroy(struct buffer_pool *pool)
+{
+    if (!pool) return;
+
+    if (pool->mr)
+        ibv_dereg_mr(pool->mr);
+    for (int i = 0; i < pool->num_classes; i++)
+        free(pool->classes[i].next);
+    hugepage_unmap(&pool->region);
+    free(pool);
+}
+
+/*******************************************************************************
+ * Allocation
+ ******************************************************************************/
+
+/**
+ * @brief Allocates a slab of at least size bytes
+ * @param pool Buffer pool
+ * @param size Requested size
+ * @return Slab address, NULL when exhausted
+ */
+void *buffer_pool_alloc(struct buffer_pool *pool, size_t size)
+{
+    for (int i = 0; i < pool->num_classes; i++) {
+        struct pool_class *cls = &pool->classes[i];
+        if (cls->slab_size < size)
+            continue;
+
+        uint32_t index = class_pop(cls);
+        if (index != UINT32_MAX)
+            return cls->base + (size_t)index * cls->slab_size;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Returns a slab to its class
+ * @param pool Buffer pool
+ * @param buf Slab address from buffer_pool_alloc
+ */
+void buffer_pool_free(struct buffer_pool *pool, void *buf)
+{
+    if (!buf) return;
+
+    for (int i = 0; i < pool->num_classes; i++) {
+        struct pool_class *cls = &pool->classes[i];
+        char *p = buf;
+        if (p < cls->base || p >= cls->base + (size_t)cls->count * cls->slab_size)
+            continue;
+
+        class_push(cls, (uint32_t)((size_t)(p - cls->base) / cls->slab_size));
+        return;
+    }
+    ERROR_LOG("Pointer %p does not belong to the buffer pool", buf);
+}
@@ -0,0 +1,112 @@
+/**
+ * @file buffer_pool.h
+ * @brief Registered buffer pool interface
+ *
+ * Carves one large, page-aligned registered region into fixed-size slabs
+ * grouped in size classes. Allocation and release are lock-free, so many
+ * operations can own distinct buffers concurrently without any per-operation
+ * memory registration.
+ */
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include "common.h"
+#include "hugepage.h"
+#include <stdatomic.h>
+
+/**
+ * Pool Configuration Constants
+ * POOL_MAX_CLASSES: Maximum number of size classes per pool
+ * POOL_FLAG_HUGEPAGE: Back the region with hugepages of up to rdma_opts.hugepage_size when available
+ */
+#define POOL_MAX_CLASSES 8
+#define POOL_FLAG_HUGEPAGE 0x1
+
+/**
+ * @brief Size class description passed to buffer_pool_create
+ */
+struct pool_class_config {
+    size_t slab_size;            // Bytes per slab
+    uint32_t count;              // Number of slabs in this class
+};
+
+/**
+ * @brief Per-class state
+ *
+ * Free slabs form a Treiber stack. free_head packs an ABA tag in the upper
+ * 32 bits and (index + 1) of the top slab in the lower 32 bits (0 = empty);
+ * next[i] holds (index + 1) of the slab below slab i.
+ */
+struct pool_class {
+    size_t slab_size;            // Bytes per slab
+    uint32_t count;              // Number of slabs
+    char *base;                  // First slab of the class
+    _Atomic uint64_t free_head;  // Tagged top of the free stack
+    _Atomic uint32_t *next;      // Free stack links
+};
+
+/**
+ * @brief Registered buffer pool
+ */
+struct buffer_pool {
+    struct hugepage_region_t region; // Backing memory for all classes
+    struct ibv_mr *mr;           // Single MR covering the region
+    int num_classes;             // Classes in use, sorted by slab_size
+    struct pool_class classes[POOL_MAX_CLASSES];
+};
+
+/**
+ * @brief Creates and registers a buffer pool
+ *
+ * @param pd Protection Domain to register the region with
+ * @param classes Size classes (any order, at most POOL_MAX_CLASSES)
+ * @param num_classes Number of entries in classes
+ * @param access ibv_access_flags for the region (IBV_ACCESS_LOCAL_WRITE is always added)
+ * @param flags POOL_FLAG_* options
+ * @param numa_node NUMA node to place the region on (-1 = no preference)
+ * @return Pool on success, NULL on failure
+ */
+struct buffer_pool *buffer_pool_create(struct ibv_pd *pd, const struct pool_class_config *classes,
+                                       int num_classes, int access, int flags, int numa_node);
+
+/**
+ * @brief Deregisters and unmaps a buffer pool
+ *
+ * @param pool Pool to destroy (may be NULL)
+ */
+void buffer_pool_destroy(struct buffer_pool *pool);
+
+/**
+ * @brief Allocates a slab of at least size bytes
+ *
+ * @param pool Buffer pool
+ * @param size Requested size in bytes
+ * @return Slab address, NULL if no class fits or all fitting classes are exhausted
+ *
+ * Takes a slab from the smallest class that fits, falling back to larger
+ * classes when it is empty. Safe to call concurrently with alloc and free.
+ */
+void *buffer_pool_alloc(struct buffer_pool *pool, size_t size);
+
+/**
+ * @brief Returns a slab to its class
+ *
+ * @param pool Buffer pool
+ * @param buf Address returned by buffer_pool_alloc
+ */
+void buffer_pool_free(struct buffer_pool *pool, void *buf);
+
+/**
+ * @brief Offset of a slab within the pool's MR
+ *
+ * @param pool Buffer pool
+ * @param buf Address inside the pool
+ * @return Offset to pass with pool->mr to post_operation_mr / pipeline_post_mr
+ */
+static inline size_t buffer_pool_offset(const struct buffer_pool *pool, const void *buf)
+{
+    return (size_t)((const char *)buf - (const char *)pool->region.addr);
+}
+
+#endif // BUFFER_POOL_H
@@ -0,0 +1,681 @@
+/**
+ * @file cm.c
+ * @brief rdma_cm connection backend implementation
+ *
+ * Implements:
+ * - Address and route resolution of a client's server through rdma_cm
+ * - A listener for one client, or for a multi-client server's intake
+ * - Connect requests and replies carrying a compact handshake as private data
+ * - QP transitions driven by rdma_init_qp_attr()
+ */
+
+#include "cm.h"
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <rdma/rdma_cma.h>
+
+/*******************************************************************************
+ * Events
+ ******************************************************************************/
+
+/**
+ * @brief Reads the next event of a channel
+ * @param channel Event channel
+ * @param timeout_ms Longest wait (-1 = forever)
+ * @return Event to acknowledge, or NULL on timeout or failure
+ */
+static struct rdma_cm_event *cm_next_event(struct rdma_event_channel *channel, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = channel->fd, .events = POLLIN };
+    int n;
+    do {
+        n = poll(&pfd, 1, timeout_ms);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        ERROR_LOG("%s waiting for a connection manager event", n == 0 ? "Timed out" : "Failed");
+        return NULL;
+    }
+
+    struct rdma_cm_event *event;
+    if (rdma_get_cm_event(channel, &event)) {
+        ERROR_LOG("Failed to read connection manager event: %s", strerror(errno));
+        return NULL;
+    }
+    return event;
+}
+
+/**
+ * @brief Waits for one particular event
+ * @param channel Event channel
+ * @param type Expected event
+ * @param timeout_ms Longest wait
+ * @param got Receives the type of the event read, -1 if none (may be NULL)
+ * @return The expected event, to acknowledge; NULL (any other event acknowledged) otherwise
+ */
+static struct rdma_cm_event *cm_expect(struct rdma_event_channel *channel, enum rdma_cm_event_type type,
+                                       int timeout_ms, int *got)
+{
+    struct rdma_cm_event *event = cm_next_event(channel, timeout_ms);
+    if (got)
+        *got = event ? (int)event->event : -1;
+    if (event && event->event != type) {
+        ERROR_LOG("Expected %s, got %s (status %d)", rdma_event_str(type), rdma_event_str(event->event),
+                  event->status);
+        rdma_ack_cm_event(event);
+        return NULL;
+    }
+    return event;
+}
+
+/*******************************************************************************
+ * Private Data Handshake
+ ******************************************************************************/
+
+/**
+ * @brief Appends a big-endian field
+ * @param p Write position, advanced past the field
+ * @param value Field value
+ * @param bytes Field width
+ */
+static void cm_put(uint8_t **p, uint64_t value, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--)
+        *(*p)++ = (uint8_t)(value >> (8 * i));
+}
+
+/**
+ * @brief Consumes a big-endian field
+ * @param p Read position, advanced past the field
+ * @param bytes Field width
+ * @return Field value
+ */
+static uint64_t cm_get(const uint8_t **p, int bytes)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++)
+        value = (value << 8) | *(*p)++;
+    return value;
+}
+
+/**
+ * @brief Serializes this side's handshake
+ * @param config Connection with a created QP and registered buffer
+ * @param buf Destination
+ * @param room Private data room of the message it goes in
+ * @return Bytes written, 0 if config's regions do not fit
+ *
+ * Layout (big-endian): magic u32, version u8, region count u8, total length
+ * u16, features u32, max inline u32, send and receive queue depths u32, then
+ * per region its address u64, length u64 and rkey u32, then (version 2) the
+ * segment size u32. QP number, PSN, GID, LID and MTU travel in the
+ * connection manager's own messages instead.
+ */
+static uint8_t cm_encode(const struct config_t *config, uint8_t *buf, size_t room)
+{
+    uint32_t num_regions = 1 + config->num_extra_regions;
+    size_t length = CM_HEADER_LEN + num_regions * CM_REGION_LEN + CM_V2_LEN;
+    if (length > room) {
+        return 0;
+    }
+
+    uint8_t *p = buf;
+    cm_put(&p, CM_MAGIC, 4);
+    cm_put(&p, CM_VERSION, 1);
+    cm_put(&p, num_regions, 1);
+    cm_put(&p, length, 2);
+    cm_put(&p, handshake_features(config), 4);
+    cm_put(&p, config->max_inline, 4);
+    cm_put(&p, config->max_send_wr, 4);
+    cm_put(&p, config->max_recv_wr, 4);
+    cm_put(&p, (uint64_t)config->buf, 8);
+    cm_put(&p, config->buf_size, 8);
+    cm_put(&p, config->mr->rkey, 4);
+    for (uint32_t i = 0; i < config->num_extra_regions; i++) {
+        cm_put(&p, config->extra_regions[i].addr, 8);
+        cm_put(&p, config->extra_regions[i].length, 8);
+        cm_put(&p, config->extra_regions[i].rkey, 4);
+    }
+    cm_put(&p, config->seg_size, 4);
+    return (uint8_t)length;
+}
+
+/**
+ * @brief Parses the peer's handshake into config->peer
+ * @param data Private data of the peer's request or reply
+ * @param len Private data bytes (providers may pad it)
+ * @param peer Peer description to fill
+ * @return 0 on success, -1 if the data is not a handshake
+ *
+ * Bytes past the regions, which a newer peer may append, are skipped.
+ */
+static int cm_decode(const void *data, uint8_t len, struct peer_info_t *peer)
+{
+    const uint8_t *p = data;
+    if (!p || len < CM_HEADER_LEN || cm_get(&p, 4) != CM_MAGIC) {
+        return -1;
+    }
+
+    uint8_t version = cm_get(&p, 1);
+    uint8_t num_regions = cm_get(&p, 1);
+    uint16_t length = cm_get(&p, 2);
+    if (version == 0 || length > len || num_regions == 0 || num_regions > HANDSHAKE_MAX_REGIONS
+        || length < CM_HEADER_LEN + num_regions * CM_REGION_LEN) {
+        return -1;
+    }
+
+    peer->version = version < CM_VERSION ? version : CM_VERSION;
+    peer->peer_features = cm_get(&p, 4);
+    peer->max_inline = cm_get(&p, 4);
+    peer->max_send_wr = cm_get(&p, 4);
+    peer->max_recv_wr = cm_get(&p, 4);
+    peer->num_regions = num_regions;
+    for (uint32_t i = 0; i < num_regions; i++) {
+        peer->regions[i].addr = cm_get(&p, 8);
+        peer->regions[i].length = cm_get(&p, 8);
+        peer->regions[i].rkey = cm_get(&p, 4);
+    }
+    peer->seg_size = 0;
+    if (version >= 2 && length >= CM_HEADER_LEN + num_regions * CM_REGION_LEN + CM_V2_LEN)
+        peer->seg_size = cm_get(&p, 4);
+    return 0;
+}
+
+/**
+ * @brief Read/atomic depths the device supports
+ * @param context Device context
+ * @param responder Receives how many it can serve at once
+ * @param initiator Receives how many it can issue at once
+ */
+static void cm_rd_atomic(struct ibv_context *context, uint8_t *responder, uint8_t *initiator)
+{
+    struct ibv_device_attr attr;
+    *responder = 1;
+    *initiator = 1;
+    if (ibv_query_device(context, &attr) == 0) {
+        *responder = attr.max_qp_rd_atom < 255 ? attr.max_qp_rd_atom : 255;
+        *initiator = attr.max_qp_init_rd_atom < 255 ? attr.max_qp_init_rd_atom : 255;
+    }
+}
+
+/**
+ * @brief Lower of two read/atomic depths, at least 1
+ */
+static uint8_t cm_depth(uint8_t a, uint8_t b)
+{
+    uint8_t depth = a < b ? a : b;
+    return depth ? depth : 1;
+}
+
+/*******************************************************************************
+ * Queue Pair Transitions
+ ******************************************************************************/
+
+/**
+ * @brief Completes config->peer from the RTR attributes rdma_cm computed
+ * @param config Connection whose peer handshake has been decoded
+ * @param attr RTR attributes from rdma_init_qp_attr()
+ */
+static void cm_fill_peer(struct config_t *config, const struct ibv_qp_attr *attr)
+{
+    struct peer_info_t *peer = &config->peer;
+
+    peer->qp_num = attr->dest_qp_num;
+    peer->psn = attr->rq_psn;
+    peer->lid = attr->ah_attr.dlid;
+    peer->gid = attr->ah_attr.grh.dgid;
+    peer->mtu = attr->path_mtu;
+    peer->features = handshake_features(config) & peer->peer_features;
+    if (peer->seg_size && peer->seg_size < config->seg_size)
+        config->seg_size = peer->seg_size;
+    for (uint32_t i = 0; i < peer->num_regions; i++) {
+        peer->regions[i].qp_num = peer->qp_num;
+        peer->regions[i].gid = peer->gid;
+    }
+
+    // Our own GID is the one the route goes out of
+    if (ibv_query_gid(config->context, config->port_num, attr->ah_attr.grh.sgid_index, &config->gid))
+        memset(&config->gid, 0, sizeof(config->gid));
+}
+
+/**
+ * @brief Moves the QP to the next state with the attributes rdma_cm computed
+ * @param config Connection (config->peer holds the agreed read/atomic depths)
+ * @param state IBV_QPS_INIT, IBV_QPS_RTR or IBV_QPS_RTS
+ * @param access_flags Remote access granted in INIT
+ * @return 0 on success, -1 on failure
+ */
+static int cm_modify_qp(struct config_t *config, enum ibv_qp_state state, int access_flags)
+{
+    struct ibv_qp_attr attr = { .qp_state = state };
+    int mask;
+    if (rdma_init_qp_attr(config->cm_id, &attr, &mask)) {
+        ERROR_LOG("Failed to get QP attributes for state %d: %s", state, strerror(errno));
+        return -1;
+    }
+
+    switch (state) {
+    case IBV_QPS_INIT:
+        attr.qp_access_flags = access_flags;
+        break;
+    case IBV_QPS_RTR:
+        attr.max_dest_rd_atomic = config->peer.max_dest_rd_atomic;
+        cm_fill_peer(config, &attr);
+        break;
+    case IBV_QPS_RTS:
+        attr.max_rd_atomic = config->peer.max_rd_atomic;
+        config->peer.local_psn = attr.sq_psn;
+        break;
+    default:
+        break;
+    }
+
+    if (ibv_modify_qp(config->qp, &attr, mask)) {
+        ERROR_LOG("Failed to modify QP to state %d: %s", state, strerror(errno));
+        return -1;
+    }
+    trace_on_qp_state(config->qp->qp_num, state);
+    return 0;
+}
+
+/*******************************************************************************
+ * Connection Setup
+ ******************************************************************************/
+
+/**
+ * @brief Resolves a server's address and a route to it
+ * @param channel Event channel of the new identifier
+ * @param server_name Server hostname or address
+ * @return Identifier bound to the device and port the route leaves from, or NULL
+ */
+static struct rdma_cm_id *cm_resolve(struct rdma_event_channel *channel, const char *server_name)
+{
+    char port[8];
+    snprintf(port, sizeof(port), "%d", TCP_PORT);
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *res;
+    int err = getaddrinfo(server_name, port, &hints, &res);
+    if (err) {
+        ERROR_LOG("No such host %s: %s", server_name, gai_strerror(err));
+        return NULL;
+    }
+
+    struct rdma_cm_id *id;
+    if (rdma_create_id(channel, &id, NULL, RDMA_PS_TCP)) {
+        ERROR_LOG("Failed to create rdma_cm identifier: %s", strerror(errno));
+        freeaddrinfo(res);
+        return NULL;
+    }
+
+    // rdma_cm reports its own timeouts as error events, so wait a little longer
+    struct rdma_cm_event *event = NULL;
+    if (rdma_resolve_addr(id, NULL, res->ai_addr, CM_TIMEOUT_MS) == 0)
+        event = cm_expect(channel, RDMA_CM_EVENT_ADDR_RESOLVED, 2 * CM_TIMEOUT_MS, NULL);
+    freeaddrinfo(res);
+    if (event) {
+        rdma_ack_cm_event(event);
+        event = NULL;
+        if (rdma_resolve_route(id, CM_TIMEOUT_MS) == 0)
+            event = cm_expect(channel, RDMA_CM_EVENT_ROUTE_RESOLVED, 2 * CM_TIMEOUT_MS, NULL);
+    }
+    if (!event) {
+        ERROR_LOG("Failed to resolve a route to %s", server_name);
+        rdma_destroy_id(id);
+        return NULL;
+    }
+    rdma_ack_cm_event(event);
+
+    DEBUG_LOG("Route to %s leaves from %s port %u", server_name, ibv_get_device_name(id->verbs->device),
+              id->port_num);
+    return id;
+}
+
+/**
+ * @brief Keeps a connection request on an event channel of its own
+ * @param event CONNECT_REQUEST event (acknowledged here)
+ * @param conn Configuration receiving the request
+ * @return 0 on success, -1 after rejecting the request
+ *
+ * Until cm_accept() settles them, conn->peer's read/atomic depths hold the
+ * client's own.
+ */
+static int cm_keep_request(struct rdma_cm_event *event, struct config_t *conn)
+{
+    struct rdma_cm_id *id = event->id;
+    int valid = cm_decode(event->param.conn.private_data, event->param.conn.private_data_len, &conn->peer) == 0;
+    conn->peer.max_rd_atomic = event->param.conn.responder_resources;
+    conn->peer.max_dest_rd_atomic = event->param.conn.initiator_depth;
+    rdma_ack_cm_event(event);
+
+    if (!valid) {
+        ERROR_LOG("Connection request carries no handshake; is the client an older build?");
+    } else if (!(conn->cm_channel = rdma_create_event_channel()) || rdma_migrate_id(id, conn->cm_channel)) {
+        ERROR_LOG("Failed to give the connection its own event channel: %s", strerror(errno));
+        if (conn->cm_channel)
+            rdma_destroy_event_channel(conn->cm_channel);
+        conn->cm_channel = NULL;
+        valid = 0;
+    }
+    if (!valid) {
+        rdma_reject(id, NULL, 0);
+        rdma_destroy_id(id);
+        return -1;
+    }
+
+    conn->cm_id = id;
+    conn->sock_fd = conn->cm_channel->fd;
+    return 0;
+}
+
+/**
+ * @brief Waits for one client on a listener of its own
+ * @param config Configuration receiving the request
+ * @return RDMA_SUCCESS, or RDMA_ERR_COMMUNICATION if the listener fails
+ */
+static rdma_status_t cm_wait_request(struct config_t *config)
+{
+    struct rdma_cm_id *listener;
+    int fd = cm_create_listener(1, &listener);
+    if (fd < 0) {
+        return RDMA_ERR_COMMUNICATION;
+    }
+
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    int taken = -1;
+    while (taken && (poll(&pfd, 1, -1) >= 0 || errno == EINTR))
+        taken = cm_take_request(listener, NULL, config);
+    cm_destroy_listener(listener);
+    return taken ? RDMA_ERR_COMMUNICATION : RDMA_SUCCESS;
+}
+
+/**
+ * @brief Connects a resolved client QP
+ * @param config Connection with resources on the resolved device
+ * @param server_name Server hostname or address (to resolve again after a rejection)
+ * @param mode RDMA operation mode
+ * @return RDMA_SUCCESS on success, error code on failure
+ *
+ * A server that is not listening yet rejects the request; as with the TCP
+ * handshake, the client tries again CM_CONNECT_RETRIES times.
+ */
+static rdma_status_t cm_connect(struct config_t *config, const char *server_name, rdma_mode_t mode)
+{
+    uint8_t data[CM_REQ_PRIVATE_LEN];
+    uint8_t len = cm_encode(config, data, sizeof(data));
+    if (!len) {
+        ERROR_LOG("A connect request has room for %d region(s); advertise more from the server",
+                  (CM_REQ_PRIVATE_LEN - CM_HEADER_LEN - CM_V2_LEN) / CM_REGION_LEN);
+        return RDMA_ERR_RESOURCE;
+    }
+    if (cm_modify_qp(config, IBV_QPS_INIT, mode_access_flags(mode))) {
+        return RDMA_ERR_COMMUNICATION;
+    }
+
+    uint8_t responder, initiator;
+    cm_rd_atomic(config->context, &responder, &initiator);
+    struct rdma_conn_param param = {
+        .private_data = data,
+        .private_data_len = len,
+        .responder_resources = responder,
+        .initiator_depth = initiator,
+        .retry_count = RETRY_COUNT,
+        .rnr_retry_count = RNR_RETRY,
+        .srq = config->dev && config->dev->srq,
+        .qp_num = config->qp->qp_num,
+    };
+
+    struct rdma_cm_event *event = NULL;
+    for (int attempt = 1; !event; attempt++) {
+        int got = -1;
+        if (rdma_connect(config->cm_id, &param) == 0)
+            event = cm_expect(config->cm_channel, RDMA_CM_EVENT_CONNECT_RESPONSE, CM_TIMEOUT_MS, &got);
+        if (event)
+            break;
+        if (attempt == CM_CONNECT_RETRIES || (got != RDMA_CM_EVENT_REJECTED && got != RDMA_CM_EVENT_UNREACHABLE)) {
+            ERROR_LOG("Failed to connect to %s", server_name);
+            return RDMA_ERR_COMMUNICATION;
+        }
+        fprintf(stderr, "Connection failed, retrying in 1 second... (%d attempts left)\n",
+                CM_CONNECT_RETRIES - attempt);
+        sleep(1);
+
+        // A rejected identifier cannot connect again; the QP stays on the device of the first route
+        struct rdma_cm_id *id = cm_resolve(config->cm_channel, server_name);
+        if (!id || id->verbs != config->context || id->port_num != config->port_num) {
+            ERROR_LOG("Route to %s changed device or port", server_name);
+            if (id)
+                rdma_destroy_id(id);
+            return RDMA_ERR_DEVICE;
+        }
+        rdma_destroy_id(config->cm_id);
+        config->cm_id = id;
+    }
+
+    if (cm_decode(event->param.conn.private_data, event->param.conn.private_data_len, &config->peer)) {
+        ERROR_LOG("Server reply carries no handshake; is the server an older build?");
+        rdma_ack_cm_event(event);
+        return RDMA_ERR_COMMUNICATION;
+    }
+    config->peer.max_rd_atomic = cm_depth(initiator, event->param.conn.responder_resources);
+    config->peer.max_dest_rd_atomic = cm_depth(responder, event->param.conn.initiator_depth);
+    rdma_ack_cm_event(event);
+
+    if (cm_modify_qp(config, IBV_QPS_RTR, 0) || cm_modify_qp(config, IBV_QPS_RTS, 0)) {
+        return RDMA_ERR_COMMUNICATION;
+    }
+    if (rdma_establish(config->cm_id)) {
+        ERROR_LOG("Failed to establish the connection: %s", strerror(errno));
+        return RDMA_ERR_COMMUNICATION;
+    }
+    return RDMA_SUCCESS;
+}
+
+/**
+ * @brief Accepts a client's pending request
+ * @param config Connection holding the request, with resources on its device
+ * @param mode RDMA operation mode
+ * @return RDMA_SUCCESS on success, error code on failure
+ */
+static rdma_status_t cm_accept(struct config_t *config, rdma_mode_t mode)
+{
+    uint8_t responder, initiator;
+    cm_rd_atomic(config->context, &responder, &initiator);
+    config->peer.max_rd_atomic = cm_depth(initiator, config->peer.max_rd_atomic);
+    config->peer.max_dest_rd_atomic = cm_depth(responder, config->peer.max_dest_rd_atomic);
+
+    uint8_t data[CM_REP_PRIVATE_LEN];
+    uint8_t len = cm_encode(config, data, sizeof(data));
+    if (!len) {
+        return RDMA_ERR_RESOURCE;
+    }
+    if (cm_modify_qp(config, IBV_QPS_INIT, mode_access_flags(mode)) || cm_modify_qp(config, IBV_QPS_RTR, 0)
+        || cm_modify_qp(config, IBV_QPS_RTS, 0)) {
+        return RDMA_ERR_COMMUNICATION;
+    }
+
+    struct rdma_conn_param param = {
+        .private_data = data,
+        .private_data_len = len,
+        .responder_resources = config->peer.max_dest_rd_atomic,
+        .initiator_depth = config->peer.max_rd_atomic,
+        .rnr_retry_count = RNR_RETRY,
+        .srq = config->dev && config->dev->srq,
+        .qp_num = config->qp->qp_num,
+    };
+    if (rdma_accept(config->cm_id, &param)) {
+        ERROR_LOG("Failed to accept the connection: %s", strerror(errno));
+        return RDMA_ERR_COMMUNICATION;
+    }
+
+    struct rdma_cm_event *event = cm_expect(config->cm_channel, RDMA_CM_EVENT_ESTABLISHED, CM_TIMEOUT_MS, NULL);
+    if (!event) {
+        return RDMA_ERR_COMMUNICATION;
+    }
+    rdma_ack_cm_event(event);
+    return RDMA_SUCCESS;
+}
+
+/**
+ * @brief Sets up and connects a QP through rdma_cm
+ * @param config RDMA configuration, possibly holding a request from cm_take_request()
+ * @param server_name Server hostname or address (NULL for server)
+ * @param mode RDMA operation mode
+ * @param remote_info Receives the peer's data buffer (may be NULL)
+ * @return RDMA_SUCCESS on success, error code on failure
+ */
+rdma_status_t cm_setup_connection(struct config_t *config, const char *server_name, rdma_mode_t mode,
+                                  struct qp_info_t *remote_info)
+{
+    rdma_status_t status = RDMA_SUCCESS;
+    if (server_name) {
+        config->cm_channel = rdma_create_event_channel();
+        if (config->cm_channel) {
+            config->sock_fd = config->cm_channel->fd;
+            config->cm_id = cm_resolve(config->cm_channel, server_name);
+        }
+        status = config->cm_id ? RDMA_SUCCESS : RDMA_ERR_COMMUNICATION;
+    } else if (!config->cm_id) {
+        status = cm_wait_request(config);
+    }
+    if (status != RDMA_SUCCESS) {
+        cm_destroy(config);
+        return status;
+    }
+
+    // Resources go on the device and port the peer is reachable through
+    if (!config->dev)
+        config->context = config->cm_id->verbs;
+    config->port_num = config->cm_id->port_num;
+    status = init_resources(config, mode);
+    if (status != RDMA_SUCCESS) {
+        fprintf(stderr, "Failed to initialize resources for the rdma_cm connection\n");
+        cm_destroy(config);  // Unless init_resources already released everything
+        return status;
+    }
+
+    status = server_name ? cm_connect(config, server_name, mode) : cm_accept(config, mode);
+    if (status != RDMA_SUCCESS) {
+        cleanup_resources(config);
+        return status;
+    }
+
+    if (remote_info) {
+        memcpy(remote_info, &config->peer.regions[0], sizeof(struct qp_info_t));
+    }
+    DEBUG_LOG("rdma_cm connection to QP %u: mtu %d, psn %u/%u, rd_atomic %u/%u, features 0x%x, %u regions",
+              config->peer.qp_num, 128 << config->peer.mtu, config->peer.local_psn, config->peer.psn,
+              config->peer.max_rd_atomic, config->peer.max_dest_rd_atomic, config->peer.features,
+              config->peer.num_regions);
+    return RDMA_SUCCESS;
+}
+
+/*******************************************************************************
+ * Listener and Teardown
+ ******************************************************************************/
+
+/**
+ * @brief Creates a listener on TCP_PORT of the rdma_cm TCP port space
+ * @param backlog Pending connection requests
+ * @param listener Receives the listening identifier
+ * @return Non-blocking event fd, or -1 on failure
+ */
+int cm_create_listener(int backlog, struct rdma_cm_id **listener)
+{
+    struct rdma_event_channel *channel = rdma_create_event_channel();
+    if (!channel) {
+        ERROR_LOG("Failed to create rdma_cm event channel: %s", strerror(errno));
+        return -1;
+    }
+
+    // Requests are taken as they come, so reading events must not block
+    int flags = fcntl(channel->fd, F_GETFL);
+    if (flags < 0 || fcntl(channel->fd, F_SETFL, flags | O_NONBLOCK) < 0
+        || rdma_create_id(channel, listener, NULL, RDMA_PS_TCP)) {
+        ERROR_LOG("Failed to create rdma_cm listener: %s", strerror(errno));
+        rdma_destroy_event_channel(channel);
+        return -1;
+    }
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(TCP_PORT),
+                                .sin_addr.s_addr = htonl(INADDR_ANY) };
+    if (rdma_bind_addr(*listener, (struct sockaddr *)&addr) || rdma_listen(*listener, backlog)) {
+        ERROR_LOG("Failed to listen on rdma_cm port %d: %s", TCP_PORT, strerror(errno));
+        cm_destroy_listener(*listener);
+        *listener = NULL;
+        return -1;
+    }
+    return channel->fd;
+}
+
+/**
+ * @brief Takes the next valid connection request off a listener
+ * @param listener Listener from cm_create_listener()
+ * @param context Device connections must arrive on (NULL = any)
+ * @param conn Zeroed configuration receiving the request
+ * @return 0 on success, -1 if no valid request is pending
+ */
+int cm_take_request(struct rdma_cm_id *listener, struct ibv_context *context, struct config_t *conn)
+{
+    struct rdma_cm_event *event;
+    while (rdma_get_cm_event(listener->channel, &event) == 0) {
+        if (event->event != RDMA_CM_EVENT_CONNECT_REQUEST) {
+            DEBUG_LOG("Ignoring %s on the listener", rdma_event_str(event->event));
+            rdma_ack_cm_event(event);
+            continue;
+        }
+
+        // Connections share the server's PD, so they must come in through its device
+        struct rdma_cm_id *id = event->id;
+        if (context && strcmp(ibv_get_device_name(id->verbs->device), ibv_get_device_name(context->device))) {
+            ERROR_LOG("Rejecting client arriving on %s; the server runs on %s", ibv_get_device_name(id->verbs->device),
+                      ibv_get_device_name(context->device));
+            rdma_ack_cm_event(event);
+            rdma_reject(id, NULL, 0);
+            rdma_destroy_id(id);
+            continue;
+        }
+        if (cm_keep_request(event, conn) == 0)
+            return 0;
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        ERROR_LOG("Failed to read listener event: %s", strerror(errno));
+    return -1;
+}
+
+/**
+ * @brief Destroys a listener and its event channel
+ * @param listener Listener (may be NULL)
+ */
+void cm_destroy_listener(struct rdma_cm_id *listener)
+{
+    if (!listener) return;
+
+    struct rdma_event_channel *channel = listener->channel;
+    rdma_destroy_id(listener);
+    rdma_destroy_event_channel(channel);
+}
+
+/**
+ * @brief Starts disconnecting; the peer's event channel becomes readable
+ * @param config Connection
+ */
+void cm_disconnect(struct config_t *config)
+{
+    if (config->cm_id)
+        rdma_disconnect(config->cm_id);
+}
+
+/**
+ * @brief Releases the rdma_cm identifier and event channel of a connection
+ * @param config Connection (no-op without rdma_cm)
+ */
+void cm_destroy(struct config_t *config)
+{
+    if (config->cm_id)
+        rdma_destroy_id(config->cm_id);
+    if (config->cm_channel) {
+        rdma_destroy_event_channel(config->cm_channel);
+        config->sock_fd = 0;
+    }
+    config->cm_id = NULL;
+    config->cm_channel = NULL;
+}
@@ -0,0 +1,100 @@
+/**
+ * @file cm.h
+ * @brief rdma_cm connection backend interface
+ *
+ * Alternative to the TCP handshake of connect_qps(), built with `make
+ * RDMA_CM=1` and selected at run time with -R. The client resolves the
+ * server's IP address and a route to it through rdma_cm, which picks the
+ * device, port and GID the peer is reachable through; no TCP_PORT socket,
+ * IB_PORT or GID_INDEX is involved. rdma_connect()/rdma_accept() carry a
+ * compact handshake in their private data, and every QP transition takes
+ * its attributes from rdma_init_qp_attr(), so PSNs, path MTU and addressing
+ * come from the connection manager.
+ *
+ * Each connection gets its own event channel, whose fd stands in for the
+ * control socket: it becomes readable when the peer disconnects.
+ */
+
+#ifndef CM_H
+#define CM_H
+
+#include "common.h"
+
+/**
+ * rdma_cm Configuration Constants
+ * CM_TIMEOUT_MS: Longest wait for address and route resolution and each connection event
+ * CM_CONNECT_RETRIES: Connection attempts a client makes before giving up (1 s apart)
+ * CM_MAGIC: First word of the private data handshake ("RDMC")
+ * CM_VERSION: Private data handshake version
+ * CM_HEADER_LEN / CM_REGION_LEN: Private data header and per-region sizes
+ * CM_V2_LEN: Bytes version 2 appends after the regions (the sender's segment size)
+ * CM_REQ_PRIVATE_LEN / CM_REP_PRIVATE_LEN: Private data room in a connect request and
+ *                                          reply, which bounds the regions each side can
+ *                                          advertise (client 1, server HANDSHAKE_MAX_REGIONS)
+ */
+#define CM_TIMEOUT_MS 5000
+#define CM_CONNECT_RETRIES 3
+#define CM_MAGIC 0x52444d43
+#define CM_VERSION 2
+#define CM_HEADER_LEN 24
+#define CM_REGION_LEN 20
+#define CM_V2_LEN 4
+#define CM_REQ_PRIVATE_LEN 56
+#define CM_REP_PRIVATE_LEN 196
+
+/**
+ * @brief Sets up and connects a QP through rdma_cm
+ *
+ * @param config RDMA configuration; a server connection may already hold a request
+ *               taken with cm_take_request() (and a shared device in config->dev)
+ * @param server_name Server hostname or address (NULL for server)
+ * @param mode RDMA operation mode
+ * @param remote_info Receives the peer's data buffer (may be NULL)
+ * @return RDMA_SUCCESS, or an error code after releasing everything set up
+ *
+ * Without a pending request, a server listens on TCP_PORT for one client.
+ */
+rdma_status_t cm_setup_connection(struct config_t *config, const char *server_name, rdma_mode_t mode,
+                                  struct qp_info_t *remote_info);
+
+/**
+ * @brief Creates a listener for many clients
+ *
+ * @param backlog Pending connection requests
+ * @param listener Receives the listening identifier
+ * @return Non-blocking fd that becomes readable on connection requests, or -1 on failure
+ */
+int cm_create_listener(int backlog, struct rdma_cm_id **listener);
+
+/**
+ * @brief Takes the next connection request off a listener
+ *
+ * @param listener Listener from cm_create_listener()
+ * @param context Device every connection must arrive on (requests on others are rejected)
+ * @param conn Zeroed configuration; receives the request on its own event channel
+ * @return 0 on success, -1 if no valid request is pending
+ */
+int cm_take_request(struct rdma_cm_id *listener, struct ibv_context *context, struct config_t *conn);
+
+/**
+ * @brief Destroys a listener from cm_create_listener()
+ *
+ * @param listener Listener (may be NULL)
+ */
+void cm_destroy_listener(struct rdma_cm_id *listener);
+
+/**
+ * @brief Tells the peer the connection is going away
+ *
+ * @param config Connection set up by cm_setup_connection()
+ */
+void cm_disconnect(struct config_t *config);
+
+/**
+ * @brief Releases the rdma_cm identifier and event channel of a connection
+ *
+ * @param config Connection whose QP, CQ and PD are already released (no-op without rdma_cm)
+ */
+void cm_destroy(struct config_t *config);
+
+#endif // CM_H
@@ -11,6 +11,18 @@
  */
 
 #include "common.h"
+#include "srq.h"
+#include "buffer_pool.h"
+#include "numa.h"
+#include "hugepage.h"
+#include "reg_cache.h"
+#include "cm.h"
+#include <endian.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/random.h>
+#include <time.h>
 #include "send-receive/send_receive.h"
 #include "rdma-write/rdma_write.h"
 #include "rdma-read/rdma_read.h"
@@ -19,10 +31,22 @@
 /*******************************************************************************
  * Constants and Configuration
  ******************************************************************************/
-#define MAX_CQ_ENTRIES 10    // Maximum Completion Queue entries
 #define TIMEOUT 14           // QP timeout value (4.096us * 2^timeout)
-#define RETRY_COUNT 7        // Number of retry attempts for RC QP operations
-#define RNR_RETRY 7         // RNR (Receiver Not Ready) retry count
+
+static void dispatch_completion(struct config_t *config, const struct ibv_wc *wc);
+static uint64_t pipeline_reserve(struct config_t *config);
+static void pipeline_submit(struct config_t *config, struct ibv_send_wr *wr, int flags);
+static int pipeline_batch_due(const struct pipeline_t *pipe);
+
+// Process-wide runtime options, overridden from the command line in rdma.c
+struct rdma_options rdma_opts = {
+    .buf_size = MAX_BUFFER_SIZE,
+    .max_msg_size = DEFAULT_MAX_MSG_SIZE,
+    .max_conns = DEFAULT_MAX_CONNECTIONS,
+    .wait = { .spin_polls = CQ_EVENT_SPIN_BUDGET, .block = 1 },
+    .numa = 1,
+    .hugepage_size = HUGEPAGE_SIZE_2M,
+};
 
 /*******************************************************************************
  * Error Handling and Utilities
@@ -82,59 +106,96 @@ static void cleanup_qp(struct config_t *config)
     }
 }
 
+/**
+ * @brief Enters a connection in its device's completion routing table
+ * @param dev Device with a shared CQ
+ * @param config Connection whose QP completes into dev->cq
+ * @return RDMA_SUCCESS on success, RDMA_ERR_RESOURCE if the table is full
+ */
+rdma_status_t device_attach(struct rdma_device_t *dev, struct config_t *config)
+{
+    if (dev->num_conns == dev->max_conns) {
+        return RDMA_ERR_RESOURCE;
+    }
+    dev->conns[dev->num_conns++] = config;
+    return RDMA_SUCCESS;
+}
+
+/**
+ * @brief Removes a connection from its device's completion routing table
+ * @param dev Device with a shared CQ
+ * @param config Connection to remove (ignored if absent)
+ */
+static void device_detach(struct rdma_device_t *dev, struct config_t *config)
+{
+    for (uint32_t i = 0; i < dev->num_conns; i++) {
+        if (dev->conns[i] == config) {
+            dev->conns[i] = dev->conns[--dev->num_conns];
+            return;
+        }
+    }
+}
+
 /**
  * @brief Main resource cleanup function
  * @param config Configuration containing all resources to cleanup
  *
  * Cleanup sequence:
  * 1. Queue Pair
- * 2. Memory Region
- * 3. Memory Buffer
- * 4. Completion Queue
- * 5. Protection Domain
- * 6. Device Context
- * 7. Socket
+ * 2. Memory Region (unless it is the shared pool's own)
+ * 3. Memory Buffer (returned to the shared pool if it came from one)
+ * 4. Completion Queue (unless borrowed from a shared device)
+ * 5. Protection Domain (unless borrowed from a shared device)
+ * 6. Device Context (unless borrowed from a shared device or rdma_cm)
+ * 7. Socket, or rdma_cm identifier and event channel
  */
 void cleanup_resources(struct config_t *config)
 {
     if (!config) return;
     
+    struct rdma_device_t *dev = config->dev;
+    stats_unregister(&config->stats);
+    stats_unregister_cq(&config->cq_stats);
     if (config->qp)
         cleanup_qp(config);  // Use the function here
-    if (config->mr)
-        ibv_dereg_mr(config->mr);
-    if (config->buf)
-        free(config->buf);
-    if (config->cq)
+    if (dev && dev->cq)
+        device_detach(dev, config);
+    pipeline_destroy(config);
+    recv_ring_destroy(config);
+    reg_cache_destroy(config->reg_cache);
+    config->reg_cache = NULL;
+    if (dev && dev->pool) {
+        if (config->mr && config->mr != dev->pool->mr)
+            ibv_dereg_mr(config->mr);
+        buffer_pool_free(dev->pool, config->buf);
+    } else {
+        if (config->mr)
+            ibv_dereg_mr(config->mr);
+        struct hugepage_region_t region = { .addr = config->buf, .size = config->buf_mapped };
+        hugepage_unmap(&region);
+    }
+    if (config->cq && !(dev && config->cq == dev->cq))
         ibv_destroy_cq(config->cq);
-    if (config->pd)
+    if (config->channel && !(dev && config->channel == dev->channel))
+        ibv_destroy_comp_channel(config->channel);
+    if (config->pd && !config->dev)
         ibv_dealloc_pd(config->pd);
-    if (config->context)
-        ibv_close_device(config->context);
-    if (config->sock_fd)
+    if (config->context && !config->dev && !config->cm_id)
+        ibv_close_device(config->context);  // rdma_cm owns the context it resolved to
+    if (config->sock_fd && !config->cm_channel)
         close(config->sock_fd);
+#ifdef RDMA_CM
+    cm_destroy(config);
+#endif
 }
 
 /**
- * @brief Initialize RDMA resources
- * @param config Configuration to initialize
- * @param mode RDMA operation mode
+ * @brief Open the first RDMA device and allocate a Protection Domain
+ * @param dev Device handle to fill
  * @return RDMA_SUCCESS on success, error code on failure
- *
- * Initialization sequence:
- * 1. Device discovery and context creation
- * 2. Protection Domain allocation
- * 3. Completion Queue creation
- * 4. Queue Pair creation and configuration
- * 5. Memory buffer allocation and registration
- * 6. GID query for RoCE
  */
-rdma_status_t init_resources(struct config_t *config, rdma_mode_t mode)
+rdma_status_t open_device(struct rdma_device_t *dev)
 {
-    if (!config) {
-        return RDMA_ERR_RESOURCE;
-    }
-
     // Get list of IB devices
     int num_devices;
     struct ibv_device **dev_list = ibv_get_device_list(&num_devices);
@@ -150,50 +211,185 @@ rdma_status_t init_resources(struct config_t *config, rdma_mode_t mode)
     }
 
     // Get device context
-    config->context = ibv_open_device(device);
-    if (!config->context) {
-        ibv_free_device_list(dev_list);
+    struct ibv_context *context = ibv_open_device(device);
+    ibv_free_device_list(dev_list);
+    if (!context) {
         return RDMA_ERR_DEVICE;
     }
 
+    rdma_status_t status = device_init(dev, context);
+    if (status != RDMA_SUCCESS)
+        ibv_close_device(context);
+    return status;
+}
+
+/**
+ * @brief Allocate a Protection Domain on an open device context
+ * @param dev Device handle to fill
+ * @param context Open device context (left open on failure)
+ * @return RDMA_SUCCESS on success, error code on failure
+ */
+rdma_status_t device_init(struct rdma_device_t *dev, struct ibv_context *context)
+{
     // Allocate Protection Domain
-    config->pd = ibv_alloc_pd(config->context);
-    if (!config->pd) {
-        cleanup_resources(config);
-        ibv_free_device_list(dev_list);
+    dev->pd = ibv_alloc_pd(context);
+    if (!dev->pd) {
         return RDMA_ERR_RESOURCE;
     }
+    dev->context = context;
+
+    // Registered memory goes on the node the NIC sits on
+    dev->numa_node = rdma_opts.numa ? numa_device_node(dev->context) : -1;
+    dev->odp_caps = rdma_opts.odp ? device_odp_caps(dev->context) : 0;
+    DEBUG_LOG("Device %s on NUMA node %d, ODP caps 0x%x", ibv_get_device_name(dev->context->device),
+              dev->numa_node, dev->odp_caps);
+    if (rdma_opts.odp && !(dev->odp_caps & ODP_CAP_EXPLICIT))
+        DEBUG_LOG("ODP requested but unsupported by the device, registering pinned memory");
+    return RDMA_SUCCESS;
+}
 
-    // Create Completion Queue
-    config->cq = ibv_create_cq(config->context, MAX_CQ_ENTRIES, NULL, NULL, 0);
-    if (!config->cq) {
-        cleanup_resources(config);
-        ibv_free_device_list(dev_list);
-        return RDMA_ERR_RESOURCE;
+/**
+ * @brief Create a completion channel whose fd never blocks
+ * @param context Device context
+ * @return Channel, or NULL on failure
+ *
+ * Waiters sleep in poll()/epoll_wait() on the fd, so reading events from it
+ * must not block.
+ */
+static struct ibv_comp_channel *create_channel(struct ibv_context *context)
+{
+    struct ibv_comp_channel *channel = ibv_create_comp_channel(context);
+    if (!channel) {
+        return NULL;
     }
 
-    // Create Queue Pair
-    struct ibv_qp_init_attr qp_init_attr = { .send_cq = config->cq,
-        .recv_cq = config->cq,
-        .qp_type = IBV_QPT_RC,
-        .cap = { .max_send_wr = MAX_CQ_ENTRIES, .max_recv_wr = MAX_CQ_ENTRIES, .max_send_sge = 1, .max_recv_sge = 1 } };
+    int flags = fcntl(channel->fd, F_GETFL);
+    if (flags < 0 || fcntl(channel->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        ibv_destroy_comp_channel(channel);
+        return NULL;
+    }
+    return channel;
+}
 
-    config->qp = ibv_create_qp(config->pd, &qp_init_attr);
-    if (!config->qp) {
-        cleanup_resources(config);
-        ibv_free_device_list(dev_list);
+/**
+ * @brief Create a CQ shared by up to max_conns connections
+ * @param dev Device opened with open_device
+ * @param max_conns Connections that will complete into the CQ
+ * @param srq_depth Receives of an SRQ those connections draw from (0 = no SRQ)
+ * @return RDMA_SUCCESS on success, RDMA_ERR_RESOURCE if the device cannot hold
+ *         the SRQ's receives in one CQ, other error codes on failure
+ *
+ * The CQ holds CQ_SIZE entries per connection, bounded by the device's max_cqe,
+ * plus every SRQ receive: any of them may complete on any of the connections,
+ * so all of them can land in this CQ at once. Without that room a burst of
+ * receives would overrun the CQ.
+ */
+rdma_status_t device_share_cq(struct rdma_device_t *dev, uint32_t max_conns, uint32_t srq_depth)
+{
+    struct ibv_device_attr dev_attr;
+    if (ibv_query_device(dev->context, &dev_attr)) {
+        return RDMA_ERR_DEVICE;
+    }
+
+    if ((uint64_t)srq_depth + CQ_SIZE > (uint64_t)dev_attr.max_cqe) {
+        ERROR_LOG("SRQ of %u receives does not fit a CQ of at most %d entries", srq_depth, dev_attr.max_cqe);
         return RDMA_ERR_RESOURCE;
     }
+    uint64_t cqe = (uint64_t)CQ_SIZE * max_conns + srq_depth;
+    if (cqe > (uint64_t)dev_attr.max_cqe)
+        cqe = dev_attr.max_cqe;
 
-    // Allocate memory buffer
-    config->buf = malloc(MAX_BUFFER_SIZE);
-    if (!config->buf) {
-        cleanup_resources(config);
-        ibv_free_device_list(dev_list);
+    dev->conns = calloc(max_conns, sizeof(*dev->conns));
+    if (!dev->conns) {
+        return RDMA_ERR_RESOURCE;
+    }
+    if (rdma_opts.event_mode) {
+        dev->channel = create_channel(dev->context);
+        if (!dev->channel) {
+            free(dev->conns);
+            dev->conns = NULL;
+            return RDMA_ERR_RESOURCE;
+        }
+    }
+    dev->cq = ibv_create_cq(dev->context, (int)cqe, NULL, dev->channel, 0);
+    if (!dev->cq) {
+        device_unshare_cq(dev);
         return RDMA_ERR_RESOURCE;
     }
+    dev->max_conns = max_conns;
+    dev->num_conns = 0;
+    stats_register_cq(&dev->cq_stats, ibv_get_device_name(dev->context->device), 0, dev->cq->handle);
+    return RDMA_SUCCESS;
+}
+
+/**
+ * @brief Release a CQ created with device_share_cq
+ * @param dev Device handle (every connection on the CQ must be cleaned up first)
+ */
+void device_unshare_cq(struct rdma_device_t *dev)
+{
+    stats_unregister_cq(&dev->cq_stats);
+    if (dev->cq)
+        ibv_destroy_cq(dev->cq);
+    if (dev->channel)
+        ibv_destroy_comp_channel(dev->channel);
+    free(dev->conns);
+    dev->cq = NULL;
+    dev->channel = NULL;
+    dev->conns = NULL;
+    dev->max_conns = 0;
+    dev->num_conns = 0;
+}
+
+/**
+ * @brief Release a device opened with open_device
+ * @param dev Device handle (its SRQ and pool must already be destroyed)
+ */
+void close_device(struct rdma_device_t *dev)
+{
+    device_unshare_cq(dev);
+    if (dev->pd)
+        ibv_dealloc_pd(dev->pd);
+    if (dev->context)
+        ibv_close_device(dev->context);
+    memset(dev, 0, sizeof(*dev));
+}
+
+/**
+ * @brief On-Demand Paging capabilities of a device
+ * @param context Device context
+ * @return ODP_CAP_* flags, 0 when ODP is unsupported
+ *
+ * One MR serves sends, receives, writes and reads alike, so explicit ODP is
+ * only reported when the RC transport supports it for all four.
+ */
+int device_odp_caps(struct ibv_context *context)
+{
+    struct ibv_device_attr_ex attr = {};
+    if (ibv_query_device_ex(context, NULL, &attr)) {
+        return 0;
+    }
+
+    const uint32_t rc_needed
+        = IBV_ODP_SUPPORT_SEND | IBV_ODP_SUPPORT_RECV | IBV_ODP_SUPPORT_WRITE | IBV_ODP_SUPPORT_READ;
+    if (!(attr.odp_caps.general_caps & IBV_ODP_SUPPORT)
+        || (attr.odp_caps.per_transport_caps.rc_odp_caps & rc_needed) != rc_needed) {
+        return 0;
+    }
 
-    // Determine access flags based on mode
+    int caps = ODP_CAP_EXPLICIT;
+    if (attr.odp_caps.general_caps & IBV_ODP_SUPPORT_IMPLICIT)
+        caps |= ODP_CAP_IMPLICIT;
+    return caps;
+}
+
+/**
+ * @brief MR access flags needed by a mode
+ * @param mode RDMA operation mode
+ * @return ibv_access_flags for the data buffer
+ */
+int mode_access_flags(rdma_mode_t mode)
+{
     int access_flags = IBV_ACCESS_LOCAL_WRITE;
     switch (mode) {
     case MODE_WRITE: access_flags |= IBV_ACCESS_REMOTE_WRITE; break;
@@ -201,23 +397,187 @@ rdma_status_t init_resources(struct config_t *config, rdma_mode_t mode)
     case MODE_SEND_RECV: break;
     case MODE_LAMBDA: access_flags |= IBV_ACCESS_REMOTE_WRITE; break;
     }
+    return access_flags;
+}
+
+/**
+ * @brief Initialize RDMA resources
+ * @param config Configuration to initialize
+ * @param mode RDMA operation mode
+ * @return RDMA_SUCCESS on success, error code on failure
+ *
+ * Initialization sequence:
+ * 1. Device discovery and context creation (or borrowed from config->dev)
+ * 2. Protection Domain allocation (or borrowed from config->dev)
+ * 3. Completion Queue creation, with a completion channel in event mode (or borrowed from config->dev)
+ * 4. Queue Pair creation and configuration
+ * 5. Memory buffer allocation and registration (or a slab of config->dev's pool)
+ * 6. GID query for RoCE
+ *
+ * The buffer is config->buf_size bytes when the caller set it beforehand,
+ * rdma_opts.buf_size otherwise.
+ */
+rdma_status_t init_resources(struct config_t *config, rdma_mode_t mode)
+{
+    if (!config) {
+        return RDMA_ERR_RESOURCE;
+    }
 
-    // Register Memory Region
-    config->mr = ibv_reg_mr(config->pd, config->buf, MAX_BUFFER_SIZE, access_flags);
-    if (!config->mr) {
+    // Open the device and allocate a Protection Domain, unless borrowing shared ones
+    if (config->dev) {
+        config->context = config->dev->context;
+        config->pd = config->dev->pd;
+        config->numa_node = config->dev->numa_node;
+        config->odp_caps = config->dev->odp_caps;
+    } else {
+        // rdma_cm has already picked the device the peer is reachable through
+        struct rdma_device_t dev = {};
+        rdma_status_t status = config->cm_id ? device_init(&dev, config->context) : open_device(&dev);
+        if (status != RDMA_SUCCESS) {
+            return status;
+        }
+        config->context = dev.context;
+        config->pd = dev.pd;
+        config->numa_node = dev.numa_node;
+        config->odp_caps = dev.odp_caps;
+
+        // The calling thread belongs to the application: moving it near the NIC is opt-in
+        if (rdma_opts.numa && rdma_opts.numa_pin)
+            numa_pin_local(config->context);
+    }
+
+    // rdma_cm has set the port the peer is reachable through
+    if (!config->port_num)
+        config->port_num = IB_PORT;
+
+    // Create Completion Queue, unless completing into a shared one
+    if (config->dev && config->dev->cq) {
+        config->cq = config->dev->cq;
+        config->channel = config->dev->channel;
+    } else {
+        if (rdma_opts.event_mode) {
+            config->channel = create_channel(config->context);
+            if (!config->channel) {
+                cleanup_resources(config);
+                return RDMA_ERR_RESOURCE;
+            }
+        }
+        config->cq = ibv_create_cq(config->context, CQ_SIZE, NULL, config->channel, 0);
+        if (config->cq)
+            stats_register_cq(&config->cq_stats, ibv_get_device_name(config->context->device), config->port_num,
+                              config->cq->handle);
+    }
+    if (!config->cq) {
+        cleanup_resources(config);
+        return RDMA_ERR_RESOURCE;
+    }
+
+    config->wait = rdma_opts.wait;
+
+    // Gather/scatter lists up to MAX_SGE entries, within what the device allows
+    struct ibv_device_attr dev_attr;
+    uint32_t max_sge = MAX_SGE;
+    if (ibv_query_device(config->context, &dev_attr) == 0 && (uint32_t)dev_attr.max_sge < max_sge)
+        max_sge = dev_attr.max_sge;
+
+    // Create Queue Pair
+    struct ibv_qp_init_attr qp_init_attr = { .send_cq = config->cq,
+        .recv_cq = config->cq,
+        .qp_type = IBV_QPT_RC,
+        .srq = config->dev && config->dev->srq ? config->dev->srq->srq : NULL,
+        .sq_sig_all = 0,  // Signaling is chosen per WR (see pipeline_post)
+        .cap = { .max_send_wr = SEND_QUEUE_DEPTH, .max_recv_wr = RECV_QUEUE_DEPTH, .max_send_sge = max_sge, .max_recv_sge = max_sge,
+            .max_inline_data = MAX_INLINE_DATA } };
+
+    config->qp = ibv_create_qp(config->pd, &qp_init_attr);
+    if (!config->qp) {
+        // Some providers reject the inline request outright; retry without it
+        DEBUG_LOG("QP creation with %d bytes inline failed, retrying without inline", MAX_INLINE_DATA);
+        qp_init_attr.cap.max_inline_data = 0;
+        config->qp = ibv_create_qp(config->pd, &qp_init_attr);
+    }
+    if (!config->qp) {
+        cleanup_resources(config);
+        return RDMA_ERR_RESOURCE;
+    }
+    // Completions on a shared CQ are routed back to this connection by QP number
+    // (a device without a routing table leaves device_attach() to the CQ's owner)
+    if (config->dev && config->dev->conns && device_attach(config->dev, config) != RDMA_SUCCESS) {
         cleanup_resources(config);
-        ibv_free_device_list(dev_list);
         return RDMA_ERR_RESOURCE;
     }
+    stats_register(&config->stats, ibv_get_device_name(config->context->device), config->port_num,
+                   config->qp->qp_num);
+    config->max_send_wr = qp_init_attr.cap.max_send_wr;  // Provider may round the request up
+    config->max_recv_wr = qp_init_attr.cap.max_recv_wr;
+    config->max_inline = qp_init_attr.cap.max_inline_data < MAX_INLINE_DATA ?
+        qp_init_attr.cap.max_inline_data : MAX_INLINE_DATA;
+    config->max_send_sge = qp_init_attr.cap.max_send_sge < MAX_SGE ? qp_init_attr.cap.max_send_sge : MAX_SGE;
+    config->max_recv_sge = qp_init_attr.cap.max_recv_sge < MAX_SGE ? qp_init_attr.cap.max_recv_sge : MAX_SGE;
+
+    // Size transfers from the runtime options and the port's message limit
+    struct ibv_port_attr port_attr;
+    if (ibv_query_port(config->context, config->port_num, &port_attr)) {
+        cleanup_resources(config);
+        return RDMA_ERR_DEVICE;
+    }
+    config->max_msg_sz = port_attr.max_msg_sz;
+    if (!config->buf_size)
+        config->buf_size = rdma_opts.buf_size;
+    config->seg_size = rdma_opts.max_msg_size < config->max_msg_sz ? rdma_opts.max_msg_size : config->max_msg_sz;
+
+    if (config->dev && config->dev->pool) {
+        // Take a slab of the shared pool; its MR is registered once for all connections
+        config->buf = buffer_pool_alloc(config->dev->pool, config->buf_size);
+        if (!config->buf) {
+            cleanup_resources(config);
+            return RDMA_ERR_RESOURCE;
+        }
+        config->mr = config->dev->pool->mr;
+
+        // The pool MR is local only: remote rights get an MR over this slab alone, so the
+        // rkey the peer learns cannot reach the buffers of the other connections
+        int access = mode_access_flags(mode);
+        if (access & (IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_ATOMIC)) {
+            if (config->odp_caps & ODP_CAP_EXPLICIT)
+                access |= IBV_ACCESS_ON_DEMAND;
+            config->mr = ibv_reg_mr(config->pd, config->buf, config->buf_size, access);
+            if (!config->mr) {
+                cleanup_resources(config);
+                return RDMA_ERR_RESOURCE;
+            }
+        }
+    } else {
+        // Map the buffer (sizes may reach gigabytes, so hugepages save NIC translation entries)
+        struct hugepage_region_t region;
+        if (hugepage_map(&region, config->buf_size, PROT_READ | PROT_WRITE, rdma_opts.hugepage_size,
+                         config->numa_node)) {
+            cleanup_resources(config);
+            return RDMA_ERR_RESOURCE;
+        }
+        config->buf = region.addr;
+        config->buf_mapped = region.size;
+
+        // Register Memory Region
+        // With ODP the pages are faulted in by the NIC as they are accessed, not pinned up front
+        int access = mode_access_flags(mode);
+        if (config->odp_caps & ODP_CAP_EXPLICIT)
+            access |= IBV_ACCESS_ON_DEMAND;
+        config->mr = ibv_reg_mr(config->pd, config->buf, config->buf_size, access);
+        if (!config->mr) {
+            cleanup_resources(config);
+            return RDMA_ERR_RESOURCE;
+        }
+    }
+
+    stats_counter_set(&config->stats.mr_bytes, config->buf_size);
 
-    // Query GID for RoCE
-    if (ibv_query_gid(config->context, IB_PORT, GID_INDEX, &config->gid)) {
+    // Query GID for RoCE (rdma_cm reports the one its route uses instead)
+    if (!config->cm_id && ibv_query_gid(config->context, config->port_num, GID_INDEX, &config->gid)) {
         cleanup_resources(config);
-        ibv_free_device_list(dev_list);
         return RDMA_ERR_DEVICE;
     }
 
-    ibv_free_device_list(dev_list);
     return RDMA_SUCCESS;
 }
 
@@ -229,40 +589,45 @@ rdma_status_t init_resources(struct config_t *config, rdma_mode_t mode)
  * @brief Transition QP to INIT state
  * @param qp Queue Pair to modify
  * @param access_flags Access permissions for the QP
+ * @return RDMA_SUCCESS, or RDMA_ERR_DEVICE if the transition is rejected
  */
-void modify_qp_to_init(struct ibv_qp *qp, int access_flags)
+rdma_status_t modify_qp_to_init(struct ibv_qp *qp, int access_flags)
 {
     struct ibv_qp_attr attr
         = { .qp_state = IBV_QPS_INIT, .pkey_index = 0, .port_num = IB_PORT, .qp_access_flags = access_flags };
 
     if (ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_ACCESS_FLAGS)) {
-        die("Failed to modify QP to INIT");
+        ERROR_LOG("Failed to modify QP to INIT: %s", strerror(errno));
+        return RDMA_ERR_DEVICE;
     }
+    trace_on_qp_state(qp->qp_num, IBV_QPS_INIT);
+    return RDMA_SUCCESS;
 }
 
 /**
  * @brief Transition QP to Ready to Receive state
  * @param qp Queue Pair to modify
- * @param remote_qpn Remote QP number
- * @param remote_gid Remote GID for addressing
+ * @param peer Handshake result: peer address and PSN, agreed MTU and responder depth
+ * @return RDMA_SUCCESS, or RDMA_ERR_DEVICE if the transition is rejected
  */
-void modify_qp_to_rtr(struct ibv_qp *qp, uint32_t remote_qpn, union ibv_gid remote_gid)
+rdma_status_t modify_qp_to_rtr(struct ibv_qp *qp, const struct peer_info_t *peer)
 {
     struct ibv_qp_attr attr = { 
         .qp_state = IBV_QPS_RTR,
-        .path_mtu = IBV_MTU_1024,
-        .dest_qp_num = remote_qpn,
-        .rq_psn = 0,
-        .max_dest_rd_atomic = 1,
+        .path_mtu = peer->mtu,
+        .dest_qp_num = peer->qp_num,
+        .rq_psn = peer->psn,
+        .max_dest_rd_atomic = peer->max_dest_rd_atomic,
         .min_rnr_timer = 12,
         .ah_attr = { 
             .is_global = 1,
+            .dlid = peer->lid,
             .sl = 0,
             .src_path_bits = 0,
             .port_num = IB_PORT,
             .grh = { 
                 .hop_limit = 1,
-                .dgid = remote_gid,
+                .dgid = peer->gid,
                 .sgid_index = GID_INDEX 
             } 
         }
@@ -271,34 +636,75 @@ void modify_qp_to_rtr(struct ibv_qp *qp, uint32_t remote_qpn, union ibv_gid remo
     if (ibv_modify_qp(qp, &attr,
             IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU | IBV_QP_DEST_QPN | 
             IBV_QP_RQ_PSN | IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER)) {
-        die("Failed to modify QP to RTR");
+        ERROR_LOG("Failed to modify QP to RTR: %s", strerror(errno));
+        return RDMA_ERR_DEVICE;
     }
+    trace_on_qp_state(qp->qp_num, IBV_QPS_RTR);
+    return RDMA_SUCCESS;
 }
 
 /**
  * @brief Transition QP to Ready to Send state
  * @param qp Queue Pair to modify
+ * @param peer Handshake result: our PSN and the agreed initiator depth
+ * @return RDMA_SUCCESS, or RDMA_ERR_DEVICE if the transition is rejected
  */
-void modify_qp_to_rts(struct ibv_qp *qp)
+rdma_status_t modify_qp_to_rts(struct ibv_qp *qp, const struct peer_info_t *peer)
 {
     struct ibv_qp_attr attr = { .qp_state = IBV_QPS_RTS,
         .timeout = TIMEOUT,
         .retry_cnt = RETRY_COUNT,
         .rnr_retry = RNR_RETRY,
-        .sq_psn = 0,
-        .max_rd_atomic = 1 };
+        .sq_psn = peer->local_psn,
+        .max_rd_atomic = peer->max_rd_atomic };
 
     if (ibv_modify_qp(qp, &attr,
             IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN
                 | IBV_QP_MAX_QP_RD_ATOMIC)) {
-        die("Failed to modify QP to RTS");
+        ERROR_LOG("Failed to modify QP to RTS: %s", strerror(errno));
+        return RDMA_ERR_DEVICE;
     }
+    trace_on_qp_state(qp->qp_num, IBV_QPS_RTS);
+    return RDMA_SUCCESS;
 }
 
 /*******************************************************************************
  * Connection Management
  ******************************************************************************/
 
+/**
+ * @brief Create the server's listening socket
+ * @param backlog Pending connections queued by the kernel
+ * @return Listening socket
+ */
+int create_listener(int backlog)
+{
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        die("Failed to create socket");
+    }
+
+    int optval = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(TCP_PORT);
+
+    if (bind(listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        close(listen_fd);
+        die("Failed to bind");
+    }
+
+    if (listen(listen_fd, backlog) < 0) {
+        close(listen_fd);
+        die("Failed to listen");
+    }
+    return listen_fd;
+}
+
 /**
  * @brief Setup network socket for control path
  * @param config RDMA configuration
@@ -306,7 +712,8 @@ void modify_qp_to_rts(struct ibv_qp *qp)
  *
  * Handles both client and server socket setup:
  * - Client: Connects with retry logic
- * - Server: Creates listening socket and accepts connection
+ * - Server: Creates listening socket and accepts a single connection
+ *   (multi-client servers accept on their own listener, see server.h)
  */
 void setup_socket(struct config_t *config, const char *server_name)
 {
@@ -361,25 +768,7 @@ void setup_socket(struct config_t *config, const char *server_name)
             die("Failed to connect after multiple attempts");
         }
     } else { // Server
-        int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-        if (listen_fd < 0) {
-            die("Failed to create socket");
-        }
-
-        int optval = 1;
-        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
-
-        memset(&server_addr, 0, sizeof(server_addr));
-        server_addr.sin_family = AF_INET;
-        server_addr.sin_addr.s_addr = INADDR_ANY;
-        server_addr.sin_port = htons(TCP_PORT);
-
-        if (bind(listen_fd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-            close(listen_fd);
-            die("Failed to bind");
-        }
-
-        listen(listen_fd, 1);
+        int listen_fd = create_listener(1);
         config->sock_fd = accept(listen_fd, NULL, NULL);
         if (config->sock_fd < 0) {
             close(listen_fd);
@@ -391,164 +780,1855 @@ void setup_socket(struct config_t *config, const char *server_name)
 }
 
 /**
- * @brief Exchange QP information between peers
- * @param config RDMA configuration
- * @param server_name Server hostname (NULL for server)
- * @param local_info Local QP info to send
- * @param remote_info Remote QP info to receive
+ * @brief Read exactly len bytes from a socket
+ * @param fd Socket
+ * @param buf Destination
+ * @param len Bytes to read
+ * @return 0 on success, -1 on error or end of stream
  */
-void exchange_qp_info(
-    struct config_t *config, const char *server_name, struct qp_info_t *local_info, struct qp_info_t *remote_info)
+int sock_read_full(int fd, void *buf, size_t len)
 {
-    if (server_name) { // Client
-        if (write(config->sock_fd, local_info, sizeof(*local_info)) != sizeof(*local_info)) {
-            close(config->sock_fd);
-            die("Failed to send local QP info");
-        }
-        if (read(config->sock_fd, remote_info, sizeof(*remote_info)) != sizeof(*remote_info)) {
-            close(config->sock_fd);
-            die("Failed to receive remote QP info");
-        }
-    } else { // Server
-        if (read(config->sock_fd, remote_info, sizeof(*remote_info)) != sizeof(*remote_info)) {
-            close(config->sock_fd);
-            die("Failed to receive remote QP info");
-        }
-        if (write(config->sock_fd, local_info, sizeof(*local_info)) != sizeof(*local_info)) {
-            close(config->sock_fd);
-            die("Failed to send local QP info");
+    for (size_t done = 0; done < len;) {
+        ssize_t n = read(fd, (char *)buf + done, len - done);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return -1;
         }
+        done += n;
     }
+    return 0;
 }
 
 /**
- * @brief Establish full RDMA connection
- * @param config RDMA configuration
- * @param server_name Server hostname (NULL for server)
- * @param remote_info Remote QP info to receive
- * @param mode RDMA operation mode
+ * @brief Write exactly len bytes to a socket
+ * @param fd Socket
+ * @param buf Source
+ * @param len Bytes to write
+ * @return 0 on success, -1 on error
  */
-void connect_qps(struct config_t *config, const char *server_name, struct qp_info_t *remote_info, rdma_mode_t mode)
+int sock_write_full(int fd, const void *buf, size_t len)
 {
-    struct qp_info_t local_qp_info = { 
-        .qp_num = config->qp->qp_num,
-        .gid = config->gid,
-        .addr = (uint64_t)config->buf,
-        .rkey = config->mr->rkey 
-    };
-
-    struct qp_info_t remote_qp_info;
-
-    // Use common connection setup
-    setup_socket(config, server_name);
-    exchange_qp_info(config, server_name, &local_qp_info, &remote_qp_info);
-
-    if (remote_info) {
-        memcpy(remote_info, &remote_qp_info, sizeof(struct qp_info_t));
+    for (size_t done = 0; done < len;) {
+        ssize_t n = write(fd, (const char *)buf + done, len - done);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return -1;
+        }
+        done += n;
     }
+    return 0;
+}
 
-    // Set appropriate access flags based on mode
-    int access_flags = IBV_ACCESS_LOCAL_WRITE;
-    switch (mode) {
-    case MODE_WRITE: access_flags |= IBV_ACCESS_REMOTE_WRITE; break;
-    case MODE_READ: access_flags |= IBV_ACCESS_REMOTE_READ; break;
-    default: break;
+/**
+ * @brief Advertise another registered region in the handshake
+ * @param config RDMA configuration (not yet connected)
+ * @param mr Registration whose rkey the peer will use
+ * @param addr Start of the range the peer may access
+ * @param length Bytes the peer may access
+ * @return RDMA_SUCCESS, or RDMA_ERR_RESOURCE when HANDSHAKE_MAX_REGIONS are taken,
+ *         the range is empty or outside mr, or mr spans the whole address space
+ *
+ * The rkey grants everything mr covers, whatever range is advertised, so an
+ * implicit ODP MR (address 0, length SIZE_MAX) is refused outright: it would
+ * open the entire process to the peer.
+ */
+rdma_status_t connect_add_region(struct config_t *config, struct ibv_mr *mr, const void *addr, size_t length)
+{
+    if (!config || !mr || !addr || length == 0 || config->num_extra_regions == HANDSHAKE_MAX_REGIONS - 1) {
+        return RDMA_ERR_RESOURCE;
+    }
+    if (!mr->addr || mr->length == SIZE_MAX) {
+        ERROR_LOG("Refusing to advertise a whole-address-space MR; register the region on its own");
+        return RDMA_ERR_RESOURCE;
+    }
+    uintptr_t start = (uintptr_t)addr, mr_start = (uintptr_t)mr->addr;
+    if (start < mr_start || start - mr_start > mr->length || length > mr->length - (start - mr_start)) {
+        ERROR_LOG("Region [%p, +%zu) is outside its MR", addr, length);
+        return RDMA_ERR_RESOURCE;
     }
 
-    // Transition QP states
-    modify_qp_to_init(config->qp, access_flags);
-    modify_qp_to_rtr(config->qp, remote_qp_info.qp_num, remote_qp_info.gid);
-    modify_qp_to_rts(config->qp);
+    struct qp_info_t *region = &config->extra_regions[config->num_extra_regions++];
+    region->addr = start;
+    region->length = length;
+    region->rkey = mr->rkey;
+    return RDMA_SUCCESS;
 }
 
-/*******************************************************************************
- * RDMA Operations
- ******************************************************************************/
+/**
+ * Handshake message in host form. On the wire every field is big-endian,
+ * laid out in this order (version 1: HANDSHAKE_HEADER_LEN bytes, then
+ * num_regions * HANDSHAKE_REGION_LEN). Later versions append fields after
+ * the regions and raise length (version 2: seg_size); readers skip what
+ * they do not know.
+ */
+struct handshake_msg_t {
+    uint32_t magic;              // HANDSHAKE_MAGIC
+    uint16_t version;            // Sender's HANDSHAKE_VERSION
+    uint16_t length;             // Total message bytes
+    uint32_t qp_num;             // Sender QP number
+    uint32_t psn;                // Sender's initial send PSN (24 bits)
+    union ibv_gid gid;          // Sender GID
+    uint16_t lid;                // Sender port LID
+    uint8_t mtu;                 // Sender port active MTU (enum ibv_mtu)
+    uint8_t num_regions;         // Entries in regions
+    uint32_t max_inline;         // Sender inline threshold
+    uint32_t max_send_wr;        // Sender send queue depth
+    uint32_t max_recv_wr;        // Sender receive queue depth
+    uint8_t max_rd_atomic;       // Reads/atomics the sender can serve at once (responder)
+    uint8_t max_init_rd_atomic;  // Reads/atomics the sender can issue at once (initiator)
+    uint32_t features;           // HANDSHAKE_FEAT_*
+    struct {
+        uint64_t addr;           // Region start
+        uint64_t length;         // Region length
+        uint32_t rkey;           // Region remote key
+    } regions[HANDSHAKE_MAX_REGIONS];
+    uint32_t seg_size;           // Sender segment size (version 2, 0 from older peers)
+};
 
 /**
- * @brief Post an RDMA operation
- * @param config RDMA configuration
- * @param op Operation type (send/write/read)
- * @param data Data buffer (NULL for read)
- * @param remote_info Remote QP info (NULL for send)
- * @param length Data length in bytes
+ * @brief Features this side of a connection offers
+ * @param config RDMA configuration with a created QP
+ * @return HANDSHAKE_FEAT_* flags
  */
-void post_operation(
-    struct config_t *config, rdma_op_t op, const char *data, const struct qp_info_t *remote_info, size_t length)
+uint32_t handshake_features(const struct config_t *config)
 {
-    if (!config || length > MAX_BUFFER_SIZE) {
-        return;
+    uint32_t features = 0;
+    if (config->dev && config->dev->srq)
+        features |= HANDSHAKE_FEAT_SRQ;
+    if (config->odp_caps & ODP_CAP_EXPLICIT)
+        features |= HANDSHAKE_FEAT_ODP;
+    if (config->ring.depth)
+        features |= HANDSHAKE_FEAT_RECV_RING;
+    return features | HANDSHAKE_FEAT_END_IMM;
+}
+
+/**
+ * @brief Describe this side of a connection
+ * @param config RDMA configuration with a created QP
+ * @param msg Message to fill
+ * @return RDMA_SUCCESS, or RDMA_ERR_DEVICE if the port or device cannot be queried
+ */
+static rdma_status_t handshake_local(struct config_t *config, struct handshake_msg_t *msg)
+{
+    struct ibv_port_attr port_attr;
+    struct ibv_device_attr dev_attr;
+    if (ibv_query_port(config->context, IB_PORT, &port_attr) || ibv_query_device(config->context, &dev_attr)) {
+        return RDMA_ERR_DEVICE;
     }
 
-    struct ibv_sge sg = { .addr = (uint64_t)config->buf, .length = length, .lkey = config->mr->lkey };
+    // A random initial PSN keeps stray packets of an earlier QP with the same number out
+    uint32_t psn;
+    if (getrandom(&psn, sizeof(psn), 0) != sizeof(psn))
+        psn = (uint32_t)time(NULL) ^ (config->qp->qp_num * 2654435761u);
+
+    memset(msg, 0, sizeof(*msg));
+    msg->magic = HANDSHAKE_MAGIC;
+    msg->version = HANDSHAKE_VERSION;
+    msg->qp_num = config->qp->qp_num;
+    msg->psn = psn & 0xffffff;
+    msg->gid = config->gid;
+    msg->lid = port_attr.lid;
+    msg->mtu = port_attr.active_mtu;
+    msg->max_inline = config->max_inline;
+    msg->max_send_wr = config->max_send_wr;
+    msg->max_recv_wr = config->max_recv_wr;
+    msg->max_rd_atomic = dev_attr.max_qp_rd_atom < 255 ? dev_attr.max_qp_rd_atom : 255;
+    msg->max_init_rd_atomic = dev_attr.max_qp_init_rd_atom < 255 ? dev_attr.max_qp_init_rd_atom : 255;
+
+    msg->features = handshake_features(config);
+
+    msg->regions[0].addr = (uint64_t)config->buf;
+    msg->regions[0].length = config->buf_size;
+    msg->regions[0].rkey = config->mr->rkey;
+    msg->num_regions = 1;
+    for (uint32_t i = 0; i < config->num_extra_regions; i++, msg->num_regions++) {
+        msg->regions[msg->num_regions].addr = config->extra_regions[i].addr;
+        msg->regions[msg->num_regions].length = config->extra_regions[i].length;
+        msg->regions[msg->num_regions].rkey = config->extra_regions[i].rkey;
+    }
+    msg->seg_size = config->seg_size;
+    msg->length = HANDSHAKE_HEADER_LEN + msg->num_regions * HANDSHAKE_REGION_LEN + HANDSHAKE_V2_LEN;
+    return RDMA_SUCCESS;
+}
 
-    struct ibv_send_wr wr = { .wr_id = 0, .sg_list = &sg, .num_sge = 1, .send_flags = IBV_SEND_SIGNALED };
+/**
+ * @brief Serialize a handshake message
+ * @param msg Message (length already set)
+ * @param buf Destination of msg->length bytes
+ */
+static void handshake_encode(const struct handshake_msg_t *msg, uint8_t *buf)
+{
+    uint16_t v16;
+    uint32_t v32;
+    uint64_t v64;
+#define PUT(bits, value) \
+    do { v##bits = htobe##bits(value); memcpy(buf, &v##bits, sizeof(v##bits)); buf += sizeof(v##bits); } while (0)
+
+    PUT(32, msg->magic);
+    PUT(16, msg->version);
+    PUT(16, msg->length);
+    PUT(32, msg->qp_num);
+    PUT(32, msg->psn);
+    memcpy(buf, msg->gid.raw, sizeof(msg->gid.raw));
+    buf += sizeof(msg->gid.raw);
+    PUT(16, msg->lid);
+    *buf++ = msg->mtu;
+    *buf++ = msg->num_regions;
+    PUT(32, msg->max_inline);
+    PUT(32, msg->max_send_wr);
+    PUT(32, msg->max_recv_wr);
+    *buf++ = msg->max_rd_atomic;
+    *buf++ = msg->max_init_rd_atomic;
+    PUT(16, 0);
+    PUT(32, msg->features);
+    for (uint32_t i = 0; i < msg->num_regions; i++) {
+        PUT(64, msg->regions[i].addr);
+        PUT(64, msg->regions[i].length);
+        PUT(32, msg->regions[i].rkey);
+        PUT(32, 0);
+    }
+    PUT(32, msg->seg_size);
+#undef PUT
+}
 
-    // Configure operation-specific parameters
-    switch (op) {
-    case OP_SEND:
-        if (data)
-            memcpy(config->buf, data, length);
-        wr.opcode = IBV_WR_SEND;
+/**
+ * @brief Parse a handshake message
+ * @param buf Received bytes
+ * @param len Number of received bytes
+ * @param msg Message to fill
+ * @return 0 on success, -1 if the message is malformed or its length field
+ *         disagrees with len
+ *
+ * Fields of versions up to HANDSHAKE_VERSION are read; anything a newer peer
+ * appended is skipped.
+ */
+static int handshake_decode(const uint8_t *buf, size_t len, struct handshake_msg_t *msg)
+{
+    const uint8_t *end = buf + len;
+    uint16_t v16;
+    uint32_t v32;
+    uint64_t v64;
+#define GET(bits, field) \
+    do { memcpy(&v##bits, buf, sizeof(v##bits)); (field) = be##bits##toh(v##bits); buf += sizeof(v##bits); } while (0)
+
+    if (len < HANDSHAKE_HEADER_LEN) return -1;
+    memset(msg, 0, sizeof(*msg));
+    GET(32, msg->magic);
+    GET(16, msg->version);
+    GET(16, msg->length);
+    GET(32, msg->qp_num);
+    GET(32, msg->psn);
+    memcpy(msg->gid.raw, buf, sizeof(msg->gid.raw));
+    buf += sizeof(msg->gid.raw);
+    GET(16, msg->lid);
+    msg->mtu = *buf++;
+    msg->num_regions = *buf++;
+    GET(32, msg->max_inline);
+    GET(32, msg->max_send_wr);
+    GET(32, msg->max_recv_wr);
+    msg->max_rd_atomic = *buf++;
+    msg->max_init_rd_atomic = *buf++;
+    buf += 2;  // Reserved
+    GET(32, msg->features);
+
+    if (msg->length != len || msg->num_regions == 0 || msg->num_regions > HANDSHAKE_MAX_REGIONS
+        || (size_t)(end - buf) < msg->num_regions * (size_t)HANDSHAKE_REGION_LEN) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < msg->num_regions; i++) {
+        GET(64, msg->regions[i].addr);
+        GET(64, msg->regions[i].length);
+        GET(32, msg->regions[i].rkey);
+        buf += 4;  // Reserved
+    }
+    if (msg->version >= 2 && (size_t)(end - buf) >= HANDSHAKE_V2_LEN)
+        GET(32, msg->seg_size);
+#undef GET
+    return 0;
+}
+
+/**
+ * @brief Settle the connection parameters both sides can use
+ * @param config RDMA configuration; config->peer is filled
+ * @param local Message this side sent
+ * @param remote Message the peer sent
+ */
+static void handshake_agree(struct config_t *config, const struct handshake_msg_t *local,
+    const struct handshake_msg_t *remote)
+{
+    struct peer_info_t *peer = &config->peer;
+    memset(peer, 0, sizeof(*peer));
+
+    peer->version = local->version < remote->version ? local->version : remote->version;
+    peer->qp_num = remote->qp_num;
+    peer->psn = remote->psn & 0xffffff;
+    peer->local_psn = local->psn;
+    peer->lid = remote->lid;
+    peer->gid = remote->gid;
+    peer->mtu = local->mtu < remote->mtu ? local->mtu : remote->mtu;
+    peer->max_inline = remote->max_inline;
+    peer->max_send_wr = remote->max_send_wr;
+    peer->max_recv_wr = remote->max_recv_wr;
+
+    // We issue what the peer can serve, and serve what the peer can issue (at least one)
+    uint8_t out = local->max_init_rd_atomic < remote->max_rd_atomic ? local->max_init_rd_atomic : remote->max_rd_atomic;
+    uint8_t in = local->max_rd_atomic < remote->max_init_rd_atomic ? local->max_rd_atomic : remote->max_init_rd_atomic;
+    peer->max_rd_atomic = out ? out : 1;
+    peer->max_dest_rd_atomic = in ? in : 1;
+
+    peer->peer_features = remote->features;
+    peer->features = local->features & remote->features;
+
+    // Segments either side posts must fit the receives the other posts
+    peer->seg_size = remote->seg_size;
+    if (remote->seg_size && remote->seg_size < config->seg_size)
+        config->seg_size = remote->seg_size;
+
+    peer->num_regions = remote->num_regions;
+    for (uint32_t i = 0; i < remote->num_regions; i++) {
+        peer->regions[i].qp_num = remote->qp_num;
+        peer->regions[i].gid = remote->gid;
+        peer->regions[i].addr = remote->regions[i].addr;
+        peer->regions[i].length = remote->regions[i].length;
+        peer->regions[i].rkey = remote->regions[i].rkey;
+    }
+}
+
+/**
+ * @brief Trade handshake messages with the peer
+ * @param config RDMA configuration with a created QP and a connected config->sock_fd
+ * @param server_name Server hostname (NULL for server)
+ * @return RDMA_SUCCESS, RDMA_ERR_DEVICE if the local port cannot be queried, or
+ *         RDMA_ERR_COMMUNICATION on a socket failure or a malformed or foreign message
+ *
+ * Each message starts with its magic, version and total length, so it is
+ * read in two steps: the fixed 8-byte prefix, then the rest. The client
+ * speaks first. config->peer holds the result.
+ */
+rdma_status_t exchange_handshake(struct config_t *config, const char *server_name)
+{
+    struct handshake_msg_t local, remote;
+    uint8_t out[HANDSHAKE_HEADER_LEN + HANDSHAKE_MAX_REGIONS * HANDSHAKE_REGION_LEN + HANDSHAKE_V2_LEN];
+    uint8_t in[HANDSHAKE_MAX_LEN];
+
+    rdma_status_t status = handshake_local(config, &local);
+    if (status != RDMA_SUCCESS) {
+        return status;
+    }
+    handshake_encode(&local, out);
+
+    if (server_name && sock_write_full(config->sock_fd, out, local.length)) {
+        ERROR_LOG("Failed to send handshake: %s", strerror(errno));
+        return RDMA_ERR_COMMUNICATION;
+    }
+
+    uint32_t magic;
+    uint16_t length;
+    if (sock_read_full(config->sock_fd, in, 8)) {
+        ERROR_LOG("Failed to receive handshake");
+        return RDMA_ERR_COMMUNICATION;
+    }
+    memcpy(&magic, in, sizeof(magic));
+    memcpy(&length, in + 6, sizeof(length));
+    length = be16toh(length);
+    if (be32toh(magic) != HANDSHAKE_MAGIC) {
+        ERROR_LOG("Peer did not send a handshake (magic 0x%08x); is it an older build?", be32toh(magic));
+        return RDMA_ERR_COMMUNICATION;
+    }
+    if (length < HANDSHAKE_HEADER_LEN || length > HANDSHAKE_MAX_LEN
+        || sock_read_full(config->sock_fd, in + 8, length - 8) || handshake_decode(in, length, &remote)) {
+        ERROR_LOG("Malformed handshake of %u bytes", length);
+        return RDMA_ERR_COMMUNICATION;
+    }
+    if (remote.version == 0) {
+        ERROR_LOG("Peer handshake has version 0");
+        return RDMA_ERR_COMMUNICATION;
+    }
+
+    if (!server_name && sock_write_full(config->sock_fd, out, local.length)) {
+        ERROR_LOG("Failed to send handshake: %s", strerror(errno));
+        return RDMA_ERR_COMMUNICATION;
+    }
+
+    handshake_agree(config, &local, &remote);
+    DEBUG_LOG("Handshake v%u with QP %u: mtu %d, psn %u/%u, rd_atomic %u/%u, features 0x%x, %u regions",
+              config->peer.version, config->peer.qp_num, 128 << config->peer.mtu, config->peer.local_psn,
+              config->peer.psn, config->peer.max_rd_atomic, config->peer.max_dest_rd_atomic, config->peer.features,
+              config->peer.num_regions);
+    return RDMA_SUCCESS;
+}
+
+/**
+ * @brief Establish full RDMA connection
+ * @param config RDMA configuration
+ * @param server_name Server hostname (NULL for server)
+ * @param remote_info Remote QP info to receive
+ * @param mode RDMA operation mode
+ * @return RDMA_SUCCESS, RDMA_ERR_COMMUNICATION if the handshake fails, or
+ *         RDMA_ERR_DEVICE if the QP cannot be brought up
+ *
+ * Leaves config's resources (socket included) to the caller on failure,
+ * so one bad peer can be dropped with cleanup_resources().
+ */
+rdma_status_t connect_qps(struct config_t *config, const char *server_name, struct qp_info_t *remote_info,
+                          rdma_mode_t mode)
+{
+    // Use common connection setup, unless the server already accepted this peer
+    if (!config->sock_fd)
+        setup_socket(config, server_name);
+    rdma_status_t status = exchange_handshake(config, server_name);
+    if (status != RDMA_SUCCESS) {
+        ERROR_LOG("Connection handshake failed");
+        return status;
+    }
+
+    if (remote_info) {
+        memcpy(remote_info, &config->peer.regions[0], sizeof(struct qp_info_t));
+    }
+    return bring_up_qp(config, mode);
+}
+
+/**
+ * @brief Move a QP through INIT, RTR and RTS with the agreed handshake parameters
+ * @param config RDMA configuration whose handshake has completed (config->peer filled)
+ * @param mode RDMA operation mode, selecting the remote access granted
+ * @return RDMA_SUCCESS, or RDMA_ERR_DEVICE if a transition fails
+ */
+rdma_status_t bring_up_qp(struct config_t *config, rdma_mode_t mode)
+{
+    rdma_status_t status;
+
+    // Transition QP states, granting the peer what the mode's buffers grant
+    if ((status = modify_qp_to_init(config->qp, mode_access_flags(mode))) != RDMA_SUCCESS
+        || (status = modify_qp_to_rtr(config->qp, &config->peer)) != RDMA_SUCCESS
+        || (status = modify_qp_to_rts(config->qp, &config->peer)) != RDMA_SUCCESS) {
+        return status;
+    }
+    return RDMA_SUCCESS;
+}
+
+/*******************************************************************************
+ * RDMA Operations
+ ******************************************************************************/
+
+/**
+ * @brief Fill in the opcode and remote fields of a send Work Request
+ * @param wr Work Request to configure
+ * @param op Operation type
+ * @param remote_info Remote QP info (NULL for send)
+ * @param remote_offset Offset added to the remote buffer address
+ * @param length Message length, carried as immediate data for OP_SEND and OP_WRITE
+ */
+static void build_send_wr(struct ibv_send_wr *wr, rdma_op_t op, const struct qp_info_t *remote_info,
+    uint64_t remote_offset, size_t length)
+{
+    switch (op) {
+    case OP_SEND:
+        wr->opcode = IBV_WR_SEND_WITH_IMM;
+        wr->imm_data = htonl(length);
+        return;
+    case OP_WRITE:
+        wr->opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
+        wr->imm_data = htonl(length);
+        break;
+    case OP_WRITE_PLAIN:
+        wr->opcode = IBV_WR_RDMA_WRITE;
         break;
+    case OP_READ:
+        wr->opcode = IBV_WR_RDMA_READ;
+        break;
+    }
+    wr->wr.rdma.remote_addr = remote_info->addr + remote_offset;
+    wr->wr.rdma.rkey = remote_info->rkey;
+}
+
+/**
+ * @brief Check whether a payload can be posted inline
+ * @param config RDMA configuration
+ * @param op Operation type
+ * @param data Caller's payload
+ * @param length Data length in bytes
+ * @return Non-zero if the WR can carry the payload with IBV_SEND_INLINE
+ *
+ * Inline payloads are copied into the WQE by ibv_post_send(), so the caller's
+ * buffer needs no registration and no staging copy, and the NIC skips the
+ * DMA read of the payload.
+ */
+static int can_post_inline(const struct config_t *config, rdma_op_t op, const char *data, size_t length)
+{
+    return data && op != OP_READ && length > 0 && length <= config->max_inline;
+}
+
+/**
+ * @brief Post a message larger than seg_size as a chain of segment WRs
+ * @param config RDMA configuration
+ * @param op Operation type
+ * @param remote_info Remote QP info (NULL for send)
+ * @param length Total length of the message staged in config->buf
+ *
+ * Segments cover consecutive offsets of config->buf and of the remote buffer.
+ * All but the last go through the send pipeline (set up on first use), which
+ * keeps up to max_send_wr of them in flight, signals one in every
+ * max_send_wr / 2 and reaps completions in bulk; the last pipelined segment is
+ * signaled so the window always drains. The last segment is posted signaled
+ * with wr_id 0 for wait_completion().
+ */
+static void post_segmented(struct config_t *config, rdma_op_t op, const struct qp_info_t *remote_info, size_t length)
+{
+    struct pipeline_t *pipe = &config->pipe;
+    size_t seg = config->seg_size;
+    size_t num_segs = (length + seg - 1) / seg;
+
+    // Segments are posted from config->buf in place, so the slots only need to exist
+    if (!pipe->depth && pipeline_init(config, config->max_send_wr, sizeof(uint64_t),
+                                      config->max_send_wr > 1 ? config->max_send_wr / 2 : 1) != RDMA_SUCCESS) {
+        die("Failed to set up the segment pipeline");
+    }
+
+    for (size_t i = 0; i < num_segs; i++) {
+        size_t offset = i * seg;
+        size_t seg_len = length - offset < seg ? length - offset : seg;
+        int last = i + 1 == num_segs;
+
+        struct ibv_sge sg = { .addr = (uint64_t)config->buf + offset, .length = seg_len, .lkey = config->mr->lkey };
+        struct ibv_send_wr wr = { .wr_id = 0, .sg_list = &sg, .num_sge = 1 };
+
+        // Only the final segment notifies the peer and carries the message length
+        build_send_wr(&wr, (op == OP_WRITE && !last) ? OP_WRITE_PLAIN : op, remote_info, offset, length);
+        if (op == OP_SEND && !last)
+            wr.opcode = IBV_WR_SEND;
+
+        if (!last) {
+            wr.wr_id = pipeline_reserve(config);
+            pipeline_submit(config, &wr, i + 2 == num_segs ? PIPELINE_FLAG_SIGNAL : 0);
+            continue;
+        }
+
+        // The final WR is outside the window, so wait until the send queue has room for it
+        while (pipe->posted - pipe->completed >= config->max_send_wr)
+            pipeline_reap(config);
+
+        wr.send_flags = IBV_SEND_SIGNALED;
+        trace_on_post_send(config->qp->qp_num, &wr);
+
+        struct ibv_send_wr *bad_wr;
+        if (ibv_post_send(config->qp, &wr, &bad_wr)) {
+            die("Failed to post segment");
+        }
+        stats_on_post_send(&config->stats, &wr);
+
+        trace_on_doorbell(config->qp->qp_num, &wr);
+    }
+}
+
+/**
+ * @brief Post an RDMA operation
+ * @param config RDMA configuration
+ * @param op Operation type (send/write/read)
+ * @param data Data buffer (NULL for read)
+ * @param remote_info Remote QP info (NULL for send)
+ * @param length Data length in bytes
+ */
+void post_operation(
+    struct config_t *config, rdma_op_t op, const char *data, const struct qp_info_t *remote_info, size_t length)
+{
+    if (!config) {
+        return;
+    }
+    if (length > config->buf_size) {
+        ERROR_LOG("Operation of %zu bytes exceeds the %zu byte buffer", length, config->buf_size);
+        return;
+    }
+
+    if (length > config->seg_size) {
+        if (data && op != OP_READ)
+            memcpy(config->buf, data, length);
+        post_segmented(config, op, remote_info, length);
+        return;
+    }
+
+    struct ibv_sge sg = { .addr = (uint64_t)config->buf, .length = length, .lkey = config->mr->lkey };
+
+    struct ibv_send_wr wr = { .wr_id = 0, .sg_list = &sg, .num_sge = 1, .send_flags = IBV_SEND_SIGNALED };
+
+    if (can_post_inline(config, op, data, length)) {
+        sg.addr = (uint64_t)data;
+        wr.send_flags |= IBV_SEND_INLINE;
+    } else if (data && op != OP_READ) {
+        memcpy(config->buf, data, length);
+    }
+    build_send_wr(&wr, op, remote_info, 0, length);
+
+    trace_on_post_send(config->qp->qp_num, &wr);
+
+    struct ibv_send_wr *bad_wr;
+    if (ibv_post_send(config->qp, &wr, &bad_wr)) {
+        die("Failed to post operation");
+    }
+    stats_on_post_send(&config->stats, &wr);
+
+    trace_on_doorbell(config->qp->qp_num, &wr);
+}
+
+/**
+ * @brief Post a receive work request for one segment
+ * @param config RDMA configuration
+ * @param offset Offset into config->buf
+ * @param length Receive buffer length
+ */
+static void post_receive_at(struct config_t *config, size_t offset, size_t length)
+{
+    struct ibv_sge sg = { .addr = (uint64_t)config->buf + offset, .length = length, .lkey = config->mr->lkey };
+
+    struct ibv_recv_wr wr = { .wr_id = 0, .sg_list = &sg, .num_sge = 1 };
+
+    struct ibv_recv_wr *bad_wr;
+    if (ibv_post_recv(config->qp, &wr, &bad_wr)) {
+        die("Failed to post RR");
+    }
+    stats_on_post_recv(&config->stats, 1);
+    trace_on_post_recv(config->qp->qp_num, &wr);
+}
+
+/**
+ * @brief Post receive work request
+ * @param config RDMA configuration
+ */
+void post_receive(struct config_t *config)
+{
+    post_receive_at(config, 0, config->buf_size < config->max_msg_sz ? config->buf_size : config->max_msg_sz);
+}
+
+/**
+ * @brief Receive a possibly segmented message into config->buf
+ * @param config RDMA configuration
+ * @return Total message length in bytes, -1 if a receive failed or the message
+ *         does not fit config->buf (the connection should then be dropped)
+ */
+ssize_t receive_message(struct config_t *config)
+{
+    size_t offset = 0;
+
+    // Older peers mark only messages whose last segment is full-size
+    int end_imm = config->peer.peer_features & HANDSHAKE_FEAT_END_IMM;
+
+    // Without a ring, one receive at a time would leave later segments to RNR retries
+    if (!config->ring.depth) {
+        size_t slot_size = config->seg_size < config->buf_size ? config->seg_size : config->buf_size;
+        if (recv_ring_init(config, RECV_RING_DEFAULT_DEPTH, slot_size, RECV_RING_REPOST_BATCH) != RDMA_SUCCESS) {
+            ERROR_LOG("Failed to set up the receive ring on QP %u", config->qp->qp_num);
+            return -1;
+        }
+    }
+
+    while (1) {
+        struct recv_msg_t msg;
+        if (recv_ring_next(config, &msg)) {
+            return -1;
+        }
+        if (msg.byte_len > config->buf_size - offset) {
+            ERROR_LOG("Incoming message on QP %u exceeds the %zu byte receive buffer", config->qp->qp_num,
+                      config->buf_size);
+            recv_ring_release(config, msg.slot);
+            return -1;
+        }
+        memcpy((char *)config->buf + offset, recv_ring_data(config, msg.slot), msg.byte_len);
+        recv_ring_release(config, msg.slot);
+
+        offset += msg.byte_len;
+        if (msg.has_imm)
+            return msg.imm_data;
+        if (!end_imm && msg.byte_len < config->seg_size)
+            return offset;
+    }
+}
+
+/*******************************************************************************
+ * Zero-Copy Operations
+ ******************************************************************************/
+
+/**
+ * @brief Register caller-owned memory for zero-copy operations
+ * @param config RDMA configuration providing the Protection Domain
+ * @param addr Start of the buffer
+ * @param length Buffer length in bytes
+ * @param access ibv_access_flags (IBV_ACCESS_LOCAL_WRITE is always added)
+ * @return Memory Region handle, NULL on failure
+ *
+ * With ODP nothing is pinned: on a device with implicit ODP the cache hands
+ * out its whole-address-space MR with exactly these rights (never to be
+ * advertised with connect_add_region), otherwise the buffer gets an
+ * on-demand MR of its own. Without ODP, or if the on-demand registration
+ * fails, the pinned registration comes from config->reg_cache, so
+ * registering the same memory again is a lookup. A buffer the cache's
+ * pinned budget cannot hold is registered on its own.
+ */
+struct ibv_mr *register_buffer(struct config_t *config, void *addr, size_t length, int access)
+{
+    if (!config || !config->pd || !addr || length == 0) {
+        return NULL;
+    }
+
+    struct ibv_mr *mr;
+    if ((config->odp_caps & ODP_CAP_EXPLICIT) && !(config->odp_caps & ODP_CAP_IMPLICIT)) {
+        mr = ibv_reg_mr(config->pd, addr, length, access | IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_ON_DEMAND);
+        if (mr) {
+            return mr;
+        }
+        DEBUG_LOG("ODP registration of %zu bytes at %p failed (%s), pinning it", length, addr, strerror(errno));
+    }
+
+    if (!config->reg_cache)
+        config->reg_cache = reg_cache_create(config->pd, rdma_opts.reg_cache_budget);
+    struct reg_entry *entry = reg_cache_get(config->reg_cache, addr, length, access);
+    if (entry) {
+        return entry->mr;
+    }
+    DEBUG_LOG("Registration cache cannot hold %zu bytes at %p, registering them on their own", length, addr);
+
+    mr = ibv_reg_mr(config->pd, addr, length, access | IBV_ACCESS_LOCAL_WRITE);
+    if (!mr) {
+        ERROR_LOG("Failed to register %zu bytes at %p: %s", length, addr, strerror(errno));
+    }
+    return mr;
+}
+
+/**
+ * @brief Release a buffer registered with register_buffer
+ * @param config RDMA configuration the buffer was registered with
+ * @param mr Memory Region handle (may be NULL)
+ *
+ * A cached registration stays registered for reuse until it is evicted,
+ * its memory is unmapped or the connection is cleaned up.
+ */
+void deregister_buffer(struct config_t *config, struct ibv_mr *mr)
+{
+    if (!mr) return;
+
+    struct reg_entry *entry = config ? reg_cache_find(config->reg_cache, mr) : NULL;
+    if (entry)
+        reg_cache_put(config->reg_cache, entry);
+    else
+        ibv_dereg_mr(mr);
+}
+
+/**
+ * @brief Build the scatter/gather entry for a range of a registered buffer
+ * @param sg Entry to fill
+ * @param mr Memory Region covering the range
+ * @param offset Offset of the range within the MR
+ * @param length Range length in bytes
+ * @return 0 on success, -1 if the range falls outside the MR
+ */
+static int build_mr_sge(struct ibv_sge *sg, const struct ibv_mr *mr, size_t offset, size_t length)
+{
+    if (!mr || offset > mr->length || length > mr->length - offset) {
+        ERROR_LOG("Range [%zu, +%zu) is outside the registered buffer", offset, length);
+        return -1;
+    }
+
+    sg->addr = (uint64_t)mr->addr + offset;
+    sg->length = length;
+    sg->lkey = mr->lkey;
+    return 0;
+}
+
+/**
+ * @brief Post an operation directly from a registered buffer
+ * @param config RDMA configuration
+ * @param op Operation type (send/write/read)
+ * @param mr Registered buffer (source for send/write, destination for read)
+ * @param offset Offset of the payload within mr
+ * @param length Data length in bytes
+ * @param remote_info Remote QP info (NULL for send)
+ * @param remote_offset Offset into the remote buffer
+ */
+void post_operation_mr(struct config_t *config, rdma_op_t op, struct ibv_mr *mr, size_t offset, size_t length,
+                       const struct qp_info_t *remote_info, uint64_t remote_offset)
+{
+    struct ibv_sge sg;
+    if (!config || build_mr_sge(&sg, mr, offset, length)) {
+        return;
+    }
+
+    struct ibv_send_wr wr = { .wr_id = 0, .sg_list = &sg, .num_sge = 1, .send_flags = IBV_SEND_SIGNALED };
+    build_send_wr(&wr, op, remote_info, remote_offset, length);
+
+    trace_on_post_send(config->qp->qp_num, &wr);
+
+    struct ibv_send_wr *bad_wr;
+    if (ibv_post_send(config->qp, &wr, &bad_wr)) {
+        die("Failed to post zero-copy operation");
+    }
+    stats_on_post_send(&config->stats, &wr);
+
+    trace_on_doorbell(config->qp->qp_num, &wr);
+}
+
+/*******************************************************************************
+ * Scatter/Gather Operations
+ ******************************************************************************/
+
+/**
+ * @brief Build verbs scatter/gather entries from segments
+ * @param sg Entries to fill (num_sge of them)
+ * @param sgl Caller's segments
+ * @param num_sge Number of segments
+ * @param max_sge Entries the WR may carry
+ * @param need_mr Non-zero unless the WR goes inline
+ * @return Total length in bytes, or -1 if a segment is invalid
+ */
+static ssize_t build_sgl(struct ibv_sge *sg, const struct sge_t *sgl, int num_sge, uint32_t max_sge, int need_mr)
+{
+    if (!sgl || num_sge < 1 || (uint32_t)num_sge > max_sge) {
+        ERROR_LOG("%d scatter/gather entries requested, the QP takes 1 to %u", num_sge, max_sge);
+        return -1;
+    }
+
+    size_t total = 0;
+    for (int i = 0; i < num_sge; i++) {
+        const struct sge_t *seg = &sgl[i];
+        if (need_mr) {
+            if (!seg->mr || (uintptr_t)seg->addr < (uintptr_t)seg->mr->addr
+                || build_mr_sge(&sg[i], seg->mr, (uintptr_t)seg->addr - (uintptr_t)seg->mr->addr, seg->length)) {
+                ERROR_LOG("Segment %d is not covered by its MR", i);
+                return -1;
+            }
+        } else {
+            sg[i] = (struct ibv_sge){ .addr = (uint64_t)seg->addr, .length = seg->length };
+        }
+        total += seg->length;
+    }
+    return total;
+}
+
+/**
+ * @brief Post a vectored send/write/read
+ * @param config RDMA configuration
+ * @param op Operation type
+ * @param sgl Segments gathered (or scattered into, for reads) in order
+ * @param num_sge Number of segments
+ * @param remote_info Remote QP info (NULL for send)
+ * @param remote_offset Byte offset into the remote buffer
+ * @return 0 on success, -1 if the segments are invalid
+ */
+int post_operation_sgl(struct config_t *config, rdma_op_t op, const struct sge_t *sgl, int num_sge,
+                       const struct qp_info_t *remote_info, uint64_t remote_offset)
+{
+    if (!config || !sgl || num_sge < 1) {
+        return -1;
+    }
+
+    // Small gathers go inline: the provider copies every segment into the WQE, no MR needed
+    size_t inline_total = 0;
+    for (int i = 0; i < num_sge; i++)
+        inline_total += sgl[i].length;
+    int inline_wr = op != OP_READ && inline_total > 0 && inline_total <= config->max_inline;
+
+    struct ibv_sge sg[MAX_SGE];
+    ssize_t total = build_sgl(sg, sgl, num_sge, config->max_send_sge, !inline_wr);
+    if (total < 0) {
+        return -1;
+    }
+    if ((size_t)total > config->seg_size) {
+        ERROR_LOG("Vectored operation of %zd bytes exceeds the %zu byte WR limit", total, config->seg_size);
+        return -1;
+    }
+
+    struct ibv_send_wr wr = { .wr_id = 0, .sg_list = sg, .num_sge = num_sge, .send_flags = IBV_SEND_SIGNALED };
+    if (inline_wr)
+        wr.send_flags |= IBV_SEND_INLINE;
+    build_send_wr(&wr, op, remote_info, remote_offset, total);
+
+    trace_on_post_send(config->qp->qp_num, &wr);
+
+    struct ibv_send_wr *bad_wr;
+    if (ibv_post_send(config->qp, &wr, &bad_wr)) {
+        die("Failed to post vectored operation");
+    }
+    stats_on_post_send(&config->stats, &wr);
+
+    trace_on_doorbell(config->qp->qp_num, &wr);
+    return 0;
+}
+
+/**
+ * @brief Post a receive scattering into several segments
+ * @param config RDMA configuration
+ * @param sgl Segments filled in order
+ * @param num_sge Number of segments
+ * @return 0 on success, -1 if the segments are invalid
+ */
+int post_receive_sgl(struct config_t *config, const struct sge_t *sgl, int num_sge)
+{
+    if (!config) {
+        return -1;
+    }
+
+    struct ibv_sge sg[MAX_SGE];
+    if (build_sgl(sg, sgl, num_sge, config->max_recv_sge, 1) < 0) {
+        return -1;
+    }
+
+    struct ibv_recv_wr wr = { .wr_id = 0, .sg_list = sg, .num_sge = num_sge };
+    struct ibv_recv_wr *bad_wr;
+    if (ibv_post_recv(config->qp, &wr, &bad_wr)) {
+        die("Failed to post vectored RR");
+    }
+    stats_on_post_recv(&config->stats, 1);
+    trace_on_post_recv(config->qp->qp_num, &wr);
+    return 0;
+}
+
+/*******************************************************************************
+ * Completion Reaping
+ ******************************************************************************/
+
+/**
+ * @brief Route completions with a given wr_id tag to a callback
+ * @param config RDMA configuration
+ * @param tag wr_id tag to handle
+ * @param cb Callback invoked per completion (NULL restores default queuing)
+ * @param ctx Opaque argument passed to the callback
+ */
+void register_completion_handler(struct config_t *config, wr_tag_t tag, completion_cb_t cb, void *ctx)
+{
+    if (tag >= WR_TAG_MAX) {
+        return;
+    }
+    config->handlers[tag].cb = cb;
+    config->handlers[tag].ctx = ctx;
+}
+
+/**
+ * @brief Reap a batch of completions and dispatch them by wr_id tag
+ * @param config RDMA configuration
+ * @param wc Caller-supplied array receiving the raw completions
+ * @param max Capacity of wc
+ * @return Number of completions reaped, -1 if polling the CQ failed
+ *
+ * A single ibv_poll_cq call drains up to max CQEs. Tagged completions go to
+ * their registered handler; the rest are queued for wait_completion().
+ * A pipeline batch left waiting for more WRs is posted first once it is
+ * older than its max_usec, so every wait loop ends up flushing it.
+ */
+int poll_completions(struct config_t *config, struct ibv_wc *wc, int max)
+{
+    int n;
+    if (pipeline_batch_due(&config->pipe))
+        pipeline_flush(config);
+    if (config->dev && config->cq == config->dev->cq) {
+        n = device_poll_completions(config->dev, wc, max);
+    } else {
+        n = ibv_poll_cq(config->cq, max, wc);
+        stats_on_cq_poll(&config->cq_stats, n);
+        for (int i = 0; i < n; i++)
+            dispatch_completion(config, &wc[i]);
+    }
+    if (n == 0)
+        stats_on_empty_poll(&config->stats);
+    return n;
+}
+
+/**
+ * @brief Reap completions from a shared CQ and route them by QP number
+ * @param dev Device with a shared CQ
+ * @param wc Caller-supplied array receiving the raw completions
+ * @param max Capacity of wc
+ * @return Number of completions reaped, -1 if polling the CQ failed
+ *
+ * Completions of a connection that is already gone are dropped.
+ */
+int device_poll_completions(struct rdma_device_t *dev, struct ibv_wc *wc, int max)
+{
+    int n = ibv_poll_cq(dev->cq, max, wc);
+    stats_on_cq_poll(&dev->cq_stats, n);
+
+    for (int i = 0; i < n; i++) {
+        struct config_t *conn = NULL;
+        for (uint32_t c = 0; c < dev->num_conns; c++) {
+            if (dev->conns[c]->qp->qp_num == wc[i].qp_num) {
+                conn = dev->conns[c];
+                break;
+            }
+        }
+        if (!conn) {
+            DEBUG_LOG("Dropping completion for unknown QP %u", wc[i].qp_num);
+            continue;
+        }
+        dispatch_completion(conn, &wc[i]);
+    }
+    return n;
+}
+
+/**
+ * @brief Hand one completion to its tag handler or the pending queue
+ * @param config Connection owning the completion
+ * @param wc Completion
+ */
+static void dispatch_completion(struct config_t *config, const struct ibv_wc *wc)
+{
+    stats_on_completion(&config->stats, wc);
+    trace_on_completion(wc);
+
+    unsigned tag = WR_ID_TAG(wc->wr_id);
+    if (tag < WR_TAG_MAX && config->handlers[tag].cb) {
+        config->handlers[tag].cb(config, wc, config->handlers[tag].ctx);
+        return;
+    }
+
+    // Losing a completion would leave its waiter hanging, so more than CQ_SIZE unclaimed ones is fatal
+    if (config->pending_count == CQ_SIZE) {
+        ERROR_LOG("%u completions not yet claimed by wait_completion, cannot queue wr_id %#lx", CQ_SIZE,
+                  wc->wr_id);
+        die("Pending completion queue overflow");
+    }
+    uint32_t tail = (config->pending_head + config->pending_count) % CQ_SIZE;
+    config->pending_wc[tail] = *wc;
+    config->pending_count++;
+}
+
+/**
+ * @brief Busy-poll for the next untagged completion
+ * @param config RDMA configuration
+ * @param wc Receives the completion; its status is left for the caller to check
+ */
+void poll_next_completion(struct config_t *config, struct ibv_wc *wc)
+{
+    struct ibv_wc batch[CQ_POLL_BATCH];
+    struct wait_state_t state = {};
+
+    while (config->pending_count == 0) {
+        int n = poll_completions(config, batch, CQ_POLL_BATCH);
+        if (n < 0) {
+            die("Failed to poll CQ");
+        }
+        if (n > 0) {
+            state.empty_polls = 0;
+            continue;
+        }
+        if (wait_backoff(&config->wait, &state, config->channel != NULL)) {
+            wait_completion_event(config);
+            state.empty_polls = 0;
+        }
+    }
+
+    *wc = config->pending_wc[config->pending_head];
+    config->pending_head = (config->pending_head + 1) % CQ_SIZE;
+    config->pending_count--;
+}
+
+/**
+ * @brief Wait for operation completion
+ * @param config RDMA configuration
+ */
+void wait_completion(struct config_t *config)
+{
+    struct ibv_wc wc;
+    poll_next_completion(config, &wc);
+    if (wc.status != IBV_WC_SUCCESS) {
+        fprintf(stderr, "Completion error: %s\n", ibv_wc_status_str(wc.status));
+        die("RDMA operation failed");
+    }
+}
+
+/*******************************************************************************
+ * Completion Events
+ ******************************************************************************/
+
+/**
+ * @brief File descriptor signaled when the CQ has an event
+ * @param config RDMA configuration
+ * @return Channel fd, -1 when the CQ has no completion channel
+ */
+int completion_fd(struct config_t *config)
+{
+    return config->channel ? config->channel->fd : -1;
+}
+
+/**
+ * @brief Request an event for the next completion
+ * @param config RDMA configuration with a completion channel
+ * @return 0 on success, -1 on failure
+ */
+int arm_completions(struct config_t *config)
+{
+    if (ibv_req_notify_cq(config->cq, 0)) {
+        ERROR_LOG("Failed to arm CQ notification: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read and acknowledge every pending channel event
+ * @param config RDMA configuration with a completion channel
+ * @return Number of events consumed
+ */
+int consume_completion_events(struct config_t *config)
+{
+    struct ibv_cq *ev_cq;
+    void *ev_ctx;
+    int events = 0;
+
+    // The fd is non-blocking, so this stops at EAGAIN once the channel is empty
+    while (ibv_get_cq_event(config->channel, &ev_cq, &ev_ctx) == 0) {
+        ibv_ack_cq_events(ev_cq, 1);
+        events++;
+    }
+    return events;
+}
+
+/**
+ * @brief Arm the CQ and sleep until it reports a completion
+ * @param config RDMA configuration with a completion channel
+ *
+ * A completion that lands between the caller's last empty poll and arming
+ * raises no event, so the CQ is checked once more after arming; anything
+ * found there is dispatched and the wait returns without sleeping.
+ * Queued pipeline WRs are posted before sleeping, whatever their age, since
+ * nothing would post them while the thread is blocked.
+ */
+void wait_completion_event(struct config_t *config)
+{
+    struct ibv_wc wc[CQ_POLL_BATCH];
+
+    pipeline_flush(config);
+    if (arm_completions(config)) {
+        die("Failed to arm CQ notification");
+    }
+    int n = poll_completions(config, wc, CQ_POLL_BATCH);
+    if (n < 0) {
+        die("Failed to poll CQ");
+    }
+    if (n > 0) {
+        return;
+    }
+
+    struct pollfd pfd = { .fd = config->channel->fd, .events = POLLIN };
+    while (poll(&pfd, 1, -1) < 0) {
+        if (errno != EINTR) {
+            die("Failed to wait for completion event");
+        }
+    }
+    consume_completion_events(config);
+}
+
+/*******************************************************************************
+ * Completion Wait Policy
+ ******************************************************************************/
+
+/**
+ * @brief Hint to the CPU that this is a spin-wait loop
+ */
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield" ::: "memory");
+#endif
+}
+
+/**
+ * @brief Monotonic clock in nanoseconds
+ * @return Current CLOCK_MONOTONIC time
+ */
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * @brief Set the wait policy of a connection
+ * @param config RDMA configuration
+ * @param policy Policy to copy
+ */
+void set_wait_policy(struct config_t *config, const struct wait_policy_t *policy)
+{
+    config->wait = *policy;
+}
+
+/**
+ * @brief Back off after an empty poll according to a wait policy
+ * @param policy Wait policy
+ * @param state Progress of the current wait
+ * @param can_block Non-zero if the caller has a completion channel to block on
+ * @return 1 if the caller should block now, 0 to poll again
+ *
+ * The clock is read only when a time bound is in play, so a plain
+ * poll-count spin costs nothing beyond the counter.
+ */
+int wait_backoff(const struct wait_policy_t *policy, struct wait_state_t *state, int can_block)
+{
+    uint32_t polls = ++state->empty_polls;
+    int timed = policy->spin_usec || policy->yield_usec;
+    uint64_t now = timed ? monotonic_ns() : 0;
 
-    case OP_WRITE:
-        if (data)
-            memcpy(config->buf, data, length);
-        wr.opcode = IBV_WR_RDMA_WRITE_WITH_IMM;
-        wr.imm_data = htonl(length);
-        wr.wr.rdma.remote_addr = remote_info->addr;
-        wr.wr.rdma.rkey = remote_info->rkey;
-        break;
+    if (polls == 1) {
+        state->yielding = 0;
+        state->phase_since_ns = now;
+    }
 
-    case OP_READ:
-        wr.opcode = IBV_WR_RDMA_READ;
-        wr.wr.rdma.remote_addr = remote_info->addr;
-        wr.wr.rdma.rkey = remote_info->rkey;
-        break;
+    // Phase 1: spin
+    if (!state->yielding) {
+        int done = !policy->spin_polls && !policy->spin_usec;
+        if (policy->spin_polls && polls >= policy->spin_polls)
+            done = 1;
+        if (policy->spin_usec && now - state->phase_since_ns >= policy->spin_usec * 1000ULL)
+            done = 1;
+        if (!done)
+            return 0;
+        state->yielding = 1;
+        state->phase_since_ns = now;
     }
 
-    struct ibv_send_wr *bad_wr;
-    if (ibv_post_send(config->qp, &wr, &bad_wr)) {
-        die("Failed to post operation");
+    // Phase 3: block, once the yield phase is over
+    int yield_over = now - state->phase_since_ns >= policy->yield_usec * 1000ULL;
+    if (yield_over && policy->block && can_block)
+        return 1;
+
+    // Phase 2: yield (and the fallback when there is nothing to block on)
+    if (policy->yield_usec) {
+        cpu_relax();
+        if (polls % WAIT_YIELD_INTERVAL == 0)
+            sched_yield();
     }
+    return 0;
 }
 
+/*******************************************************************************
+ * Receive Ring
+ ******************************************************************************/
+
 /**
- * @brief Post receive work request
+ * @brief Completion handler for receive ring slots
  * @param config RDMA configuration
+ * @param wc Completion carrying a WR_TAG_RECV_RING wr_id (value = slot index)
+ * @param ctx Unused
  */
-void post_receive(struct config_t *config)
+static void recv_ring_on_completion(struct config_t *config, const struct ibv_wc *wc, void *ctx)
 {
-    struct ibv_sge sg = { .addr = (uint64_t)config->buf, .length = MAX_BUFFER_SIZE, .lkey = config->mr->lkey };
+    (void)ctx;
+    struct recv_ring_t *ring = &config->ring;
 
-    struct ibv_recv_wr wr = { .wr_id = 0, .sg_list = &sg, .num_sge = 1 };
+    if (!ring->srq)
+        ring->posted--;
+    if (wc->status == IBV_WC_WR_FLUSH_ERR) {
+        return;  // QP is being torn down
+    }
+    if (wc->status != IBV_WC_SUCCESS) {
+        // Only this connection is broken; its owner sees ring->failed and drops it
+        ERROR_LOG("Receive on QP %u failed: %s", config->qp->qp_num, ibv_wc_status_str(wc->status));
+        ring->failed = 1;
+        if (ring->srq)
+            srq_release(ring->srq, (uint32_t)WR_ID_VALUE(wc->wr_id));
+        return;
+    }
+
+    struct recv_msg_t *msg = &ring->ready[(ring->ready_head + ring->ready_count) % ring->depth];
+    msg->slot = (uint32_t)WR_ID_VALUE(wc->wr_id);
+    msg->byte_len = wc->byte_len;
+    msg->has_imm = (wc->wc_flags & IBV_WC_WITH_IMM) != 0;
+    msg->imm_data = msg->has_imm ? ntohl(wc->imm_data) : 0;
+    ring->ready_count++;
+}
+
+/**
+ * @brief Post all released slots as one chained receive list
+ * @param config RDMA configuration
+ */
+void recv_ring_flush(struct config_t *config)
+{
+    struct recv_ring_t *ring = &config->ring;
+    if (ring->srq) {
+        srq_refill(ring->srq);
+        return;
+    }
+    if (ring->repost_count == 0) {
+        return;
+    }
+
+    struct ibv_recv_wr wrs[ring->repost_count];
+    struct ibv_sge sges[ring->repost_count];
+
+    for (uint32_t i = 0; i < ring->repost_count; i++) {
+        uint32_t slot = ring->repost[i];
+        sges[i].addr = (uint64_t)recv_ring_data(config, slot);
+        sges[i].length = ring->slot_size;
+        sges[i].lkey = ring->mr ? ring->mr->lkey : 0;
+
+        wrs[i].wr_id = WR_ID_MAKE(WR_TAG_RECV_RING, slot);
+        wrs[i].sg_list = &sges[i];
+        wrs[i].num_sge = ring->slot_size ? 1 : 0;
+        wrs[i].next = i + 1 < ring->repost_count ? &wrs[i + 1] : NULL;
+    }
 
     struct ibv_recv_wr *bad_wr;
-    if (ibv_post_recv(config->qp, &wr, &bad_wr)) {
-        die("Failed to post RR");
+    if (ibv_post_recv(config->qp, wrs, &bad_wr)) {
+        die("Failed to repost receive ring slots");
     }
+    stats_on_post_recv(&config->stats, ring->repost_count);
+    trace_on_recv_repost(config->qp->qp_num, wrs);
+
+    ring->posted += ring->repost_count;
+    ring->repost_count = 0;
 }
 
 /**
- * @brief Wait for operation completion
+ * @brief Set up and pre-post the receive ring
+ * @param config RDMA configuration with an initialized QP
+ * @param depth Number of slots (clamped to the QP's max_recv_wr)
+ * @param slot_size Bytes per slot; 0 posts imm-only receives (RDMA write with immediate)
+ * @param repost_batch Released slots accumulated before a chained repost
+ * @return RDMA_SUCCESS on success, error code on failure
+ */
+rdma_status_t recv_ring_init(struct config_t *config, uint32_t depth, size_t slot_size, uint32_t repost_batch)
+{
+    if (!config || !config->qp || depth == 0 || repost_batch == 0) {
+        return RDMA_ERR_RESOURCE;
+    }
+
+    struct recv_ring_t *ring = &config->ring;
+    if (depth > config->max_recv_wr)
+        depth = config->max_recv_wr;
+
+    ring->repost = calloc(depth, sizeof(*ring->repost));
+    ring->ready = calloc(depth, sizeof(*ring->ready));
+    if (!ring->repost || !ring->ready) {
+        recv_ring_destroy(config);
+        return RDMA_ERR_RESOURCE;
+    }
+
+    if (slot_size) {
+        // A mapping of their own, so the NUMA policy covers no unrelated heap data
+        struct hugepage_region_t region;
+        if (hugepage_map(&region, (size_t)depth * slot_size, PROT_READ | PROT_WRITE, rdma_opts.hugepage_size,
+                         config->numa_node)) {
+            recv_ring_destroy(config);
+            return RDMA_ERR_RESOURCE;
+        }
+        ring->slots = region.addr;
+        ring->slots_mapped = region.size;
+        ring->mr = ibv_reg_mr(config->pd, ring->slots, (size_t)depth * slot_size, IBV_ACCESS_LOCAL_WRITE);
+        if (!ring->mr) {
+            recv_ring_destroy(config);
+            return RDMA_ERR_RESOURCE;
+        }
+    }
+
+    ring->depth = depth;
+    ring->slot_size = slot_size;
+    ring->repost_batch = repost_batch < depth ? repost_batch : depth;
+    register_completion_handler(config, WR_TAG_RECV_RING, recv_ring_on_completion, NULL);
+
+    // Initial fill is one chained post of every slot
+    for (uint32_t i = 0; i < depth; i++)
+        ring->repost[i] = i;
+    ring->repost_count = depth;
+    recv_ring_flush(config);
+
+    DEBUG_LOG("Receive ring ready: depth=%u slot_size=%zu repost_batch=%u", depth, slot_size, ring->repost_batch);
+    return RDMA_SUCCESS;
+}
+
+/**
+ * @brief Back the receive ring with a Shared Receive Queue
+ * @param config RDMA configuration whose QP was created on srq
+ * @param srq Shared Receive Queue providing the slots
+ * @return RDMA_SUCCESS on success, error code on failure
+ *
+ * The slots, their MR and reposting belong to the SRQ; the connection only
+ * keeps a ready FIFO large enough for every SRQ slot.
+ */
+rdma_status_t recv_ring_attach_srq(struct config_t *config, struct srq_t *srq)
+{
+    if (!config || !srq) {
+        return RDMA_ERR_RESOURCE;
+    }
+
+    struct recv_ring_t *ring = &config->ring;
+    ring->ready = calloc(srq->depth, sizeof(*ring->ready));
+    if (!ring->ready) {
+        return RDMA_ERR_RESOURCE;
+    }
+
+    ring->srq = srq;
+    ring->depth = srq->depth;
+    ring->slot_size = srq->slot_size;
+    register_completion_handler(config, WR_TAG_RECV_RING, recv_ring_on_completion, NULL);
+    return RDMA_SUCCESS;
+}
+
+/**
+ * @brief Release the receive ring
  * @param config RDMA configuration
  */
-void wait_completion(struct config_t *config)
+void recv_ring_destroy(struct config_t *config)
 {
-    struct ibv_wc wc;
-    while (ibv_poll_cq(config->cq, 1, &wc) == 0)
-        ;
-    if (wc.status != IBV_WC_SUCCESS) {
-        fprintf(stderr, "Completion error: %s\n", ibv_wc_status_str(wc.status));
+    struct recv_ring_t *ring = &config->ring;
+
+    if (ring->mr)
+        ibv_dereg_mr(ring->mr);
+    struct hugepage_region_t region = { .addr = ring->slots, .size = ring->slots_mapped };
+    hugepage_unmap(&region);
+    free(ring->repost);
+    free(ring->ready);
+    memset(ring, 0, sizeof(*ring));
+    register_completion_handler(config, WR_TAG_RECV_RING, NULL, NULL);
+}
+
+/**
+ * @brief Payload address of a receive slot
+ * @param config RDMA configuration
+ * @param slot Slot index
+ * @return Slot address (NULL for imm-only rings)
+ */
+void *recv_ring_data(struct config_t *config, uint32_t slot)
+{
+    struct recv_ring_t *ring = &config->ring;
+    if (ring->srq) {
+        return srq_data(ring->srq, slot);
+    }
+    return ring->slots ? ring->slots + (size_t)slot * ring->slot_size : NULL;
+}
+
+/**
+ * @brief Wait for the next received message
+ * @param config RDMA configuration with an initialized ring
+ * @param msg Receives the slot index, length and immediate data
+ * @return 0 on success, -1 once a receive has failed and no message is left
+ */
+int recv_ring_next(struct config_t *config, struct recv_msg_t *msg)
+{
+    struct recv_ring_t *ring = &config->ring;
+    struct ibv_wc wc[CQ_POLL_BATCH];
+    struct wait_state_t state = {};
+
+    while (ring->ready_count == 0) {
+        if (ring->failed) {
+            return -1;
+        }
+        int n = poll_completions(config, wc, CQ_POLL_BATCH);
+        if (n < 0) {
+            die("Failed to poll CQ");
+        }
+        if (n > 0) {
+            state.empty_polls = 0;
+            continue;
+        }
+        if (wait_backoff(&config->wait, &state, config->channel != NULL)) {
+            wait_completion_event(config);
+            state.empty_polls = 0;
+            continue;
+        }
+        // An idle SRQ may be starved; look for its low-watermark event now and then
+        if (state.empty_polls % SRQ_EVENT_POLL_INTERVAL == 0 && ring->srq)
+            srq_poll_events(ring->srq);
+    }
+
+    *msg = ring->ready[ring->ready_head];
+    ring->ready_head = (ring->ready_head + 1) % ring->depth;
+    ring->ready_count--;
+    return 0;
+}
+
+/**
+ * @brief Hand a consumed slot back to the ring
+ * @param config RDMA configuration
+ * @param slot Slot index from recv_ring_next()
+ *
+ * Reposts happen once repost_batch slots are released, or earlier when
+ * fewer than repost_batch receives remain posted, so the peer is never
+ * left without a receive to land in.
+ */
+void recv_ring_release(struct config_t *config, uint32_t slot)
+{
+    struct recv_ring_t *ring = &config->ring;
+
+    if (ring->srq) {
+        srq_release(ring->srq, slot);
+        return;
+    }
+    ring->repost[ring->repost_count++] = slot;
+    if (ring->repost_count >= ring->repost_batch || ring->posted < ring->repost_batch)
+        recv_ring_flush(config);
+}
+
+/*******************************************************************************
+ * Send Pipeline
+ ******************************************************************************/
+
+/**
+ * @brief Completion handler for pipelined WRs
+ * @param config RDMA configuration
+ * @param wc Completion carrying a WR_TAG_PIPELINE wr_id
+ * @param ctx Unused
+ *
+ * A completion for sequence N retires every WR up to and including N, since
+ * an RC send queue completes in order.
+ */
+static void pipeline_on_completion(struct config_t *config, const struct ibv_wc *wc, void *ctx)
+{
+    (void)ctx;
+    struct pipeline_t *pipe = &config->pipe;
+
+    if (wc->status != IBV_WC_SUCCESS) {
+        fprintf(stderr, "Completion error: %s (wr_id %#lx)\n", ibv_wc_status_str(wc->status), wc->wr_id);
         die("RDMA operation failed");
     }
+
+    uint64_t seq = WR_ID_VALUE(wc->wr_id);
+    if (seq + 1 > pipe->completed)
+        pipe->completed = seq + 1;
+}
+
+/**
+ * @brief Set up the multi-outstanding send pipeline
+ * @param config RDMA configuration with an initialized QP
+ * @param depth Maximum WRs in flight (clamped to the QP's max_send_wr)
+ * @param slot_size Staging buffer size per WR
+ * @param signal_interval Signal one WR out of every signal_interval (clamped to depth)
+ * @return RDMA_SUCCESS on success, error code on failure
+ *
+ * Every in-flight WR owns a staging slot, so the caller's buffer can be reused
+ * as soon as pipeline_post() returns. Slots are recycled in posting order, which
+ * matches the order in which an RC send queue completes its WRs. A pipeline
+ * that is already set up is left untouched; pipeline_destroy() it first.
+ */
+rdma_status_t pipeline_init(struct config_t *config, uint32_t depth, size_t slot_size, uint32_t signal_interval)
+{
+    if (!config || !config->pd || depth == 0 || slot_size == 0 || signal_interval == 0) {
+        return RDMA_ERR_RESOURCE;
+    }
+
+    struct pipeline_t *pipe = &config->pipe;
+    if (pipe->depth) {
+        // Reinitialising would leak the slots and forget WRs still in flight
+        ERROR_LOG("Send pipeline is already set up");
+        return RDMA_ERR_RESOURCE;
+    }
+    if (depth > config->max_send_wr)
+        depth = config->max_send_wr;
+
+    // A mapping of their own, so the NUMA policy covers no unrelated heap data
+    struct hugepage_region_t region;
+    if (hugepage_map(&region, (size_t)depth * slot_size, PROT_READ | PROT_WRITE, rdma_opts.hugepage_size,
+                     config->numa_node)) {
+        return RDMA_ERR_RESOURCE;
+    }
+
+    pipe->slots_mr = ibv_reg_mr(config->pd, region.addr, (size_t)depth * slot_size, IBV_ACCESS_LOCAL_WRITE);
+    if (!pipe->slots_mr) {
+        hugepage_unmap(&region);
+        return RDMA_ERR_RESOURCE;
+    }
+    pipe->slots = region.addr;
+    pipe->slots_mapped = region.size;
+
+    pipe->depth = depth;
+    pipe->slot_size = slot_size;
+    pipe->posted = 0;
+    pipe->completed = 0;
+    pipe->signal_interval = signal_interval < depth ? signal_interval : depth;
+    pipe->unsignaled = 0;
+    register_completion_handler(config, WR_TAG_PIPELINE, pipeline_on_completion, NULL);
+    DEBUG_LOG("Pipeline ready: depth=%u slot_size=%zu signal_interval=%u", depth, slot_size, pipe->signal_interval);
+    return RDMA_SUCCESS;
+}
+
+/**
+ * @brief Release the send pipeline staging slots
+ * @param config RDMA configuration
+ */
+void pipeline_destroy(struct config_t *config)
+{
+    struct pipeline_t *pipe = &config->pipe;
+
+    if (pipe->slots_mr)
+        ibv_dereg_mr(pipe->slots_mr);
+    struct hugepage_region_t region = { .addr = pipe->slots, .size = pipe->slots_mapped };
+    hugepage_unmap(&region);
+    free(pipe->batch_wrs);
+    free(pipe->batch_sges);
+    memset(pipe, 0, sizeof(*pipe));
+    register_completion_handler(config, WR_TAG_PIPELINE, NULL, NULL);
+}
+
+/**
+ * @brief Staging buffer used by a pipelined WR
+ * @param config RDMA configuration
+ * @param wr_id wr_id returned by pipeline_post()
+ * @return Slot address, valid until depth further WRs have been posted
+ */
+void *pipeline_slot(struct config_t *config, uint64_t wr_id)
+{
+    struct pipeline_t *pipe = &config->pipe;
+    return pipe->slots + (WR_ID_VALUE(wr_id) % pipe->depth) * pipe->slot_size;
+}
+
+/**
+ * @brief Enable doorbell batching of pipelined WRs
+ * @param config RDMA configuration with an initialized pipeline
+ * @param max_wrs WRs chained per ibv_post_send (clamped to depth, 0 or 1 = no batching)
+ * @param max_usec Age in microseconds at which a partial batch is flushed (0 = no limit)
+ * @return RDMA_SUCCESS on success, error code on failure
+ *
+ * Every ibv_post_send rings the NIC doorbell with an MMIO write. Chaining
+ * small WRs through next and posting them together pays for one doorbell per
+ * batch instead of one per WR.
+ */
+rdma_status_t pipeline_set_batch(struct config_t *config, uint32_t max_wrs, uint32_t max_usec)
+{
+    struct pipeline_t *pipe = &config->pipe;
+    if (!pipe->depth) {
+        return RDMA_ERR_RESOURCE;
+    }
+
+    // Queued WRs point into the arrays about to be replaced
+    pipeline_flush(config);
+    free(pipe->batch_wrs);
+    free(pipe->batch_sges);
+    pipe->batch_wrs = NULL;
+    pipe->batch_sges = NULL;
+    pipe->batch_max = 0;
+
+    if (max_wrs > pipe->depth)
+        max_wrs = pipe->depth;
+    if (max_wrs > 1) {
+        pipe->batch_wrs = calloc(max_wrs, sizeof(*pipe->batch_wrs));
+        pipe->batch_sges = calloc(max_wrs, sizeof(*pipe->batch_sges));
+        if (!pipe->batch_wrs || !pipe->batch_sges) {
+            free(pipe->batch_wrs);
+            free(pipe->batch_sges);
+            pipe->batch_wrs = NULL;
+            pipe->batch_sges = NULL;
+            return RDMA_ERR_RESOURCE;
+        }
+        pipe->batch_max = max_wrs;
+    }
+    pipe->batch_ns = (uint64_t)max_usec * 1000;
+    DEBUG_LOG("Pipeline batching: max_wrs=%u max_usec=%u", pipe->batch_max, max_usec);
+    return RDMA_SUCCESS;
+}
+
+/**
+ * @brief Post every queued WR with a single doorbell
+ * @param config RDMA configuration
+ */
+void pipeline_flush(struct config_t *config)
+{
+    struct pipeline_t *pipe = &config->pipe;
+    if (!pipe->batched) return;
+
+    for (uint32_t i = 0; i + 1 < pipe->batched; i++)
+        pipe->batch_wrs[i].next = &pipe->batch_wrs[i + 1];
+    pipe->batch_wrs[pipe->batched - 1].next = NULL;
+
+    struct ibv_send_wr *bad_wr;
+    if (ibv_post_send(config->qp, pipe->batch_wrs, &bad_wr)) {
+        die("Failed to post pipelined batch");
+    }
+    stats_on_post_send(&config->stats, pipe->batch_wrs);
+    trace_on_doorbell(config->qp->qp_num, pipe->batch_wrs);
+    pipe->batched = 0;
+}
+
+/**
+ * @brief Check whether a partial batch has waited long enough
+ * @param pipe Pipeline state
+ * @return Non-zero if the queued WRs should be posted now
+ */
+static int pipeline_batch_due(const struct pipeline_t *pipe)
+{
+    return pipe->batched && pipe->batch_ns && monotonic_ns() - pipe->batch_start >= pipe->batch_ns;
+}
+
+/**
+ * @brief Reap available pipeline completions in bulk
+ * @param config RDMA configuration
+ * @return Number of WRs retired by this call
+ */
+int pipeline_reap(struct config_t *config)
+{
+    struct pipeline_t *pipe = &config->pipe;
+    struct ibv_wc wc[CQ_POLL_BATCH];
+    uint64_t before = pipe->completed;
+
+    // poll_completions() posts a batch left waiting for more WRs once it is old enough
+    if (poll_completions(config, wc, CQ_POLL_BATCH) < 0) {
+        die("Failed to poll CQ");
+    }
+
+    return (int)(pipe->completed - before);
+}
+
+/**
+ * @brief Wait for a free window entry and return the wr_id it will carry
+ * @param config RDMA configuration with an initialized pipeline
+ * @return wr_id for the next pipelined WR
+ */
+static uint64_t pipeline_reserve(struct config_t *config)
+{
+    struct pipeline_t *pipe = &config->pipe;
+
+    // Window full: retire completions until a slot frees up
+    while (pipe->posted - pipe->completed >= pipe->depth) {
+        // The WR that would retire the window may still be queued
+        pipeline_flush(config);
+        pipeline_reap(config);
+    }
+
+    return WR_ID_MAKE(WR_TAG_PIPELINE, pipe->posted);
+}
+
+/**
+ * @brief Decide signaling for a reserved WR and post it
+ * @param config RDMA configuration
+ * @param wr Fully built WR carrying the wr_id from pipeline_reserve()
+ * @param flags PIPELINE_FLAG_SIGNAL to force a signaled WR
+ *
+ * A WR is signaled when it is the signal_interval-th since the last signaled
+ * one, when the caller asks for it, or when it takes the last free window
+ * entry - otherwise a full window could never be reaped.
+ *
+ * With batching enabled the WR and its SGE are copied into the batch and
+ * posted later by pipeline_flush(); a forced signal flushes right away, since
+ * it marks the end of a burst the caller is about to wait for.
+ */
+static void pipeline_submit(struct config_t *config, struct ibv_send_wr *wr, int flags)
+{
+    struct pipeline_t *pipe = &config->pipe;
+
+    int signaled = (flags & PIPELINE_FLAG_SIGNAL) || pipe->unsignaled + 1 >= pipe->signal_interval
+        || pipe->posted + 1 - pipe->completed >= pipe->depth;
+    if (signaled)
+        wr->send_flags |= IBV_SEND_SIGNALED;
+
+    pipe->posted++;
+    pipe->unsignaled = signaled ? 0 : pipe->unsignaled + 1;
+    trace_on_post_send(config->qp->qp_num, wr);
+
+    if (pipe->batch_max) {
+        if (pipe->batched == 0)
+            pipe->batch_start = monotonic_ns();
+        pipe->batch_sges[pipe->batched] = *wr->sg_list;
+        pipe->batch_wrs[pipe->batched] = *wr;
+        pipe->batch_wrs[pipe->batched].sg_list = &pipe->batch_sges[pipe->batched];
+        pipe->batched++;
+
+        if (pipe->batched == pipe->batch_max || (flags & PIPELINE_FLAG_SIGNAL) || pipeline_batch_due(pipe))
+            pipeline_flush(config);
+        return;
+    }
+
+    struct ibv_send_wr *bad_wr;
+    if (ibv_post_send(config->qp, wr, &bad_wr)) {
+        die("Failed to post pipelined operation");
+    }
+    stats_on_post_send(&config->stats, wr);
+    trace_on_doorbell(config->qp->qp_num, wr);
+}
+
+/**
+ * @brief Post a WR through the pipeline without waiting for its completion
+ * @param config RDMA configuration with an initialized pipeline
+ * @param op Operation type
+ * @param data Payload to stage (ignored for reads)
+ * @param remote_info Remote QP info (NULL for send)
+ * @param remote_offset Offset into the remote buffer
+ * @param length Data length in bytes (at most slot_size)
+ * @param flags PIPELINE_FLAG_SIGNAL to force a signaled WR
+ * @return wr_id of the posted WR, 0 on invalid arguments
+ */
+uint64_t pipeline_post(struct config_t *config, rdma_op_t op, const char *data,
+                       const struct qp_info_t *remote_info, uint64_t remote_offset, size_t length, int flags)
+{
+    struct pipeline_t *pipe = &config->pipe;
+    if (!pipe->depth || length > pipe->slot_size) {
+        return 0;
+    }
+
+    uint64_t wr_id = pipeline_reserve(config);
+    char *slot = pipeline_slot(config, wr_id);
+
+    struct ibv_sge sg = { .addr = (uint64_t)slot, .length = length, .lkey = pipe->slots_mr->lkey };
+    struct ibv_send_wr wr = { .wr_id = wr_id, .sg_list = &sg, .num_sge = 1 };
+    if (can_post_inline(config, op, data, length))
+        wr.send_flags |= IBV_SEND_INLINE;
+    // Inline data is read at ibv_post_send time, which batching defers past our return
+    if ((wr.send_flags & IBV_SEND_INLINE) && !pipe->batch_max) {
+        sg.addr = (uint64_t)data;
+    } else if (data && op != OP_READ) {
+        memcpy(slot, data, length);
+    }
+    build_send_wr(&wr, op, remote_info, remote_offset, length);
+
+    pipeline_submit(config, &wr, flags);
+    return wr_id;
+}
+
+/**
+ * @brief Post a WR through the pipeline straight from a registered buffer
+ * @param config RDMA configuration with an initialized pipeline
+ * @param op Operation type
+ * @param mr Registered buffer (source for send/write, destination for read)
+ * @param offset Offset of the payload within mr
+ * @param length Data length in bytes
+ * @param remote_info Remote QP info (NULL for send)
+ * @param remote_offset Offset into the remote buffer
+ * @param flags PIPELINE_FLAG_SIGNAL to force a signaled WR
+ * @return wr_id of the posted WR, 0 on invalid arguments
+ */
+uint64_t pipeline_post_mr(struct config_t *config, rdma_op_t op, struct ibv_mr *mr, size_t offset, size_t length,
+                          const struct qp_info_t *remote_info, uint64_t remote_offset, int flags)
+{
+    struct ibv_sge sg;
+    if (!config->pipe.depth || build_mr_sge(&sg, mr, offset, length)) {
+        return 0;
+    }
+
+    uint64_t wr_id = pipeline_reserve(config);
+    struct ibv_send_wr wr = { .wr_id = wr_id, .sg_list = &sg, .num_sge = 1 };
+    build_send_wr(&wr, op, remote_info, remote_offset, length);
+
+    pipeline_submit(config, &wr, flags);
+    return wr_id;
+}
+
+/**
+ * @brief Wait until every pipelined WR has completed
+ * @param config RDMA configuration
+ * @return 0 on success, -1 if unsignaled WRs remain at the tail of the window
+ */
+int pipeline_drain(struct config_t *config)
+{
+    struct pipeline_t *pipe = &config->pipe;
+
+    pipeline_flush(config);
+
+    // WRs after the last signaled one only retire with a later signaled WR
+    uint64_t target = pipe->posted - pipe->unsignaled;
+    while (pipe->completed < target)
+        pipeline_reap(config);
+
+    if (pipe->unsignaled) {
+        ERROR_LOG("%u unsignaled WRs cannot be drained; post the last one with PIPELINE_FLAG_SIGNAL",
+            pipe->unsignaled);
+        return -1;
+    }
+    return 0;
 }
 
 /*******************************************************************************
  * Signal and Error Handling
  ******************************************************************************/
 
+// Configuration torn down by the signal handlers
+struct config_t *global_config = NULL;
+
 /**
  * @brief Signal handler for graceful shutdown
  * @param signo Signal number
@@ -572,6 +2652,13 @@ void handle_disconnect(struct config_t *config)
 {
     if (!config) return;
     
+#ifdef RDMA_CM
+    if (config->cm_id) {
+        cm_disconnect(config);
+        return;
+    }
+#endif
+
     // Send a zero-length message to indicate disconnect
     char empty_msg = 0;
     if (config->sock_fd) {
@@ -594,14 +2681,24 @@ void handle_disconnect(struct config_t *config)
 rdma_status_t setup_rdma_connection(struct config_t *config, const char *server_name, 
                                   rdma_mode_t mode, struct qp_info_t *remote_info)
 {
+#ifdef RDMA_CM
+    if (rdma_opts.cm) {
+        return cm_setup_connection(config, server_name, mode, remote_info);
+    }
+#endif
+
     rdma_status_t status = init_resources(config, mode);
     if (status != RDMA_SUCCESS) {
         fprintf(stderr, "Failed to initialize resources: %s\n", rdma_err_to_str(status));
         return status;
     }
     
-    connect_qps(config, server_name, remote_info, mode);
-    return RDMA_SUCCESS;
+    status = connect_qps(config, server_name, remote_info, mode);
+    if (status != RDMA_SUCCESS) {
+        fprintf(stderr, "Failed to connect: %s\n", rdma_err_to_str(status));
+        cleanup_resources(config);
+    }
+    return status;
 }
 
 /**
@@ -612,12 +2709,8 @@ rdma_status_t setup_rdma_connection(struct config_t *config, const char *server_
 int run_server(rdma_mode_t mode)
 {
     int result;
-    struct config_t config = {};
-    
-    if (setup_rdma_connection(&config, NULL, mode, NULL) != RDMA_SUCCESS) {
-        return -1;
-    }
     
+    // Each mode sets up its own connections
     switch (mode) {
         case MODE_WRITE:
             result = rw_run_server();
@@ -636,7 +2729,6 @@ int run_server(rdma_mode_t mode)
             result = -1;
     }
     
-    cleanup_resources(&config);
     return result;
 }
 
@@ -649,13 +2741,8 @@ int run_server(rdma_mode_t mode)
 int run_client(const char *server_name, rdma_mode_t mode)
 {
     int result;
-    struct config_t config = {};
-    struct qp_info_t remote_info;
-    
-    if (setup_rdma_connection(&config, server_name, mode, &remote_info) != RDMA_SUCCESS) {
-        return -1;
-    }
     
+    // Each mode sets up its own connection
     switch (mode) {
         case MODE_WRITE:
             result = rw_run_client(server_name);
@@ -674,6 +2761,5 @@ int run_client(const char *server_name, rdma_mode_t mode)
             result = -1;
     }
     
-    cleanup_resources(&config);
     return result;
 }
@@ -12,21 +12,32 @@
 #include <sys/socket.h>
 #include <unistd.h>
 #include <errno.h>
+#include "stats.h"
+#include "trace.h"
 
 /**
  * Configuration Constants
- * MAX_BUFFER_SIZE: Maximum size for RDMA data transfer buffer, critical for memory registration
+ * MAX_BUFFER_SIZE: Default size of the RDMA data transfer buffer (runtime: rdma_opts.buf_size)
+ * DEFAULT_MAX_MSG_SIZE: Default largest single WR; bigger messages are segmented
+ * MAX_MESSAGE_SIZE: Upper bound on buffer/message sizes (lengths travel in 32-bit immediate data)
  * TCP_PORT: Port used for out-of-band connection setup and QP information exchange
  * IB_PORT: InfiniBand/RoCE port number on the NIC
  * GID_INDEX: Global Identifier index for RoCE v2 protocol (usually 1 for RoCE, 0 for IB)
+ * RETRY_COUNT / RNR_RETRY: Transport and Receiver Not Ready retries of an RC QP
  */
-#define MAX_BUFFER_SIZE 4096  // Maximum size for RDMA data transfer buffer
+#define MAX_BUFFER_SIZE 4096  // Default size for RDMA data transfer buffer
+#define DEFAULT_MAX_MSG_SIZE (1UL << 20)  // Default segment size (1 MiB)
+#define MAX_MESSAGE_SIZE 0xFFFFFFFFUL     // Largest length representable in immediate data
 #define TCP_PORT 18515        // TCP port used for initial connection setup
 #define IB_PORT 1            // InfiniBand port number
 #define GID_INDEX 1          // GID index for RoCEv2
+#define RETRY_COUNT 7        // Number of retry attempts for RC QP operations
+#define RNR_RETRY 7          // RNR (Receiver Not Ready) retry count
 
-/* Debug Configuration */
-#define DEBUG 1              // Debug mode flag: 1 = enabled, 0 = disabled
+/* Debug Configuration (make DEBUG=1 enables DEBUG_LOG) */
+#ifndef DEBUG
+#define DEBUG 0              // Debug mode flag: 1 = enabled, 0 = disabled
+#endif
 
 /**
  * Logging Macros
@@ -65,6 +76,77 @@
 #define MAX_INLINE_DATA 256  // Maximum inline data size
 #define MAX_SGE 4           // Maximum scatter/gather elements per request
 
+/**
+ * Send Pipeline Configuration
+ * SEND_QUEUE_DEPTH / RECV_QUEUE_DEPTH: Queue sizes requested at QP creation (their sum fits CQ_SIZE)
+ * PIPELINE_DEFAULT_DEPTH: Default number of WRs the pipeline keeps in flight per QP
+ * PIPELINE_DEFAULT_SIGNAL_INTERVAL: Default N for "signal every Nth WR" (1 = signal all)
+ * PIPELINE_FLAG_SIGNAL: pipeline_post() flag forcing a signaled WR (end of a burst)
+ * PIPELINE_DEFAULT_BATCH_USEC: Default age at which a partly filled doorbell batch is flushed
+ * CQ_POLL_BATCH: Maximum completions reaped per ibv_poll_cq call
+ */
+#define SEND_QUEUE_DEPTH 64
+#define RECV_QUEUE_DEPTH 64
+#define PIPELINE_DEFAULT_DEPTH 32
+#define PIPELINE_DEFAULT_SIGNAL_INTERVAL 1
+#define PIPELINE_FLAG_SIGNAL 0x1
+#define PIPELINE_DEFAULT_BATCH_USEC 50
+#define CQ_POLL_BATCH 16
+
+// The untagged completions of a connection's requested queues all fit its pending_wc stash
+_Static_assert(SEND_QUEUE_DEPTH + RECV_QUEUE_DEPTH <= CQ_SIZE, "pending_wc cannot hold a full send and receive queue");
+
+/**
+ * Receive Ring Configuration
+ * RECV_RING_DEFAULT_DEPTH: Default number of pre-posted receive slots
+ * RECV_RING_REPOST_BATCH: Released slots are reposted as one chained ibv_recv_wr list of this size
+ */
+#define RECV_RING_DEFAULT_DEPTH 32
+#define RECV_RING_REPOST_BATCH 8
+
+/**
+ * Multi-Client Server Configuration
+ * DEFAULT_MAX_CONNECTIONS: Default number of clients a server keeps connected at once
+ * MAX_CONNECTIONS: Upper bound on -c (worker CQs and per-pass tables scale with it)
+ * LISTEN_BACKLOG: Pending TCP connections queued by the listening socket
+ * MAX_WORKERS: Upper bound on server worker threads (and on the CPU list)
+ */
+#define DEFAULT_MAX_CONNECTIONS 64
+#define MAX_CONNECTIONS 4096
+#define LISTEN_BACKLOG 64
+#define MAX_WORKERS 64
+
+/**
+ * On-Demand Paging Capabilities
+ * ODP_CAP_EXPLICIT: MRs may be registered with IBV_ACCESS_ON_DEMAND for every RC operation
+ * ODP_CAP_IMPLICIT: One MR may cover the whole address space (addr NULL, length SIZE_MAX)
+ */
+#define ODP_CAP_EXPLICIT 0x1
+#define ODP_CAP_IMPLICIT 0x2
+
+/**
+ * Completion Wait Configuration
+ * CQ_EVENT_SPIN_BUDGET: Default empty CQ polls spent spinning before backing off
+ * WAIT_YIELD_INTERVAL: Empty polls between sched_yield() calls in the yield phase
+ *                      (the polls in between only execute a pause instruction)
+ */
+#define CQ_EVENT_SPIN_BUDGET 1024
+#define WAIT_YIELD_INTERVAL 64
+
+/**
+ * Work Request ID Layout
+ * The top 8 bits of a wr_id select the completion handler (tag), the low
+ * 56 bits are free for the owner of that tag (sequence number, slot index...).
+ * Completions tagged WR_TAG_DEFAULT are queued for wait_completion().
+ */
+#define WR_ID_TAG_SHIFT 56
+#define WR_ID_VALUE_MASK ((1ULL << WR_ID_TAG_SHIFT) - 1)
+#define WR_ID_MAKE(tag, value) (((uint64_t)(tag) << WR_ID_TAG_SHIFT) | ((value) & WR_ID_VALUE_MASK))
+#define WR_ID_TAG(wr_id) ((unsigned)((wr_id) >> WR_ID_TAG_SHIFT))
+#define WR_ID_VALUE(wr_id) ((wr_id) & WR_ID_VALUE_MASK)
+
+typedef enum wr_tag { WR_TAG_DEFAULT = 0, WR_TAG_PIPELINE, WR_TAG_RECV_RING, WR_TAG_MAX } wr_tag_t;
+
 /**
  * Error handling macro
  * CHECK_NULL: Validates pointer and returns error code if NULL
@@ -87,8 +169,9 @@ typedef enum rdma_mode { MODE_SEND_RECV, MODE_WRITE, MODE_READ, MODE_LAMBDA } rd
  * OP_SEND: Regular send operation (requires receive on remote side)
  * OP_WRITE: RDMA write operation (one-sided)
  * OP_READ: RDMA read operation (one-sided)
+ * OP_WRITE_PLAIN: RDMA write without immediate data (consumes no remote receive)
  */
-typedef enum rdma_op { OP_SEND, OP_WRITE, OP_READ } rdma_op_t;
+typedef enum rdma_op { OP_SEND, OP_WRITE, OP_READ, OP_WRITE_PLAIN } rdma_op_t;
 
 /**
  * RDMA Status Codes
@@ -97,22 +180,191 @@ typedef enum rdma_op { OP_SEND, OP_WRITE, OP_READ } rdma_op_t;
 typedef enum { RDMA_SUCCESS = 0, RDMA_ERR_DEVICE, RDMA_ERR_RESOURCE, RDMA_ERR_COMMUNICATION } rdma_status_t;
 
 /**
- * Configuration Structure
- * Contains all RDMA resources required for communication:
- * - Device context and Protection Domain
- * - Queue Pair and Completion Queue
- * - Memory Region for RDMA operations
- * - Communication buffer and metadata
+ * Completion Wait Policy
+ * How a waiter behaves while the CQ stays empty, in three phases:
+ * 1. Spin: back-to-back polls, until spin_polls empty polls or spin_usec have passed
+ *    (whichever bound is set and reached first; with neither set the phase is skipped)
+ * 2. Yield: polls separated by a pause instruction, with sched_yield() every
+ *    WAIT_YIELD_INTERVAL polls, for yield_usec
+ * 3. Block: sleep on the completion channel if block is set and the CQ has one;
+ *    otherwise the yield phase (or, with yield_usec = 0, the spin) continues
  */
-struct config_t {
+struct wait_policy_t {
+	uint32_t spin_polls;         // Empty polls in the spin phase (0 = no poll bound)
+	uint32_t spin_usec;          // Duration of the spin phase (0 = no time bound)
+	uint32_t yield_usec;         // Duration of the yield phase
+	int block;                   // Sleep on the completion channel afterwards
+};
+
+/**
+ * Completion Wait State
+ * Progress of one wait through the policy phases; zero-initialize before waiting
+ * and reset empty_polls to 0 whenever a poll makes progress.
+ */
+struct wait_state_t {
+	uint32_t empty_polls;        // Consecutive empty polls
+	int yielding;                // Spin phase is over
+	uint64_t phase_since_ns;     // CLOCK_MONOTONIC start of the current phase
+};
+
+/**
+ * Runtime Options
+ * Process-wide tunables, filled from the command line before any connection is set up:
+ * - buf_size: size of each connection's registered data buffer
+ * - max_msg_size: largest payload posted as a single WR; longer messages are split into
+ *   segments of this size (further capped by the port's max_msg_sz)
+ * - srq_depth: servers draw receives from a Shared Receive Queue of this many slots (0 = off)
+ * - max_conns: clients a server keeps connected at once (sizes the shared CQ and buffer pool)
+ * - event_mode: CQs get a completion channel and idle waiters sleep on it instead of spinning
+ * - wait: wait policy every new connection (and the server loop) starts with
+ * - workers: server worker threads, each with its own CQ and share of the clients
+ *   (0 = service everything from the calling thread)
+ * - cpus: CPUs the workers are pinned to, worker i on cpus[i % num_cpus] (none = unpinned)
+ * - numa: registered buffers are placed on the device's NUMA node and server worker
+ *   threads without an explicit CPU are kept on the device's local CPUs
+ * - numa_pin: with numa, the application's own polling thread is kept there too (a
+ *   standalone connection's caller, an inline server); off, since it changes the
+ *   affinity of a thread the library does not own
+ * - hugepage_size: largest hugepage tried for large registered regions (0 = regular pages)
+ * - odp: data buffers are registered on demand (unpinned) on devices that support it
+ * - reg_cache_budget: pinned bytes each connection's registration cache may hold
+ *   (0 = half of RLIMIT_MEMLOCK)
+ * - stats_interval_ms: every connection's statistics are dumped to stderr this often (0 = never)
+ * - metrics_endpoint: TCP port (on 127.0.0.1), host:port or Unix socket path the metrics
+ *   exporter serves on (NULL = off)
+ * - trace_path: WR lifecycle events are traced from startup and dumped here at exit (NULL = off)
+ */
+struct rdma_options {
+	size_t buf_size;             // Data buffer size in bytes
+	size_t max_msg_size;         // Segment size in bytes
+	uint32_t srq_depth;          // SRQ slots, 0 disables SRQ mode
+	uint32_t max_conns;          // Concurrent server connections
+	int event_mode;              // Non-zero: block on completion channels when idle
+	struct wait_policy_t wait;   // Default completion wait policy
+	uint32_t workers;            // Server worker threads (0 = single-threaded)
+	uint32_t num_cpus;           // Entries in cpus
+	int cpus[MAX_WORKERS];       // CPU pinning list for the workers
+	int numa;                    // Non-zero: NUMA-local buffers and worker threads
+	int numa_pin;                // Non-zero: also pin the calling thread near the device
+	size_t hugepage_size;        // Hugepage size for registered regions (0 = off)
+	int odp;                     // Non-zero: use On-Demand Paging where supported
+	size_t reg_cache_budget;     // Registration cache pinned-byte budget (0 = from RLIMIT_MEMLOCK)
+	unsigned stats_interval_ms;  // Periodic statistics dump interval (0 = off)
+	const char *metrics_endpoint;  // Metrics exporter port, host:port or socket path (NULL = off)
+	const char *trace_path;      // Trace dump file (NULL = off)
+	int cm;                      // Non-zero: connect through rdma_cm (RDMA_CM=1 builds only)
+};
+
+extern struct rdma_options rdma_opts;
+
+struct config_t;
+
+/**
+ * Completion Callback
+ * Invoked by poll_completions() for every completion whose wr_id tag has a
+ * registered handler. The callback owns status checking for its WRs.
+ */
+typedef void (*completion_cb_t)(struct config_t *config, const struct ibv_wc *wc, void *ctx);
+
+struct completion_handler_t {
+	completion_cb_t cb;          // Callback (NULL = queue for wait_completion)
+	void *ctx;                   // Opaque argument passed to cb
+};
+
+/**
+ * Send Pipeline State
+ * Tracks Work Requests posted through pipeline_post() until their completions are reaped:
+ * - depth: maximum WRs kept outstanding (bounded by the QP's max_send_wr)
+ * - posted/completed: monotonic sequence counters, wr_id carries the posted sequence
+ * - signal_interval: only every Nth WR is signaled; a signaled completion retires all
+ *   earlier unsignaled WRs, so posted - completed is the send queue credit in use
+ * - slots: one staging buffer of slot_size bytes per window entry, so the payload of
+ *   an in-flight WR is never overwritten by a later post
+ * - batch: with doorbell batching on, WRs are chained through next and handed to
+ *   ibv_post_send together; a queued WR already counts as posted
+ */
+struct pipeline_t {
+	uint32_t depth;              // Window size (0 = pipeline not initialized)
+	uint64_t posted;             // WRs posted so far
+	uint64_t completed;          // WRs retired so far
+	uint32_t signal_interval;    // Signal one WR out of every signal_interval
+	uint32_t unsignaled;         // Unsignaled WRs posted since the last signaled one
+	size_t slot_size;            // Bytes per staging slot
+	char *slots;                 // depth * slot_size staging area
+	size_t slots_mapped;         // Bytes mapped for slots by hugepage_map
+	struct ibv_mr *slots_mr;     // Memory Region covering the staging area
+	uint32_t batch_max;          // WRs chained per doorbell (0 = post every WR immediately)
+	uint64_t batch_ns;           // Flush once the oldest queued WR is this old (0 = no limit)
+	uint32_t batched;            // WRs queued but not yet posted
+	uint64_t batch_start;        // When the oldest queued WR was queued (CLOCK_MONOTONIC ns)
+	struct ibv_send_wr *batch_wrs;  // batch_max WRs, linked through next when posted
+	struct ibv_sge *batch_sges;  // Scatter/gather entry of each queued WR
+};
+
+struct srq_t;
+struct buffer_pool;
+struct reg_cache;
+struct rdma_cm_id;
+struct rdma_event_channel;
+
+/**
+ * Shared Device Resources
+ * A device context and Protection Domain that several connections can share.
+ * When config->dev is set before init_resources(), the connection borrows them
+ * instead of opening its own, and also borrows whichever optional parts are set:
+ * - srq: the QP is created on it
+ * - cq: the QP completes into it; the connection is entered in conns so that
+ *   completions polled by any connection are routed to the one owning the QP
+ * - pool: the data buffer is a slab of the pool, covered by the pool's MR
+ */
+struct rdma_device_t {
 	struct ibv_context *context;  // Device context
 	struct ibv_pd *pd;           // Protection Domain
-	struct ibv_cq *cq;           // Completion Queue
-	struct ibv_qp *qp;           // Queue Pair
-	struct ibv_mr *mr;           // Memory Region
-	void *buf;                   // Data buffer
-	union ibv_gid gid;          // GID for RoCEv2
-	int sock_fd;                 // Socket for control messages
+	int numa_node;               // NUMA node of the device (-1 = unknown or placement off)
+	int odp_caps;                // ODP_CAP_* in use (0 = ODP off or unsupported)
+	struct srq_t *srq;           // Shared Receive Queue (optional)
+	struct ibv_cq *cq;           // Shared Completion Queue (optional)
+	struct ibv_comp_channel *channel;  // Completion channel of cq (event mode)
+	struct buffer_pool *pool;    // Shared data buffer pool (optional)
+	struct config_t **conns;     // Connections completing into cq
+	uint32_t max_conns;          // Capacity of conns
+	uint32_t num_conns;          // Entries in conns
+	struct cq_stats_t cq_stats;  // Poll counters of cq
+};
+
+/**
+ * Received Message Descriptor
+ * Handed out by recv_ring_next(); the payload stays in the slot until it is released.
+ */
+struct recv_msg_t {
+	uint32_t slot;               // Slot index (pass to recv_ring_release)
+	uint32_t byte_len;           // Bytes received into the slot
+	int has_imm;                 // Non-zero if imm_data is valid
+	uint32_t imm_data;           // Immediate data in host byte order
+};
+
+/**
+ * Receive Ring State
+ * A fixed set of receive slots kept pre-posted on the QP so senders never hit RNR:
+ * - completed receives queue up in ready until the application takes them
+ * - released slots collect in repost and go back to the QP as one chained WR list
+ * - when attached to an SRQ the slots belong to the SRQ and only ready is per connection
+ */
+struct recv_ring_t {
+	uint32_t depth;              // Number of slots (0 = ring not initialized)
+	size_t slot_size;            // Bytes per slot (0 for imm-only receives)
+	char *slots;                 // depth * slot_size receive area
+	size_t slots_mapped;         // Bytes mapped for slots by hugepage_map
+	struct ibv_mr *mr;           // Memory Region covering the slots
+	uint32_t posted;             // Slots currently posted on the QP
+	uint32_t repost_batch;       // Release count that triggers a repost
+	uint32_t *repost;            // Released slots awaiting repost
+	uint32_t repost_count;       // Entries in repost
+	struct recv_msg_t *ready;    // FIFO of completed receives
+	uint32_t ready_head;         // Next ready entry
+	uint32_t ready_count;        // Entries in ready
+	struct srq_t *srq;           // Backing SRQ (NULL = per-QP slots)
+	int failed;                  // A receive completed in error; the connection is unusable
 };
 
 /**
@@ -120,13 +372,119 @@ struct config_t {
  * Contains metadata needed to establish RDMA connection:
  * - QP number for identifying the remote QP
  * - GID for RoCE addressing
- * - Remote buffer address and key for RDMA operations
+ * - Remote buffer address, length and key for RDMA operations
  */
 struct qp_info_t {
 	uint32_t qp_num;            // Queue Pair number
 	union ibv_gid gid;          // GID for RoCEv2
 	uint64_t addr;              // Remote buffer address
 	uint32_t rkey;              // Remote key for RDMA operations
+	uint64_t length;            // Remote buffer length
+};
+
+/**
+ * Connection Handshake
+ * HANDSHAKE_MAGIC: First word of every handshake message ("RDHS")
+ * HANDSHAKE_VERSION: Protocol version spoken; peers settle on the lower of their two
+ * HANDSHAKE_MAX_REGIONS: Memory regions advertised per side (region 0 is config->buf)
+ * HANDSHAKE_HEADER_LEN: Bytes of the fixed part of a version 1 message
+ * HANDSHAKE_REGION_LEN: Bytes per advertised region
+ * HANDSHAKE_V2_LEN: Bytes version 2 appends after the regions (the sender's segment size)
+ * HANDSHAKE_MAX_LEN: Longest message accepted; later versions only append fields,
+ *                    which older peers skip
+ *
+ * Feature flags, advertised by each side for itself:
+ * HANDSHAKE_FEAT_SRQ: Receives are served from a shared receive queue
+ * HANDSHAKE_FEAT_ODP: Advertised regions are registered on demand (first touch may fault)
+ * HANDSHAKE_FEAT_RECV_RING: Receives stay pre-posted in a ring, sends need no rendezvous
+ * HANDSHAKE_FEAT_END_IMM: The last segment of every message carries the message length
+ *                         as immediate data; without it, a peer ends a message on a
+ *                         segment shorter than seg_size
+ */
+#define HANDSHAKE_MAGIC 0x52444853
+#define HANDSHAKE_VERSION 2
+#define HANDSHAKE_MAX_REGIONS 8
+#define HANDSHAKE_HEADER_LEN 56
+#define HANDSHAKE_REGION_LEN 24
+#define HANDSHAKE_V2_LEN 4
+#define HANDSHAKE_MAX_LEN 4096
+
+#define HANDSHAKE_FEAT_SRQ (1u << 0)
+#define HANDSHAKE_FEAT_ODP (1u << 1)
+#define HANDSHAKE_FEAT_RECV_RING (1u << 2)
+#define HANDSHAKE_FEAT_END_IMM (1u << 3)
+
+/**
+ * Peer Information
+ * What the handshake learned about the peer and what both sides agreed on.
+ * Filled by connect_qps(); the QP is brought up with the agreed values.
+ */
+struct peer_info_t {
+	uint16_t version;            // Protocol version in use (lower of both sides)
+	uint32_t qp_num;             // Peer QP number
+	uint32_t psn;                // Peer's initial send PSN (our receive PSN)
+	uint32_t local_psn;          // Our random initial send PSN
+	uint16_t lid;                // Peer port LID (0 on RoCE)
+	union ibv_gid gid;          // Peer GID
+	enum ibv_mtu mtu;            // Agreed path MTU (smaller active MTU of the two ports)
+	uint32_t max_inline;         // Peer inline threshold
+	uint32_t max_send_wr;        // Peer send queue depth
+	uint32_t max_recv_wr;        // Peer receive queue depth (bounds sends in flight to it)
+	uint8_t max_rd_atomic;       // Agreed reads/atomics we may have outstanding (RTS)
+	uint8_t max_dest_rd_atomic;  // Agreed reads/atomics the peer may have outstanding (RTR)
+	uint32_t peer_features;      // HANDSHAKE_FEAT_* the peer advertised
+	uint32_t features;           // HANDSHAKE_FEAT_* advertised by both sides
+	uint32_t seg_size;           // Peer segment size (0 = not sent); config->seg_size becomes the smaller
+	uint32_t num_regions;        // Entries in regions
+	struct qp_info_t regions[HANDSHAKE_MAX_REGIONS];  // Peer regions (0 = its data buffer)
+};
+
+/**
+ * Configuration Structure
+ * Contains all RDMA resources required for communication:
+ * - Device context and Protection Domain
+ * - Queue Pair and Completion Queue
+ * - Memory Region for RDMA operations
+ * - Communication buffer and metadata
+ */
+struct config_t {
+	struct rdma_device_t *dev;   // Shared device resources (NULL = owns its own)
+	struct ibv_context *context;  // Device context
+	struct ibv_pd *pd;           // Protection Domain
+	int numa_node;               // Node registered memory is placed on (-1 = no preference)
+	int odp_caps;                // ODP_CAP_* for memory registered on this connection
+	struct ibv_cq *cq;           // Completion Queue
+	struct ibv_comp_channel *channel;  // Completion channel of cq (NULL = busy polling only)
+	struct wait_policy_t wait;   // How waits on cq back off while it is empty
+	struct ibv_qp *qp;           // Queue Pair
+	struct ibv_mr *mr;           // Memory Region
+	void *buf;                   // Data buffer
+	size_t buf_size;             // Size of buf in bytes (preset to override rdma_opts.buf_size)
+	size_t buf_mapped;           // Bytes mapped for buf by hugepage_map (0 = pool slab)
+	size_t seg_size;             // Largest payload posted as one WR
+	size_t max_msg_sz;           // Port limit on a single message
+	union ibv_gid gid;          // GID for RoCEv2
+	uint8_t port_num;            // NIC port in use (IB_PORT unless rdma_cm picked one)
+	int sock_fd;                 // Socket for control messages (rdma_cm: its event channel's fd)
+	struct rdma_cm_id *cm_id;    // rdma_cm connection (NULL = TCP handshake, see cm.h)
+	struct rdma_event_channel *cm_channel;  // Events of cm_id; readable once the peer leaves
+	uint32_t max_send_wr;        // Send queue depth granted at QP creation
+	uint32_t max_recv_wr;        // Receive queue depth granted at QP creation
+	uint32_t max_inline;         // Inline threshold: min(MAX_INLINE_DATA, device grant)
+	uint32_t max_send_sge;       // Gather entries per send WR granted at QP creation
+	uint32_t max_recv_sge;       // Scatter entries per receive WR granted at QP creation
+	struct pipeline_t pipe;      // Multi-outstanding send pipeline
+	struct recv_ring_t ring;     // Pre-posted receive slots
+	struct completion_handler_t handlers[WR_TAG_MAX];  // Per-tag completion dispatch
+	struct ibv_wc pending_wc[CQ_SIZE];  // Untagged completions awaiting wait_completion (as deep as the CQ)
+	uint32_t pending_head;       // Next pending completion to hand out
+	uint32_t pending_count;      // Number of queued pending completions
+	struct conn_stats_t stats;   // Hot-path counters and latency histograms (stats.h)
+	struct cq_stats_t cq_stats;  // Poll counters of cq when the connection owns it
+	struct qp_info_t extra_regions[HANDSHAKE_MAX_REGIONS - 1];  // Ranges advertised after buf (addr, length, rkey)
+	uint32_t num_extra_regions;  // Entries in extra_regions
+	struct reg_cache *reg_cache; // Registrations made by register_buffer (created on first use)
+	struct peer_info_t peer;     // Handshake result (valid once connected)
 };
 
 /* Function Declarations */
@@ -145,6 +503,31 @@ void die_with_cleanup(const char *message, struct config_t *config);
  */
 void cleanup_resources(struct config_t *config);
 
+/**
+ * Shared Device Functions
+ * open_device: Opens the first RDMA device, allocates a Protection Domain and looks up its NUMA node
+ * device_init: Same for a context opened elsewhere (e.g. the one rdma_cm resolved to)
+ * device_share_cq: Creates a CQ sized for max_conns connections plus srq_depth SRQ receives,
+ *                  and the table routing its completions
+ * device_unshare_cq: Releases that CQ and table again (close_device does this too)
+ * device_attach: Enters a connection in that table; init_resources() does this unless the
+ *                device it is given has no table (RDMA_ERR_RESOURCE when the table is full)
+ * device_poll_completions: Drains up to max completions from the shared CQ and dispatches each
+ *                          to its connection; returns the number reaped, or -1 on poll failure
+ * close_device: Releases the shared CQ, PD and context (SRQ and pool must be destroyed first)
+ * device_odp_caps: ODP_CAP_* the device offers for RC (0 when it has no ODP support)
+ * mode_access_flags: MR access flags a mode needs on its data buffer
+ */
+rdma_status_t open_device(struct rdma_device_t *dev);
+rdma_status_t device_init(struct rdma_device_t *dev, struct ibv_context *context);
+rdma_status_t device_share_cq(struct rdma_device_t *dev, uint32_t max_conns, uint32_t srq_depth);
+void device_unshare_cq(struct rdma_device_t *dev);
+rdma_status_t device_attach(struct rdma_device_t *dev, struct config_t *config);
+int device_poll_completions(struct rdma_device_t *dev, struct ibv_wc *wc, int max);
+void close_device(struct rdma_device_t *dev);
+int device_odp_caps(struct ibv_context *context);
+int mode_access_flags(rdma_mode_t mode);
+
 /**
  * @brief Initializes RDMA resources
  * @param config Configuration structure to initialize
@@ -158,28 +541,47 @@ rdma_status_t init_resources(struct config_t *config, rdma_mode_t mode);
  * Queue Pair State Management Functions
  * Handle the state transitions of Queue Pairs:
  * modify_qp_to_init: Transitions QP to INIT state
- * modify_qp_to_rtr: Transitions QP to Ready to Receive state
- * modify_qp_to_rts: Transitions QP to Ready to Send state
- * Each state requires specific attributes and capabilities to be set
+ * modify_qp_to_rtr: Transitions QP to Ready to Receive state with the peer's address, PSN
+ *                   and the agreed MTU and responder depth
+ * modify_qp_to_rts: Transitions QP to Ready to Send state with our PSN and the agreed
+ *                   initiator depth
+ * Each state requires specific attributes and capabilities to be set; a rejected
+ * transition returns RDMA_ERR_DEVICE
  */
-void modify_qp_to_init(struct ibv_qp *qp, int access_flags);
-void modify_qp_to_rtr(struct ibv_qp *qp, uint32_t remote_qpn, union ibv_gid remote_gid);
-void modify_qp_to_rts(struct ibv_qp *qp);
+rdma_status_t modify_qp_to_init(struct ibv_qp *qp, int access_flags);
+rdma_status_t modify_qp_to_rtr(struct ibv_qp *qp, const struct peer_info_t *peer);
+rdma_status_t modify_qp_to_rts(struct ibv_qp *qp, const struct peer_info_t *peer);
 
 /* Connection Management Functions */
 /**
  * Connection Management Functions
+ * create_listener: Binds TCP_PORT and listens with the given backlog, returns the socket
  * setup_socket: Establishes TCP connection for control messages
- * exchange_qp_info: Exchanges QP information between peers
- * connect_qps: Performs full QP connection setup
+ * sock_read_full / sock_write_full: Move exactly len bytes over a socket despite short
+ *                                   reads and writes; 0 on success, -1 on error or EOF
+ * connect_add_region: Advertises [addr, addr + length) of a registered region to the peer in
+ *                     the handshake (call before connect_qps; regions follow config->buf in
+ *                     order). Whole-address-space (implicit ODP) MRs are refused
+ * exchange_handshake: Trades versioned, framed handshake messages and fills config->peer
+ *                     with the peer's parameters and the agreed ones
+ * handshake_features: HANDSHAKE_FEAT_* this side of a connection offers
+ * connect_qps: Performs full QP connection setup (over config->sock_fd if already connected);
+ *              on failure config still holds its resources for cleanup_resources()
+ * bring_up_qp: The QP state transitions of connect_qps, for a handshake already exchanged
  * @param config: RDMA configuration structure
  * @param server_name: Target server hostname (NULL for server side)
- * @param remote_info: Structure to store remote QP information
+ * @param remote_info: Structure to store the peer's data buffer (config->peer.regions[0])
  */
+int create_listener(int backlog);
 void setup_socket(struct config_t *config, const char *server_name);
-void exchange_qp_info(
-	struct config_t *config, const char *server_name, struct qp_info_t *local_info, struct qp_info_t *remote_info);
-void connect_qps(struct config_t *config, const char *server_name, struct qp_info_t *remote_info, rdma_mode_t mode);
+int sock_read_full(int fd, void *buf, size_t len);
+int sock_write_full(int fd, const void *buf, size_t len);
+rdma_status_t connect_add_region(struct config_t *config, struct ibv_mr *mr, const void *addr, size_t length);
+rdma_status_t exchange_handshake(struct config_t *config, const char *server_name);
+uint32_t handshake_features(const struct config_t *config);
+rdma_status_t connect_qps(struct config_t *config, const char *server_name, struct qp_info_t *remote_info,
+                          rdma_mode_t mode);
+rdma_status_t bring_up_qp(struct config_t *config, rdma_mode_t mode);
 
 /* RDMA Operation Functions */
 /**
@@ -196,6 +598,83 @@ void connect_qps(struct config_t *config, const char *server_name, struct qp_inf
 void wait_completion(struct config_t *config);
 void post_receive(struct config_t *config);
 
+/**
+ * @brief Receives a possibly segmented message into config->buf
+ *
+ * @param config RDMA configuration structure
+ * @return Total message length in bytes, or -1 if a receive failed or the
+ *         message overflows config->buf; only this connection is affected,
+ *         and a server should drop it
+ *
+ * Segments are taken from the receive ring's pre-posted slots and copied
+ * into config->buf at increasing offsets until the final segment arrives,
+ * which carries the total length as immediate data. Both sides segment at
+ * the seg_size agreed in the handshake, so the end of a message never
+ * depends on its length. A peer without HANDSHAKE_FEAT_END_IMM ends a
+ * message on a segment shorter than seg_size. A connection without a ring
+ * gets one of RECV_RING_DEFAULT_DEPTH seg_size slots on the first call, so
+ * every segment after the first finds a receive posted; set the ring up
+ * before the peer sends to cover the first one as well.
+ */
+ssize_t receive_message(struct config_t *config);
+
+/**
+ * Receive Ring Functions
+ * recv_ring_init: Allocates depth slots (bounded by max_recv_wr) and posts them all
+ * recv_ring_next: Blocks until a receive completes and returns its descriptor; -1 once a
+ *                 receive has failed (ring.failed) and nothing is left to hand out
+ * recv_ring_data: Address of a slot's payload
+ * recv_ring_release: Returns a consumed slot; reposts are batched via chained WRs
+ * recv_ring_attach_srq: Uses an SRQ's slots instead of per-QP ones (QP created on the SRQ)
+ * recv_ring_flush: Reposts every released slot immediately
+ * recv_ring_destroy: Releases the slots (the QP must be destroyed or drained first)
+ */
+rdma_status_t recv_ring_init(struct config_t *config, uint32_t depth, size_t slot_size, uint32_t repost_batch);
+rdma_status_t recv_ring_attach_srq(struct config_t *config, struct srq_t *srq);
+int recv_ring_next(struct config_t *config, struct recv_msg_t *msg);
+void *recv_ring_data(struct config_t *config, uint32_t slot);
+void recv_ring_release(struct config_t *config, uint32_t slot);
+void recv_ring_flush(struct config_t *config);
+void recv_ring_destroy(struct config_t *config);
+
+/**
+ * Completion Reaping Functions
+ * register_completion_handler: Routes completions carrying a wr_id tag to a callback
+ * poll_completions: Drains up to max completions into wc in one ibv_poll_cq call and
+ *                   dispatches them; returns the number reaped, or -1 on poll failure
+ * poll_next_completion: Busy-polls for the next untagged completion without checking
+ *                       its status (wait_completion() is the status-checking variant)
+ */
+void register_completion_handler(struct config_t *config, wr_tag_t tag, completion_cb_t cb, void *ctx);
+int poll_completions(struct config_t *config, struct ibv_wc *wc, int max);
+void poll_next_completion(struct config_t *config, struct ibv_wc *wc);
+
+/**
+ * Completion Event Functions (event mode, i.e. config->channel != NULL)
+ * completion_fd: Non-blocking fd of the completion channel, for epoll/poll; -1 without one
+ * arm_completions: Requests an event for the next completion (ibv_req_notify_cq)
+ * consume_completion_events: Reads and acknowledges every pending channel event without
+ *                            blocking, returns how many there were. The CQ must be
+ *                            re-armed before waiting on the fd again
+ * wait_completion_event: Arms the CQ and sleeps until it reports a completion; returns
+ *                        early if one arrived while arming. Callers re-poll afterwards
+ */
+int completion_fd(struct config_t *config);
+int arm_completions(struct config_t *config);
+int consume_completion_events(struct config_t *config);
+void wait_completion_event(struct config_t *config);
+
+/**
+ * Completion Wait Policy Functions
+ * set_wait_policy: Changes how waits on this connection's CQ back off (per connection,
+ *                  e.g. spin-only for latency-sensitive clients, early block for batch work)
+ * wait_backoff: Called after each empty poll; spins, pauses or yields according to
+ *               the policy and returns 1 once the caller should block on its channel
+ *               (never when can_block is 0). Reset the state after blocking
+ */
+void set_wait_policy(struct config_t *config, const struct wait_policy_t *policy);
+int wait_backoff(const struct wait_policy_t *policy, struct wait_state_t *state, int can_block);
+
 /**
  * @brief Posts an RDMA operation
  *
@@ -207,10 +686,98 @@ void post_receive(struct config_t *config);
  *
  * Posts a Work Request (WR) for the specified RDMA operation.
  * Handles both two-sided (send/recv) and one-sided (read/write) operations.
+ * Payloads up to config->max_inline bytes are posted inline straight from data,
+ * without the copy into config->buf. Payloads longer than config->seg_size are
+ * split into several WRs; only the last is signaled, so a single wait_completion()
+ * still covers the whole message. The final segment of a send or a write
+ * carries the total length as immediate data.
  */
 void post_operation(struct config_t *config, rdma_op_t op, const char *data,
                    const struct qp_info_t *remote_info, size_t length);
 
+/**
+ * Zero-Copy Functions
+ * register_buffer: Registers caller-owned memory with the connection's PD, returning
+ *                  the MR handle used to post from it (NULL on failure). ODP
+ *                  registrations come first (implicit ODP: the cache's single MR);
+ *                  without ODP, or when it fails, the connection's registration
+ *                  cache (reg_cache.h) provides a pinned one. Either way the MR may
+ *                  be shared and may start below addr: post at buffer_offset(mr, addr)
+ * deregister_buffer: Releases an MR returned by register_buffer (back to the cache,
+ *                    which keeps it for the next registration of the same memory)
+ * buffer_offset: Offset of addr inside mr, for post_operation_mr / pipeline_post_mr
+ * post_operation_mr: Posts a signaled send/write/read directly from [offset, offset + length)
+ *                    of a registered buffer, with no staging copy. Completes through
+ *                    wait_completion() like post_operation()
+ */
+struct ibv_mr *register_buffer(struct config_t *config, void *addr, size_t length, int access);
+void deregister_buffer(struct config_t *config, struct ibv_mr *mr);
+void post_operation_mr(struct config_t *config, rdma_op_t op, struct ibv_mr *mr, size_t offset, size_t length,
+                       const struct qp_info_t *remote_info, uint64_t remote_offset);
+
+static inline size_t buffer_offset(const struct ibv_mr *mr, const void *addr)
+{
+    return (size_t)((uintptr_t)addr - (uintptr_t)mr->addr);
+}
+
+/**
+ * Scatter/Gather Segment
+ * One piece of a vectored operation, iovec-style. mr must cover [addr, addr + length);
+ * it may be NULL only for segments of a send/write that is posted inline.
+ */
+struct sge_t {
+	void *addr;                  // Start of the segment
+	size_t length;               // Segment length in bytes
+	struct ibv_mr *mr;           // Registration covering the segment
+};
+
+/**
+ * Vectored Functions
+ * post_operation_sgl: Posts one signaled send/write/read gathering from (or, for read,
+ *                     scattering into) up to max_send_sge segments, e.g. a header and a
+ *                     payload in separate buffers, with no staging copy. The total must fit
+ *                     in one WR (seg_size). Completes through wait_completion()
+ * post_receive_sgl: Posts one receive scattering the incoming message over up to
+ *                   max_recv_sge segments; completes through wait_completion()
+ * Both return 0 on success and -1 if the segments are invalid (nothing is posted).
+ * The segments must stay untouched until the WR completes.
+ */
+int post_operation_sgl(struct config_t *config, rdma_op_t op, const struct sge_t *sgl, int num_sge,
+                       const struct qp_info_t *remote_info, uint64_t remote_offset);
+int post_receive_sgl(struct config_t *config, const struct sge_t *sgl, int num_sge);
+
+/**
+ * Send Pipeline Functions
+ * pipeline_init: Allocates and registers the staging slots, window bounded by max_send_wr,
+ *                and sets how often WRs are signaled; fails if the pipeline is already set up
+ * pipeline_post: Copies data into the next free slot and posts it without waiting;
+ *                reaps completions first if the window is full. Returns the WR's wr_id.
+ *                Pass PIPELINE_FLAG_SIGNAL on the last WR of a burst so it can be drained
+ * pipeline_reap: Reaps all available completions in bulk, returns the number retired
+ * pipeline_drain: Blocks until every posted WR has completed; returns -1 if the tail of
+ *                 the window is unsignaled and can never complete
+ * pipeline_post_mr: Zero-copy variant of pipeline_post posting from a registered buffer;
+ *                   the buffer range must stay untouched until the WR is retired
+ * pipeline_slot: Returns the staging buffer used by a wr_id (read results land here)
+ * pipeline_set_batch: Enables doorbell batching: WRs are queued and posted as one chain
+ *                     once max_wrs are queued, the oldest is max_usec old (checked on post
+ *                     and in poll_completions), a WR carries PIPELINE_FLAG_SIGNAL, the
+ *                     window needs reaping, or wait_completion_event is about to sleep
+ * pipeline_flush: Posts every queued WR with a single ibv_post_send
+ * pipeline_destroy: Releases the staging slots
+ */
+rdma_status_t pipeline_init(struct config_t *config, uint32_t depth, size_t slot_size, uint32_t signal_interval);
+uint64_t pipeline_post(struct config_t *config, rdma_op_t op, const char *data,
+                       const struct qp_info_t *remote_info, uint64_t remote_offset, size_t length, int flags);
+uint64_t pipeline_post_mr(struct config_t *config, rdma_op_t op, struct ibv_mr *mr, size_t offset, size_t length,
+                          const struct qp_info_t *remote_info, uint64_t remote_offset, int flags);
+int pipeline_reap(struct config_t *config);
+int pipeline_drain(struct config_t *config);
+void *pipeline_slot(struct config_t *config, uint64_t wr_id);
+rdma_status_t pipeline_set_batch(struct config_t *config, uint32_t max_wrs, uint32_t max_usec);
+void pipeline_flush(struct config_t *config);
+void pipeline_destroy(struct config_t *config);
+
 // Run functions for client/server
 int run_client(const char *server_name, rdma_mode_t mode);
 int run_server(rdma_mode_t mode);
@@ -220,7 +787,8 @@ extern struct config_t *global_config;
 void signal_handler(int signo);
 void handle_disconnect(struct config_t *config);  // Add this declaration
 
-// Add helper function declaration
+// Connects over the TCP handshake, or over rdma_cm with -R (see cm.h); on failure
+// everything set up for config, the socket included, has been released
 rdma_status_t setup_rdma_connection(struct config_t *config, const char *server_name, 
                                   rdma_mode_t mode, struct qp_info_t *remote_info);
 
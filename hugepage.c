@@ -0,0 +1,93 @@
+/**
+ * @file hugepage.c
+ * @brief Hugepage-backed region implementation
+ *
+ * Implements region mapping with graceful fallback:
+ * - MAP_HUGETLB with an explicit page size (1 GB, then 2 MB)
+ * - Regular pages with transparent hugepage advice
+ * - NUMA placement applied before any page is touched
+ */
+
+#include "hugepage.h"
+#include "numa.h"
+
+/**
+ * @brief Tries one hugetlb mapping
+ * @param region Receives the mapping on success
+ * @param size Requested size in bytes
+ * @param prot mmap protection
+ * @param page_size Hugepage size (power of two)
+ * @return 0 on success, -1 if the hugetlb pool cannot back it
+ */
+static int map_hugetlb(struct hugepage_region_t *region, size_t size, int prot, size_t page_size)
+{
+    size_t huge_size = (size + page_size - 1) & ~(page_size - 1);
+    int page_shift = __builtin_ctzl(page_size);
+
+    void *addr = mmap(NULL, huge_size, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (page_shift << MAP_HUGE_SHIFT),
+                      -1, 0);
+    if (addr == MAP_FAILED) {
+        DEBUG_LOG("%zu KB hugepage mapping of %zu bytes failed: %s", page_size >> 10, huge_size, strerror(errno));
+        return -1;
+    }
+    region->addr = addr;
+    region->size = huge_size;
+    region->page_size = page_size;
+    return 0;
+}
+
+/**
+ * @brief Maps a region, with hugepages when possible
+ * @param region Receives the mapping
+ * @param size Requested size in bytes
+ * @param prot mmap protection
+ * @param hugepage_size Largest page size to try (0 = regular pages)
+ * @param numa_node NUMA node to place the pages on (-1 = no preference)
+ * @return 0 on success, -1 on failure
+ */
+int hugepage_map(struct hugepage_region_t *region, size_t size, int prot, size_t hugepage_size, int numa_node)
+{
+    memset(region, 0, sizeof(*region));
+    if (size == 0) {
+        return -1;
+    }
+
+    // Largest size first; a size the region does not fill would only waste the pool
+    for (size_t page_size = hugepage_size; page_size >= HUGEPAGE_SIZE_2M; page_size /= 512) {
+        if (size >= page_size && map_hugetlb(region, size, prot, page_size) == 0)
+            break;
+    }
+
+    if (!region->addr) {
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t mapped = (size + page_size - 1) & ~(page_size - 1);
+        void *addr = mmap(NULL, mapped, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (addr == MAP_FAILED) {
+            ERROR_LOG("Failed to map %zu byte region: %s", mapped, strerror(errno));
+            return -1;
+        }
+        // Without a hugetlb reservation, transparent hugepages are the next best thing
+        if (hugepage_size && size >= HUGEPAGE_SIZE_2M)
+            madvise(addr, mapped, MADV_HUGEPAGE);
+        region->addr = addr;
+        region->size = mapped;
+        region->page_size = page_size;
+    }
+
+    // Nothing has been touched yet, so every page faults in on the chosen node
+    numa_bind(region->addr, region->size, numa_node);
+    DEBUG_LOG("Mapped %zu bytes with %zu KB pages", region->size, region->page_size >> 10);
+    return 0;
+}
+
+/**
+ * @brief Unmaps a region mapped by hugepage_map
+ * @param region Region to unmap
+ */
+void hugepage_unmap(struct hugepage_region_t *region)
+{
+    if (!region->addr) return;
+
+    munmap(region->addr, region->size);
+    memset(region, 0, sizeof(*region));
+}
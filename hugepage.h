@@ -0,0 +1,59 @@
+/**
+ * @file hugepage.h
+ * @brief Hugepage-backed region interface
+ *
+ * Maps the large regions that get registered (data buffers, the buffer pool,
+ * the lambda code region) with 2 MB or 1 GB hugepages when the hugetlb pool
+ * has them. A registered region needs one NIC translation entry per page, so
+ * hugepages shrink both the MTT footprint and registration time. When no
+ * hugepages are available the mapping falls back to smaller pages.
+ */
+
+#ifndef HUGEPAGE_H
+#define HUGEPAGE_H
+
+#include "common.h"
+#include <sys/mman.h>
+
+/**
+ * Hugepage Sizes
+ * HUGEPAGE_SIZE_2M: Default x86-64 / arm64 hugepage
+ * HUGEPAGE_SIZE_1G: Gigantic page, reserved at boot (hugepagesz=1G hugepages=N)
+ */
+#define HUGEPAGE_SIZE_2M (2UL * 1024 * 1024)
+#define HUGEPAGE_SIZE_1G (1024UL * 1024 * 1024)
+
+/**
+ * @brief Private anonymous mapping and the page size backing it
+ */
+struct hugepage_region_t {
+    void *addr;                  // Start of the mapping
+    size_t size;                 // Mapped bytes (the request rounded up to page_size)
+    size_t page_size;            // Backing page size (the system page size after a fallback)
+};
+
+/**
+ * @brief Maps a region, with hugepages when possible
+ *
+ * @param region Receives the mapping
+ * @param size Requested size in bytes
+ * @param prot mmap protection (PROT_READ | PROT_WRITE, plus PROT_EXEC for code)
+ * @param hugepage_size Largest page size to try (HUGEPAGE_SIZE_1G, HUGEPAGE_SIZE_2M, 0 = regular pages)
+ * @param numa_node NUMA node to place the pages on (-1 = no preference)
+ * @return 0 on success, -1 on failure
+ *
+ * Each hugepage size from hugepage_size down to 2 MB is tried only if size
+ * fills at least one page of it, so small regions are not rounded up to a
+ * hugepage. If every hugetlb mapping fails, regular pages are used and
+ * transparent hugepages are requested with madvise(MADV_HUGEPAGE).
+ */
+int hugepage_map(struct hugepage_region_t *region, size_t size, int prot, size_t hugepage_size, int numa_node);
+
+/**
+ * @brief Unmaps a region mapped by hugepage_map
+ *
+ * @param region Region to unmap (no-op if it was never mapped)
+ */
+void hugepage_unmap(struct hugepage_region_t *region);
+
+#endif // HUGEPAGE_H
@@ -10,6 +10,7 @@
  */
 
 #include "lambda.h"
+#include "hugepage.h"
 #include <dlfcn.h>
 #include <elf.h>
 #include <fcntl.h>
@@ -38,7 +39,12 @@ struct lambda_memory_regions client_regions;
  */
 static void setup_lambda_regions(struct config_t *config)
 {
-	client_regions.code_region = malloc(LAMBDA_MAX_CODE_SIZE);
+	struct hugepage_region_t code;
+	if (hugepage_map(&code, LAMBDA_MAX_CODE_SIZE, PROT_READ | PROT_WRITE, rdma_opts.hugepage_size, config->numa_node)) {
+		ERROR_LOG("Failed to map code region");
+		exit(1);
+	}
+	client_regions.code_region = code.addr;
 	client_regions.input_region = config->buf;
 	client_regions.output_region = config->buf + LAMBDA_MAX_INPUT_SIZE;
 
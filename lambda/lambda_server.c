@@ -10,7 +10,7 @@
  */
 
 #include "lambda.h"
-#include <sys/mman.h>
+#include "hugepage.h"
 
 static struct lambda_memory_regions server_regions;
 
@@ -35,15 +35,15 @@ static void setup_lambda_regions(struct config_t *config)
 		exit(1);
 	}
 
-	// Allocate executable memory for code
-	server_regions.code_region
-		= mmap(NULL, LAMBDA_MAX_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-
-	if (server_regions.code_region == MAP_FAILED) {
-		ERROR_LOG("Failed to mmap code region: %s", strerror(errno));
+	// Allocate executable memory for code (hugepage-backed when available)
+	struct hugepage_region_t code;
+	if (hugepage_map(&code, LAMBDA_MAX_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, rdma_opts.hugepage_size,
+			config->numa_node)) {
+		ERROR_LOG("Failed to map code region");
 		exit(1);
 	}
-	DEBUG_LOG("Code region mapped at %p", server_regions.code_region);
+	server_regions.code_region = code.addr;
+	DEBUG_LOG("Code region mapped at %p (%zu KB pages)", server_regions.code_region, code.page_size >> 10);
 
 	// Register with RDMA
 	server_regions.code_mr = ibv_reg_mr(
@@ -109,16 +109,14 @@ static void lambda_server_loop(struct config_t *config)
     struct lambda_metadata meta_storage;
     struct qp_info_t client_info;
 
+    // Per-request progress goes to the trace rings; DEBUG_LOG would stall every request
     while (1) {
-        DEBUG_LOG("Waiting for function code...");
-
         // First receive metadata
         if (post_lambda_receive(config) != 0) {
             ERROR_LOG("Failed to post receive for metadata");
             break;
         }
 
-        DEBUG_LOG("Waiting for metadata");
         wait_completion(config);
 
         // Copy metadata and client QP info
@@ -132,8 +130,7 @@ static void lambda_server_loop(struct config_t *config)
             break;
         }
 
-        DEBUG_LOG("Received metadata for function '%s', code_size: %zu, entry_offset: %lu",
-            meta->function_name[0] ? meta->function_name : "<unnamed>", meta->code_size, meta->entry_offset);
+        trace_on_lambda(config->qp->qp_num, TRACE_LAMBDA_META, meta->code_size, 0);
 
         // Wait for function code
         if (post_lambda_receive(config) != 0) {
@@ -141,12 +138,11 @@ static void lambda_server_loop(struct config_t *config)
             break;
         }
 
-        DEBUG_LOG("Waiting for function code");
         wait_completion(config);
 
         // Copy received code to executable region using stored metadata
         memcpy(server_regions.code_region, config->buf, meta->code_size);
-        DEBUG_LOG("Copied %zu bytes of code to executable region", meta->code_size);
+        trace_on_lambda(config->qp->qp_num, TRACE_LAMBDA_CODE, meta->code_size, 0);
 
         // Post receive for input data
         if (post_lambda_receive(config) != 0) {
@@ -154,8 +150,8 @@ static void lambda_server_loop(struct config_t *config)
             break;
         }
 
-        DEBUG_LOG("Waiting for input data");
         wait_completion(config);
+        trace_on_lambda(config->qp->qp_num, TRACE_LAMBDA_INPUT, meta->input_size, 0);
 
         // Validate entry offset using stored metadata
         if (meta->entry_offset >= meta->code_size) {
@@ -165,14 +161,10 @@ static void lambda_server_loop(struct config_t *config)
 
         // Execute function using stored metadata
         lambda_fn func = (lambda_fn)(server_regions.code_region + meta->entry_offset);
-        DEBUG_LOG("Function address: %p", func);
-
         size_t output_size;
-        DEBUG_LOG("Executing function...");
-
         int result = func(server_regions.input_region, meta->input_size, server_regions.output_region, &output_size);
 
-        DEBUG_LOG("Function execution complete. Result: %d, output_size: %zu", result, output_size);
+        trace_on_lambda(config->qp->qp_num, TRACE_LAMBDA_EXEC, output_size, result);
 
          // Instead of sending, we'll write the result directly to client's memory
         char result_buf[MAX_BUFFER_SIZE];
@@ -187,9 +179,9 @@ static void lambda_server_loop(struct config_t *config)
             memcpy(result_buf + data_offset, server_regions.output_region, bytes_to_copy);
         }
 
-        DEBUG_LOG("Writing result back to client memory at address %lu", client_info.addr);
         post_lambda_write(config, result_buf, &client_info);
         wait_completion(config);
+        trace_on_lambda(config->qp->qp_num, TRACE_LAMBDA_RESULT, MAX_BUFFER_SIZE, 0);
     }
 }
 
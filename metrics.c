@@ -0,0 +1,601 @@
+/**
+ * @file metrics.c
+ * @brief Prometheus metrics exporter implementation
+ *
+ * Implements:
+ * - Rendering of the connection, CQ and registration cache statistics
+ * - Export of the sysfs port counters of every device port in use
+ * - A single-threaded HTTP / Unix socket endpoint serving the rendering
+ */
+
+#include "metrics.h"
+#include "common.h"
+#include "reg_cache.h"
+#include <dirent.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/un.h>
+
+/**
+ * Exporter state. Scrapes are served one at a time by the exporter thread.
+ */
+static pthread_t metrics_thread;
+static int metrics_running;
+static int metrics_stop_flag;
+static int metrics_fd = -1;
+static int metrics_http;
+static char metrics_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+/**
+ * @brief One metric family
+ */
+struct metric_family {
+    const char *name;            // Sample name (counters end in _total)
+    const char *type;            // counter, gauge, summary or untyped
+    const char *help;            // HELP text
+};
+
+/**
+ * Connection families, rendered in this order
+ */
+enum qp_family {
+    QP_POSTED,
+    QP_COMPLETED,
+    QP_BYTES,
+    QP_EMPTY_POLLS,
+    QP_ERRORS,
+    QP_OUTSTANDING,
+    QP_OUTSTANDING_MAX,
+    QP_MR_BYTES,
+    QP_LATENCY,
+    QP_FAMILY_MAX
+};
+
+static const struct metric_family qp_families[QP_FAMILY_MAX] = {
+    [QP_POSTED] = { "rdma_qp_posted_total", "counter", "Work requests posted" },
+    [QP_COMPLETED] = { "rdma_qp_completed_total", "counter", "Work requests retired by a completion" },
+    [QP_BYTES] = { "rdma_qp_bytes_total", "counter", "Bytes posted (sends) or received (recv)" },
+    [QP_EMPTY_POLLS] = { "rdma_qp_cq_empty_polls_total", "counter", "Polls of the connection's CQ that found nothing" },
+    [QP_ERRORS] = { "rdma_qp_completion_errors_total", "counter", "Failed completions by failure class" },
+    [QP_OUTSTANDING] = { "rdma_qp_outstanding_wrs", "gauge", "Send work requests posted and not yet retired" },
+    [QP_OUTSTANDING_MAX] = { "rdma_qp_outstanding_wrs_max", "gauge", "High-water mark of outstanding send work requests" },
+    [QP_MR_BYTES] = { "rdma_qp_mr_bytes", "gauge", "Bytes covered by the connection's data buffer registration" },
+    [QP_LATENCY] = { "rdma_qp_latency_seconds", "summary", "Time from posting a signaled work request to reaping its completion" },
+};
+
+/**
+ * CQ families, rendered in this order
+ */
+enum cq_family { CQ_POLLS, CQ_EMPTY_POLLS, CQ_COMPLETIONS, CQ_FAMILY_MAX };
+
+static const struct metric_family cq_families[CQ_FAMILY_MAX] = {
+    [CQ_POLLS] = { "rdma_cq_polls_total", "counter", "ibv_poll_cq calls" },
+    [CQ_EMPTY_POLLS] = { "rdma_cq_empty_polls_total", "counter", "ibv_poll_cq calls that found nothing" },
+    [CQ_COMPLETIONS] = { "rdma_cq_completions_total", "counter", "Completions reaped" },
+};
+
+/**
+ * Registration cache families, rendered in this order
+ */
+enum cache_family { CACHE_PINNED, CACHE_BUDGET, CACHE_HITS, CACHE_MISSES, CACHE_EVICTIONS, CACHE_FAMILY_MAX };
+
+static const struct metric_family cache_families[CACHE_FAMILY_MAX] = {
+    [CACHE_PINNED] = { "rdma_reg_cache_pinned_bytes", "gauge", "Bytes registered by the cache" },
+    [CACHE_BUDGET] = { "rdma_reg_cache_budget_bytes", "gauge", "Pinned-byte ceiling of the cache (0 = unlimited)" },
+    [CACHE_HITS] = { "rdma_reg_cache_hits_total", "counter", "Lookups served by an existing registration" },
+    [CACHE_MISSES] = { "rdma_reg_cache_misses_total", "counter", "Lookups that registered memory" },
+    [CACHE_EVICTIONS] = { "rdma_reg_cache_evictions_total", "counter", "Registrations dropped for the budget or merged" },
+};
+
+/**
+ * Port counter families, one per directory under /sys/class/infiniband/<device>/ports/<port>/
+ */
+struct port_family {
+    const char *dir;             // Directory holding one file per counter
+    struct metric_family family; // Family its counters are exported as
+};
+
+static const struct port_family port_families[] = {
+    { "counters", { "rdma_port_counter", "untyped", "IB port counter from sysfs, raw (port_*_data counts 4-byte words)" } },
+    { "hw_counters", { "rdma_port_hw_counter", "untyped", "Driver-specific port counter from sysfs, raw" } },
+};
+
+static const double latency_quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+/**
+ * @brief A device port in use, for the port counter export
+ */
+struct port_seen {
+    char device[STATS_DEVICE_NAME_MAX];  // Device name
+    uint8_t port_num;            // Port number
+};
+
+/**
+ * @brief Walk state shared by the registry callbacks
+ */
+struct render_ctx {
+    FILE *out;                   // Output stream
+    int family;                  // Family being rendered
+    struct conn_stats_t *snap;   // Scratch snapshot for latency summaries
+    struct port_seen ports[METRICS_MAX_PORTS];  // Distinct device ports seen
+    int num_ports;               // Entries in ports
+};
+
+/**
+ * @brief Registration cache counters copied out under the cache list lock
+ */
+struct cache_sample {
+    char device[STATS_DEVICE_NAME_MAX];  // Device of the cache's PD
+    uint32_t pd;                 // Kernel handle of the PD
+    uint64_t values[CACHE_FAMILY_MAX];  // One value per cache family
+};
+
+/*******************************************************************************
+ * Rendering
+ ******************************************************************************/
+
+/**
+ * @brief Writes the HELP and TYPE lines of a family
+ * @param out Output stream
+ * @param family Family about to be rendered
+ */
+static void render_header(FILE *out, const struct metric_family *family)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", family->name, family->help, family->name, family->type);
+}
+
+/**
+ * @brief Remembers a device port for the port counter export
+ * @param ctx Render state
+ * @param device Device name
+ * @param port_num Port number (0 = none, e.g. a shared CQ)
+ */
+static void note_port(struct render_ctx *ctx, const char *device, uint8_t port_num)
+{
+    if (!device[0] || !port_num) return;
+
+    for (int i = 0; i < ctx->num_ports; i++) {
+        if (ctx->ports[i].port_num == port_num && strcmp(ctx->ports[i].device, device) == 0) return;
+    }
+    if (ctx->num_ports < METRICS_MAX_PORTS) {
+        struct port_seen *seen = &ctx->ports[ctx->num_ports++];
+        snprintf(seen->device, sizeof(seen->device), "%s", device);
+        seen->port_num = port_num;
+    }
+}
+
+/**
+ * @brief stats_for_each callback rendering one connection's samples of ctx->family
+ * @param stats Connection statistics
+ * @param arg Render state
+ */
+static void render_qp(const struct conn_stats_t *stats, void *arg)
+{
+    struct render_ctx *ctx = arg;
+    FILE *out = ctx->out;
+    const char *name = qp_families[ctx->family].name;
+    const uint64_t *per_op = NULL;
+
+    note_port(ctx, stats->device, stats->port_num);
+
+    switch (ctx->family) {
+    case QP_POSTED: per_op = stats->posted; break;
+    case QP_COMPLETED: per_op = stats->completed; break;
+    case QP_BYTES: per_op = stats->bytes; break;
+    case QP_ERRORS:
+        fprintf(out, "%s{device=\"%s\",qp=\"%u\",type=\"rnr\"} %lu\n", name, stats->device, stats->qp_num,
+                stats_counter_read(&stats->rnr_errors));
+        fprintf(out, "%s{device=\"%s\",qp=\"%u\",type=\"retry\"} %lu\n", name, stats->device, stats->qp_num,
+                stats_counter_read(&stats->retry_errors));
+        fprintf(out, "%s{device=\"%s\",qp=\"%u\",type=\"other\"} %lu\n", name, stats->device, stats->qp_num,
+                stats_counter_read(&stats->other_errors));
+        return;
+    case QP_LATENCY:
+        stats_snapshot(stats, ctx->snap);
+        for (int op = 0; op < STATS_OP_RECV; op++) {
+            const struct latency_hist_t *hist = &ctx->snap->latency[op];
+            if (!hist->count) continue;
+
+            for (size_t q = 0; q < sizeof(latency_quantiles) / sizeof(latency_quantiles[0]); q++) {
+                fprintf(out, "%s{device=\"%s\",qp=\"%u\",op=\"%s\",quantile=\"%g\"} %.9f\n", name, stats->device,
+                        stats->qp_num, stats_op_name(op), latency_quantiles[q],
+                        stats_percentile(hist, latency_quantiles[q]) / 1e9);
+            }
+            fprintf(out, "%s_sum{device=\"%s\",qp=\"%u\",op=\"%s\"} %.9f\n", name, stats->device, stats->qp_num,
+                    stats_op_name(op), hist->sum_ns / 1e9);
+            fprintf(out, "%s_count{device=\"%s\",qp=\"%u\",op=\"%s\"} %lu\n", name, stats->device, stats->qp_num,
+                    stats_op_name(op), hist->count);
+        }
+        return;
+    default: break;
+    }
+
+    if (per_op) {
+        for (int op = 0; op < STATS_OP_MAX; op++) {
+            fprintf(out, "%s{device=\"%s\",qp=\"%u\",op=\"%s\"} %lu\n", name, stats->device, stats->qp_num,
+                    stats_op_name(op), stats_counter_read(&per_op[op]));
+        }
+        return;
+    }
+
+    const uint64_t *value = ctx->family == QP_EMPTY_POLLS ? &stats->cq_empty_polls
+                          : ctx->family == QP_OUTSTANDING ? &stats->outstanding
+                          : ctx->family == QP_OUTSTANDING_MAX ? &stats->max_outstanding
+                                                              : &stats->mr_bytes;
+    fprintf(out, "%s{device=\"%s\",qp=\"%u\"} %lu\n", name, stats->device, stats->qp_num, stats_counter_read(value));
+}
+
+/**
+ * @brief stats_for_each_cq callback rendering one CQ's sample of ctx->family
+ * @param stats CQ statistics
+ * @param arg Render state
+ */
+static void render_cq(const struct cq_stats_t *stats, void *arg)
+{
+    struct render_ctx *ctx = arg;
+    const uint64_t *value = ctx->family == CQ_POLLS ? &stats->polls
+                          : ctx->family == CQ_EMPTY_POLLS ? &stats->empty_polls
+                                                          : &stats->completions;
+
+    note_port(ctx, stats->device, stats->port_num);
+    fprintf(ctx->out, "%s{device=\"%s\",cq=\"%u\"} %lu\n", cq_families[ctx->family].name, stats->device,
+            stats->cq_handle, stats_counter_read(value));
+}
+
+/**
+ * @brief Registration cache walk state
+ */
+struct cache_walk {
+    struct cache_sample samples[METRICS_MAX_CACHES];  // Copied counters
+    int count;                   // Entries in samples
+};
+
+/**
+ * @brief reg_cache_for_each callback copying one cache's counters
+ * @param cache Registration cache
+ * @param arg Cache walk state
+ *
+ * Only copies: printing could free memory, and munmap() re-enters the cache list.
+ */
+static void sample_cache(const struct reg_cache *cache, void *arg)
+{
+    struct cache_walk *walk = arg;
+    if (walk->count == METRICS_MAX_CACHES) return;
+
+    struct cache_sample *s = &walk->samples[walk->count++];
+    snprintf(s->device, sizeof(s->device), "%s", ibv_get_device_name(cache->pd->context->device));
+    s->pd = cache->pd->handle;
+    s->values[CACHE_PINNED] = stats_counter_read(&cache->pinned);
+    s->values[CACHE_BUDGET] = cache->budget;
+    s->values[CACHE_HITS] = stats_counter_read(&cache->hits);
+    s->values[CACHE_MISSES] = stats_counter_read(&cache->misses);
+    s->values[CACHE_EVICTIONS] = stats_counter_read(&cache->evictions);
+}
+
+/**
+ * @brief Renders one port counter directory of every device port in use
+ * @param ctx Render state (ports filled in)
+ * @param family Port counter family
+ */
+static void render_port_counters(struct render_ctx *ctx, const struct port_family *family)
+{
+    const char *name = family->family.name;
+    render_header(ctx->out, &family->family);
+
+    for (int i = 0; i < ctx->num_ports; i++) {
+        const struct port_seen *seen = &ctx->ports[i];
+        char dir_path[256];
+        snprintf(dir_path, sizeof(dir_path), "/sys/class/infiniband/%s/ports/%u/%s", seen->device, seen->port_num,
+                 family->dir);
+        DIR *dir = opendir(dir_path);
+        if (!dir) continue;  // Not every driver has hw_counters
+
+        struct dirent *entry;
+        while ((entry = readdir(dir))) {
+            if (entry->d_name[0] == '.') continue;
+
+            char path[512];
+            unsigned long value;
+            snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+            FILE *f = fopen(path, "r");
+            if (!f) continue;
+            int ok = fscanf(f, "%lu", &value) == 1;
+            fclose(f);
+            if (ok) {
+                fprintf(ctx->out, "%s{device=\"%s\",port=\"%u\",counter=\"%s\"} %lu\n", name, seen->device,
+                        seen->port_num, entry->d_name, value);
+            }
+        }
+        closedir(dir);
+    }
+}
+
+/**
+ * @brief Writes every metric in the Prometheus text format
+ * @param out Output stream
+ */
+void metrics_render(FILE *out)
+{
+    struct render_ctx ctx = { .out = out };
+    ctx.snap = malloc(sizeof(*ctx.snap));
+    if (!ctx.snap) return;
+
+    for (ctx.family = 0; ctx.family < QP_FAMILY_MAX; ctx.family++) {
+        render_header(out, &qp_families[ctx.family]);
+        stats_for_each(render_qp, &ctx);
+    }
+    for (ctx.family = 0; ctx.family < CQ_FAMILY_MAX; ctx.family++) {
+        render_header(out, &cq_families[ctx.family]);
+        stats_for_each_cq(render_cq, &ctx);
+    }
+
+    struct cache_walk *walk = calloc(1, sizeof(*walk));
+    if (walk) {
+        reg_cache_for_each(sample_cache, walk);
+        for (int f = 0; f < CACHE_FAMILY_MAX; f++) {
+            render_header(out, &cache_families[f]);
+            for (int i = 0; i < walk->count; i++) {
+                fprintf(out, "%s{device=\"%s\",pd=\"%u\"} %lu\n", cache_families[f].name, walk->samples[i].device,
+                        walk->samples[i].pd, walk->samples[i].values[f]);
+            }
+        }
+        free(walk);
+    }
+
+    for (size_t f = 0; f < sizeof(port_families) / sizeof(port_families[0]); f++)
+        render_port_counters(&ctx, &port_families[f]);
+
+    free(ctx.snap);
+}
+
+/*******************************************************************************
+ * Endpoint
+ ******************************************************************************/
+
+/**
+ * @brief Sends a whole buffer to a scraper
+ * @param fd Connected socket
+ * @param buf Data
+ * @param len Bytes to send
+ * @return 0 on success, -1 if the scraper went away or stalled
+ */
+static int send_all(int fd, const char *buf, size_t len)
+{
+    while (len) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Answers one HTTP request with the metrics
+ * @param fd Connected socket
+ * @param body Rendered metrics
+ * @param body_len Length of body
+ *
+ * The request line and headers are read and ignored apart from the method:
+ * every path serves the metrics, and the connection is closed after the reply.
+ */
+static void serve_http(int fd, const char *body, size_t body_len)
+{
+    char req[2048];
+    size_t len = 0;
+
+    while (len < sizeof(req) - 1) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, METRICS_IO_TIMEOUT_MS) <= 0) return;
+        ssize_t n = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+        if (n <= 0) return;
+        len += n;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+    }
+
+    char head[256];
+    int is_head = strncmp(req, "HEAD ", 5) == 0;
+    if (!is_head && strncmp(req, "GET ", 4) != 0) {
+        int n = snprintf(head, sizeof(head),
+                         "HTTP/1.1 405 Method Not Allowed\r\nAllow: GET, HEAD\r\nContent-Length: 0\r\n"
+                         "Connection: close\r\n\r\n");
+        send_all(fd, head, n);
+        return;
+    }
+
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                     "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                     body_len);
+    if (send_all(fd, head, n) == 0 && !is_head)
+        send_all(fd, body, body_len);
+}
+
+/**
+ * @brief Exporter thread: accepts scrapers one at a time until stopped
+ * @param arg Unused
+ * @return NULL
+ */
+static void *metrics_loop(void *arg)
+{
+    (void)arg;
+    while (!__atomic_load_n(&metrics_stop_flag, __ATOMIC_RELAXED)) {
+        struct pollfd pfd = { .fd = metrics_fd, .events = POLLIN };
+        if (poll(&pfd, 1, METRICS_POLL_MS) <= 0) continue;
+
+        int fd = accept(metrics_fd, NULL, NULL);
+        if (fd < 0) continue;
+
+        // A scraper that stops reading must not wedge the exporter
+        struct timeval timeout = { .tv_sec = METRICS_IO_TIMEOUT_MS / 1000,
+                                   .tv_usec = (METRICS_IO_TIMEOUT_MS % 1000) * 1000 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        char *body = NULL;
+        size_t body_len = 0;
+        FILE *out = open_memstream(&body, &body_len);
+        if (out) {
+            metrics_render(out);
+            fclose(out);
+            if (metrics_http)
+                serve_http(fd, body, body_len);
+            else
+                send_all(fd, body, body_len);
+        }
+        free(body);
+        close(fd);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Binds a TCP socket for the HTTP endpoint
+ * @param endpoint Port number, or host:port ([addr]:port for IPv6)
+ * @return Bound socket, or -1 on failure
+ *
+ * A bare port binds METRICS_DEFAULT_HOST, so the counters are not served to
+ * the network unless an address is given.
+ */
+static int open_tcp_endpoint(const char *endpoint)
+{
+    char host[NI_MAXHOST] = METRICS_DEFAULT_HOST;
+    const char *port = endpoint;
+
+    const char *colon = strrchr(endpoint, ':');
+    if (colon) {
+        const char *name = endpoint;
+        size_t len = colon - endpoint;
+        if (len >= 2 && name[0] == '[' && name[len - 1] == ']') {
+            name++;
+            len -= 2;
+        }
+        if (len == 0 || len >= sizeof(host)) {
+            ERROR_LOG("Invalid metrics address: %s", endpoint);
+            return -1;
+        }
+        memcpy(host, name, len);
+        host[len] = '\0';
+        port = colon + 1;
+    }
+
+    char *end;
+    unsigned long port_num = strtoul(port, &end, 10);
+    if (port[0] < '0' || port[0] > '9' || *end || port_num == 0 || port_num > 65535) {
+        ERROR_LOG("Invalid metrics endpoint: %s (port, host:port or absolute socket path)", endpoint);
+        return -1;
+    }
+
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM, .ai_flags = AI_PASSIVE };
+    struct addrinfo *res;
+    int rc = getaddrinfo(host, port, &hints, &res);
+    if (rc) {
+        ERROR_LOG("Failed to resolve metrics address %s: %s", host, gai_strerror(rc));
+        return -1;
+    }
+
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        int optval = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    if (fd < 0)
+        ERROR_LOG("Failed to bind metrics endpoint %s:%s: %s", host, port, strerror(errno));
+    freeaddrinfo(res);
+    return fd;
+}
+
+/**
+ * @brief Opens the listening socket for an endpoint
+ * @param endpoint TCP port number, host:port or absolute Unix socket path
+ * @return Listening socket, or -1 on failure
+ */
+static int open_endpoint(const char *endpoint)
+{
+    int fd;
+
+    if (endpoint[0] == '/') {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (strlen(endpoint) >= sizeof(addr.sun_path)) {
+            ERROR_LOG("Metrics socket path too long: %s", endpoint);
+            return -1;
+        }
+        strcpy(addr.sun_path, endpoint);
+        strcpy(metrics_path, endpoint);
+        unlink(endpoint);  // Left behind by an earlier run
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            ERROR_LOG("Failed to bind metrics socket %s: %s", endpoint, strerror(errno));
+            if (fd >= 0) close(fd);
+            metrics_path[0] = '\0';
+            return -1;
+        }
+        metrics_http = 0;
+    } else {
+        fd = open_tcp_endpoint(endpoint);
+        if (fd < 0) {
+            return -1;
+        }
+        metrics_http = 1;
+    }
+
+    if (listen(fd, METRICS_BACKLOG) < 0) {
+        ERROR_LOG("Failed to listen for metrics scrapers: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Starts the exporter thread
+ * @param endpoint TCP port number, host:port or absolute Unix socket path
+ * @return 0 on success, -1 on failure
+ */
+int metrics_start(const char *endpoint)
+{
+    if (metrics_running || !endpoint) {
+        return -1;
+    }
+
+    metrics_fd = open_endpoint(endpoint);
+    if (metrics_fd < 0) {
+        return -1;
+    }
+
+    metrics_stop_flag = 0;
+    if (pthread_create(&metrics_thread, NULL, metrics_loop, NULL)) {
+        close(metrics_fd);
+        metrics_fd = -1;
+        return -1;
+    }
+    metrics_running = 1;
+    return 0;
+}
+
+/**
+ * @brief Stops the exporter thread (no-op if not running)
+ */
+void metrics_stop(void)
+{
+    if (!metrics_running) return;
+
+    __atomic_store_n(&metrics_stop_flag, 1, __ATOMIC_RELAXED);
+    pthread_join(metrics_thread, NULL);
+    close(metrics_fd);
+    metrics_fd = -1;
+    if (metrics_path[0]) {
+        unlink(metrics_path);
+        metrics_path[0] = '\0';
+    }
+    metrics_running = 0;
+}
@@ -0,0 +1,62 @@
+/**
+ * @file metrics.h
+ * @brief Prometheus metrics exporter interface
+ *
+ * Serves the library's statistics in the Prometheus text exposition format:
+ * per-QP counters and latency summaries, per-CQ poll counters, registration
+ * cache usage, and the NIC port counters the kernel exposes under
+ * /sys/class/infiniband/<device>/ports/<port>/. Either over a minimal HTTP
+ * endpoint for a Prometheus scraper, or as a plain text dump written to
+ * whoever connects to a Unix socket (e.g. `socat - UNIX-CONNECT:<path>`).
+ *
+ * Rendering runs on the exporter's own thread and only reads counters with
+ * relaxed atomic loads; the connections being observed pay nothing for it.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+
+/**
+ * Exporter Configuration
+ * METRICS_BACKLOG: Pending scrape connections
+ * METRICS_POLL_MS: How often the exporter thread checks for metrics_stop()
+ * METRICS_IO_TIMEOUT_MS: Longest wait for a scraper's request or for it to take the reply
+ * METRICS_MAX_PORTS: Distinct device ports whose counters are exported
+ * METRICS_MAX_CACHES: Registration caches exported per scrape
+ * METRICS_DEFAULT_HOST: Address a bare port number binds to (loopback: counters stay local)
+ */
+#define METRICS_BACKLOG 16
+#define METRICS_POLL_MS 100
+#define METRICS_IO_TIMEOUT_MS 1000
+#define METRICS_MAX_PORTS 16
+#define METRICS_MAX_CACHES 64
+#define METRICS_DEFAULT_HOST "127.0.0.1"
+
+/**
+ * @brief Starts the exporter thread
+ *
+ * @param endpoint TCP port number to serve HTTP on METRICS_DEFAULT_HOST, or
+ *                 host:port to serve it on another address ([addr]:port for
+ *                 IPv6, 0.0.0.0:port for every interface); any path answers
+ *                 with the metrics. An absolute path creates a Unix socket instead.
+ * @return int 0 on success, -1 if already running or the endpoint cannot be opened
+ */
+int metrics_start(const char *endpoint);
+
+/**
+ * @brief Stops the exporter thread and closes its endpoint (no-op if not running)
+ */
+void metrics_stop(void);
+
+/**
+ * @brief Writes every metric in the Prometheus text format
+ *
+ * @param out Output stream
+ *
+ * Callable from any thread, with or without the exporter running.
+ */
+void metrics_render(FILE *out);
+
+#endif // METRICS_H
@@ -0,0 +1,157 @@
+/**
+ * @file numa.c
+ * @brief NUMA placement implementation
+ *
+ * Implements device-local placement:
+ * - NUMA node and local CPU list read from the device's sysfs entry
+ * - Preferred-node memory policy (with migration) for registered regions
+ * - Affinity of polling threads to the device's local CPUs
+ */
+
+#define _GNU_SOURCE  // cpu_set_t, sched_setaffinity
+#include "numa.h"
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+/*******************************************************************************
+ * Device Topology
+ ******************************************************************************/
+
+/**
+ * @brief Reads one line of a device's sysfs attribute
+ * @param context Open device context
+ * @param attr Attribute below the device's "device" link (e.g. "numa_node")
+ * @param line Receives the line, newline stripped
+ * @param size Size of line
+ * @return 0 on success, -1 if the attribute cannot be read
+ */
+static int read_device_attr(struct ibv_context *context, const char *attr, char *line, size_t size)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/%s/device/%s", NUMA_SYSFS_ROOT, ibv_get_device_name(context->device), attr);
+
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return -1;
+    }
+    char *ok = fgets(line, size, file);
+    fclose(file);
+    if (!ok) {
+        return -1;
+    }
+    line[strcspn(line, "\n")] = '\0';
+    return 0;
+}
+
+/**
+ * @brief NUMA node an RDMA device is attached to
+ * @param context Open device context
+ * @return Node number, or -1 when unknown
+ */
+int numa_device_node(struct ibv_context *context)
+{
+    char line[32];
+    if (read_device_attr(context, "numa_node", line, sizeof(line))) {
+        return -1;
+    }
+
+    // The kernel reports -1 when the platform has no NUMA information
+    int node = atoi(line);
+    return node >= 0 && node < NUMA_MAX_NODES ? node : -1;
+}
+
+/**
+ * @brief CPUs local to an RDMA device
+ * @param context Open device context
+ * @param set Receives the CPUs listed in local_cpulist (e.g. "0-7,16-23")
+ * @return Number of CPUs in set, 0 when unknown
+ */
+static int device_cpus(struct ibv_context *context, cpu_set_t *set)
+{
+    char line[1024];
+
+    CPU_ZERO(set);
+    if (read_device_attr(context, "local_cpulist", line, sizeof(line))) {
+        return 0;
+    }
+
+    for (char *p = line; *p;) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p) {
+            return 0;
+        }
+        if (*end == '-')
+            last = strtol(end + 1, &end, 10);
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, set);
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return 0;
+        p = end;
+    }
+    return CPU_COUNT(set);
+}
+
+/*******************************************************************************
+ * Placement
+ ******************************************************************************/
+
+/**
+ * @brief Prefers a NUMA node for the pages of a region
+ * @param addr Start of the region
+ * @param len Length in bytes
+ * @param node Preferred node (-1 = no change)
+ * @return 0 on success or when node is -1, -1 on failure
+ */
+int numa_bind(void *addr, size_t len, int node)
+{
+    if (node < 0 || !addr || len == 0) {
+        return 0;
+    }
+
+    // mbind works on whole pages; callers pass dedicated mappings, so rounding moves nothing else
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr & ~(page_size - 1);
+    uintptr_t end = ((uintptr_t)addr + len + page_size - 1) & ~(page_size - 1);
+
+    unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))] = {};
+    mask[node / (8 * sizeof(unsigned long))] = 1UL << (node % (8 * sizeof(unsigned long)));
+
+    if (syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, mask, NUMA_MAX_NODES + 1, MPOL_MF_MOVE)) {
+        DEBUG_LOG("Failed to bind %zu bytes to node %d: %s", len, node, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Restricts the calling thread to the CPUs local to an RDMA device
+ * @param context Open device context
+ * @return 0 on success, -1 when no local CPU is available to the thread
+ */
+int numa_pin_local(struct ibv_context *context)
+{
+    cpu_set_t local, allowed;
+
+    if (device_cpus(context, &local) == 0 || sched_getaffinity(0, sizeof(allowed), &allowed)) {
+        return -1;
+    }
+
+    CPU_AND(&local, &local, &allowed);
+    if (CPU_COUNT(&local) == 0) {
+        DEBUG_LOG("No CPU local to %s is available, leaving affinity unchanged",
+                  ibv_get_device_name(context->device));
+        return -1;
+    }
+    if (sched_setaffinity(0, sizeof(local), &local)) {
+        DEBUG_LOG("Failed to set local CPU affinity: %s", strerror(errno));
+        return -1;
+    }
+    DEBUG_LOG("Polling thread restricted to the %d CPUs local to %s", CPU_COUNT(&local),
+              ibv_get_device_name(context->device));
+    return 0;
+}
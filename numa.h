@@ -0,0 +1,60 @@
+/**
+ * @file numa.h
+ * @brief NUMA placement interface
+ *
+ * Finds the NUMA node and local CPUs of an RDMA device through sysfs, so
+ * registered memory can be placed on the node the NIC DMAs from and polling
+ * threads can run next to it. Uses the mbind and sched_setaffinity system
+ * calls directly; libnuma is not required.
+ */
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#include "common.h"
+
+/**
+ * NUMA Configuration Constants
+ * NUMA_SYSFS_ROOT: sysfs directory holding one entry per RDMA device
+ * NUMA_MAX_NODES: Highest node number (exclusive) a memory policy can name
+ */
+#define NUMA_SYSFS_ROOT "/sys/class/infiniband"
+#define NUMA_MAX_NODES 1024
+
+/**
+ * @brief NUMA node an RDMA device is attached to
+ *
+ * @param context Open device context
+ * @return Node number, or -1 when unknown (single-node host, no sysfs entry)
+ */
+int numa_device_node(struct ibv_context *context);
+
+/**
+ * @brief Prefers a NUMA node for the pages of a region
+ *
+ * @param addr Start of the region (rounded down to a page boundary)
+ * @param len Length in bytes
+ * @param node Preferred node (-1 = leave the default policy alone)
+ * @return 0 on success or when node is -1, -1 on failure
+ *
+ * Pages faulted in afterwards come from node while it has free memory;
+ * pages already touched are migrated. Must run before the region is
+ * registered, since registration pins the pages where they are. The policy
+ * covers whole pages, so region must be a mapping of its own (hugepage_map
+ * binds what it maps); on heap memory it would move unrelated allocations
+ * sharing those pages.
+ */
+int numa_bind(void *addr, size_t len, int node);
+
+/**
+ * @brief Restricts the calling thread to the CPUs local to an RDMA device
+ *
+ * @param context Open device context
+ * @return 0 on success, -1 when the local CPUs are unknown or outside the current affinity
+ *
+ * Only CPUs the thread may already run on are kept, so an outer taskset or
+ * cgroup limit still applies.
+ */
+int numa_pin_local(struct ibv_context *context);
+
+#endif // NUMA_H
@@ -10,6 +10,7 @@
  */
 
 #include "../common.h"
+#include "../server.h"
 
 /**
  * @brief Posts an RDMA read operation
@@ -30,56 +31,62 @@ static void rd_post_read(struct config_t *config, uint64_t remote_offset, size_t
 }
 
 /**
- * @brief Main server loop for read operations
+ * @brief Exposes the stored text to a newly connected client
  *
- * @param config RDMA configuration structure
+ * @param server Server holding the text in its ctx
+ * @param conn Client connection
+ * @return 0 to keep the client
  *
- * Server operation sequence:
- * 1. Prompts for input text to store in buffer
- * 2. Stores text in registered memory region
- * 3. Makes memory available for remote read operations
- * 4. Waits indefinitely for client read requests
+ * Every client reads from its own buffer, so the text is copied into it
+ * before the client starts issuing reads.
  */
-static void rd_server_loop(struct config_t *config)
+static int rd_on_connect(struct rdma_server_t *server, struct config_t *conn)
 {
-    printf("Enter text to store: ");
-    fflush(stdout);
-    
-    char input[MAX_BUFFER_SIZE];
-    if (fgets(input, MAX_BUFFER_SIZE, stdin)) {
-        size_t len = strlen(input);
-        if (input[len - 1] == '\n')
-            input[--len] = '\0';
-        memcpy(config->buf, input, len + 1);
-        printf("Waiting for client read requests...\n");
-        while (1)
-            sleep(1);
-    }
+    const char *text = server->ctx;
+    size_t len = strlen(text) + 1;
+
+    memcpy(conn->buf, text, len < conn->buf_size ? len : conn->buf_size);
+    return 0;
 }
 
+static const struct server_ops rd_server_ops = {
+    .on_connect = rd_on_connect,
+};
+
 /**
  * @brief Initializes and runs the RDMA read server
  *
  * @return int 0 on success, -1 on failure
  *
  * Server initialization sequence:
- * 1. Sets up RDMA resources with read permissions
- * 2. Initializes memory buffer with user input
- * 3. Enters server loop to handle read requests
+ * 1. Prompts for input text to store
+ * 2. Sets up the shared device, CQ and buffer pool with read permissions
+ * 3. Accepts clients indefinitely, each reading the text without involving the server CPU
  */
 int rd_run_server(void)
 {
-    struct config_t config = {};
+    struct rdma_server_t server;
+
+    printf("Enter text to store: ");
+    fflush(stdout);
     
-    if (setup_rdma_connection(&config, NULL, MODE_READ, NULL) != RDMA_SUCCESS) {
+    char input[MAX_BUFFER_SIZE];
+    if (!fgets(input, MAX_BUFFER_SIZE, stdin)) {
         return -1;
     }
+    size_t len = strlen(input);
+    if (len > 0 && input[len - 1] == '\n')
+        input[--len] = '\0';
+
+    if (server_init(&server, MODE_READ, &rd_server_ops, input) != RDMA_SUCCESS) {
+        return -1;
+    }
+
+    printf("Read Server ready. Waiting for client read requests...\n");
+    int result = server_run(&server);
     
-    printf("Read Server ready.\n");
-    rd_server_loop(&config);
-    
-    cleanup_resources(&config);
-    return 0;
+    server_destroy(&server);
+    return result;
 }
 
 /**
@@ -94,7 +101,7 @@ int rd_run_server(void)
  *    - Specify start and end positions to read
  *    - Read specified range using RDMA read
  *    - View retrieved data
- * 3. Validates input ranges
+ * 3. Validates input ranges against both buffer sizes
  * 4. Performs RDMA read operations
  */
 int rd_run_client(const char *server_name)
@@ -106,22 +113,25 @@ int rd_run_client(const char *server_name)
         return -1;
     }
     
+    // Reads land in the local buffer, so both buffers bound the range
+    size_t limit = remote_info.length < config.buf_size ? remote_info.length : config.buf_size;
+
     printf("Connected to server.\n");
     printf("Enter character range to read (format: start_pos end_pos):\n");
     printf("Example: 0 5 to read first 6 characters\n");
     
     char input[MAX_BUFFER_SIZE];
     while (fgets(input, MAX_BUFFER_SIZE, stdin)) {
-        int start, end;
-        if (sscanf(input, "%d %d", &start, &end) == 2) {
-            if (start < 0 || end < start || end >= MAX_BUFFER_SIZE) {
-                printf("Invalid range. start must be >= 0, end must be >= start and < %d\n", MAX_BUFFER_SIZE);
+        long long start, end;
+        if (sscanf(input, "%lld %lld", &start, &end) == 2) {
+            if (start < 0 || end < start || (size_t)end >= limit) {
+                printf("Invalid range. start must be >= 0, end must be >= start and < %zu\n", limit);
                 continue;
             }
             size_t read_len = end - start + 1;
             rd_post_read(&config, start, read_len, &remote_info);
             wait_completion(&config);
-            printf("Read data (%zu bytes from position %d): %.*s\n", 
+            printf("Read data (%zu bytes from position %lld): %.*s\n", 
                    read_len, start, (int)read_len, (char *)config.buf);
         } else {
             printf("Invalid input. Please enter two numbers: start_pos end_pos\n");
@@ -10,6 +10,7 @@
  */
 
 #include "../common.h"
+#include "../server.h"
 
 /**
  * @brief Posts an RDMA write operation with immediate data
@@ -29,66 +30,82 @@ static void rw_post_write(struct config_t *config, const char *message, struct q
 }
 
 /**
- * @brief Main server event loop for write operations
+ * @brief Sets up a newly connected client
  *
- * @param config RDMA configuration structure
+ * @param server Server the client connected to
+ * @param conn Client connection
+ * @return 0 on success, -1 to drop the client
  *
- * Server operation sequence:
- * 1. Posts receive request for immediate data
- * 2. Waits for completion event
- * 3. Extracts message length from immediate data
- * 4. Processes received message
- * 5. Repeats for next message
+ * Immediate data needs a receive per write but no receive buffer.
  */
-static void rw_server_loop(struct config_t *config)
+static int rw_on_connect(struct rdma_server_t *server, struct config_t *conn)
 {
-    while (1) {
-        // Post a receive work request to get immediate data
-        // This is necessary because RDMA Write with immediate requires a receive queue entry
-        post_receive(config);
-        
-        // Wait for completion by polling the completion queue
-        struct ibv_wc wc;
-        while (ibv_poll_cq(config->cq, 1, &wc) == 0)
-            ;
-            
-        // Check completion status
-        if (wc.status != IBV_WC_SUCCESS) {
-            fprintf(stderr, "Completion error: %s\n", ibv_wc_status_str(wc.status));
-            continue;
+    (void)server;
+    return recv_ring_init(conn, RECV_RING_DEFAULT_DEPTH, 0, RECV_RING_REPOST_BATCH) == RDMA_SUCCESS ? 0 : -1;
+}
+
+/**
+ * @brief Handles the writes a client has completed
+ *
+ * @param server Server the client is connected to
+ * @param conn Client connection
+ * @return 0 to keep the client, -1 to drop it after a failed receive
+ *
+ * For each completed receive:
+ * 1. Extracts message length from immediate data
+ * 2. Processes received message
+ * 3. Releases the ring slot for batched reposting
+ */
+static int rw_on_service(struct rdma_server_t *server, struct config_t *conn)
+{
+    (void)server;
+
+    while (conn->ring.ready_count > 0) {
+        // Each RDMA Write with immediate consumes one pre-posted, zero-length receive
+        struct recv_msg_t msg;
+        if (recv_ring_next(conn, &msg)) {
+            return -1;
         }
 
-        // Extract message length from immediate data (sent in network byte order)
-        uint32_t received_len = ntohl(wc.imm_data);
-        printf("Received (%u bytes): %s\n", received_len, (char *)config->buf);
+        // Extract message length from immediate data (converted to host order by the ring)
+        uint32_t received_len = msg.imm_data;
+        printf("Received from QP %u (%u bytes): %s\n", conn->qp->qp_num, received_len, (char *)conn->buf);
         fflush(stdout);
+
+        recv_ring_release(conn, msg.slot);
     }
+    return 0;
 }
 
+static const struct server_ops rw_server_ops = {
+    .on_connect = rw_on_connect,
+    .on_service = rw_on_service,
+};
+
 /**
  * @brief Initializes and runs the RDMA write server
  *
  * @return int 0 on success, -1 on failure
  *
  * Server initialization sequence:
- * 1. Sets up RDMA resources with write permissions
- * 2. Enters server loop for handling write requests
- * 3. Performs cleanup on exit
+ * 1. Sets up the shared device, CQ and buffer pool with write permissions
+ * 2. Accepts clients, each writing into its own buffer over its own QP
+ * 3. Reports every client's writes from one service loop
+ * 4. Performs cleanup on exit
  */
 int rw_run_server(void)
 {
-    struct config_t config = {};
-    
-    // Setup RDMA connection in Write mode
-    if (setup_rdma_connection(&config, NULL, MODE_WRITE, NULL) != RDMA_SUCCESS) {
+    struct rdma_server_t server;
+
+    if (server_init(&server, MODE_WRITE, &rw_server_ops, NULL) != RDMA_SUCCESS) {
         return -1;
     }
-    
+
     printf("Write Server ready.\n");
-    rw_server_loop(&config);
+    int result = server_run(&server);
     
-    cleanup_resources(&config);
-    return 0;
+    server_destroy(&server);
+    return result;
 }
 
 /**
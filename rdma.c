@@ -13,9 +13,13 @@
 #include "send-receive/send_receive.h"
 #include "rdma-write/rdma_write.h"
 #include "rdma-read/rdma_read.h"
+#include "hugepage.h"
+#include "metrics.h"
+#include "srq.h"
 #include <stdio.h>
 #include <string.h>
 #include <signal.h>
+#include <getopt.h>
 
 /**
  * @brief Displays program usage instructions
@@ -37,6 +41,210 @@ void print_usage() {
     printf("    ./rdma write <host>      - Run RDMA write client\n");
     printf("    ./rdma read <host>       - Run RDMA read client\n");
     printf("    ./rdma lambda <host>     - Run Lambda client\n");
+    printf("\n");
+    printf("  Options (before the mode):\n");
+    printf("    -b <size>                - Data buffer size (default %d, K/M/G suffixes allowed)\n", MAX_BUFFER_SIZE);
+    printf("    -m <size>                - Largest single WR; longer messages are segmented (default %lu)\n",
+           DEFAULT_MAX_MSG_SIZE);
+    printf("    -q <depth>               - Server: share receives through an SRQ of <depth> (>= 4) slots\n");
+    printf("    -c <count>               - Server: maximum concurrent clients (default: %d)\n",
+           DEFAULT_MAX_CONNECTIONS);
+    printf("    -e                       - Event mode: sleep on completion channels when idle\n");
+    printf("    -w <polls>:<spin_us>:<yield_us>\n");
+    printf("                             - Wait policy: spin for <polls> empty polls or <spin_us>,\n");
+    printf("                               then pause/yield for <yield_us>, then block (with -e)\n");
+    printf("                               (default %d:0:0)\n", CQ_EVENT_SPIN_BUDGET);
+    printf("    -t <threads>             - Server: worker threads sharing the clients (default: serve inline)\n");
+    printf("    -C <cpus>                - Server: pin workers to a CPU list such as 2,3,6-7\n");
+    printf("    -N                       - Skip NUMA placement (buffers and worker threads near the NIC)\n");
+    printf("    -L                       - Also keep the client's (or inline server's) own thread on\n");
+    printf("                               the NIC's local CPUs\n");
+    printf("    -H <2M|1G|0>             - Largest hugepage for registered regions (default 2M, 0 = off)\n");
+    printf("    -O                       - Register data buffers with On-Demand Paging when supported\n");
+    printf("    -M <size>                - Pinned bytes each registration cache may hold\n");
+    printf("                               (default: half of RLIMIT_MEMLOCK)\n");
+    printf("    -S <seconds>             - Dump per-connection statistics to stderr every <seconds>\n");
+    printf("    -P <port|host:port|path> - Serve Prometheus metrics over HTTP on <port> (127.0.0.1)\n");
+    printf("                               or <host:port>, or as text on the Unix socket <path>\n");
+    printf("    -T <file>                - Trace WR lifecycle events and dump them to <file> at exit\n");
+    printf("                               (SIGUSR2 pauses/resumes; decode with rdma-trace-decode)\n");
+    printf("    -R                       - Connect through rdma_cm instead of the TCP handshake; the\n");
+    printf("                               device, port and GID follow the route to <host>%s\n",
+#ifdef RDMA_CM
+           "");
+#else
+           " (build with RDMA_CM=1)");
+#endif
+}
+
+/**
+ * @brief Parses a byte count with an optional K/M/G suffix
+ *
+ * @param arg Command line argument
+ * @param max Largest accepted size
+ * @param out Receives the parsed size
+ * @return 0 on success, -1 if the value is malformed, zero or above max
+ */
+static int parse_size(const char *arg, unsigned long long max, size_t *out)
+{
+    char *end;
+    unsigned long long value = strtoull(arg, &end, 10);
+    unsigned long long unit = 1;
+
+    switch (*end) {
+    case 'G': case 'g': unit = 1ULL << 30; end++; break;
+    case 'M': case 'm': unit = 1ULL << 20; end++; break;
+    case 'K': case 'k': unit = 1ULL << 10; end++; break;
+    }
+
+    if (*end != '\0' || value == 0 || value > max / unit) {
+        return -1;
+    }
+    *out = value * unit;
+    return 0;
+}
+
+/**
+ * @brief Parses a decimal count within a range
+ *
+ * @param arg Command line argument
+ * @param min Smallest accepted value
+ * @param max Largest accepted value
+ * @param out Receives the parsed count
+ * @return 0 on success, -1 if the value is malformed or outside [min, max]
+ */
+static int parse_count(const char *arg, unsigned long min, unsigned long max, uint32_t *out)
+{
+    char *end;
+    errno = 0;
+    unsigned long value = strtoul(arg, &end, 10);
+
+    if (end == arg || *end != '\0' || errno || arg[0] == '-' || value < min || value > max) {
+        return -1;
+    }
+    *out = value;
+    return 0;
+}
+
+/**
+ * @brief Parses a wait policy given as <polls>:<spin_us>:<yield_us>
+ *
+ * @param arg Command line argument
+ * @param out Receives the three fields; left untouched on failure
+ * @return 0 on success, -1 unless there are exactly three unsigned decimal
+ *         fields, each at most UINT32_MAX
+ */
+static int parse_wait_policy(const char *arg, struct wait_policy_t *out)
+{
+    uint32_t fields[3];
+    const char *p = arg;
+
+    for (int i = 0; i < 3; i++) {
+        // strtoul() would skip blanks and accept a sign
+        if (*p < '0' || *p > '9') {
+            return -1;
+        }
+        char *end;
+        errno = 0;
+        unsigned long value = strtoul(p, &end, 10);
+        if (errno || value > UINT32_MAX || *end != (i < 2 ? ':' : '\0')) {
+            return -1;
+        }
+        fields[i] = value;
+        p = end + 1;
+    }
+
+    out->spin_polls = fields[0];
+    out->spin_usec = fields[1];
+    out->yield_usec = fields[2];
+    return 0;
+}
+
+/**
+ * @brief Parses a CPU list such as "2,3,6-7" into rdma_opts.cpus
+ *
+ * @param arg Command line argument
+ * @return 0 on success, -1 if the list is malformed or longer than MAX_WORKERS
+ */
+static int parse_cpu_list(const char *arg)
+{
+    const char *p = arg;
+
+    rdma_opts.num_cpus = 0;
+    while (*p) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p || first < 0) {
+            return -1;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) {
+                return -1;
+            }
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            if (rdma_opts.num_cpus == MAX_WORKERS) {
+                return -1;
+            }
+            rdma_opts.cpus[rdma_opts.num_cpus++] = (int)cpu;
+        }
+        if (*end == ',')
+            end++;
+        else if (*end != '\0')
+            return -1;
+        p = end;
+    }
+    return rdma_opts.num_cpus > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Pauses or resumes tracing on SIGUSR2
+ * @param signo Signal number (unused)
+ */
+static void trace_toggle_handler(int signo) {
+    (void)signo;
+    trace_enable(!trace_enabled());
+}
+
+// Set once the -T dump has been written, so exit() does not write it again
+static volatile sig_atomic_t trace_dumped;
+
+/**
+ * @brief Writes the trace dump requested with -T on a normal exit
+ *
+ * Registered with atexit(). A shutdown signal dumps from trace_signal_handler()
+ * instead, before its exit() gets here.
+ */
+static void trace_dump_at_exit(void) {
+    if (trace_dumped) {
+        return;
+    }
+    trace_dumped = 1;
+    if (trace_dump(rdma_opts.trace_path) == 0) {
+        fprintf(stderr, "Trace written to %s\n", rdma_opts.trace_path);
+    } else {
+        fprintf(stderr, "Failed to write trace dump %s: %s\n", rdma_opts.trace_path, strerror(errno));
+    }
+}
+
+/**
+ * @brief Dumps the trace on SIGINT/SIGTERM, then shuts down as signal_handler() does
+ * @param signo Signal number
+ *
+ * trace_dump() only uses open/write/close, so it is safe here; exit() would
+ * otherwise run the dump from the atexit handler in signal context.
+ */
+static void trace_signal_handler(int signo) {
+    if (!trace_dumped) {
+        trace_dumped = 1;
+        const char *msg = trace_dump(rdma_opts.trace_path) == 0 ? "Trace written\n" : "Failed to write trace dump\n";
+        ssize_t n = write(STDERR_FILENO, msg, strlen(msg));
+        (void)n;
+    }
+    signal_handler(signo);
 }
 
 /**
@@ -44,17 +252,24 @@ void print_usage() {
  *
  * Sets up handlers for SIGINT and SIGTERM to ensure proper cleanup of RDMA
  * resources when the program is terminated. Uses sigaction for reliable
- * signal handling across different UNIX implementations.
+ * signal handling across different UNIX implementations. With -T, the
+ * shutdown signals dump the trace first and SIGUSR2 toggles tracing.
  */
 static void setup_signal_handlers(void) {
     struct sigaction sa = {
-        .sa_handler = signal_handler,
+        .sa_handler = rdma_opts.trace_path ? trace_signal_handler : signal_handler,
         .sa_flags = 0
     };
     sigemptyset(&sa.sa_mask);
     
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
+
+    if (rdma_opts.trace_path) {
+        struct sigaction toggle = { .sa_handler = trace_toggle_handler, .sa_flags = SA_RESTART };
+        sigemptyset(&toggle.sa_mask);
+        sigaction(SIGUSR2, &toggle, NULL);
+    }
 }
 
 // External reference to global configuration pointer used by signal handlers
@@ -71,6 +286,110 @@ extern struct config_t *global_config;
  * Supports multiple operation modes and handles both client and server roles.
  */
 int main(int argc, char *argv[]) {
+    // Parse runtime options
+    int opt;
+    uint32_t stats_interval_s;
+    while ((opt = getopt(argc, argv, "b:m:q:c:ew:t:C:NLH:OM:S:P:T:R")) != -1) {
+        switch (opt) {
+        case 'b':
+            if (parse_size(optarg, MAX_MESSAGE_SIZE, &rdma_opts.buf_size)) {
+                fprintf(stderr, "Invalid buffer size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'm':
+            if (parse_size(optarg, MAX_MESSAGE_SIZE, &rdma_opts.max_msg_size)) {
+                fprintf(stderr, "Invalid message size: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'q':
+            if (parse_count(optarg, SRQ_MIN_DEPTH, UINT32_MAX, &rdma_opts.srq_depth)) {
+                fprintf(stderr, "Invalid SRQ depth: %s (at least %d)\n", optarg, SRQ_MIN_DEPTH);
+                return 1;
+            }
+            break;
+        case 'c':
+            if (parse_count(optarg, 1, MAX_CONNECTIONS, &rdma_opts.max_conns)) {
+                fprintf(stderr, "Invalid client count: %s (1 to %d)\n", optarg, MAX_CONNECTIONS);
+                return 1;
+            }
+            break;
+        case 'e':
+            rdma_opts.event_mode = 1;
+            break;
+        case 'w':
+            if (parse_wait_policy(optarg, &rdma_opts.wait)) {
+                fprintf(stderr, "Invalid wait policy: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 't':
+            if (parse_count(optarg, 1, MAX_WORKERS, &rdma_opts.workers)) {
+                fprintf(stderr, "Invalid worker thread count: %s (1 to %d)\n", optarg, MAX_WORKERS);
+                return 1;
+            }
+            break;
+        case 'C':
+            if (parse_cpu_list(optarg)) {
+                fprintf(stderr, "Invalid CPU list: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'N':
+            rdma_opts.numa = 0;
+            break;
+        case 'L':
+            rdma_opts.numa_pin = 1;
+            break;
+        case 'H':
+            if (strcmp(optarg, "0") == 0) {
+                rdma_opts.hugepage_size = 0;
+            } else if (parse_size(optarg, MAX_MESSAGE_SIZE, &rdma_opts.hugepage_size)
+                       || (rdma_opts.hugepage_size != HUGEPAGE_SIZE_2M && rdma_opts.hugepage_size != HUGEPAGE_SIZE_1G)) {
+                fprintf(stderr, "Invalid hugepage size: %s (2M, 1G or 0)\n", optarg);
+                return 1;
+            }
+            break;
+        case 'O':
+            rdma_opts.odp = 1;
+            break;
+        case 'M':
+            if (parse_size(optarg, SIZE_MAX, &rdma_opts.reg_cache_budget)) {
+                fprintf(stderr, "Invalid registration cache budget: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'S':
+            // Kept in milliseconds, so the seconds must not overflow once scaled
+            if (parse_count(optarg, 1, UINT32_MAX / 1000, &stats_interval_s)) {
+                fprintf(stderr, "Invalid statistics interval: %s (1 to %u seconds)\n", optarg, UINT32_MAX / 1000);
+                return 1;
+            }
+            rdma_opts.stats_interval_ms = stats_interval_s * 1000;
+            break;
+        case 'P':
+            rdma_opts.metrics_endpoint = optarg;
+            break;
+        case 'T':
+            rdma_opts.trace_path = optarg;
+            break;
+        case 'R':
+#ifdef RDMA_CM
+            rdma_opts.cm = 1;
+            break;
+#else
+            fprintf(stderr, "-R needs an rdma_cm build (make RDMA_CM=1)\n");
+            return 1;
+#endif
+        default:
+            print_usage();
+            return 1;
+        }
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+
     // Validate command line arguments
     if (argc < 2 || argc > 3) {
         print_usage();
@@ -108,12 +427,47 @@ int main(int argc, char *argv[]) {
     printf("\n=== RDMA Communication Program Started ===\n");
     printf("Mode: %s (%s)\n", mode, host ? "Client" : "Server");
     printf("Configuration:\n");
-    printf("  Buffer size: %d bytes\n", MAX_BUFFER_SIZE);
-    printf("  IB port: %d\n", IB_PORT);
-    printf("  GID index: %d\n", GID_INDEX);
-    printf("  TCP port: %d\n", TCP_PORT);
+    printf("  Buffer size: %zu bytes\n", rdma_opts.buf_size);
+    printf("  Max message size: %zu bytes\n", rdma_opts.max_msg_size);
+    printf("  Completions: %s\n", rdma_opts.event_mode ? "event-driven" : "busy polling");
+    printf("  Wait policy: spin %u polls / %u us, yield %u us\n", rdma_opts.wait.spin_polls,
+           rdma_opts.wait.spin_usec, rdma_opts.wait.yield_usec);
+    if (!host && rdma_opts.workers)
+        printf("  Worker threads: %u%s\n", rdma_opts.workers, rdma_opts.num_cpus ? " (pinned)" : "");
+    printf("  NUMA placement: %s%s\n", rdma_opts.numa ? "device-local" : "off",
+           rdma_opts.numa && rdma_opts.numa_pin ? " (calling thread pinned)" : "");
+    printf("  Hugepages: %s\n", rdma_opts.hugepage_size == HUGEPAGE_SIZE_1G ? "1G, 2M"
+                             : rdma_opts.hugepage_size ? "2M" : "off");
+    printf("  On-demand paging: %s\n", rdma_opts.odp ? "requested" : "off");
+    if (rdma_opts.reg_cache_budget)
+        printf("  Registration cache budget: %zu bytes\n", rdma_opts.reg_cache_budget);
+    if (rdma_opts.stats_interval_ms)
+        printf("  Statistics dump: every %u s\n", rdma_opts.stats_interval_ms / 1000);
+    if (rdma_opts.metrics_endpoint)
+        printf("  Metrics: %s %s\n", rdma_opts.metrics_endpoint[0] == '/' ? "socket" : "HTTP",
+               rdma_opts.metrics_endpoint);
+    if (rdma_opts.trace_path)
+        printf("  Trace: %s (SIGUSR2 to pause/resume)\n", rdma_opts.trace_path);
+    if (rdma_opts.cm) {
+        printf("  Connection: rdma_cm on port %d (device, IB port and GID from the route)\n", TCP_PORT);
+    } else {
+        printf("  IB port: %d\n", IB_PORT);
+        printf("  GID index: %d\n", GID_INDEX);
+        printf("  TCP port: %d\n", TCP_PORT);
+    }
     fflush(stdout);
 
+    if (rdma_opts.stats_interval_ms && stats_dump_start(stderr, rdma_opts.stats_interval_ms)) {
+        fprintf(stderr, "Failed to start the statistics dump\n");
+    }
+    if (rdma_opts.metrics_endpoint && metrics_start(rdma_opts.metrics_endpoint)) {
+        fprintf(stderr, "Failed to start the metrics exporter\n");
+    }
+    if (rdma_opts.trace_path) {
+        atexit(trace_dump_at_exit);
+        trace_enable(1);
+    }
+
     // Execute appropriate mode-specific implementation
     int result;
     if (host) {
@@ -133,6 +487,8 @@ int main(int argc, char *argv[]) {
     }
     
     // Cleanup global state
+    stats_dump_stop();
+    metrics_stop();
     global_config = NULL;
     return result;
 }
@@ -0,0 +1,685 @@
+/**
+ * @file reg_cache.c
+ * @brief Memory registration cache implementation
+ *
+ * Implements cached registration of application memory:
+ * - AVL interval tree of registrations, augmented with subtree max end
+ * - Reuse of covering registrations, merging of overlapping idle ones
+ * - LRU eviction under a pinned-byte budget
+ * - Invalidation through an interposed munmap()
+ * - Implicit ODP registration in place of all of the above where supported
+ */
+
+#include "reg_cache.h"
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+/**
+ * Cache Constants
+ * REG_CACHE_MAX_OVERLAPS: Entries examined per lookup or invalidation pass
+ */
+#define REG_CACHE_MAX_OVERLAPS 32
+
+// Caches watching munmap(), and a guard against re-entering them from their own calls
+static struct reg_cache *caches;
+static pthread_mutex_t caches_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic int num_caches;
+static __thread int cache_busy;
+
+/*******************************************************************************
+ * Interval Tree
+ ******************************************************************************/
+
+/**
+ * @brief Height of a subtree (0 when empty)
+ */
+static int tree_height(const struct reg_entry *e)
+{
+    return e ? e->height : 0;
+}
+
+/**
+ * @brief Recomputes height and max_end of a node from its children
+ * @param e Node to update
+ */
+static void tree_update(struct reg_entry *e)
+{
+    int hl = tree_height(e->left), hr = tree_height(e->right);
+    e->height = 1 + (hl > hr ? hl : hr);
+    e->max_end = e->end;
+    if (e->left && e->left->max_end > e->max_end)
+        e->max_end = e->left->max_end;
+    if (e->right && e->right->max_end > e->max_end)
+        e->max_end = e->right->max_end;
+}
+
+/**
+ * @brief Rotates a subtree right
+ * @param y Subtree root with a left child
+ * @return New subtree root
+ */
+static struct reg_entry *rotate_right(struct reg_entry *y)
+{
+    struct reg_entry *x = y->left;
+    y->left = x->right;
+    x->right = y;
+    tree_update(y);
+    tree_update(x);
+    return x;
+}
+
+/**
+ * @brief Rotates a subtree left
+ * @param x Subtree root with a right child
+ * @return New subtree root
+ */
+static struct reg_entry *rotate_left(struct reg_entry *x)
+{
+    struct reg_entry *y = x->right;
+    x->right = y->left;
+    y->left = x;
+    tree_update(x);
+    tree_update(y);
+    return y;
+}
+
+/**
+ * @brief Restores the AVL invariant at a node whose subtrees changed
+ * @param e Subtree root
+ * @return New subtree root
+ */
+static struct reg_entry *tree_rebalance(struct reg_entry *e)
+{
+    tree_update(e);
+    int balance = tree_height(e->left) - tree_height(e->right);
+    if (balance > 1) {
+        if (tree_height(e->left->left) < tree_height(e->left->right))
+            e->left = rotate_left(e->left);
+        return rotate_right(e);
+    }
+    if (balance < -1) {
+        if (tree_height(e->right->right) < tree_height(e->right->left))
+            e->right = rotate_right(e->right);
+        return rotate_left(e);
+    }
+    return e;
+}
+
+/**
+ * @brief Tree order: by start, ties broken by node address
+ */
+static int entry_before(const struct reg_entry *a, const struct reg_entry *b)
+{
+    return a->start < b->start || (a->start == b->start && (uintptr_t)a < (uintptr_t)b);
+}
+
+/**
+ * @brief Inserts an entry
+ * @param root Subtree root
+ * @param e Entry to insert
+ * @return New subtree root
+ */
+static struct reg_entry *tree_insert(struct reg_entry *root, struct reg_entry *e)
+{
+    if (!root) {
+        e->left = e->right = NULL;
+        tree_update(e);
+        return e;
+    }
+    if (entry_before(e, root))
+        root->left = tree_insert(root->left, e);
+    else
+        root->right = tree_insert(root->right, e);
+    return tree_rebalance(root);
+}
+
+/**
+ * @brief Detaches the first entry of a subtree
+ * @param root Non-empty subtree root
+ * @param min Receives the detached entry
+ * @return New subtree root
+ */
+static struct reg_entry *tree_remove_min(struct reg_entry *root, struct reg_entry **min)
+{
+    if (!root->left) {
+        *min = root;
+        return root->right;
+    }
+    root->left = tree_remove_min(root->left, min);
+    return tree_rebalance(root);
+}
+
+/**
+ * @brief Removes an entry
+ * @param root Subtree root
+ * @param e Entry in the subtree
+ * @return New subtree root
+ */
+static struct reg_entry *tree_remove(struct reg_entry *root, struct reg_entry *e)
+{
+    if (!root) {
+        return NULL;
+    }
+    if (root == e) {
+        if (!e->left || !e->right) {
+            return e->left ? e->left : e->right;
+        }
+        // Replace the node by its in-order successor
+        struct reg_entry *next;
+        struct reg_entry *right = tree_remove_min(e->right, &next);
+        next->left = e->left;
+        next->right = right;
+        return tree_rebalance(next);
+    }
+    if (entry_before(e, root))
+        root->left = tree_remove(root->left, e);
+    else
+        root->right = tree_remove(root->right, e);
+    return tree_rebalance(root);
+}
+
+/**
+ * @brief Collects entries overlapping [start, end)
+ * @param e Subtree root
+ * @param start First byte of the range
+ * @param end One past the last byte
+ * @param out Receives the overlapping entries
+ * @param count Entries already in out
+ * @return Entries in out (at most REG_CACHE_MAX_OVERLAPS)
+ */
+static size_t tree_overlaps(struct reg_entry *e, uintptr_t start, uintptr_t end, struct reg_entry **out, size_t count)
+{
+    // Nothing in this subtree reaches start
+    if (!e || e->max_end <= start || count == REG_CACHE_MAX_OVERLAPS) {
+        return count;
+    }
+    count = tree_overlaps(e->left, start, end, out, count);
+    if (e->start < end && e->end > start && count < REG_CACHE_MAX_OVERLAPS)
+        out[count++] = e;
+    // Right subtree entries start at or after e->start
+    if (e->start < end)
+        count = tree_overlaps(e->right, start, end, out, count);
+    return count;
+}
+
+/*******************************************************************************
+ * Entry Management
+ ******************************************************************************/
+
+/**
+ * @brief Takes an entry off the LRU list
+ */
+static void lru_unlink(struct reg_cache *cache, struct reg_entry *e)
+{
+    if (e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        cache->lru_head = e->lru_next;
+    if (e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    else
+        cache->lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+/**
+ * @brief Puts an entry at the most recently used end of the LRU list
+ */
+static void lru_push(struct reg_cache *cache, struct reg_entry *e)
+{
+    e->lru_prev = NULL;
+    e->lru_next = cache->lru_head;
+    if (cache->lru_head)
+        cache->lru_head->lru_prev = e;
+    else
+        cache->lru_tail = e;
+    cache->lru_head = e;
+}
+
+/**
+ * @brief Deregisters and frees an entry
+ * @param cache Registration cache (lock held)
+ * @param e Entry no longer in the tree, with no references
+ */
+static void entry_free(struct reg_cache *cache, struct reg_entry *e)
+{
+    stats_counter_set(&cache->pinned, cache->pinned - (e->end - e->start));
+    if (e->mr)
+        ibv_dereg_mr(e->mr);
+    free(e);
+}
+
+/**
+ * @brief Takes a stale entry off the stale list
+ */
+static void stale_unlink(struct reg_cache *cache, struct reg_entry *e)
+{
+    if (e->lru_prev)
+        e->lru_prev->lru_next = e->lru_next;
+    else
+        cache->stale = e->lru_next;
+    if (e->lru_next)
+        e->lru_next->lru_prev = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+/**
+ * @brief Removes an entry from the cache
+ * @param cache Registration cache (lock held)
+ * @param e Entry to remove; one still referenced moves to the stale list and
+ *          is freed by its last put
+ */
+static void entry_drop(struct reg_cache *cache, struct reg_entry *e)
+{
+    cache->root = tree_remove(cache->root, e);
+    lru_unlink(cache, e);
+    if (e->refs == 0) {
+        entry_free(cache, e);
+        return;
+    }
+    e->stale = 1;
+    e->lru_next = cache->stale;
+    if (cache->stale)
+        cache->stale->lru_prev = e;
+    cache->stale = e;
+}
+
+/**
+ * @brief Evicts idle entries, least recently used first, until size more bytes fit
+ * @param cache Registration cache (lock held)
+ * @param size Bytes about to be registered
+ * @return 0 if they fit within the budget, -1 otherwise
+ */
+static int make_room(struct reg_cache *cache, size_t size)
+{
+    struct reg_entry *e = cache->lru_tail;
+
+    while (cache->budget && cache->pinned + size > cache->budget && e) {
+        struct reg_entry *prev = e->lru_prev;
+        if (e->refs == 0) {
+            entry_drop(cache, e);
+            stats_counter_add(&cache->evictions, 1);
+        }
+        e = prev;
+    }
+    return cache->budget && cache->pinned + size > cache->budget ? -1 : 0;
+}
+
+/*******************************************************************************
+ * Cache Lifecycle
+ ******************************************************************************/
+
+/**
+ * @brief Slot of an access set among the implicit ODP registrations
+ * @param access ibv_access_flags including IBV_ACCESS_LOCAL_WRITE
+ * @return Index into cache->implicit, -1 if access has flags beyond local and remote rights
+ */
+static int implicit_index(int access)
+{
+    if (access & ~REG_CACHE_IMPLICIT_ACCESS) {
+        return -1;
+    }
+    return (access & ~IBV_ACCESS_LOCAL_WRITE) >> 1;
+}
+
+/**
+ * @brief Registers the implicit ODP MR of one access set
+ * @param cache Registration cache (locked, or not yet shared)
+ * @param access Exact rights of the MR, IBV_ACCESS_LOCAL_WRITE included
+ * @return 0 on success, -1 if the device refuses the registration
+ *
+ * The MR spans the whole address space, so it gets the requested rights and
+ * nothing more: a local-only caller never holds a remotely usable rkey.
+ */
+static int implicit_register(struct reg_cache *cache, int access)
+{
+    struct reg_entry *e = &cache->implicit[implicit_index(access)];
+
+    e->mr = ibv_reg_mr(cache->pd, NULL, SIZE_MAX, access | IBV_ACCESS_ON_DEMAND);
+    if (!e->mr) {
+        return -1;
+    }
+    e->start = 0;
+    e->end = UINTPTR_MAX;
+    e->access = access;
+    return 0;
+}
+
+/**
+ * @brief Creates a registration cache
+ * @param pd Protection Domain to register with
+ * @param budget Pinned-byte ceiling (0 = half of RLIMIT_MEMLOCK)
+ * @return Cache on success, NULL on failure
+ */
+struct reg_cache *reg_cache_create(struct ibv_pd *pd, size_t budget)
+{
+    if (!pd) {
+        return NULL;
+    }
+
+    struct reg_cache *cache = calloc(1, sizeof(*cache));
+    if (!cache) {
+        return NULL;
+    }
+    cache->pd = pd;
+    cache->budget = budget;
+    pthread_mutex_init(&cache->lock, NULL);
+
+    // Implicit ODP: unpinned MRs serve every address, so there is nothing to cache. The
+    // local-only one is registered now to probe support, the others on first use
+    if (rdma_opts.odp && (device_odp_caps(pd->context) & ODP_CAP_IMPLICIT)) {
+        if (implicit_register(cache, IBV_ACCESS_LOCAL_WRITE) == 0) {
+            cache->implicit_odp = 1;
+            DEBUG_LOG("Registration cache using implicit ODP");
+            return cache;
+        }
+        DEBUG_LOG("Implicit ODP registration failed (%s), caching explicit registrations", strerror(errno));
+    }
+
+    // Leave room under the locked-memory limit for the QPs, CQs and other MRs
+    struct rlimit limit;
+    if (budget == 0 && getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+        cache->budget = limit.rlim_cur / 2;
+
+    pthread_mutex_lock(&caches_lock);
+    cache->next = caches;
+    caches = cache;
+    atomic_fetch_add(&num_caches, 1);
+    pthread_mutex_unlock(&caches_lock);
+
+    DEBUG_LOG("Registration cache ready, budget %zu bytes%s", cache->budget, cache->budget ? "" : " (unlimited)");
+    return cache;
+}
+
+/**
+ * @brief Deregisters every entry and frees the cache
+ * @param cache Cache to destroy
+ */
+void reg_cache_destroy(struct reg_cache *cache)
+{
+    if (!cache) return;
+
+    if (cache->implicit_odp) {
+        for (int i = 0; i < REG_CACHE_IMPLICIT_SETS; i++) {
+            if (cache->implicit[i].mr)
+                ibv_dereg_mr(cache->implicit[i].mr);
+        }
+        pthread_mutex_destroy(&cache->lock);
+        free(cache);
+        return;
+    }
+
+    pthread_mutex_lock(&caches_lock);
+    for (struct reg_cache **p = &caches; *p; p = &(*p)->next) {
+        if (*p == cache) {
+            *p = cache->next;
+            break;
+        }
+    }
+    atomic_fetch_sub(&num_caches, 1);
+    pthread_mutex_unlock(&caches_lock);
+
+    cache_busy++;
+    while (cache->root)
+        entry_drop(cache, cache->root);
+    while (cache->stale) {
+        struct reg_entry *e = cache->stale;
+        stale_unlink(cache, e);
+        entry_free(cache, e);
+    }
+    cache_busy--;
+    DEBUG_LOG("Registration cache: %lu hits, %lu misses, %lu evictions", cache->hits, cache->misses, cache->evictions);
+    pthread_mutex_destroy(&cache->lock);
+    free(cache);
+}
+
+/**
+ * @brief Calls fn for every live registration cache
+ * @param fn Callback reading the cache's counters
+ * @param ctx Passed through to fn
+ */
+void reg_cache_for_each(void (*fn)(const struct reg_cache *cache, void *ctx), void *ctx)
+{
+    pthread_mutex_lock(&caches_lock);
+    for (struct reg_cache *c = caches; c; c = c->next)
+        fn(c, ctx);
+    pthread_mutex_unlock(&caches_lock);
+}
+
+/*******************************************************************************
+ * Lookup
+ ******************************************************************************/
+
+/**
+ * @brief Returns a registration covering [addr, addr + length)
+ * @param cache Registration cache
+ * @param addr Start of the buffer
+ * @param length Buffer length in bytes
+ * @param access ibv_access_flags needed
+ * @return Referenced entry, NULL on failure
+ */
+struct reg_entry *reg_cache_get(struct reg_cache *cache, void *addr, size_t length, int access)
+{
+    if (!cache || !addr || length == 0) {
+        return NULL;
+    }
+
+    // Registration is page-granular anyway; aligning lets neighbouring buffers share entries
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)addr & ~(page_size - 1);
+    uintptr_t end = ((uintptr_t)addr + length + page_size - 1) & ~(page_size - 1);
+    access |= IBV_ACCESS_LOCAL_WRITE;
+    if (cache->implicit_odp) {
+        int index = implicit_index(access);
+        if (index < 0) {
+            return NULL;
+        }
+        pthread_mutex_lock(&cache->lock);
+        struct reg_entry *implicit = &cache->implicit[index];
+        if (!implicit->mr && implicit_register(cache, access)) {
+            ERROR_LOG("Implicit ODP registration with access %#x failed: %s", access, strerror(errno));
+            implicit = NULL;
+        }
+        pthread_mutex_unlock(&cache->lock);
+        return implicit;
+    }
+
+    struct reg_entry *found[REG_CACHE_MAX_OVERLAPS];
+    struct reg_entry *e = NULL;
+
+    pthread_mutex_lock(&cache->lock);
+    cache_busy++;
+    size_t n = tree_overlaps(cache->root, start, end, found, 0);
+    for (size_t i = 0; i < n; i++) {
+        // Exact rights only: a wider entry would hand out remote access nobody asked for
+        if (found[i]->start <= start && found[i]->end >= end && found[i]->access == access) {
+            e = found[i];
+            break;
+        }
+    }
+    if (e) {
+        e->refs++;
+        lru_unlink(cache, e);
+        lru_push(cache, e);
+        stats_counter_add(&cache->hits, 1);
+        goto out;
+    }
+
+    // Fold idle overlapping entries with the same rights into one registration of the union
+    uintptr_t req_start = start, req_end = end;
+    for (size_t i = 0; i < n; i++) {
+        if (found[i]->refs || found[i]->access != access)
+            continue;
+        if (found[i]->start < start)
+            start = found[i]->start;
+        if (found[i]->end > end)
+            end = found[i]->end;
+        entry_drop(cache, found[i]);
+        stats_counter_add(&cache->evictions, 1);
+    }
+
+    e = calloc(1, sizeof(*e));
+    if (!e || make_room(cache, end - start)) {
+        ERROR_LOG("Registration cache budget of %zu bytes exhausted", cache->budget);
+        free(e);
+        e = NULL;
+        goto out;
+    }
+    e->mr = ibv_reg_mr(cache->pd, (void *)start, end - start, access);
+    if (!e->mr && (start != req_start || end != req_end)) {
+        // Part of the union may be gone without an munmap we could see
+        start = req_start;
+        end = req_end;
+        e->mr = ibv_reg_mr(cache->pd, (void *)start, end - start, access);
+    }
+    if (!e->mr) {
+        ERROR_LOG("Failed to register %zu bytes at %p: %s", (size_t)(end - start), (void *)start, strerror(errno));
+        free(e);
+        e = NULL;
+        goto out;
+    }
+
+    e->start = start;
+    e->end = end;
+    e->access = access;
+    e->refs = 1;
+    stats_counter_add(&cache->pinned, end - start);
+    cache->root = tree_insert(cache->root, e);
+    lru_push(cache, e);
+    stats_counter_add(&cache->misses, 1);
+
+out:
+    cache_busy--;
+    pthread_mutex_unlock(&cache->lock);
+    return e;
+}
+
+/**
+ * @brief Drops a reference taken by reg_cache_get
+ * @param cache Registration cache
+ * @param entry Entry to release
+ */
+void reg_cache_put(struct reg_cache *cache, struct reg_entry *entry)
+{
+    if (!cache || !entry || cache->implicit_odp) return;
+
+    pthread_mutex_lock(&cache->lock);
+    cache_busy++;
+    if (--entry->refs == 0 && entry->stale) {
+        stale_unlink(cache, entry);
+        entry_free(cache, entry);
+    }
+    cache_busy--;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @brief Finds the referenced entry a registration was handed out with
+ * @param cache Registration cache
+ * @param mr MR of an entry returned by reg_cache_get
+ * @return The entry, or NULL if mr is not the cache's
+ */
+struct reg_entry *reg_cache_find(struct reg_cache *cache, const struct ibv_mr *mr)
+{
+    if (!cache || !mr) {
+        return NULL;
+    }
+    for (int i = 0; i < REG_CACHE_IMPLICIT_SETS; i++) {
+        if (cache->implicit[i].mr && mr == cache->implicit[i].mr) {
+            return &cache->implicit[i];
+        }
+    }
+
+    struct reg_entry *found[REG_CACHE_MAX_OVERLAPS];
+    struct reg_entry *e = NULL;
+    uintptr_t start = (uintptr_t)mr->addr;
+
+    pthread_mutex_lock(&cache->lock);
+    size_t n = tree_overlaps(cache->root, start, start + 1, found, 0);
+    for (size_t i = 0; i < n && !e; i++) {
+        if (found[i]->mr == mr)
+            e = found[i];
+    }
+    for (struct reg_entry *s = cache->stale; s && !e; s = s->lru_next) {
+        if (s->mr == mr)
+            e = s;
+    }
+    pthread_mutex_unlock(&cache->lock);
+    return e;
+}
+
+/*******************************************************************************
+ * Invalidation
+ ******************************************************************************/
+
+/**
+ * @brief Drops every entry overlapping [start, end)
+ * @param cache Registration cache (lock held, cache_busy raised)
+ * @param start First byte of the range
+ * @param end One past the last byte
+ */
+static void invalidate_locked(struct reg_cache *cache, uintptr_t start, uintptr_t end)
+{
+    struct reg_entry *found[REG_CACHE_MAX_OVERLAPS];
+    size_t n;
+    while ((n = tree_overlaps(cache->root, start, end, found, 0)) > 0) {
+        for (size_t i = 0; i < n; i++)
+            entry_drop(cache, found[i]);
+    }
+}
+
+/**
+ * @brief Forgets every registration overlapping a range
+ * @param cache Registration cache
+ * @param addr Start of the range
+ * @param length Range length in bytes
+ */
+void reg_cache_invalidate(struct reg_cache *cache, void *addr, size_t length)
+{
+    if (!cache || length == 0) return;
+
+    pthread_mutex_lock(&cache->lock);
+    cache_busy++;
+    invalidate_locked(cache, (uintptr_t)addr, (uintptr_t)addr + length);
+    cache_busy--;
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @brief munmap() wrapper invalidating cached registrations of the range
+ * @param addr Start of the mapping
+ * @param length Length in bytes
+ * @return 0 on success, -1 with errno set on failure
+ *
+ * Interposes on the C library's munmap() for the program and for shared
+ * libraries that resolve it dynamically. Every cache stays locked from the
+ * invalidation until the pages are unmapped; otherwise a concurrent
+ * reg_cache_get() could register the doomed range again and keep a stale
+ * MR. Locks are taken in list order, after caches_lock, which no cache
+ * operation holds while taking its own lock. Calls made while a cache is
+ * working (ibv_dereg_mr may unmap provider memory) skip invalidation, since
+ * they never touch cached application memory.
+ */
+int munmap(void *addr, size_t length)
+{
+    if (atomic_load_explicit(&num_caches, memory_order_relaxed) == 0 || cache_busy || length == 0) {
+        return syscall(SYS_munmap, addr, length);
+    }
+
+    uintptr_t start = (uintptr_t)addr, end = (uintptr_t)addr + length;
+    pthread_mutex_lock(&caches_lock);
+    cache_busy++;
+    for (struct reg_cache *cache = caches; cache; cache = cache->next) {
+        pthread_mutex_lock(&cache->lock);
+        invalidate_locked(cache, start, end);
+    }
+    int ret = syscall(SYS_munmap, addr, length);
+    int saved_errno = errno;
+    for (struct reg_cache *cache = caches; cache; cache = cache->next)
+        pthread_mutex_unlock(&cache->lock);
+    cache_busy--;
+    pthread_mutex_unlock(&caches_lock);
+    errno = saved_errno;
+    return ret;
+}
@@ -0,0 +1,172 @@
+/**
+ * @file reg_cache.h
+ * @brief Memory registration cache interface
+ *
+ * Lets operations post straight from application memory without paying for
+ * ibv_reg_mr on every call. Registrations are kept in an interval tree keyed
+ * by address range and reused for any buffer they cover; overlapping idle
+ * registrations are merged into one. Idle registrations are evicted least
+ * recently used first to stay within a pinned-memory budget, and are dropped
+ * when the memory under them is unmapped.
+ *
+ * With rdma_opts.odp on a device supporting implicit On-Demand Paging, the
+ * cache instead hands out MRs covering the whole address space, one per set
+ * of access rights; nothing is pinned and the NIC resolves pages as they are
+ * accessed. Such an MR must never be advertised to a peer.
+ *
+ * An entry is only reused or merged for callers asking for exactly its
+ * rights, so memory never gains remote access its owner did not request.
+ */
+
+#ifndef REG_CACHE_H
+#define REG_CACHE_H
+
+#include "common.h"
+#include <pthread.h>
+
+/**
+ * Implicit ODP Access Sets
+ * REG_CACHE_IMPLICIT_ACCESS: Rights an implicit ODP MR may be registered with
+ * REG_CACHE_IMPLICIT_SETS: Implicit MRs a cache can hold, one per combination of remote rights
+ */
+#define REG_CACHE_IMPLICIT_ACCESS \
+    (IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_READ | IBV_ACCESS_REMOTE_ATOMIC)
+#define REG_CACHE_IMPLICIT_SETS 8
+
+/**
+ * @brief One cached registration
+ *
+ * Entries are nodes of an AVL tree ordered by start and augmented with the
+ * largest end in each subtree, so every entry overlapping a range is found
+ * in O(log n + k). refs counts users between reg_cache_get() and
+ * reg_cache_put(); only entries with refs == 0 are evicted or merged.
+ */
+struct reg_entry {
+    uintptr_t start;             // First byte covered (page-aligned)
+    uintptr_t end;               // One past the last byte covered (page-aligned)
+    int access;                  // ibv_access_flags of mr
+    struct ibv_mr *mr;           // Registration of [start, end)
+    uint32_t refs;               // Outstanding reg_cache_get() references
+    int stale;                   // Memory was unmapped; deregister on the last put
+    uintptr_t max_end;           // Largest end in this subtree
+    int height;                  // AVL height of this subtree
+    struct reg_entry *left;      // Entries starting earlier
+    struct reg_entry *right;     // Entries starting later (or equal)
+    struct reg_entry *lru_prev;  // More recently used neighbour (stale: previous stale entry)
+    struct reg_entry *lru_next;  // Less recently used neighbour (stale: next stale entry)
+};
+
+/**
+ * @brief Registration cache of one Protection Domain
+ */
+struct reg_cache {
+    struct ibv_pd *pd;           // PD every entry is registered with
+    size_t budget;               // Pinned-byte ceiling (0 = unlimited)
+    uint64_t pinned;             // Bytes currently registered by the cache
+    struct reg_entry *root;      // Interval tree of live entries
+    struct reg_entry *lru_head;  // Most recently used entry
+    struct reg_entry *lru_tail;  // Least recently used entry
+    struct reg_entry *stale;     // Unmapped entries still referenced, off the tree
+    pthread_mutex_t lock;        // Protects everything above (pinned is also readable unlocked)
+    uint64_t hits;               // Lookups served by an existing entry
+    uint64_t misses;             // Lookups that registered memory
+    uint64_t evictions;          // Entries deregistered for budget or merging
+                                 // (counters updated under lock, readable with stats_counter_read)
+    struct reg_cache *next;      // Next cache watching munmap
+    int implicit_odp;            // Entries are the implicit MRs below, nothing is cached
+    struct reg_entry implicit[REG_CACHE_IMPLICIT_SETS];  // Whole-address-space ODP MRs by access set
+                                 // (registered on first use, mr NULL until then)
+};
+
+/**
+ * @brief Creates a registration cache
+ *
+ * @param pd Protection Domain to register with
+ * @param budget Most bytes the cache may keep registered; 0 uses half of
+ *        RLIMIT_MEMLOCK (unlimited when that limit is)
+ * @return Cache on success, NULL on failure
+ */
+struct reg_cache *reg_cache_create(struct ibv_pd *pd, size_t budget);
+
+/**
+ * @brief Deregisters every entry and frees the cache
+ *
+ * @param cache Cache to destroy (may be NULL); entries still referenced are
+ *        deregistered too, so their MRs must no longer be posted
+ */
+void reg_cache_destroy(struct reg_cache *cache);
+
+/**
+ * @brief Returns a registration covering [addr, addr + length)
+ *
+ * @param cache Registration cache
+ * @param addr Start of the buffer
+ * @param length Buffer length in bytes
+ * @param access ibv_access_flags needed (IBV_ACCESS_LOCAL_WRITE is always added)
+ * @return Referenced entry on success, NULL if registration failed or the
+ *         budget is held entirely by referenced entries
+ *
+ * Post with entry->mr at reg_cache_offset(entry, addr), and hand the entry
+ * back with reg_cache_put() once the WR has completed.
+ */
+struct reg_entry *reg_cache_get(struct reg_cache *cache, void *addr, size_t length, int access);
+
+/**
+ * @brief Drops a reference taken by reg_cache_get
+ *
+ * @param cache Registration cache
+ * @param entry Entry to release; it stays cached for reuse unless it went stale
+ */
+void reg_cache_put(struct reg_cache *cache, struct reg_entry *entry);
+
+/**
+ * @brief Finds the referenced entry a registration was handed out with
+ *
+ * @param cache Registration cache
+ * @param mr entry->mr of an entry returned by reg_cache_get and not yet put
+ * @return The entry, or NULL if mr does not come from this cache
+ *
+ * Lets callers that only kept the MR (register_buffer) release it with
+ * reg_cache_put().
+ */
+struct reg_entry *reg_cache_find(struct reg_cache *cache, const struct ibv_mr *mr);
+
+/**
+ * @brief Forgets every registration overlapping a range
+ *
+ * @param cache Registration cache
+ * @param addr Start of the range
+ * @param length Range length in bytes
+ *
+ * Called automatically for munmap(), with every cache locked until the pages
+ * are gone, so no lookup can register the range again in between. Memory
+ * released any other way (free()
+ * of a large malloc block, mremap, madvise(MADV_DONTNEED)) must be reported
+ * by the caller before it is reused, or stale pages may be posted.
+ */
+void reg_cache_invalidate(struct reg_cache *cache, void *addr, size_t length);
+
+/**
+ * @brief Calls fn for every live registration cache
+ *
+ * @param fn Callback; must only read the cache's counters (stats_counter_read),
+ *           not take its lock or create or destroy caches
+ * @param ctx Passed through to fn
+ *
+ * Implicit ODP caches pin nothing and are not listed.
+ */
+void reg_cache_for_each(void (*fn)(const struct reg_cache *cache, void *ctx), void *ctx);
+
+/**
+ * @brief Offset of a buffer inside a cached registration
+ *
+ * @param entry Entry returned by reg_cache_get
+ * @param addr Address inside the entry's range
+ * @return Offset to pass with entry->mr to post_operation_mr / pipeline_post_mr
+ */
+static inline size_t reg_cache_offset(const struct reg_entry *entry, const void *addr)
+{
+    return (size_t)((uintptr_t)addr - (uintptr_t)entry->mr->addr);
+}
+
+#endif // REG_CACHE_H
@@ -10,6 +10,8 @@
  */
 
 #include "../common.h"
+#include "../srq.h"
+#include "../server.h"
 
 /**
  * @brief Posts a send operation
@@ -26,58 +28,108 @@ void sr_post_send(struct config_t *config, const char *message)
 }
 
 /**
- * @brief Main server event loop
+ * @brief Sets up the receive ring used by both sides
  *
  * @param config RDMA configuration structure
+ * @return RDMA status code
  *
- * Server operation sequence:
- * 1. Posts receive request for next message
- * 2. Waits for receive completion
- * 3. Processes received message
- * 4. Sends acknowledgment
- * 5. Waits for send completion
- * 6. Repeats from step 1
+ * Slots hold one full segment, so receive_message() can reassemble
+ * segmented messages from them.
  */
-static void sr_server_loop(struct config_t *config)
+static rdma_status_t sr_setup_ring(struct config_t *config)
 {
-    while (1) {
-        // Post receive operation to prepare for incoming message
-        post_receive(config);
-        wait_completion(config);
-        printf("Received: %s\n", (char *)config->buf);
+    size_t slot_size = config->seg_size < config->buf_size ? config->seg_size : config->buf_size;
+    return recv_ring_init(config, RECV_RING_DEFAULT_DEPTH, slot_size, RECV_RING_REPOST_BATCH);
+}
+
+/**
+ * @brief Sets up a newly connected client
+ *
+ * @param server Server the client connected to
+ * @param conn Client connection
+ * @return 0 on success, -1 to drop the client
+ *
+ * Keeps receives pre-posted so the client never waits on RNR, either in
+ * the client's own ring or in the server-wide SRQ (-q).
+ */
+static int sr_on_connect(struct rdma_server_t *server, struct config_t *conn)
+{
+    rdma_status_t status = server->dev.srq ? recv_ring_attach_srq(conn, server->dev.srq) : sr_setup_ring(conn);
+    return status == RDMA_SUCCESS ? 0 : -1;
+}
+
+/**
+ * @brief Handles the messages a client has waiting
+ *
+ * @param server Server the client is connected to
+ * @param conn Client connection
+ * @return 0 to keep the client, -1 to drop it (failed receive or oversized message)
+ *
+ * For each received message:
+ * 1. Waits until all of its segments have arrived
+ * 2. Processes received message
+ * 3. Sends acknowledgment
+ * 4. Waits for send completion
+ */
+static int sr_on_service(struct rdma_server_t *server, struct config_t *conn)
+{
+    (void)server;
+
+    while (conn->ring.ready_count > 0) {
+        // Receive the next message, reassembling it if it was segmented
+        ssize_t len = receive_message(conn);
+        if (len < 0) {
+            return -1;
+        }
+        printf("Received from QP %u (%zd bytes): %.*s\n", conn->qp->qp_num, len, (int)len, (char *)conn->buf);
         fflush(stdout);
         
         // Send acknowledgment back to client
-        sr_post_send(config, "ACK");
-        wait_completion(config);
+        sr_post_send(conn, "ACK");
+        wait_completion(conn);
     }
+    return 0;
 }
 
+static const struct server_ops sr_server_ops = {
+    .on_connect = sr_on_connect,
+    .on_service = sr_on_service,
+};
+
 /**
  * @brief Initializes and runs the send-receive server
  *
  * @return int 0 on success, -1 on failure
  *
  * Server initialization sequence:
- * 1. Sets up RDMA resources in send-receive mode
- * 2. Waits for client connection
- * 3. Enters message handling loop
+ * 1. Sets up the shared device, CQ and buffer pool (and SRQ with -q)
+ * 2. Accepts clients, each on its own QP
+ * 3. Answers every client's messages from one service loop
  * 4. Performs cleanup on exit
  */
 int sr_run_server(void)
 {
-    struct config_t config = {};
-    
-    // Initialize RDMA resources and wait for client connection
-    if (setup_rdma_connection(&config, NULL, MODE_SEND_RECV, NULL) != RDMA_SUCCESS) {
+    struct rdma_server_t server;
+
+    if (server_init(&server, MODE_SEND_RECV, &sr_server_ops, NULL) != RDMA_SUCCESS) {
         return -1;
     }
-    
+
+    // SRQ mode: all clients draw receives from one pool
+    if (rdma_opts.srq_depth) {
+        size_t slot_size = rdma_opts.max_msg_size < rdma_opts.buf_size ? rdma_opts.max_msg_size : rdma_opts.buf_size;
+        server.dev.srq = srq_create(&server.dev, rdma_opts.srq_depth, slot_size, rdma_opts.srq_depth / 4);
+        if (!server.dev.srq) {
+            server_destroy(&server);
+            return -1;
+        }
+    }
+
     printf("Send-Receive Server ready.\n");
-    sr_server_loop(&config);
+    int result = server_run(&server);
     
-    cleanup_resources(&config);
-    return 0;
+    server_destroy(&server);
+    return result;
 }
 
 /**
@@ -106,6 +158,12 @@ int sr_run_client(const char *server_name)
         return -1;
     }
     
+    // The ACK receive is posted before the message goes out
+    if (sr_setup_ring(&config) != RDMA_SUCCESS) {
+        cleanup_resources(&config);
+        return -1;
+    }
+
     printf("Connected to server. Enter messages (Ctrl+D to stop):\n");
     
     // Main input loop
@@ -124,8 +182,10 @@ int sr_run_client(const char *server_name)
         wait_completion(&config);
         
         // Wait for server acknowledgment
-        post_receive(&config);
-        wait_completion(&config);
+        if (receive_message(&config) < 0) {
+            cleanup_resources(&config);
+            return -1;
+        }
         printf("Server acknowledged\n");
     }
 
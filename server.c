@@ -0,0 +1,808 @@
+/**
+ * @file server.c
+ * @brief Multi-client RDMA server implementation
+ *
+ * Implements the shared-resource server:
+ * - Non-blocking listener accepting clients while others are serviced
+ * - Per-client QP on the shared PD, buffer taken from the shared pool
+ * - Workers with their own CQ, routing completions to connections by QP number
+ * - Optional worker threads pinned to CPUs, fed by an acceptor thread that
+ *   also runs the TCP handshake
+ * - Client teardown when its control socket closes (or its rdma_cm connection drops)
+ * - Event mode: epoll over sockets and the completion channel once idle
+ */
+
+#define _GNU_SOURCE  // pthread_setaffinity_np
+#include "server.h"
+#include "srq.h"
+#include "buffer_pool.h"
+#include "numa.h"
+#include "cm.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+/*******************************************************************************
+ * Connection Management
+ ******************************************************************************/
+
+/**
+ * @brief Adds a descriptor to a worker's epoll set
+ * @param worker Worker in event mode
+ * @param fd Descriptor to watch for input
+ * @param ptr Identifies the descriptor in returned events
+ * @return 0 on success, -1 on failure
+ */
+static int worker_watch(struct server_worker_t *worker, int fd, void *ptr)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = ptr };
+
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+        ERROR_LOG("Failed to watch fd %d: %s", fd, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Tears down one client connection
+ * @param worker Worker owning the connection
+ * @param conn Connection to drop (removed from the worker's table and freed)
+ */
+static void worker_drop(struct server_worker_t *worker, struct config_t *conn)
+{
+    struct rdma_server_t *server = worker->server;
+
+    if (server->ops->on_disconnect)
+        server->ops->on_disconnect(server, conn);
+
+    uint32_t qp_num = conn->qp ? conn->qp->qp_num : 0;
+    cleanup_resources(conn);
+    free(conn);
+    atomic_fetch_sub_explicit(&worker->load, 1, memory_order_relaxed);
+    printf("Client on QP %u disconnected (worker %u, %u connected)\n", qp_num, worker->index,
+           worker->dev.num_conns);
+    fflush(stdout);
+}
+
+/**
+ * @brief Takes the next waiting client off the listener
+ * @param server Server
+ * @return New connection holding its control socket (or rdma_cm request), NULL if none is waiting
+ */
+static struct config_t *server_accept(struct rdma_server_t *server)
+{
+    struct config_t *conn = calloc(1, sizeof(*conn));
+    if (!conn) {
+        ERROR_LOG("Out of memory for a new client");
+        return NULL;
+    }
+
+#ifdef RDMA_CM
+    if (server->cm_listener) {
+        if (cm_take_request(server->cm_listener, server->dev.context, conn) == 0)
+            return conn;
+        free(conn);
+        return NULL;
+    }
+#endif
+
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            ERROR_LOG("Failed to accept: %s", strerror(errno));
+        free(conn);
+        return NULL;
+    }
+
+    // A stalled client must not hold up the QP exchange for everyone else
+    struct timeval timeout = { .tv_sec = 5, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    conn->sock_fd = fd;
+    return conn;
+}
+
+/**
+ * @brief Turns away a client taken by server_accept()
+ * @param conn Connection without resources (its socket is closed, its request rejected)
+ */
+static void server_discard(struct config_t *conn)
+{
+    cleanup_resources(conn);
+    free(conn);
+}
+
+/**
+ * @brief Brings up the QP of an accepted client on a worker
+ * @param worker Worker that will own the connection (its load already counts it)
+ * @param conn Connection from server_accept(), or from server_handshake() if it has a QP already
+ */
+static void worker_connect(struct server_worker_t *worker, struct config_t *conn)
+{
+    struct rdma_server_t *server = worker->server;
+
+    conn->dev = &worker->dev;
+    if (conn->qp) {
+        // The acceptor did the handshake; the QP leaves RESET only once its completions are routed here
+        if (device_attach(&worker->dev, conn) != RDMA_SUCCESS
+            || bring_up_qp(conn, server->mode) != RDMA_SUCCESS) {
+            ERROR_LOG("Failed to bring up the QP of a client on worker %u", worker->index);
+            server_discard(conn);
+            atomic_fetch_sub_explicit(&worker->load, 1, memory_order_relaxed);
+            return;
+        }
+    } else {
+        // A failed setup or handshake releases everything (the socket included), dropping only this client
+        if (setup_rdma_connection(conn, NULL, server->mode, NULL) != RDMA_SUCCESS) {
+            free(conn);
+            atomic_fetch_sub_explicit(&worker->load, 1, memory_order_relaxed);
+            return;
+        }
+    }
+
+    if (server->ops->on_connect && server->ops->on_connect(server, conn)) {
+        worker_drop(worker, conn);
+        return;
+    }
+
+    // Closing the socket on drop also removes it from the epoll set
+    if (worker->epoll_fd >= 0 && worker_watch(worker, conn->sock_fd, conn)) {
+        worker_drop(worker, conn);
+        return;
+    }
+
+    printf("Client connected on QP %u (worker %u, %u connected)\n", conn->qp->qp_num, worker->index,
+           worker->dev.num_conns);
+    fflush(stdout);
+}
+
+/**
+ * @brief Counts every connection the server holds or has queued
+ * @param server Server
+ * @return Connections across all workers
+ */
+static uint32_t server_load(struct rdma_server_t *server)
+{
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < server->num_workers; i++)
+        total += atomic_load_explicit(&server->workers[i].load, memory_order_relaxed);
+    return total;
+}
+
+/**
+ * @brief Takes in new clients for a worker
+ * @param worker Worker whose intake fd is readable
+ *
+ * An inline worker accepts straight from the listener; a worker thread
+ * takes the clients the acceptor queued for it.
+ */
+static void worker_intake(struct server_worker_t *worker)
+{
+    struct rdma_server_t *server = worker->server;
+
+    if (!server->threaded) {
+        struct config_t *conn;
+        while ((conn = server_accept(server))) {
+            if (server_load(server) >= rdma_opts.max_conns) {
+                ERROR_LOG("Connection limit of %u reached, rejecting client", rdma_opts.max_conns);
+                server_discard(conn);
+                continue;
+            }
+            atomic_fetch_add_explicit(&worker->load, 1, memory_order_relaxed);
+            worker_connect(worker, conn);
+        }
+        return;
+    }
+
+    uint64_t signals;
+    if (read(worker->intake_fd, &signals, sizeof(signals)) < 0 && errno != EAGAIN) {
+        ERROR_LOG("Failed to read worker eventfd: %s", strerror(errno));
+    }
+
+    struct config_t *conns[rdma_opts.max_conns];
+    pthread_mutex_lock(&worker->lock);
+    uint32_t count = worker->handoff_count;
+    memcpy(conns, worker->handoff, count * sizeof(*conns));
+    worker->handoff_count = 0;
+    pthread_mutex_unlock(&worker->lock);
+
+    for (uint32_t i = 0; i < count; i++)
+        worker_connect(worker, conns[i]);
+}
+
+/**
+ * @brief Checks the intake fd and every control socket without blocking
+ * @param worker Worker to check
+ *
+ * Clients send nothing on the control socket once connected, so any
+ * readable or hung-up socket means the client went away.
+ */
+static void worker_poll_sockets(struct server_worker_t *worker)
+{
+    uint32_t n = worker->dev.num_conns;
+    struct pollfd fds[n + 1];
+    struct config_t *conns[n];
+
+    fds[0] = (struct pollfd){ .fd = worker->intake_fd, .events = POLLIN };
+    for (uint32_t i = 0; i < n; i++) {
+        conns[i] = worker->dev.conns[i];
+        fds[i + 1] = (struct pollfd){ .fd = conns[i]->sock_fd, .events = POLLIN };
+    }
+
+    if (poll(fds, n + 1, 0) <= 0) {
+        return;
+    }
+
+    // Drops reorder dev.conns, so work from the snapshot taken above
+    for (uint32_t i = 0; i < n; i++) {
+        if (fds[i + 1].revents)
+            worker_drop(worker, conns[i]);
+    }
+    if (fds[0].revents & POLLIN)
+        worker_intake(worker);
+}
+
+/**
+ * @brief Waits for socket, SRQ and completion events (event mode)
+ * @param worker Worker in event mode
+ * @param timeout epoll_wait timeout in ms; -1 arms the CQ and sleeps until something happens
+ * @return 0 on success, -1 if the CQ can no longer be armed or polled
+ *
+ * Before sleeping the CQ is armed and polled once more, so a completion
+ * that raced with arming is dispatched instead of missed.
+ */
+static int worker_wait_events(struct server_worker_t *worker, int timeout)
+{
+    struct rdma_device_t *dev = &worker->dev;
+
+    if (timeout != 0) {
+        struct ibv_wc wc[CQ_POLL_BATCH];
+        if (ibv_req_notify_cq(dev->cq, 0)) {
+            ERROR_LOG("Failed to arm CQ notification of worker %u", worker->index);
+            return -1;
+        }
+        int n = device_poll_completions(dev, wc, CQ_POLL_BATCH);
+        if (n < 0) {
+            ERROR_LOG("Failed to poll CQ of worker %u", worker->index);
+            return -1;
+        }
+        if (n > 0) {
+            return 0;
+        }
+    }
+
+    struct epoll_event events[SERVER_EPOLL_BATCH];
+    int n = epoll_wait(worker->epoll_fd, events, SERVER_EPOLL_BATCH, timeout);
+    if (n < 0) {
+        if (errno != EINTR)
+            ERROR_LOG("epoll_wait failed: %s", strerror(errno));
+        return 0;
+    }
+
+    int intake_pending = 0;
+    for (int i = 0; i < n; i++) {
+        void *ptr = events[i].data.ptr;
+        if (ptr == dev->channel) {
+            // Acknowledge; the completions themselves are reaped by the service loop
+            struct ibv_cq *ev_cq;
+            void *ev_ctx;
+            while (ibv_get_cq_event(dev->channel, &ev_cq, &ev_ctx) == 0)
+                ibv_ack_cq_events(ev_cq, 1);
+        } else if (ptr == &worker->intake_fd) {
+            intake_pending = 1;
+        } else if (ptr == dev->context) {
+            srq_poll_events(dev->srq);
+        } else {
+            // Clients send nothing on the control socket once connected
+            worker_drop(worker, ptr);
+        }
+    }
+    if (intake_pending)
+        worker_intake(worker);
+    return 0;
+}
+
+/*******************************************************************************
+ * Workers
+ ******************************************************************************/
+
+/**
+ * @brief Pins the calling thread to the worker's CPU
+ * @param worker Worker about to run its loop
+ *
+ * A worker without a CPU of its own is kept on the device's local CPUs if it
+ * runs on a thread of its own; the single inline worker runs on the caller's
+ * thread, which is left alone unless rdma_opts.numa_pin asks for it.
+ */
+static void worker_pin(struct server_worker_t *worker)
+{
+    if (worker->cpu < 0) {
+        if (rdma_opts.numa && (worker->server->threaded || rdma_opts.numa_pin))
+            numa_pin_local(worker->dev.context);
+        return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(worker->cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err) {
+        ERROR_LOG("Failed to pin worker %u to CPU %d: %s", worker->index, worker->cpu, strerror(err));
+        return;
+    }
+    DEBUG_LOG("Worker %u pinned to CPU %d", worker->index, worker->cpu);
+}
+
+/**
+ * @brief Service loop of one worker
+ * @param worker Worker to run
+ * @return -1 on failure, 0 once the server asks workers to stop
+ */
+static int worker_loop(struct server_worker_t *worker)
+{
+    struct rdma_server_t *server = worker->server;
+    struct rdma_device_t *dev = &worker->dev;
+    struct ibv_wc wc[CQ_POLL_BATCH];
+    uint32_t passes = 0;
+    struct wait_state_t state = {};
+
+    // Only worker 0 handles SRQ limit events, which arrive on the device async fd
+    int srq_events = worker->index == 0 && dev->srq;
+    if (worker->epoll_fd >= 0 && srq_events && worker_watch(worker, dev->context->async_fd, dev->context)) {
+        return -1;
+    }
+
+    worker_pin(worker);
+    while (!atomic_load_explicit(&server->stop, memory_order_relaxed)) {
+        int n = device_poll_completions(dev, wc, CQ_POLL_BATCH);
+        if (n < 0) {
+            ERROR_LOG("Failed to poll CQ of worker %u", worker->index);
+            return -1;
+        }
+
+        for (uint32_t i = 0; i < dev->num_conns;) {
+            struct config_t *conn = dev->conns[i];
+            // A failed receive breaks only its own connection
+            if ((conn->ring.failed && conn->ring.ready_count == 0)
+                || (server->ops->on_service && conn->ring.ready_count > 0
+                    && server->ops->on_service(server, conn))) {
+                worker_drop(worker, conn);  // The last connection now sits in slot i
+                continue;
+            }
+            i++;
+        }
+
+        if (n > 0)
+            state.empty_polls = 0;
+        if (worker->epoll_fd >= 0) {
+            // Back off per the wait policy, then sleep until a completion or socket event
+            if (n == 0 && wait_backoff(&server->wait, &state, 1)) {
+                if (worker_wait_events(worker, -1))
+                    return -1;
+                state.empty_polls = 0;
+            } else if (++passes % SERVER_SOCKET_POLL_INTERVAL == 0) {
+                if (worker_wait_events(worker, 0))
+                    return -1;
+            }
+            continue;
+        }
+
+        if (n == 0)
+            wait_backoff(&server->wait, &state, 0);
+        // Look for new and departed clients whenever idle, and now and then when busy
+        if (n == 0 || ++passes % SERVER_SOCKET_POLL_INTERVAL == 0)
+            worker_poll_sockets(worker);
+        if (n == 0 && srq_events && state.empty_polls % SRQ_EVENT_POLL_INTERVAL == 0)
+            srq_poll_events(dev->srq);
+    }
+    return 0;
+}
+
+/**
+ * @brief Worker thread entry point
+ * @param arg Worker
+ * @return NULL
+ *
+ * A worker whose CQ fails drops only its own clients and takes no new ones;
+ * the other workers keep serving.
+ */
+static void *worker_thread(void *arg)
+{
+    struct server_worker_t *worker = arg;
+
+    if (worker_loop(worker) == 0) {
+        return NULL;
+    }
+
+    ERROR_LOG("Worker %u failed, dropping its %u clients", worker->index, worker->dev.num_conns);
+    pthread_mutex_lock(&worker->lock);
+    atomic_store(&worker->failed, 1);
+    uint32_t count = worker->handoff_count;
+    worker->handoff_count = 0;
+    pthread_mutex_unlock(&worker->lock);
+
+    for (uint32_t i = 0; i < count; i++) {
+        server_discard(worker->handoff[i]);
+        atomic_fetch_sub_explicit(&worker->load, 1, memory_order_relaxed);
+    }
+    while (worker->dev.num_conns > 0)
+        worker_drop(worker, worker->dev.conns[0]);
+    return NULL;
+}
+
+/**
+ * @brief Creates a worker's CQ, intake fd and epoll set
+ * @param server Initialized server (device and listener ready)
+ * @param worker Worker to set up
+ * @param index Worker number
+ * @return RDMA_SUCCESS on success, error code on failure
+ */
+static rdma_status_t worker_init(struct rdma_server_t *server, struct server_worker_t *worker, uint32_t index)
+{
+    worker->server = server;
+    worker->index = index;
+    worker->cpu = rdma_opts.num_cpus ? rdma_opts.cpus[index % rdma_opts.num_cpus] : -1;
+    worker->epoll_fd = -1;
+    worker->intake_fd = -1;
+    atomic_init(&worker->load, 0);
+    atomic_init(&worker->failed, 0);
+    pthread_mutex_init(&worker->lock, NULL);
+
+    // Same PD, pool and SRQ as every other worker; the CQ is this worker's alone
+    worker->dev.context = server->dev.context;
+    worker->dev.pd = server->dev.pd;
+    worker->dev.numa_node = server->dev.numa_node;
+    worker->dev.odp_caps = server->dev.odp_caps;
+    worker->dev.pool = server->dev.pool;
+    // Any worker may see every receive of the SRQ a mode sets up from -q
+    rdma_status_t status = device_share_cq(&worker->dev, rdma_opts.max_conns, rdma_opts.srq_depth);
+    if (status != RDMA_SUCCESS) {
+        return status;
+    }
+
+    if (server->threaded) {
+        worker->handoff = calloc(rdma_opts.max_conns, sizeof(*worker->handoff));
+        worker->intake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (!worker->handoff || worker->intake_fd < 0) {
+            return RDMA_ERR_RESOURCE;
+        }
+    } else {
+        worker->intake_fd = server->listen_fd;
+    }
+
+    // Event mode: sleep in epoll_wait on the intake fd and the CQ's channel
+    if (worker->dev.channel) {
+        worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (worker->epoll_fd < 0
+            || worker_watch(worker, worker->intake_fd, &worker->intake_fd)
+            || worker_watch(worker, worker->dev.channel->fd, worker->dev.channel)) {
+            return RDMA_ERR_RESOURCE;
+        }
+    }
+    return RDMA_SUCCESS;
+}
+
+/**
+ * @brief Disconnects a worker's clients and releases its resources
+ * @param worker Worker whose thread (if any) has exited
+ */
+static void worker_destroy(struct server_worker_t *worker)
+{
+    while (worker->dev.num_conns > 0)
+        worker_drop(worker, worker->dev.conns[0]);
+    for (uint32_t i = 0; i < worker->handoff_count; i++)
+        server_discard(worker->handoff[i]);
+
+    if (worker->epoll_fd >= 0)
+        close(worker->epoll_fd);
+    if (worker->server->threaded && worker->intake_fd >= 0)
+        close(worker->intake_fd);
+    free(worker->handoff);
+    device_unshare_cq(&worker->dev);
+    pthread_mutex_destroy(&worker->lock);
+}
+
+/*******************************************************************************
+ * Acceptor
+ ******************************************************************************/
+
+/**
+ * @brief Creates a client's QP for a worker and exchanges the TCP handshake with it
+ * @param server Threaded server
+ * @param worker Worker the client goes to
+ * @param conn Connection from server_accept()
+ * @return RDMA_SUCCESS, or an error code once conn has been released (the socket included)
+ *
+ * Runs on the acceptor. The QP completes into the worker's CQ but is created
+ * on worker->staging, which has no routing table, so nothing the worker
+ * reads is touched here; worker_connect() attaches the QP and moves it out
+ * of RESET. Over rdma_cm the worker still runs the whole setup itself.
+ */
+static rdma_status_t server_handshake(struct rdma_server_t *server, struct server_worker_t *worker,
+                                      struct config_t *conn)
+{
+    conn->dev = &worker->staging;
+
+    rdma_status_t status = init_resources(conn, server->mode);
+    if (status != RDMA_SUCCESS) {
+        ERROR_LOG("Failed to initialize resources for a client (status %d)", status);
+        free(conn);
+        return status;
+    }
+
+    status = exchange_handshake(conn, NULL);
+    if (status != RDMA_SUCCESS) {
+        ERROR_LOG("Client handshake failed (status %d)", status);
+        server_discard(conn);
+    }
+    return status;
+}
+
+/**
+ * @brief Hands an accepted client to the least loaded worker
+ * @param server Threaded server
+ * @param conn Connection from server_accept()
+ * @return 0 on success (or if the client was turned away), -1 once every worker has failed
+ *
+ * A client that is slow to answer the handshake holds up only further
+ * accepts (for up to its socket timeout), never a worker's clients.
+ */
+static int server_dispatch(struct rdma_server_t *server, struct config_t *conn)
+{
+    if (server_load(server) >= rdma_opts.max_conns) {
+        ERROR_LOG("Connection limit of %u reached, rejecting client", rdma_opts.max_conns);
+        server_discard(conn);
+        return 0;
+    }
+
+    for (;;) {
+        struct server_worker_t *target = NULL;
+        for (uint32_t i = 0; i < server->num_workers; i++) {
+            struct server_worker_t *worker = &server->workers[i];
+            if (atomic_load(&worker->failed))
+                continue;
+            if (!target || atomic_load_explicit(&worker->load, memory_order_relaxed)
+                               < atomic_load_explicit(&target->load, memory_order_relaxed))
+                target = worker;
+        }
+        if (!target) {
+            ERROR_LOG("No worker left to serve clients");
+            server_discard(conn);
+            return -1;
+        }
+
+        // A worker failing meanwhile no longer takes its queue, so pick again
+        pthread_mutex_lock(&target->lock);
+        if (atomic_load(&target->failed)) {
+            pthread_mutex_unlock(&target->lock);
+            continue;
+        }
+        atomic_fetch_add_explicit(&target->load, 1, memory_order_relaxed);
+        pthread_mutex_unlock(&target->lock);
+
+        if (!server->cm_listener && server_handshake(server, target, conn) != RDMA_SUCCESS) {
+            atomic_fetch_sub_explicit(&target->load, 1, memory_order_relaxed);
+            return 0;
+        }
+
+        // The QP is bound to the target's CQ by now, so a target that failed during the handshake drops it
+        pthread_mutex_lock(&target->lock);
+        if (atomic_load(&target->failed)) {
+            pthread_mutex_unlock(&target->lock);
+            server_discard(conn);
+            atomic_fetch_sub_explicit(&target->load, 1, memory_order_relaxed);
+            return 0;
+        }
+        target->handoff[target->handoff_count++] = conn;
+        pthread_mutex_unlock(&target->lock);
+
+        uint64_t one = 1;
+        if (write(target->intake_fd, &one, sizeof(one)) < 0) {
+            ERROR_LOG("Failed to signal worker %u: %s", target->index, strerror(errno));
+        }
+        return 0;
+    }
+}
+
+/**
+ * @brief Accept loop of a threaded server
+ * @param server Server whose workers are running
+ * @return -1 on failure (including every worker having failed)
+ */
+static int server_accept_loop(struct rdma_server_t *server)
+{
+    struct pollfd pfd = { .fd = server->listen_fd, .events = POLLIN };
+
+    while (!atomic_load_explicit(&server->stop, memory_order_relaxed)) {
+        if (poll(&pfd, 1, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            ERROR_LOG("Failed to wait on listener: %s", strerror(errno));
+            return -1;
+        }
+
+        struct config_t *conn;
+        while ((conn = server_accept(server))) {
+            if (server_dispatch(server, conn))
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ * Server Lifecycle
+ ******************************************************************************/
+
+/**
+ * @brief Creates the buffer pool, the listener and the workers of an opened server
+ * @param server Server whose device is open
+ * @return RDMA_SUCCESS on success, error code on failure (server destroyed)
+ */
+static rdma_status_t server_setup(struct rdma_server_t *server)
+{
+    rdma_status_t status;
+
+    // One page-aligned slab per client, all covered by a single local-only MR; a client whose
+    // mode grants remote access gets an MR of its own over its slab (see init_resources)
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    struct pool_class_config cls = {
+        .slab_size = (rdma_opts.buf_size + page_size - 1) & ~(page_size - 1),
+        .count = rdma_opts.max_conns,
+    };
+    int access = IBV_ACCESS_LOCAL_WRITE;
+    if (server->dev.odp_caps & ODP_CAP_EXPLICIT)
+        access |= IBV_ACCESS_ON_DEMAND;
+    server->dev.pool = buffer_pool_create(server->dev.pd, &cls, 1, access, POOL_FLAG_HUGEPAGE, server->dev.numa_node);
+    if (!server->dev.pool) {
+        server_destroy(server);
+        return RDMA_ERR_RESOURCE;
+    }
+
+#ifdef RDMA_CM
+    if (rdma_opts.cm)
+        server->listen_fd = cm_create_listener(LISTEN_BACKLOG, &server->cm_listener);
+    else
+#endif
+        server->listen_fd = create_listener(LISTEN_BACKLOG);
+    int flags = fcntl(server->listen_fd, F_GETFL);
+    if (flags < 0 || fcntl(server->listen_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        server_destroy(server);
+        return RDMA_ERR_COMMUNICATION;
+    }
+
+    uint32_t count = server->threaded ? rdma_opts.workers : 1;
+    server->workers = calloc(count, sizeof(*server->workers));
+    if (!server->workers) {
+        server_destroy(server);
+        return RDMA_ERR_RESOURCE;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        server->num_workers++;
+        status = worker_init(server, &server->workers[i], i);
+        if (status != RDMA_SUCCESS) {
+            server_destroy(server);
+            return status;
+        }
+    }
+
+    DEBUG_LOG("Server ready for %u clients on %u worker%s%s", rdma_opts.max_conns, count,
+        server->threaded ? " threads" : "", rdma_opts.event_mode ? " (event mode)" : "");
+    return RDMA_SUCCESS;
+}
+
+/**
+ * @brief Opens the device and creates the buffer pool and per-worker CQs
+ * @param server Server to initialize
+ * @param mode RDMA mode of every connection
+ * @param ops Connection callbacks
+ * @param ctx Mode-specific state
+ * @return RDMA_SUCCESS on success, error code on failure
+ *
+ * With NUMA placement the calling thread runs on the device's local CPUs
+ * while the CQs are created, so the provider touches their memory there
+ * first, and gets its own affinity back before returning.
+ */
+rdma_status_t server_init(struct rdma_server_t *server, rdma_mode_t mode, const struct server_ops *ops, void *ctx)
+{
+    memset(server, 0, sizeof(*server));
+    server->mode = mode;
+    server->ops = ops;
+    server->ctx = ctx;
+    server->listen_fd = -1;
+    server->wait = rdma_opts.wait;
+    server->threaded = rdma_opts.workers > 0;
+    atomic_init(&server->stop, 0);
+
+    rdma_status_t status = open_device(&server->dev);
+    if (status != RDMA_SUCCESS) {
+        return status;
+    }
+
+    cpu_set_t caller;
+    int restore = rdma_opts.numa && sched_getaffinity(0, sizeof(caller), &caller) == 0
+                  && numa_pin_local(server->dev.context) == 0;
+    status = server_setup(server);
+    if (restore && sched_setaffinity(0, sizeof(caller), &caller)) {
+        ERROR_LOG("Failed to restore the caller's CPU affinity: %s", strerror(errno));
+    }
+    return status;
+}
+
+/**
+ * @brief Accepts and services clients until a fatal error
+ * @param server Initialized server
+ * @return -1 on failure
+ */
+int server_run(struct rdma_server_t *server)
+{
+    // The SRQ is set after server_init(); every worker creates its QPs on it
+    for (uint32_t i = 0; i < server->num_workers; i++) {
+        struct server_worker_t *worker = &server->workers[i];
+        worker->dev.srq = server->dev.srq;
+
+        // What init_resources() needs of dev, minus the connection table the worker alone touches
+        worker->staging = (struct rdma_device_t){
+            .context = worker->dev.context,
+            .pd = worker->dev.pd,
+            .numa_node = worker->dev.numa_node,
+            .odp_caps = worker->dev.odp_caps,
+            .srq = worker->dev.srq,
+            .cq = worker->dev.cq,
+            .channel = worker->dev.channel,
+            .pool = worker->dev.pool,
+        };
+    }
+
+    if (!server->threaded) {
+        return worker_loop(&server->workers[0]);
+    }
+
+    for (uint32_t i = 0; i < server->num_workers; i++) {
+        struct server_worker_t *worker = &server->workers[i];
+        int err = pthread_create(&worker->thread, NULL, worker_thread, worker);
+        if (err) {
+            ERROR_LOG("Failed to start worker %u: %s", i, strerror(err));
+            return -1;
+        }
+        worker->started = 1;
+    }
+    return server_accept_loop(server);
+}
+
+/**
+ * @brief Stops the workers, disconnects every client and releases the shared resources
+ * @param server Server to destroy
+ */
+void server_destroy(struct rdma_server_t *server)
+{
+    atomic_store(&server->stop, 1);
+    for (uint32_t i = 0; i < server->num_workers; i++) {
+        struct server_worker_t *worker = &server->workers[i];
+        if (!worker->started)
+            continue;
+        uint64_t one = 1;
+        if (write(worker->intake_fd, &one, sizeof(one)) < 0) {
+            ERROR_LOG("Failed to wake worker %u: %s", i, strerror(errno));
+        }
+        pthread_join(worker->thread, NULL);
+    }
+
+    for (uint32_t i = 0; i < server->num_workers; i++)
+        worker_destroy(&server->workers[i]);
+    free(server->workers);
+
+#ifdef RDMA_CM
+    if (server->cm_listener)
+        cm_destroy_listener(server->cm_listener);
+    else
+#endif
+    if (server->listen_fd >= 0)
+        close(server->listen_fd);
+    srq_destroy(server->dev.srq);
+    buffer_pool_destroy(server->dev.pool);
+    close_device(&server->dev);
+}
@@ -0,0 +1,129 @@
+/**
+ * @file server.h
+ * @brief Multi-client RDMA server interface
+ *
+ * Keeps the listening socket open and gives every accepted client its own
+ * RC Queue Pair. All connections share one device context, Protection
+ * Domain and registered buffer pool (and the SRQ when one is set on the
+ * device). Connections are sharded across workers; each worker owns a
+ * Completion Queue and services its clients from a single polling loop,
+ * optionally on its own thread pinned to a CPU.
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "common.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/**
+ * Server Configuration Constants
+ * SERVER_SOCKET_POLL_INTERVAL: Busy service passes between checks for new and closed clients
+ * SERVER_EPOLL_BATCH: Events taken per epoll_wait call (event mode)
+ */
+#define SERVER_SOCKET_POLL_INTERVAL 1024
+#define SERVER_EPOLL_BATCH 32
+
+struct rdma_server_t;
+
+/**
+ * Connection Callbacks
+ * Called on the thread of the worker owning the connection, so with several
+ * workers they run concurrently for different clients.
+ * on_connect: The client's QP is ready to send; set up per-connection state
+ *             (receive ring, initial buffer contents...). Non-zero drops the client
+ * on_service: The connection has completed receives waiting in its receive ring.
+ *             Non-zero drops the client
+ * on_disconnect: The client is about to be torn down (optional)
+ */
+struct server_ops {
+    int (*on_connect)(struct rdma_server_t *server, struct config_t *conn);
+    int (*on_service)(struct rdma_server_t *server, struct config_t *conn);
+    void (*on_disconnect)(struct rdma_server_t *server, struct config_t *conn);
+};
+
+/**
+ * @brief One service loop with its own CQ and connections
+ *
+ * dev borrows the server's context, PD, pool and SRQ but has its own CQ and
+ * connection table, so no CQ or connection state is shared between workers.
+ * New clients reach a worker through intake_fd: the listener itself when the
+ * worker serves inline, otherwise an eventfd the acceptor signals after
+ * queueing the accepted client in handoff. Over TCP the acceptor has already
+ * created the client's QP on staging and exchanged the handshake, so a slow
+ * client never stalls the worker's service loop; the worker only routes the
+ * QP's completions and brings it up.
+ */
+struct server_worker_t {
+    struct rdma_server_t *server; // Owning server
+    uint32_t index;              // Worker number
+    int cpu;                     // CPU the loop is pinned to (-1 = unpinned)
+    struct rdma_device_t dev;    // Shared resources plus this worker's CQ and conns
+    struct rdma_device_t staging; // dev without conns: the acceptor sets clients up on it
+    int epoll_fd;                // Event mode only (-1 = busy polling)
+    int intake_fd;               // Readable when new clients are waiting
+    pthread_mutex_t lock;        // Protects handoff / handoff_count
+    struct config_t **handoff;   // Accepted clients queued by the acceptor
+    uint32_t handoff_count;      // Entries in handoff
+    _Atomic uint32_t load;       // Connections owned or queued
+    _Atomic int failed;          // CQ failed; clients dropped, no new ones taken (set under lock)
+    pthread_t thread;            // Worker thread (threaded servers only)
+    int started;                 // thread is running
+};
+
+/**
+ * @brief Multi-client server state
+ *
+ * With rdma_opts.workers = 0 a single worker runs inline in server_run() and
+ * accepts on the listener itself. Otherwise server_run() starts that many
+ * worker threads and becomes the acceptor, handing each client to the least
+ * loaded worker that has not failed. In event mode every worker sleeps in epoll_wait on its
+ * intake fd, its CQ's completion channel, its clients' control sockets and
+ * (worker 0, with an SRQ) the device async fd.
+ */
+struct rdma_server_t {
+    struct rdma_device_t dev;    // Shared context, PD, pool (and optional SRQ)
+    rdma_mode_t mode;            // Mode every connection is set up in
+    int listen_fd;               // Listening socket, kept open (rdma_cm: cm_listener's event fd)
+    struct rdma_cm_id *cm_listener; // rdma_cm listener (-R), NULL with TCP
+    const struct server_ops *ops; // Mode callbacks
+    void *ctx;                   // Mode-specific state
+    struct wait_policy_t wait;   // Back-off of the service loops while their CQ is empty
+    struct server_worker_t *workers; // Service loops
+    uint32_t num_workers;        // Entries in workers
+    int threaded;                // Workers run on their own threads
+    _Atomic int stop;            // Asks the worker threads to exit
+};
+
+/**
+ * @brief Opens the device and creates the buffer pool and per-worker CQs
+ *
+ * @param server Server to initialize
+ * @param mode RDMA mode of every connection
+ * @param ops Connection callbacks
+ * @param ctx Mode-specific state, available as server->ctx
+ * @return RDMA_SUCCESS on success, error code on failure
+ *
+ * Sized for rdma_opts.max_conns clients with rdma_opts.buf_size bytes each,
+ * spread over rdma_opts.workers workers. An SRQ may be set on server->dev
+ * after this call and before server_run().
+ */
+rdma_status_t server_init(struct rdma_server_t *server, rdma_mode_t mode, const struct server_ops *ops, void *ctx);
+
+/**
+ * @brief Accepts and services clients until a fatal error
+ *
+ * @param server Initialized server
+ * @return -1 on failure (does not return otherwise)
+ */
+int server_run(struct rdma_server_t *server);
+
+/**
+ * @brief Stops the workers, disconnects every client and releases the shared resources
+ *
+ * @param server Server to destroy (its SRQ, if any, is destroyed too)
+ */
+void server_destroy(struct rdma_server_t *server);
+
+#endif // SERVER_H
@@ -0,0 +1,237 @@
+/**
+ * @file srq.c
+ * @brief Shared Receive Queue implementation
+ *
+ * Implements the shared receive pool:
+ * - SRQ creation sized against device limits
+ * - Batched, chained reposting of released slots
+ * - Low-watermark refill driven by IBV_EVENT_SRQ_LIMIT_REACHED
+ */
+
+#include "srq.h"
+#include "hugepage.h"
+#include <fcntl.h>
+
+/*******************************************************************************
+ * Slot Posting
+ ******************************************************************************/
+
+/**
+ * @brief Posts released slots as one chained receive list
+ * @param srq Shared Receive Queue (lock held by caller)
+ */
+static void post_free_slots(struct srq_t *srq)
+{
+    if (srq->free_count == 0) {
+        return;
+    }
+
+    struct ibv_recv_wr wrs[srq->repost_batch];
+    struct ibv_sge sges[srq->repost_batch];
+
+    // Chains are capped at repost_batch WRs to bound stack usage
+    while (srq->free_count > 0) {
+        uint32_t n = srq->free_count < srq->repost_batch ? srq->free_count : srq->repost_batch;
+        uint32_t *slots = &srq->free_slots[srq->free_count - n];
+
+        for (uint32_t i = 0; i < n; i++) {
+            sges[i].addr = (uint64_t)srq_data(srq, slots[i]);
+            sges[i].length = srq->slot_size;
+            sges[i].lkey = srq->mr->lkey;
+
+            wrs[i].wr_id = WR_ID_MAKE(WR_TAG_RECV_RING, slots[i]);
+            wrs[i].sg_list = &sges[i];
+            wrs[i].num_sge = 1;
+            wrs[i].next = i + 1 < n ? &wrs[i + 1] : NULL;
+        }
+
+        struct ibv_recv_wr *bad_wr;
+        if (ibv_post_srq_recv(srq->srq, wrs, &bad_wr)) {
+            die("Failed to post SRQ receives");
+        }
+        trace_on_recv_repost(0, wrs);
+        srq->free_count -= n;
+    }
+}
+
+/**
+ * @brief Arms the SRQ low watermark
+ * @param srq Shared Receive Queue
+ * @return 0 on success, -1 on failure
+ */
+static int arm_limit(struct srq_t *srq)
+{
+    struct ibv_srq_attr attr = { .srq_limit = srq->limit };
+
+    if (ibv_modify_srq(srq->srq, &attr, IBV_SRQ_LIMIT)) {
+        ERROR_LOG("Failed to arm SRQ limit %u: %s", srq->limit, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ * SRQ Lifecycle
+ ******************************************************************************/
+
+/**
+ * @brief Creates an SRQ and pre-posts all of its slots
+ * @param dev Shared device
+ * @param depth Number of slots
+ * @param slot_size Bytes per slot
+ * @param limit Low watermark
+ * @return SRQ on success, NULL on failure
+ */
+struct srq_t *srq_create(struct rdma_device_t *dev, uint32_t depth, size_t slot_size, uint32_t limit)
+{
+    if (!dev || !dev->pd || depth == 0 || slot_size == 0) {
+        return NULL;
+    }
+
+    struct ibv_device_attr dev_attr;
+    if (ibv_query_device(dev->context, &dev_attr)) {
+        return NULL;
+    }
+    if (depth > (uint32_t)dev_attr.max_srq_wr)
+        depth = dev_attr.max_srq_wr;
+
+    struct srq_t *srq = calloc(1, sizeof(*srq));
+    if (!srq) {
+        return NULL;
+    }
+    pthread_mutex_init(&srq->lock, NULL);
+    srq->context = dev->context;
+    srq->depth = depth;
+    srq->slot_size = slot_size;
+    srq->limit = limit < depth ? limit : depth / 2;
+    srq->repost_batch = RECV_RING_REPOST_BATCH < depth ? RECV_RING_REPOST_BATCH : depth;
+
+    struct ibv_srq_init_attr init_attr = { .attr = { .max_wr = depth, .max_sge = 1 } };
+    srq->srq = ibv_create_srq(dev->pd, &init_attr);
+    if (!srq->srq) {
+        ERROR_LOG("Failed to create SRQ: %s", strerror(errno));
+        srq_destroy(srq);
+        return NULL;
+    }
+
+    // A mapping of their own, so the NUMA policy covers no unrelated heap data
+    struct hugepage_region_t region;
+    srq->free_slots = calloc(depth, sizeof(*srq->free_slots));
+    if (!srq->free_slots
+        || hugepage_map(&region, (size_t)depth * slot_size, PROT_READ | PROT_WRITE, rdma_opts.hugepage_size,
+                        dev->numa_node)) {
+        srq_destroy(srq);
+        return NULL;
+    }
+    srq->slots = region.addr;
+    srq->slots_mapped = region.size;
+
+    srq->mr = ibv_reg_mr(dev->pd, srq->slots, (size_t)depth * slot_size, IBV_ACCESS_LOCAL_WRITE);
+    if (!srq->mr) {
+        srq_destroy(srq);
+        return NULL;
+    }
+
+    // Async events are drained opportunistically from the polling loop
+    int flags = fcntl(srq->context->async_fd, F_GETFL);
+    if (flags < 0 || fcntl(srq->context->async_fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        srq_destroy(srq);
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < depth; i++)
+        srq->free_slots[i] = i;
+    srq->free_count = depth;
+    post_free_slots(srq);
+
+    if (arm_limit(srq)) {
+        srq_destroy(srq);
+        return NULL;
+    }
+
+    DEBUG_LOG("SRQ ready: depth=%u slot_size=%zu limit=%u", depth, slot_size, srq->limit);
+    return srq;
+}
+
+/**
+ * @brief Destroys an SRQ
+ * @param srq SRQ to destroy
+ */
+void srq_destroy(struct srq_t *srq)
+{
+    if (!srq) return;
+
+    if (srq->srq)
+        ibv_destroy_srq(srq->srq);
+    if (srq->mr)
+        ibv_dereg_mr(srq->mr);
+    struct hugepage_region_t region = { .addr = srq->slots, .size = srq->slots_mapped };
+    hugepage_unmap(&region);
+    free(srq->free_slots);
+    pthread_mutex_destroy(&srq->lock);
+    free(srq);
+}
+
+/*******************************************************************************
+ * Slot Management
+ ******************************************************************************/
+
+/**
+ * @brief Payload address of an SRQ slot
+ * @param srq Shared Receive Queue
+ * @param slot Slot index
+ * @return Slot address
+ */
+void *srq_data(struct srq_t *srq, uint32_t slot)
+{
+    return srq->slots + (size_t)slot * srq->slot_size;
+}
+
+/**
+ * @brief Returns a consumed slot
+ * @param srq Shared Receive Queue
+ * @param slot Slot index
+ */
+void srq_release(struct srq_t *srq, uint32_t slot)
+{
+    pthread_mutex_lock(&srq->lock);
+    srq->free_slots[srq->free_count++] = slot;
+    if (srq->free_count >= srq->repost_batch)
+        post_free_slots(srq);
+    pthread_mutex_unlock(&srq->lock);
+}
+
+/**
+ * @brief Reposts every released slot
+ * @param srq Shared Receive Queue
+ */
+void srq_refill(struct srq_t *srq)
+{
+    pthread_mutex_lock(&srq->lock);
+    post_free_slots(srq);
+    pthread_mutex_unlock(&srq->lock);
+}
+
+/**
+ * @brief Drains pending async events without blocking
+ * @param srq Shared Receive Queue
+ * @return Number of low-watermark events handled
+ */
+int srq_poll_events(struct srq_t *srq)
+{
+    struct ibv_async_event event;
+    int handled = 0;
+
+    while (ibv_get_async_event(srq->context, &event) == 0) {
+        if (event.event_type == IBV_EVENT_SRQ_LIMIT_REACHED && event.element.srq == srq->srq) {
+            DEBUG_LOG("SRQ below %u posted receives, refilling", srq->limit);
+            srq_refill(srq);
+            arm_limit(srq);
+            handled++;
+        } else {
+            DEBUG_LOG("Async event: %s", ibv_event_type_str(event.event_type));
+        }
+        ibv_ack_async_event(&event);
+    }
+    return handled;
+}
@@ -0,0 +1,103 @@
+/**
+ * @file srq.h
+ * @brief Shared Receive Queue interface
+ *
+ * Lets every QP of a server draw receives from one pre-posted pool instead
+ * of a receive queue and buffer per connection. The pool is refilled in
+ * batches as slots are released, and immediately when the hardware reports
+ * that it dropped below its low watermark (IBV_EVENT_SRQ_LIMIT_REACHED).
+ */
+
+#ifndef SRQ_H
+#define SRQ_H
+
+#include "common.h"
+#include <pthread.h>
+
+/**
+ * SRQ Configuration Constants
+ * SRQ_DEFAULT_DEPTH: Default number of receive slots shared by all QPs
+ * SRQ_MIN_DEPTH: Smallest depth accepted for -q (servers arm the low watermark at depth / 4)
+ * SRQ_EVENT_POLL_INTERVAL: Empty CQ polls between checks of the async event fd
+ */
+#define SRQ_DEFAULT_DEPTH 1024
+#define SRQ_MIN_DEPTH 4
+#define SRQ_EVENT_POLL_INTERVAL 64
+
+/**
+ * @brief Shared Receive Queue with its receive slots
+ *
+ * Receives carry WR_TAG_RECV_RING wr_ids whose value is the slot index, so
+ * a connection's receive ring can hand them out unchanged. Released slots
+ * wait in free_slots until a batch is reposted; lock protects that list
+ * because completions for one SRQ surface on many connections.
+ */
+struct srq_t {
+    struct ibv_srq *srq;         // Verbs SRQ
+    struct ibv_context *context; // Device context (for async events)
+    uint32_t depth;              // Number of slots
+    size_t slot_size;            // Bytes per slot
+    char *slots;                 // depth * slot_size receive area
+    size_t slots_mapped;         // Bytes mapped for slots by hugepage_map
+    struct ibv_mr *mr;           // Memory Region covering the slots
+    uint32_t limit;              // Low watermark armed with IBV_SRQ_LIMIT
+    uint32_t repost_batch;       // Released slots reposted together
+    pthread_mutex_t lock;        // Protects free_slots / free_count
+    uint32_t *free_slots;        // Released slots awaiting repost
+    uint32_t free_count;         // Entries in free_slots
+};
+
+/**
+ * @brief Creates an SRQ and pre-posts all of its slots
+ *
+ * @param dev Shared device (its PD owns the SRQ and the slot MR)
+ * @param depth Number of slots (clamped to the device's max_srq_wr)
+ * @param slot_size Bytes per slot
+ * @param limit Low watermark; refill is triggered when fewer receives remain posted
+ * @return SRQ on success, NULL on failure
+ */
+struct srq_t *srq_create(struct rdma_device_t *dev, uint32_t depth, size_t slot_size, uint32_t limit);
+
+/**
+ * @brief Destroys an SRQ (all QPs using it must be destroyed first)
+ *
+ * @param srq SRQ to destroy (may be NULL)
+ */
+void srq_destroy(struct srq_t *srq);
+
+/**
+ * @brief Payload address of an SRQ slot
+ *
+ * @param srq Shared Receive Queue
+ * @param slot Slot index
+ * @return Slot address
+ */
+void *srq_data(struct srq_t *srq, uint32_t slot);
+
+/**
+ * @brief Returns a consumed slot; reposts once repost_batch slots are free
+ *
+ * @param srq Shared Receive Queue
+ * @param slot Slot index
+ */
+void srq_release(struct srq_t *srq, uint32_t slot);
+
+/**
+ * @brief Reposts every released slot as one chained list
+ *
+ * @param srq Shared Receive Queue
+ */
+void srq_refill(struct srq_t *srq);
+
+/**
+ * @brief Drains pending async events without blocking
+ *
+ * @param srq Shared Receive Queue
+ * @return Number of low-watermark events handled
+ *
+ * On IBV_EVENT_SRQ_LIMIT_REACHED the SRQ is refilled and the limit re-armed
+ * (the hardware disarms it after firing once).
+ */
+int srq_poll_events(struct srq_t *srq);
+
+#endif // SRQ_H
@@ -0,0 +1,530 @@
+/**
+ * @file stats.c
+ * @brief Per-connection hot-path statistics implementation
+ *
+ * Implements:
+ * - Single-writer counters updated with relaxed atomic stores
+ * - Log-linear latency histograms fed from an in-order FIFO of signaled WRs
+ * - Registries of live connections and CQs for snapshots, dumps and export
+ */
+
+#include "stats.h"
+#include <infiniband/verbs.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Registries of live connections and CQs, and the periodic dump thread.
+ * Only registration and readers take the lock, never the hot path.
+ */
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct conn_stats_t *registry;
+static struct cq_stats_t *cq_registry;
+static pthread_t dump_thread;
+static int dump_running;
+static int dump_stop;
+static FILE *dump_out;
+static unsigned dump_interval_ms;
+
+static const char *const op_names[STATS_OP_MAX] = { "send", "write", "write_imm", "read", "recv" };
+
+/*******************************************************************************
+ * Clock
+ ******************************************************************************/
+
+/**
+ * @brief Monotonic clock in nanoseconds
+ * @return Current CLOCK_MONOTONIC time
+ */
+static inline uint64_t stats_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*******************************************************************************
+ * Latency Histograms
+ ******************************************************************************/
+
+/**
+ * @brief Bucket holding a latency
+ * @param ns Latency in nanoseconds
+ * @return Bucket index
+ *
+ * Values below STATS_HIST_SUB get a bucket each; above that, the position
+ * of the top bit picks the power of two and the next STATS_HIST_SUB_BITS
+ * bits the linear bucket within it.
+ */
+static inline uint32_t hist_bucket(uint64_t ns)
+{
+    if (ns < STATS_HIST_SUB) {
+        return (uint32_t)ns;
+    }
+    uint32_t shift = 63 - __builtin_clzll(ns);
+    if (shift >= STATS_HIST_MAX_SHIFT) {
+        return STATS_HIST_BUCKETS - 1;
+    }
+    uint32_t sub = (ns >> (shift - STATS_HIST_SUB_BITS)) & (STATS_HIST_SUB - 1);
+    return (shift - STATS_HIST_SUB_BITS + 1) * STATS_HIST_SUB + sub;
+}
+
+/**
+ * @brief Largest latency a bucket holds
+ * @param bucket Bucket index
+ * @return Upper edge of the bucket in nanoseconds
+ */
+static uint64_t hist_bucket_max(uint32_t bucket)
+{
+    if (bucket < STATS_HIST_SUB) {
+        return bucket;
+    }
+    uint32_t shift = bucket / STATS_HIST_SUB + STATS_HIST_SUB_BITS - 1;
+    uint64_t width = 1ULL << (shift - STATS_HIST_SUB_BITS);
+    return (1ULL << shift) + (bucket % STATS_HIST_SUB + 1) * width - 1;
+}
+
+/**
+ * @brief Records one latency sample
+ * @param hist Histogram
+ * @param ns Latency in nanoseconds
+ */
+static void hist_record(struct latency_hist_t *hist, uint64_t ns)
+{
+    if (hist->count == 0 || ns < hist->min_ns)
+        stats_counter_set(&hist->min_ns, ns);
+    if (ns > hist->max_ns)
+        stats_counter_set(&hist->max_ns, ns);
+    stats_counter_add(&hist->buckets[hist_bucket(ns)], 1);
+    stats_counter_add(&hist->sum_ns, ns);
+    stats_counter_add(&hist->count, 1);
+}
+
+/**
+ * @brief Latency at a percentile
+ * @param hist Histogram (typically from stats_snapshot)
+ * @param p Fraction of samples, 0..1
+ * @return Upper edge of the bucket holding that sample, 0 if empty
+ */
+uint64_t stats_percentile(const struct latency_hist_t *hist, double p)
+{
+    uint64_t count = stats_counter_read(&hist->count);
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t)(p * count);
+    if (rank >= count)
+        rank = count - 1;
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < STATS_HIST_BUCKETS; i++) {
+        seen += stats_counter_read(&hist->buckets[i]);
+        if (seen > rank) {
+            uint64_t edge = hist_bucket_max(i);
+            uint64_t max = stats_counter_read(&hist->max_ns);
+            return edge < max ? edge : max;
+        }
+    }
+    return stats_counter_read(&hist->max_ns);
+}
+
+/*******************************************************************************
+ * Hot-Path Recording
+ ******************************************************************************/
+
+/**
+ * @brief Statistics opcode of a send WR
+ * @param opcode Posted opcode
+ * @return Matching stats_op_t
+ */
+static stats_op_t send_op(enum ibv_wr_opcode opcode)
+{
+    switch (opcode) {
+    case IBV_WR_RDMA_WRITE: return STATS_OP_WRITE;
+    case IBV_WR_RDMA_WRITE_WITH_IMM: return STATS_OP_WRITE_IMM;
+    case IBV_WR_RDMA_READ: return STATS_OP_READ;
+    default: return STATS_OP_SEND;
+    }
+}
+
+/**
+ * @brief Accounts a chain of posted send WRs
+ * @param stats Connection statistics
+ * @param wr First WR of the chain that ibv_post_send accepted
+ */
+void stats_on_post_send(struct conn_stats_t *stats, const struct ibv_send_wr *wr)
+{
+    uint64_t now = 0;
+    uint32_t count = 0;
+
+    for (; wr; wr = wr->next, count++) {
+        stats_op_t op = send_op(wr->opcode);
+        uint64_t bytes = 0;
+        for (int i = 0; i < wr->num_sge; i++)
+            bytes += wr->sg_list[i].length;
+        stats_counter_add(&stats->posted[op], 1);
+        stats_counter_add(&stats->bytes[op], bytes);
+
+        stats->unsignaled++;
+        if (!(wr->send_flags & IBV_SEND_SIGNALED))
+            continue;
+
+        // Untimed when the FIFO is full; the count still retires with the next entry
+        if (stats->inflight_count < STATS_INFLIGHT) {
+            if (!now)
+                now = stats_now_ns();
+            uint32_t tail = (stats->inflight_head + stats->inflight_count) % STATS_INFLIGHT;
+            stats->inflight[tail] = (struct stats_inflight_t){ .post_ns = now, .wrs = stats->unsignaled, .op = op };
+            stats->inflight_count++;
+            stats->unsignaled = 0;
+        }
+    }
+
+    uint64_t outstanding = stats->outstanding + count;
+    stats_counter_set(&stats->outstanding, outstanding);
+    if (outstanding > stats->max_outstanding)
+        stats_counter_set(&stats->max_outstanding, outstanding);
+}
+
+/**
+ * @brief Accounts posted receives
+ * @param stats Connection statistics
+ * @param count Receive WRs posted
+ */
+void stats_on_post_recv(struct conn_stats_t *stats, uint32_t count)
+{
+    stats_counter_add(&stats->posted[STATS_OP_RECV], count);
+}
+
+/**
+ * @brief Accounts one completion
+ * @param stats Connection statistics
+ * @param wc Completion reaped for the connection
+ */
+void stats_on_completion(struct conn_stats_t *stats, const struct ibv_wc *wc)
+{
+    if (wc->status != IBV_WC_SUCCESS) {
+        switch (wc->status) {
+        case IBV_WC_RNR_RETRY_EXC_ERR: stats_counter_add(&stats->rnr_errors, 1); break;
+        case IBV_WC_RETRY_EXC_ERR: stats_counter_add(&stats->retry_errors, 1); break;
+        default: stats_counter_add(&stats->other_errors, 1); break;
+        }
+        return;
+    }
+
+    if (wc->opcode & IBV_WC_RECV) {
+        stats_counter_add(&stats->completed[STATS_OP_RECV], 1);
+        stats_counter_add(&stats->bytes[STATS_OP_RECV], wc->byte_len);
+        return;
+    }
+
+    if (stats->inflight_count == 0) {
+        return;
+    }
+    struct stats_inflight_t *entry = &stats->inflight[stats->inflight_head];
+    stats->inflight_head = (stats->inflight_head + 1) % STATS_INFLIGHT;
+    stats->inflight_count--;
+
+    stats_counter_add(&stats->completed[entry->op], entry->wrs);
+    uint64_t outstanding = stats->outstanding;
+    stats_counter_set(&stats->outstanding, outstanding > entry->wrs ? outstanding - entry->wrs : 0);
+    hist_record(&stats->latency[entry->op], stats_now_ns() - entry->post_ns);
+}
+
+/**
+ * @brief Accounts a CQ poll that returned nothing
+ * @param stats Connection statistics
+ */
+void stats_on_empty_poll(struct conn_stats_t *stats)
+{
+    stats_counter_add(&stats->cq_empty_polls, 1);
+}
+
+/**
+ * @brief Accounts one poll of a CQ
+ * @param stats CQ statistics
+ * @param n Completions the poll returned (negative on failure)
+ */
+void stats_on_cq_poll(struct cq_stats_t *stats, int n)
+{
+    stats_counter_add(&stats->polls, 1);
+    if (n > 0)
+        stats_counter_add(&stats->completions, n);
+    else if (n == 0)
+        stats_counter_add(&stats->empty_polls, 1);
+}
+
+/*******************************************************************************
+ * Registry
+ ******************************************************************************/
+
+/**
+ * @brief Resets a connection's statistics and registers them
+ * @param stats Connection statistics
+ * @param device Name of the device the QP lives on
+ * @param port_num NIC port the QP is bound to
+ * @param qp_num QP number
+ */
+void stats_register(struct conn_stats_t *stats, const char *device, uint8_t port_num, uint32_t qp_num)
+{
+    stats_unregister(stats);
+    memset(stats, 0, sizeof(*stats));
+    snprintf(stats->device, sizeof(stats->device), "%s", device);
+    stats->port_num = port_num;
+    stats->qp_num = qp_num;
+
+    pthread_mutex_lock(&registry_lock);
+    stats->next = registry;
+    if (registry)
+        registry->prev = stats;
+    registry = stats;
+    pthread_mutex_unlock(&registry_lock);
+}
+
+/**
+ * @brief Removes a connection's statistics from the registry
+ * @param stats Connection statistics (ignored if never registered)
+ */
+void stats_unregister(struct conn_stats_t *stats)
+{
+    if (!stats->qp_num) return;
+
+    pthread_mutex_lock(&registry_lock);
+    if (stats->prev)
+        stats->prev->next = stats->next;
+    else
+        registry = stats->next;
+    if (stats->next)
+        stats->next->prev = stats->prev;
+    pthread_mutex_unlock(&registry_lock);
+
+    stats->next = stats->prev = NULL;
+    stats->qp_num = 0;
+}
+
+/**
+ * @brief Visits every registered connection
+ * @param fn Called with each connection's statistics, under the registry lock
+ * @param ctx Passed to fn
+ */
+void stats_for_each(void (*fn)(const struct conn_stats_t *stats, void *ctx), void *ctx)
+{
+    pthread_mutex_lock(&registry_lock);
+    for (struct conn_stats_t *stats = registry; stats; stats = stats->next)
+        fn(stats, ctx);
+    pthread_mutex_unlock(&registry_lock);
+}
+
+/**
+ * @brief Resets a CQ's statistics and registers them
+ * @param stats CQ statistics
+ * @param device Name of the device the CQ lives on
+ * @param port_num NIC port of the connection owning the CQ, 0 for a CQ shared
+ *        by connections (their QPs report the ports)
+ * @param cq_handle Kernel handle of the CQ, unique per device context
+ */
+void stats_register_cq(struct cq_stats_t *stats, const char *device, uint8_t port_num, uint32_t cq_handle)
+{
+    stats_unregister_cq(stats);
+    memset(stats, 0, sizeof(*stats));
+    snprintf(stats->device, sizeof(stats->device), "%s", device);
+    stats->port_num = port_num;
+    stats->cq_handle = cq_handle;
+    stats->registered = 1;
+
+    pthread_mutex_lock(&registry_lock);
+    stats->next = cq_registry;
+    if (cq_registry)
+        cq_registry->prev = stats;
+    cq_registry = stats;
+    pthread_mutex_unlock(&registry_lock);
+}
+
+/**
+ * @brief Removes a CQ's statistics from the registry
+ * @param stats CQ statistics (ignored if never registered)
+ */
+void stats_unregister_cq(struct cq_stats_t *stats)
+{
+    if (!stats->registered) return;
+
+    pthread_mutex_lock(&registry_lock);
+    if (stats->prev)
+        stats->prev->next = stats->next;
+    else
+        cq_registry = stats->next;
+    if (stats->next)
+        stats->next->prev = stats->prev;
+    pthread_mutex_unlock(&registry_lock);
+
+    stats->next = stats->prev = NULL;
+    stats->registered = 0;
+}
+
+/**
+ * @brief Visits every registered CQ
+ * @param fn Called with each CQ's statistics, under the registry lock
+ * @param ctx Passed to fn
+ */
+void stats_for_each_cq(void (*fn)(const struct cq_stats_t *stats, void *ctx), void *ctx)
+{
+    pthread_mutex_lock(&registry_lock);
+    for (struct cq_stats_t *stats = cq_registry; stats; stats = stats->next)
+        fn(stats, ctx);
+    pthread_mutex_unlock(&registry_lock);
+}
+
+/*******************************************************************************
+ * Export
+ ******************************************************************************/
+
+/**
+ * @brief Name of a statistics opcode
+ * @param op Statistics opcode
+ * @return Static name
+ */
+const char *stats_op_name(stats_op_t op)
+{
+    return op < STATS_OP_MAX ? op_names[op] : "unknown";
+}
+
+/**
+ * @brief Copies a connection's shared statistics
+ * @param stats Connection statistics, possibly being updated
+ * @param out Receives the copy (its in-flight FIFO and links are cleared)
+ */
+void stats_snapshot(const struct conn_stats_t *stats, struct conn_stats_t *out)
+{
+    memset(out, 0, sizeof(*out));
+    memcpy(out->device, stats->device, sizeof(out->device));
+    out->qp_num = stats->qp_num;
+
+    for (int op = 0; op < STATS_OP_MAX; op++) {
+        out->posted[op] = stats_counter_read(&stats->posted[op]);
+        out->completed[op] = stats_counter_read(&stats->completed[op]);
+        out->bytes[op] = stats_counter_read(&stats->bytes[op]);
+    }
+    out->cq_empty_polls = stats_counter_read(&stats->cq_empty_polls);
+    out->rnr_errors = stats_counter_read(&stats->rnr_errors);
+    out->retry_errors = stats_counter_read(&stats->retry_errors);
+    out->other_errors = stats_counter_read(&stats->other_errors);
+    out->outstanding = stats_counter_read(&stats->outstanding);
+    out->max_outstanding = stats_counter_read(&stats->max_outstanding);
+    out->mr_bytes = stats_counter_read(&stats->mr_bytes);
+
+    for (int op = 0; op < STATS_OP_RECV; op++) {
+        const struct latency_hist_t *hist = &stats->latency[op];
+        out->latency[op].count = stats_counter_read(&hist->count);
+        out->latency[op].sum_ns = stats_counter_read(&hist->sum_ns);
+        out->latency[op].min_ns = stats_counter_read(&hist->min_ns);
+        out->latency[op].max_ns = stats_counter_read(&hist->max_ns);
+        for (uint32_t i = 0; i < STATS_HIST_BUCKETS; i++)
+            out->latency[op].buckets[i] = stats_counter_read(&hist->buckets[i]);
+    }
+}
+
+/**
+ * @brief Prints one connection's statistics
+ * @param out Output stream
+ * @param stats Connection statistics
+ */
+void stats_dump(FILE *out, const struct conn_stats_t *stats)
+{
+    struct conn_stats_t snap;
+    stats_snapshot(stats, &snap);
+
+    fprintf(out, "[STATS] %s qp %u: outstanding %lu (max %lu), empty polls %lu, rnr %lu, retry %lu, errors %lu\n",
+            snap.device, snap.qp_num, snap.outstanding, snap.max_outstanding, snap.cq_empty_polls,
+            snap.rnr_errors, snap.retry_errors, snap.other_errors);
+
+    for (int op = 0; op < STATS_OP_MAX; op++) {
+        if (!snap.posted[op] && !snap.completed[op]) continue;
+
+        fprintf(out, "[STATS]   %-9s posted %lu completed %lu bytes %lu", op_names[op], snap.posted[op],
+                snap.completed[op], snap.bytes[op]);
+        const struct latency_hist_t *hist = op < STATS_OP_RECV ? &snap.latency[op] : NULL;
+        if (hist && hist->count) {
+            fprintf(out, " | latency us: min %.2f avg %.2f p50 %.2f p99 %.2f p99.9 %.2f max %.2f",
+                    hist->min_ns / 1000.0, (double)hist->sum_ns / hist->count / 1000.0,
+                    stats_percentile(hist, 0.50) / 1000.0, stats_percentile(hist, 0.99) / 1000.0,
+                    stats_percentile(hist, 0.999) / 1000.0, hist->max_ns / 1000.0);
+        }
+        fprintf(out, "\n");
+    }
+}
+
+/**
+ * @brief stats_for_each callback printing one connection
+ * @param stats Connection statistics
+ * @param ctx Output stream
+ */
+static void dump_one(const struct conn_stats_t *stats, void *ctx)
+{
+    stats_dump(ctx, stats);
+}
+
+/**
+ * @brief Prints every registered connection
+ * @param out Output stream
+ */
+void stats_dump_all(FILE *out)
+{
+    stats_for_each(dump_one, out);
+    fflush(out);
+}
+
+/**
+ * @brief Periodic dump thread
+ * @param arg Unused
+ * @return NULL
+ */
+static void *dump_loop(void *arg)
+{
+    (void)arg;
+    while (!__atomic_load_n(&dump_stop, __ATOMIC_RELAXED)) {
+        // Sleep in short steps so stats_dump_stop() returns promptly
+        for (unsigned slept = 0; slept < dump_interval_ms && !__atomic_load_n(&dump_stop, __ATOMIC_RELAXED);
+             slept += 10)
+            usleep(10000);
+        if (!__atomic_load_n(&dump_stop, __ATOMIC_RELAXED))
+            stats_dump_all(dump_out);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Starts dumping every registered connection periodically
+ * @param out Output stream
+ * @param interval_ms Time between dumps in milliseconds
+ * @return 0 on success, -1 if already running or the thread cannot start
+ */
+int stats_dump_start(FILE *out, unsigned interval_ms)
+{
+    if (dump_running || interval_ms == 0) {
+        return -1;
+    }
+
+    dump_out = out;
+    dump_interval_ms = interval_ms;
+    dump_stop = 0;
+    if (pthread_create(&dump_thread, NULL, dump_loop, NULL)) {
+        return -1;
+    }
+    dump_running = 1;
+    return 0;
+}
+
+/**
+ * @brief Stops the periodic dump thread (no-op if not running)
+ */
+void stats_dump_stop(void)
+{
+    if (!dump_running) return;
+
+    __atomic_store_n(&dump_stop, 1, __ATOMIC_RELAXED);
+    pthread_join(dump_thread, NULL);
+    dump_running = 0;
+}
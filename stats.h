@@ -0,0 +1,207 @@
+/**
+ * @file stats.h
+ * @brief Per-connection hot-path statistics interface
+ *
+ * Every connection carries counters of the WRs it posts and completes (by
+ * opcode), bytes moved, empty CQ polls, RNR and transport retry failures and
+ * send queue occupancy, plus log-linear (HDR-style) histograms of the time
+ * from posting a signaled WR to reaping its completion.
+ *
+ * CQs polled by the library count their polls, empty polls and completions.
+ *
+ * Counters have a single writer, the thread driving the connection, which
+ * updates them with relaxed atomic stores and no locked instructions. Any
+ * other thread may read them at any time with relaxed atomic loads, through
+ * stats_snapshot() or the registries of live connections and CQs, e.g. for
+ * the periodic dump started by stats_dump_start() or the metrics exporter.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Counter Primitives
+ * stats_counter_add / stats_counter_set: Update a counter that only the calling thread
+ *     writes (or that a lock serializes writers of). A relaxed load and store instead of
+ *     an atomic add: no update is lost with one writer, and no locked instruction is paid
+ * stats_counter_read: Read a counter from any thread; never torn, never blocks the writer
+ */
+static inline void stats_counter_add(uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+}
+
+static inline void stats_counter_set(uint64_t *counter, uint64_t value)
+{
+    __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t stats_counter_read(const uint64_t *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+/**
+ * Statistics Configuration
+ * STATS_HIST_SUB_BITS: Each power of two is split into 2^STATS_HIST_SUB_BITS linear
+ *                      buckets, i.e. values are kept to within 1/8 (12.5%)
+ * STATS_HIST_MAX_SHIFT: Latencies of 2^STATS_HIST_MAX_SHIFT ns (~18 min) and above share
+ *                       the last bucket
+ * STATS_HIST_BUCKETS: Buckets per histogram (exact buckets below 2^STATS_HIST_SUB_BITS ns,
+ *                     then STATS_HIST_SUB per power of two)
+ * STATS_INFLIGHT: Signaled send WRs whose post time is tracked at once (must cover the
+ *                 send queue depth; WRs beyond it go untimed)
+ * STATS_DEVICE_NAME_MAX: Longest device name kept with a connection's statistics
+ */
+#define STATS_HIST_SUB_BITS 3
+#define STATS_HIST_SUB (1 << STATS_HIST_SUB_BITS)
+#define STATS_HIST_MAX_SHIFT 40
+#define STATS_HIST_BUCKETS ((STATS_HIST_MAX_SHIFT - STATS_HIST_SUB_BITS + 1) * STATS_HIST_SUB)
+#define STATS_INFLIGHT 256
+#define STATS_DEVICE_NAME_MAX 64
+
+/**
+ * Statistics Opcodes
+ * Send-side WRs are classified by the opcode they were posted with, receives by
+ * their completion. Write-with-imm is counted apart from plain writes.
+ */
+typedef enum stats_op {
+	STATS_OP_SEND,
+	STATS_OP_WRITE,
+	STATS_OP_WRITE_IMM,
+	STATS_OP_READ,
+	STATS_OP_RECV,
+	STATS_OP_MAX
+} stats_op_t;
+
+/**
+ * Latency Histogram
+ * Log-linear buckets of nanosecond latencies, as in HdrHistogram: fixed relative
+ * precision over the whole range with a few hundred counters.
+ */
+struct latency_hist_t {
+	uint64_t count;              // Samples recorded
+	uint64_t sum_ns;             // Sum of all samples
+	uint64_t min_ns;             // Smallest sample (valid when count > 0)
+	uint64_t max_ns;             // Largest sample
+	uint64_t buckets[STATS_HIST_BUCKETS];  // Samples per bucket
+};
+
+/**
+ * In-Flight Signaled WR
+ * RC send queues complete in order, so each signaled completion retires the
+ * oldest entry, together with the unsignaled WRs posted before it.
+ */
+struct stats_inflight_t {
+	uint64_t post_ns;            // When the signaled WR was posted
+	uint32_t wrs;                // WRs retired by its completion (itself included)
+	uint32_t op;                 // stats_op_t of the signaled WR
+};
+
+/**
+ * Connection Statistics
+ * Embedded in struct config_t. Fields up to inflight are readable from any
+ * thread with relaxed loads; the in-flight FIFO is private to the writer.
+ */
+struct conn_stats_t {
+	char device[STATS_DEVICE_NAME_MAX];  // Device the QP lives on
+	uint8_t port_num;            // NIC port the QP is bound to
+	uint32_t qp_num;             // QP number (0 = not registered)
+	uint64_t posted[STATS_OP_MAX];  // WRs posted
+	uint64_t completed[STATS_OP_MAX];  // WRs retired (sends: credited to the signaled WR's opcode)
+	uint64_t bytes[STATS_OP_MAX];  // Bytes posted (sends), bytes received (STATS_OP_RECV)
+	uint64_t cq_empty_polls;     // Polls of the connection's CQ that found nothing
+	uint64_t rnr_errors;         // Completions failed with RNR retry exhausted
+	uint64_t retry_errors;       // Completions failed with transport retry exhausted
+	uint64_t other_errors;       // Any other failed completion
+	uint64_t outstanding;        // Send WRs posted and not yet retired
+	uint64_t max_outstanding;    // High-water mark of outstanding
+	uint64_t mr_bytes;           // Bytes covered by the connection's data buffer MR
+	struct latency_hist_t latency[STATS_OP_RECV];  // Post-to-completion time per send opcode
+	struct stats_inflight_t inflight[STATS_INFLIGHT];  // FIFO of signaled WRs awaiting completion
+	uint32_t inflight_head;      // Oldest entry
+	uint32_t inflight_count;     // Entries in inflight
+	uint32_t unsignaled;         // Unsignaled WRs posted since the last signaled one
+	struct conn_stats_t *next;   // Registry link
+	struct conn_stats_t *prev;   // Registry link
+};
+
+/**
+ * CQ Statistics
+ * Embedded in struct config_t for a CQ of its own and in struct rdma_device_t for a
+ * shared one. Same single-writer rules as the connection statistics.
+ */
+struct cq_stats_t {
+	char device[STATS_DEVICE_NAME_MAX];  // Device the CQ lives on
+	uint8_t port_num;            // NIC port of the connection owning the CQ (0 = shared CQ)
+	uint32_t cq_handle;          // Kernel handle of the CQ
+	int registered;              // Listed in the CQ registry
+	uint64_t polls;              // ibv_poll_cq calls
+	uint64_t empty_polls;        // Polls that found nothing
+	uint64_t completions;        // Completions reaped
+	struct cq_stats_t *next;     // Registry link
+	struct cq_stats_t *prev;     // Registry link
+};
+
+struct ibv_send_wr;
+struct ibv_wc;
+
+/**
+ * Registry Functions
+ * stats_register: Resets the statistics and adds them to the registry of live connections
+ * stats_unregister: Removes them again (no-op if not registered); call before freeing
+ * stats_for_each: Calls fn for every registered connection, under the registry lock;
+ *                 fn must only read, and must not (un)register connections
+ * stats_register_cq / stats_unregister_cq / stats_for_each_cq: The same for CQs
+ */
+void stats_register(struct conn_stats_t *stats, const char *device, uint8_t port_num, uint32_t qp_num);
+void stats_unregister(struct conn_stats_t *stats);
+void stats_for_each(void (*fn)(const struct conn_stats_t *stats, void *ctx), void *ctx);
+void stats_register_cq(struct cq_stats_t *stats, const char *device, uint8_t port_num, uint32_t cq_handle);
+void stats_unregister_cq(struct cq_stats_t *stats);
+void stats_for_each_cq(void (*fn)(const struct cq_stats_t *stats, void *ctx), void *ctx);
+
+/**
+ * Hot-Path Recording Functions (writer thread only)
+ * stats_on_post_send: Accounts a posted chain of send WRs and timestamps the signaled ones
+ * stats_on_post_recv: Accounts count posted receives
+ * stats_on_completion: Accounts one completion: receive bytes, send retirement and
+ *                      latency, or the failure class of an error
+ * stats_on_empty_poll: Accounts a CQ poll that returned nothing
+ * stats_on_cq_poll: Accounts one ibv_poll_cq call on a CQ and what it returned
+ */
+void stats_on_post_send(struct conn_stats_t *stats, const struct ibv_send_wr *wr);
+void stats_on_post_recv(struct conn_stats_t *stats, uint32_t count);
+void stats_on_completion(struct conn_stats_t *stats, const struct ibv_wc *wc);
+void stats_on_empty_poll(struct conn_stats_t *stats);
+void stats_on_cq_poll(struct cq_stats_t *stats, int n);
+
+/**
+ * Export Functions (any thread)
+ * stats_snapshot: Copies the shared counters and histograms with relaxed loads
+ *                 (each value is atomic; the set is not a single point in time)
+ * stats_percentile: Latency at or below which a fraction p (0..1) of the samples fall,
+ *                   reported as the upper edge of its bucket; 0 for an empty histogram
+ * stats_dump: Prints one connection's counters and latency summary
+ * stats_dump_all: Prints every registered connection
+ * stats_dump_start: Starts a thread printing every registered connection each interval_ms
+ * stats_dump_stop: Stops that thread
+ */
+void stats_snapshot(const struct conn_stats_t *stats, struct conn_stats_t *out);
+uint64_t stats_percentile(const struct latency_hist_t *hist, double p);
+void stats_dump(FILE *out, const struct conn_stats_t *stats);
+void stats_dump_all(FILE *out);
+int stats_dump_start(FILE *out, unsigned interval_ms);
+void stats_dump_stop(void);
+
+/**
+ * @brief Human-readable name of a statistics opcode
+ * @param op Statistics opcode
+ * @return Static name such as "write_imm"
+ */
+const char *stats_op_name(stats_op_t op);
+
+#endif // STATS_H
@@ -0,0 +1,33 @@
+/**
+ * @file test.h
+ * @brief Minimal unit test helpers
+ *
+ * The tests under tests/ need no RDMA hardware: each builds the code under
+ * test into its own binary and exits non-zero if any check failed.
+ * `make test` builds and runs them all.
+ */
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+static int test_failures;
+
+/**
+ * Test Macros
+ * CHECK: Records a failure, with the condition and its location, unless cond holds
+ * TEST_RESULT: Prints the outcome of a test binary; its exit status
+ */
+#define CHECK(cond)                                                                                                    \
+    do {                                                                                                               \
+        if (!(cond)) {                                                                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);                                   \
+            test_failures++;                                                                                           \
+        }                                                                                                              \
+    } while (0)
+
+#define TEST_RESULT(name)                                                                                              \
+    (printf("%s: %s\n", name, test_failures ? "FAILED" : "passed"), test_failures ? 1 : 0)
+
+#endif // TEST_H
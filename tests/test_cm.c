@@ -0,0 +1,183 @@
+/**
+ * @file test_cm.c
+ * @brief Unit tests of the rdma_cm private data handshake
+ *
+ * Covers cm_encode()/cm_decode(): a round trip, truncated input, region
+ * counts out of range and length fields that disagree with the data. cm.c is
+ * built into the test so its static codec can be called directly; only the
+ * RDMA_CM=1 build has it.
+ */
+
+#include "../cm.c"
+#include "test.h"
+
+// Byte offsets of fields patched in encoded data
+#define NUM_REGIONS_OFFSET 5
+#define LENGTH_OFFSET 6
+
+static struct config_t config;   // Too large for the stack (pending_wc)
+
+/**
+ * @brief Fills config with a buffer and num_regions - 1 extra regions
+ * @param mr MR to register the buffer with
+ * @param num_regions Regions to advertise (1 to HANDSHAKE_MAX_REGIONS)
+ */
+static void sample_config(struct ibv_mr *mr, uint32_t num_regions)
+{
+    memset(&config, 0, sizeof(config));
+    memset(mr, 0, sizeof(*mr));
+    mr->rkey = 0x4321;
+    config.mr = mr;
+    config.buf = (void *)0x7f1234560000UL;
+    config.buf_size = 1 << 22;
+    config.seg_size = 1 << 16;
+    config.max_inline = 220;
+    config.max_send_wr = 128;
+    config.max_recv_wr = 256;
+    config.num_extra_regions = num_regions - 1;
+    for (uint32_t i = 0; i < config.num_extra_regions; i++) {
+        config.extra_regions[i].addr = 0x7f0000000000ULL + ((uint64_t)i << 20);
+        config.extra_regions[i].length = 4096ULL << i;
+        config.extra_regions[i].rkey = 0x100 + i;
+    }
+}
+
+/**
+ * @brief Overwrites the big-endian length field of encoded data
+ * @param buf Encoded data
+ * @param length New value
+ */
+static void set_length(uint8_t *buf, uint16_t length)
+{
+    buf[LENGTH_OFFSET] = length >> 8;
+    buf[LENGTH_OFFSET + 1] = length & 0xff;
+}
+
+/**
+ * @brief Encoding then decoding returns every field, and data that does not fit is refused
+ */
+static void test_round_trip(void)
+{
+    struct ibv_mr mr;
+    struct peer_info_t peer;
+    uint8_t buf[CM_REP_PRIVATE_LEN];
+
+    for (uint32_t n = 1; n <= HANDSHAKE_MAX_REGIONS; n++) {
+        sample_config(&mr, n);
+        uint8_t len = cm_encode(&config, buf, sizeof(buf));
+        CHECK(len == CM_HEADER_LEN + n * CM_REGION_LEN + CM_V2_LEN);
+        memset(&peer, 0, sizeof(peer));
+        CHECK(cm_decode(buf, len, &peer) == 0);
+        CHECK(peer.version == CM_VERSION && peer.num_regions == n);
+        CHECK(peer.peer_features == handshake_features(&config));
+        CHECK(peer.max_inline == config.max_inline && peer.max_send_wr == config.max_send_wr
+              && peer.max_recv_wr == config.max_recv_wr);
+        CHECK(peer.seg_size == config.seg_size);
+        CHECK(peer.regions[0].addr == (uint64_t)config.buf && peer.regions[0].length == config.buf_size
+              && peer.regions[0].rkey == mr.rkey);
+        for (uint32_t i = 1; i < n; i++) {
+            const struct qp_info_t *r = &config.extra_regions[i - 1];
+            CHECK(peer.regions[i].addr == r->addr && peer.regions[i].length == r->length
+                  && peer.regions[i].rkey == r->rkey);
+        }
+    }
+
+    // A connect request has room for fewer regions than a reply
+    sample_config(&mr, HANDSHAKE_MAX_REGIONS);
+    CHECK(cm_encode(&config, buf, CM_REQ_PRIVATE_LEN) == 0);
+}
+
+/**
+ * @brief Private data padded by the provider, or from a newer peer, still decodes
+ */
+static void test_padding(void)
+{
+    struct ibv_mr mr;
+    struct peer_info_t peer;
+    uint8_t buf[CM_REP_PRIVATE_LEN];
+
+    sample_config(&mr, 2);
+    memset(buf, 0xee, sizeof(buf));
+    uint8_t len = cm_encode(&config, buf, sizeof(buf));
+    CHECK(cm_decode(buf, sizeof(buf), &peer) == 0);
+    CHECK(peer.num_regions == 2 && peer.seg_size == config.seg_size);
+
+    set_length(buf, len + 16);
+    buf[4] = CM_VERSION + 1;
+    CHECK(cm_decode(buf, sizeof(buf), &peer) == 0);
+    CHECK(peer.version == CM_VERSION && peer.regions[1].rkey == config.extra_regions[0].rkey);
+}
+
+/**
+ * @brief Data too short to hold the header or the regions it announces is rejected
+ */
+static void test_truncated(void)
+{
+    struct ibv_mr mr;
+    struct peer_info_t peer;
+    uint8_t buf[CM_REP_PRIVATE_LEN];
+
+    sample_config(&mr, 3);
+    uint8_t len = cm_encode(&config, buf, sizeof(buf));
+    CHECK(cm_decode(NULL, len, &peer) != 0);
+    for (uint8_t n = 0; n < len; n++)
+        CHECK(cm_decode(buf, n, &peer) != 0);
+}
+
+/**
+ * @brief No regions, or more than HANDSHAKE_MAX_REGIONS, is rejected
+ */
+static void test_region_count(void)
+{
+    struct ibv_mr mr;
+    struct peer_info_t peer;
+    uint8_t buf[CM_REP_PRIVATE_LEN];
+
+    sample_config(&mr, 1);
+    uint8_t len = cm_encode(&config, buf, sizeof(buf));
+    buf[NUM_REGIONS_OFFSET] = 0;
+    CHECK(cm_decode(buf, len, &peer) != 0);
+
+    // A length spanning the whole reply room
+    memset(buf, 0, sizeof(buf));
+    sample_config(&mr, 1);
+    cm_encode(&config, buf, sizeof(buf));
+    set_length(buf, sizeof(buf));
+    buf[NUM_REGIONS_OFFSET] = HANDSHAKE_MAX_REGIONS + 1;
+    CHECK(cm_decode(buf, sizeof(buf), &peer) != 0);
+    buf[NUM_REGIONS_OFFSET] = 0xff;
+    CHECK(cm_decode(buf, sizeof(buf), &peer) != 0);
+}
+
+/**
+ * @brief A length field past the data or short of the regions it announces is rejected
+ */
+static void test_bad_length(void)
+{
+    struct ibv_mr mr;
+    struct peer_info_t peer;
+    uint8_t buf[CM_REP_PRIVATE_LEN];
+
+    sample_config(&mr, 2);
+    uint8_t len = cm_encode(&config, buf, sizeof(buf));
+    set_length(buf, len + 1);
+    CHECK(cm_decode(buf, len, &peer) != 0);
+    set_length(buf, CM_HEADER_LEN + 2 * CM_REGION_LEN - 1);
+    CHECK(cm_decode(buf, len, &peer) != 0);
+    set_length(buf, 0);
+    CHECK(cm_decode(buf, len, &peer) != 0);
+}
+
+/**
+ * @brief Test entry point
+ * @return 0 if every check passed, 1 otherwise
+ */
+int main(void)
+{
+    test_round_trip();
+    test_padding();
+    test_truncated();
+    test_region_count();
+    test_bad_length();
+    return TEST_RESULT("test_cm");
+}
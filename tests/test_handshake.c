@@ -0,0 +1,186 @@
+/**
+ * @file test_handshake.c
+ * @brief Unit tests of the TCP handshake wire format
+ *
+ * Covers handshake_encode()/handshake_decode(): a round trip, older and newer
+ * peers, truncated input, region counts out of range and length fields that
+ * disagree with the message. common.c is built into the test so its static
+ * codec can be called directly.
+ */
+
+#include "../common.c"
+#include "test.h"
+
+// Byte offsets of fields patched in encoded messages
+#define LENGTH_OFFSET 6
+#define NUM_REGIONS_OFFSET 35
+
+/**
+ * @brief Fills a version 2 message advertising num_regions regions
+ * @param msg Message to fill
+ * @param num_regions Regions to advertise (1 to HANDSHAKE_MAX_REGIONS)
+ */
+static void sample_msg(struct handshake_msg_t *msg, uint8_t num_regions)
+{
+    memset(msg, 0, sizeof(*msg));
+    msg->magic = HANDSHAKE_MAGIC;
+    msg->version = HANDSHAKE_VERSION;
+    msg->qp_num = 0x1234;
+    msg->psn = 0xabcdef;
+    for (size_t i = 0; i < sizeof(msg->gid.raw); i++)
+        msg->gid.raw[i] = (uint8_t)(0xf0 + i);
+    msg->lid = 7;
+    msg->mtu = IBV_MTU_4096;
+    msg->num_regions = num_regions;
+    msg->max_inline = 220;
+    msg->max_send_wr = 128;
+    msg->max_recv_wr = 256;
+    msg->max_rd_atomic = 16;
+    msg->max_init_rd_atomic = 8;
+    msg->features = HANDSHAKE_FEAT_RECV_RING | HANDSHAKE_FEAT_END_IMM;
+    for (uint8_t i = 0; i < num_regions; i++) {
+        msg->regions[i].addr = 0x7f0000000000ULL + ((uint64_t)i << 20);
+        msg->regions[i].length = 4096ULL << i;
+        msg->regions[i].rkey = 0x100 + i;
+    }
+    msg->seg_size = 1 << 20;
+    msg->length = HANDSHAKE_HEADER_LEN + num_regions * HANDSHAKE_REGION_LEN + HANDSHAKE_V2_LEN;
+}
+
+/**
+ * @brief Overwrites the big-endian length field of an encoded message
+ * @param buf Encoded message
+ * @param length New value
+ */
+static void set_length(uint8_t *buf, uint16_t length)
+{
+    buf[LENGTH_OFFSET] = length >> 8;
+    buf[LENGTH_OFFSET + 1] = length & 0xff;
+}
+
+/**
+ * @brief Encoding then decoding returns every field
+ */
+static void test_round_trip(void)
+{
+    struct handshake_msg_t in, out;
+    uint8_t buf[HANDSHAKE_MAX_LEN];
+
+    for (uint8_t n = 1; n <= HANDSHAKE_MAX_REGIONS; n++) {
+        sample_msg(&in, n);
+        handshake_encode(&in, buf);
+        CHECK(handshake_decode(buf, in.length, &out) == 0);
+        CHECK(out.magic == in.magic && out.version == in.version && out.length == in.length);
+        CHECK(out.qp_num == in.qp_num && out.psn == in.psn);
+        CHECK(memcmp(out.gid.raw, in.gid.raw, sizeof(in.gid.raw)) == 0);
+        CHECK(out.lid == in.lid && out.mtu == in.mtu);
+        CHECK(out.max_inline == in.max_inline && out.max_send_wr == in.max_send_wr
+              && out.max_recv_wr == in.max_recv_wr);
+        CHECK(out.max_rd_atomic == in.max_rd_atomic && out.max_init_rd_atomic == in.max_init_rd_atomic);
+        CHECK(out.features == in.features && out.seg_size == in.seg_size);
+        CHECK(out.num_regions == n);
+        for (uint8_t i = 0; i < n; i++) {
+            CHECK(out.regions[i].addr == in.regions[i].addr && out.regions[i].length == in.regions[i].length
+                  && out.regions[i].rkey == in.regions[i].rkey);
+        }
+    }
+}
+
+/**
+ * @brief A version 1 peer sends no segment size; a newer peer's trailing bytes are skipped
+ */
+static void test_versions(void)
+{
+    struct handshake_msg_t in, out;
+    uint8_t buf[HANDSHAKE_MAX_LEN];
+
+    sample_msg(&in, 2);
+    in.version = 1;
+    in.length -= HANDSHAKE_V2_LEN;
+    handshake_encode(&in, buf);
+    CHECK(handshake_decode(buf, in.length, &out) == 0);
+    CHECK(out.version == 1 && out.seg_size == 0 && out.num_regions == 2);
+
+    sample_msg(&in, 2);
+    in.version = HANDSHAKE_VERSION + 1;
+    handshake_encode(&in, buf);
+    memset(buf + in.length, 0xee, 16);
+    set_length(buf, in.length + 16);
+    CHECK(handshake_decode(buf, in.length + 16, &out) == 0);
+    CHECK(out.seg_size == in.seg_size && out.regions[1].rkey == in.regions[1].rkey);
+}
+
+/**
+ * @brief Every prefix too short to hold the header or the regions it announces is rejected
+ */
+static void test_truncated(void)
+{
+    struct handshake_msg_t in, out;
+    uint8_t buf[HANDSHAKE_MAX_LEN];
+
+    sample_msg(&in, 3);
+    in.version = 1;
+    in.length -= HANDSHAKE_V2_LEN;
+    handshake_encode(&in, buf);
+    for (size_t len = 0; len < in.length; len++) {
+        set_length(buf, len);
+        CHECK(handshake_decode(buf, len, &out) != 0);
+    }
+}
+
+/**
+ * @brief No regions, or more than HANDSHAKE_MAX_REGIONS, is rejected
+ */
+static void test_region_count(void)
+{
+    struct handshake_msg_t in, out;
+    uint8_t buf[HANDSHAKE_MAX_LEN];
+
+    sample_msg(&in, 1);
+    handshake_encode(&in, buf);
+    buf[NUM_REGIONS_OFFSET] = 0;
+    CHECK(handshake_decode(buf, in.length, &out) != 0);
+
+    // Enough bytes behind the header that only the count itself can fail the check
+    sample_msg(&in, HANDSHAKE_MAX_REGIONS);
+    handshake_encode(&in, buf);
+    size_t len = HANDSHAKE_HEADER_LEN + (HANDSHAKE_MAX_REGIONS + 1) * HANDSHAKE_REGION_LEN + HANDSHAKE_V2_LEN;
+    memset(buf + in.length, 0, len - in.length);
+    set_length(buf, len);
+    buf[NUM_REGIONS_OFFSET] = HANDSHAKE_MAX_REGIONS + 1;
+    CHECK(handshake_decode(buf, len, &out) != 0);
+    buf[NUM_REGIONS_OFFSET] = 0xff;
+    CHECK(handshake_decode(buf, len, &out) != 0);
+}
+
+/**
+ * @brief A length field that disagrees with the bytes received is rejected
+ */
+static void test_bad_length(void)
+{
+    struct handshake_msg_t in, out;
+    uint8_t buf[HANDSHAKE_MAX_LEN];
+
+    sample_msg(&in, 2);
+    handshake_encode(&in, buf);
+    set_length(buf, in.length - 1);
+    CHECK(handshake_decode(buf, in.length, &out) != 0);
+    set_length(buf, in.length + 1);
+    CHECK(handshake_decode(buf, in.length, &out) != 0);
+    set_length(buf, 0);
+    CHECK(handshake_decode(buf, in.length, &out) != 0);
+}
+
+/**
+ * @brief Test entry point
+ * @return 0 if every check passed, 1 otherwise
+ */
+int main(void)
+{
+    test_round_trip();
+    test_versions();
+    test_truncated();
+    test_region_count();
+    test_bad_length();
+    return TEST_RESULT("test_handshake");
+}
@@ -0,0 +1,288 @@
+/**
+ * @file test_reg_cache.c
+ * @brief Unit tests of the registration cache
+ *
+ * Covers the interval tree under random inserts and removals (AVL balance,
+ * max_end augmentation, ordering, overlap queries against a linear scan) and
+ * the cache built on it: hits, exact access rights, merging, budget eviction
+ * and invalidation. reg_cache.c is built into the test so its static tree is
+ * reachable, and ibv_reg_mr()/ibv_dereg_mr() are replaced by stubs that
+ * never touch a device, so no RDMA hardware is needed.
+ */
+
+#include "../reg_cache.c"
+#include "test.h"
+
+/**
+ * Test Configuration
+ * TREE_ENTRIES: Entries in the random tree
+ * TREE_SPAN: Address span the random entries fall in
+ * TREE_QUERIES: Random overlap queries checked against a linear scan
+ */
+#define TREE_ENTRIES 2000
+#define TREE_SPAN (1UL << 28)
+#define TREE_QUERIES 2000
+
+static int live_mrs;             // MRs registered and not yet deregistered
+
+/*******************************************************************************
+ * Verbs Stubs
+ ******************************************************************************/
+
+/**
+ * @brief Stub registration: an MR describing the range, no device involved
+ */
+struct ibv_mr *ibv_reg_mr_iova2(struct ibv_pd *pd, void *addr, size_t length, uint64_t iova, unsigned int access)
+{
+    (void)iova;
+    (void)access;
+    if (!addr) {
+        errno = EOPNOTSUPP;  // No implicit ODP
+        return NULL;
+    }
+    struct ibv_mr *mr = calloc(1, sizeof(*mr));
+    if (!mr) {
+        return NULL;
+    }
+    mr->pd = pd;
+    mr->addr = addr;
+    mr->length = length;
+    mr->lkey = mr->rkey = (uint32_t)++live_mrs;
+    return mr;
+}
+
+struct ibv_mr *(ibv_reg_mr)(struct ibv_pd *pd, void *addr, size_t length, int access)
+{
+    return ibv_reg_mr_iova2(pd, addr, length, (uintptr_t)addr, access);
+}
+
+int ibv_dereg_mr(struct ibv_mr *mr)
+{
+    live_mrs--;
+    free(mr);
+    return 0;
+}
+
+/*******************************************************************************
+ * Interval Tree
+ ******************************************************************************/
+
+/**
+ * @brief Checks ordering, heights, balance and max_end of a subtree
+ * @param e Subtree root
+ * @param count Incremented once per node
+ * @return Height of the subtree
+ */
+static int check_subtree(const struct reg_entry *e, size_t *count)
+{
+    if (!e) {
+        return 0;
+    }
+    (*count)++;
+    int hl = check_subtree(e->left, count);
+    int hr = check_subtree(e->right, count);
+    CHECK(e->height == 1 + (hl > hr ? hl : hr));
+    CHECK(hl - hr <= 1 && hr - hl <= 1);
+
+    uintptr_t max_end = e->end;
+    if (e->left) {
+        CHECK(entry_before(e->left, e));
+        if (e->left->max_end > max_end)
+            max_end = e->left->max_end;
+    }
+    if (e->right) {
+        CHECK(entry_before(e, e->right));
+        if (e->right->max_end > max_end)
+            max_end = e->right->max_end;
+    }
+    CHECK(e->max_end == max_end);
+    return e->height;
+}
+
+/**
+ * @brief Random inserts and removals keep the tree valid and its overlap queries exact
+ */
+static void test_tree(void)
+{
+    static struct reg_entry entries[TREE_ENTRIES];
+    int in_tree[TREE_ENTRIES] = {};
+    struct reg_entry *root = NULL;
+    size_t live = 0;
+
+    srand(1);
+    for (int i = 0; i < TREE_ENTRIES; i++) {
+        entries[i].start = (uintptr_t)rand() % TREE_SPAN;
+        entries[i].end = entries[i].start + 1 + (uintptr_t)rand() % (1 << 16);
+    }
+    for (int i = 0; i < TREE_ENTRIES; i++) {
+        root = tree_insert(root, &entries[i]);
+        in_tree[i] = 1;
+        live++;
+    }
+    // Remove every third entry, then a few of the rest again by re-inserting and removing
+    for (int i = 0; i < TREE_ENTRIES; i += 3) {
+        root = tree_remove(root, &entries[i]);
+        in_tree[i] = 0;
+        live--;
+    }
+    for (int i = 1; i < TREE_ENTRIES; i += 7) {
+        if (!in_tree[i]) continue;
+        root = tree_remove(root, &entries[i]);
+        root = tree_insert(root, &entries[i]);
+    }
+
+    size_t count = 0;
+    int height = check_subtree(root, &count);
+    CHECK(count == live);
+    // An AVL tree of n nodes is at most about 1.44 log2(n) high
+    CHECK(height <= 18);
+
+    for (int q = 0; q < TREE_QUERIES; q++) {
+        uintptr_t start = (uintptr_t)rand() % TREE_SPAN;
+        uintptr_t end = start + 1 + (uintptr_t)rand() % (1 << 12);
+        struct reg_entry *found[REG_CACHE_MAX_OVERLAPS];
+        size_t n = tree_overlaps(root, start, end, found, 0);
+
+        size_t expected = 0;
+        for (int i = 0; i < TREE_ENTRIES; i++) {
+            if (in_tree[i] && entries[i].start < end && entries[i].end > start)
+                expected++;
+        }
+        CHECK(n == (expected < REG_CACHE_MAX_OVERLAPS ? expected : REG_CACHE_MAX_OVERLAPS));
+        for (size_t k = 0; k < n; k++)
+            CHECK(found[k]->start < end && found[k]->end > start);
+    }
+
+    for (int i = 0; i < TREE_ENTRIES; i++) {
+        if (in_tree[i])
+            root = tree_remove(root, &entries[i]);
+    }
+    CHECK(root == NULL);
+}
+
+/*******************************************************************************
+ * Cache
+ ******************************************************************************/
+
+/**
+ * @brief Address of a page in a range no test maps or touches
+ */
+static void *page(size_t index)
+{
+    return (void *)(0x100000000UL + index * (size_t)sysconf(_SC_PAGESIZE));
+}
+
+/**
+ * @brief Covered buffers hit, other access rights miss, idle neighbours merge
+ */
+static void test_lookup(void)
+{
+    struct ibv_pd pd = {};
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    struct reg_cache *cache = reg_cache_create(&pd, SIZE_MAX);
+    CHECK(cache != NULL);
+    if (!cache) return;
+
+    struct reg_entry *a = reg_cache_get(cache, page(0), 2 * page_size, 0);
+    CHECK(a && a->start == (uintptr_t)page(0) && a->end == (uintptr_t)page(2));
+    struct reg_entry *b = reg_cache_get(cache, (char *)page(1) + 10, 100, 0);
+    CHECK(b == a && a->refs == 2 && cache->hits == 1 && cache->misses == 1);
+
+    // Same memory with remote rights is a registration of its own
+    struct reg_entry *remote = reg_cache_get(cache, page(0), page_size, IBV_ACCESS_REMOTE_READ);
+    CHECK(remote && remote != a && remote->access == (IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ));
+    CHECK(reg_cache_find(cache, remote->mr) == remote);
+    reg_cache_put(cache, remote);
+    reg_cache_put(cache, b);
+    reg_cache_put(cache, a);
+
+    // A buffer spanning an idle entry and beyond folds it into one registration
+    struct reg_entry *merged = reg_cache_get(cache, page(1), 3 * page_size, 0);
+    CHECK(merged && merged->start == (uintptr_t)page(0) && merged->end == (uintptr_t)page(4));
+    CHECK(cache->evictions == 1);
+    // The remote entry kept its own rights and range
+    struct reg_entry *again = reg_cache_get(cache, page(0), page_size, IBV_ACCESS_REMOTE_READ);
+    CHECK(again == remote);
+    reg_cache_put(cache, again);
+    reg_cache_put(cache, merged);
+
+    reg_cache_destroy(cache);
+    CHECK(live_mrs == 0);
+}
+
+/**
+ * @brief The budget evicts idle entries least recently used first, never referenced ones
+ */
+static void test_budget(void)
+{
+    struct ibv_pd pd = {};
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    struct reg_cache *cache = reg_cache_create(&pd, 2 * page_size);
+    CHECK(cache != NULL);
+    if (!cache) return;
+
+    struct reg_entry *a = reg_cache_get(cache, page(10), page_size, 0);
+    struct reg_entry *b = reg_cache_get(cache, page(20), page_size, 0);
+    CHECK(a && b && cache->pinned == 2 * page_size);
+    reg_cache_put(cache, a);
+    reg_cache_put(cache, b);
+
+    // b was used last, so a goes
+    struct reg_entry *c = reg_cache_get(cache, page(30), page_size, 0);
+    CHECK(c && cache->pinned == 2 * page_size && cache->evictions == 1);
+    struct reg_entry *b2 = reg_cache_get(cache, page(20), page_size, 0);
+    CHECK(b2 == b);
+
+    // Every pinned byte is referenced: nothing can be evicted
+    CHECK(reg_cache_get(cache, page(40), page_size, 0) == NULL);
+    reg_cache_put(cache, b2);
+    reg_cache_put(cache, c);
+
+    reg_cache_destroy(cache);
+    CHECK(live_mrs == 0);
+}
+
+/**
+ * @brief Invalidation drops idle entries at once and referenced ones at their last put
+ */
+static void test_invalidate(void)
+{
+    struct ibv_pd pd = {};
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    struct reg_cache *cache = reg_cache_create(&pd, SIZE_MAX);
+    CHECK(cache != NULL);
+    if (!cache) return;
+
+    struct reg_entry *idle = reg_cache_get(cache, page(50), page_size, 0);
+    struct reg_entry *held = reg_cache_get(cache, page(52), page_size, 0);
+    CHECK(idle && held);
+    reg_cache_put(cache, idle);
+    int before = live_mrs;
+
+    reg_cache_invalidate(cache, page(50), 4 * page_size);
+    CHECK(cache->root == NULL && live_mrs == before - 1);
+    CHECK(held->stale && reg_cache_find(cache, held->mr) == held);
+
+    // The range is registered afresh, not served by the stale entry
+    struct reg_entry *fresh = reg_cache_get(cache, page(52), page_size, 0);
+    CHECK(fresh && fresh != held);
+    reg_cache_put(cache, held);
+    CHECK(cache->stale == NULL && live_mrs == before - 1);
+    reg_cache_put(cache, fresh);
+
+    reg_cache_destroy(cache);
+    CHECK(live_mrs == 0);
+}
+
+/**
+ * @brief Test entry point
+ * @return 0 if every check passed, 1 otherwise
+ */
+int main(void)
+{
+    test_tree();
+    test_lookup();
+    test_budget();
+    test_invalidate();
+    return TEST_RESULT("test_reg_cache");
+}
@@ -0,0 +1,274 @@
+/**
+ * @file trace_decode.c
+ * @brief Offline decoder of WR trace dumps
+ *
+ * Converts a dump written by trace_dump() into Chrome trace JSON, for
+ * chrome://tracing or https://ui.perfetto.dev:
+ * - Every event becomes an instant event on the track of the thread that
+ *   recorded it, with its QP, WR id, opcode and size as arguments
+ * - Every signaled send WR also becomes an async span on its QP's track,
+ *   from the post to its completion, so queueing and doorbell delays and
+ *   completion latency are visible at a glance
+ *
+ * Usage: rdma-trace-decode <dump> [output.json]
+ *
+ * Built by `make tools`. Reads only the dump, so it runs on any machine.
+ */
+
+#include "../trace.h"
+#include <infiniband/verbs.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const type_names[TRACE_TYPE_MAX] = {
+    "post_send", "doorbell", "post_recv", "recv_repost", "cqe", "qp_state", "lambda"
+};
+
+/*******************************************************************************
+ * Names
+ ******************************************************************************/
+
+/**
+ * @brief Name of a send opcode
+ * @param opcode enum ibv_wr_opcode
+ * @return Static name
+ */
+static const char *wr_opcode_name(int opcode)
+{
+    switch (opcode) {
+    case IBV_WR_SEND: return "send";
+    case IBV_WR_SEND_WITH_IMM: return "send_imm";
+    case IBV_WR_RDMA_WRITE: return "write";
+    case IBV_WR_RDMA_WRITE_WITH_IMM: return "write_imm";
+    case IBV_WR_RDMA_READ: return "read";
+    case IBV_WR_ATOMIC_CMP_AND_SWP: return "cmp_swap";
+    case IBV_WR_ATOMIC_FETCH_AND_ADD: return "fetch_add";
+    default: return "other";
+    }
+}
+
+/**
+ * @brief Name of a completion opcode
+ * @param opcode enum ibv_wc_opcode
+ * @return Static name
+ */
+static const char *wc_opcode_name(int opcode)
+{
+    switch (opcode) {
+    case IBV_WC_SEND: return "send";
+    case IBV_WC_RDMA_WRITE: return "write";
+    case IBV_WC_RDMA_READ: return "read";
+    case IBV_WC_COMP_SWAP: return "cmp_swap";
+    case IBV_WC_FETCH_ADD: return "fetch_add";
+    case IBV_WC_RECV: return "recv";
+    case IBV_WC_RECV_RDMA_WITH_IMM: return "recv_imm";
+    default: return "other";
+    }
+}
+
+/**
+ * @brief Name of a QP state
+ * @param state enum ibv_qp_state
+ * @return Static name
+ */
+static const char *qp_state_name(int state)
+{
+    switch (state) {
+    case IBV_QPS_RESET: return "RESET";
+    case IBV_QPS_INIT: return "INIT";
+    case IBV_QPS_RTR: return "RTR";
+    case IBV_QPS_RTS: return "RTS";
+    case IBV_QPS_SQD: return "SQD";
+    case IBV_QPS_SQE: return "SQE";
+    case IBV_QPS_ERR: return "ERR";
+    default: return "UNKNOWN";
+    }
+}
+
+/**
+ * @brief Name of a lambda request stage
+ * @param stage trace_lambda_stage_t
+ * @return Static name
+ */
+static const char *lambda_stage_name(int stage)
+{
+    switch (stage) {
+    case TRACE_LAMBDA_META: return "meta";
+    case TRACE_LAMBDA_CODE: return "code";
+    case TRACE_LAMBDA_INPUT: return "input";
+    case TRACE_LAMBDA_EXEC: return "exec";
+    case TRACE_LAMBDA_RESULT: return "result";
+    default: return "other";
+    }
+}
+
+/*******************************************************************************
+ * Decoding
+ ******************************************************************************/
+
+/**
+ * @brief qsort comparator ordering events by timestamp
+ */
+static int by_tsc(const void *a, const void *b)
+{
+    const struct trace_event *x = a, *y = b;
+    return x->tsc < y->tsc ? -1 : x->tsc > y->tsc;
+}
+
+/**
+ * @brief Reads a whole dump
+ * @param path Dump file
+ * @param hdr Receives the header
+ * @param count Receives the number of events
+ * @return Events (caller frees), or NULL on failure
+ */
+static struct trace_event *read_dump(const char *path, struct trace_file_header *hdr, size_t *count)
+{
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        perror(path);
+        return NULL;
+    }
+    if (fread(hdr, sizeof(*hdr), 1, in) != 1 || memcmp(hdr->magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a trace dump\n", path);
+        fclose(in);
+        return NULL;
+    }
+    if (hdr->version != TRACE_VERSION || hdr->event_size != sizeof(struct trace_event)) {
+        fprintf(stderr, "%s: trace format version %u, this decoder reads version %u\n", path, hdr->version,
+                TRACE_VERSION);
+        fclose(in);
+        return NULL;
+    }
+
+    size_t cap = 1 << 16, n = 0;
+    struct trace_event *events = malloc(cap * sizeof(*events));
+    while (events) {
+        n += fread(events + n, sizeof(*events), cap - n, in);
+        if (n < cap) break;
+        struct trace_event *grown = realloc(events, 2 * cap * sizeof(*events));
+        if (!grown) {
+            free(events);
+            events = NULL;
+            break;
+        }
+        events = grown;
+        cap *= 2;
+    }
+    fclose(in);
+    if (!events) {
+        fprintf(stderr, "%s: out of memory\n", path);
+        return NULL;
+    }
+    *count = n;
+    return events;
+}
+
+/**
+ * @brief Writes the Chrome trace JSON of a dump
+ * @param out Output stream
+ * @param hdr Dump header
+ * @param events Events sorted by timestamp
+ * @param count Number of events
+ */
+static void write_chrome_trace(FILE *out, const struct trace_file_header *hdr, const struct trace_event *events,
+                               size_t count)
+{
+    // Ticks to microseconds, from the clock pairs taken at enable and dump time
+    double us_per_tick = 1e-3;
+    if (hdr->dump_tsc > hdr->base_tsc && hdr->dump_ns > hdr->base_ns)
+        us_per_tick = (double)(hdr->dump_ns - hdr->base_ns) / (hdr->dump_tsc - hdr->base_tsc) / 1000.0;
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"threads\"}},\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"signaled WRs by QP\"}}");
+
+    for (size_t i = 0; i < count; i++) {
+        const struct trace_event *ev = &events[i];
+        double ts = ((int64_t)(ev->tsc - hdr->base_tsc)) * us_per_tick;
+        const char *type = ev->type < TRACE_TYPE_MAX ? type_names[ev->type] : "unknown";
+
+        fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%u,"
+                     "\"args\":{\"qp\":%u",
+                type, type, ts, ev->tid, ev->qp_num);
+        switch (ev->type) {
+        case TRACE_POST_SEND:
+            fprintf(out, ",\"wr_id\":\"0x%" PRIx64 "\",\"op\":\"%s\",\"bytes\":%u,\"signaled\":%d,\"inline\":%d",
+                    ev->wr_id, wr_opcode_name(ev->opcode), ev->value, !!(ev->flags & IBV_SEND_SIGNALED),
+                    !!(ev->flags & IBV_SEND_INLINE));
+            break;
+        case TRACE_DOORBELL:
+        case TRACE_POST_RECV:
+        case TRACE_RECV_REPOST:
+            fprintf(out, ",\"wr_id\":\"0x%" PRIx64 "\",\"wrs\":%u", ev->wr_id, ev->value);
+            break;
+        case TRACE_CQE:
+            fprintf(out, ",\"wr_id\":\"0x%" PRIx64 "\",\"op\":\"%s\",\"bytes\":%u,\"status\":%u", ev->wr_id,
+                    wc_opcode_name(ev->opcode), ev->value, ev->status);
+            break;
+        case TRACE_QP_STATE:
+            fprintf(out, ",\"state\":\"%s\"", qp_state_name(ev->opcode));
+            break;
+        case TRACE_LAMBDA:
+            fprintf(out, ",\"stage\":\"%s\",\"bytes\":%u", lambda_stage_name(ev->opcode), ev->value);
+            if (ev->opcode == TRACE_LAMBDA_EXEC)
+                fprintf(out, ",\"result\":%" PRId64, (int64_t)ev->wr_id);
+            break;
+        }
+        fprintf(out, "}}");
+
+        // Async span per signaled send WR: begins at its post, ends at its completion
+        if (ev->type == TRACE_POST_SEND && (ev->flags & IBV_SEND_SIGNALED)) {
+            fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"wr\",\"ph\":\"b\",\"id\":\"%u:0x%" PRIx64 "\",\"ts\":%.3f,"
+                         "\"pid\":2,\"tid\":%u}",
+                    wr_opcode_name(ev->opcode), ev->qp_num, ev->wr_id, ts, ev->qp_num);
+        } else if (ev->type == TRACE_CQE && !(ev->opcode & IBV_WC_RECV)) {
+            fprintf(out, ",\n{\"name\":\"%s\",\"cat\":\"wr\",\"ph\":\"e\",\"id\":\"%u:0x%" PRIx64 "\",\"ts\":%.3f,"
+                         "\"pid\":2,\"tid\":%u,\"args\":{\"status\":%u}}",
+                    wc_opcode_name(ev->opcode), ev->qp_num, ev->wr_id, ts, ev->qp_num, ev->status);
+        }
+    }
+    fprintf(out, "\n]}\n");
+}
+
+/**
+ * @brief Decoder entry point
+ * @param argc Number of command line arguments
+ * @param argv Dump path, then an optional output path (stdout otherwise)
+ * @return 0 on success, 1 on failure
+ */
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <dump> [output.json]\n", argv[0]);
+        return 1;
+    }
+
+    struct trace_file_header hdr;
+    size_t count;
+    struct trace_event *events = read_dump(argv[1], &hdr, &count);
+    if (!events) {
+        return 1;
+    }
+    qsort(events, count, sizeof(*events), by_tsc);
+
+    FILE *out = argc > 2 ? fopen(argv[2], "w") : stdout;
+    if (!out) {
+        perror(argv[2]);
+        free(events);
+        return 1;
+    }
+    write_chrome_trace(out, &hdr, events, count);
+    int ok = fflush(out) == 0;
+    if (out != stdout)
+        ok = fclose(out) == 0 && ok;
+    free(events);
+    if (!ok) {
+        fprintf(stderr, "Failed to write the Chrome trace\n");
+        return 1;
+    }
+    fprintf(stderr, "%zu events decoded\n", count);
+    return 0;
+}
@@ -0,0 +1,398 @@
+/**
+ * @file trace.c
+ * @brief Work request lifecycle tracing implementation
+ *
+ * Implements:
+ * - Per-thread single-writer event rings, claimed on a thread's first event
+ *   and handed to a later thread once their owner exits
+ * - Time-stamp counter reads, with a CLOCK_MONOTONIC fallback
+ * - Lock-free, async-signal-safe dumps of every ring to a file
+ */
+
+#include "trace.h"
+#include "common.h"
+#include <fcntl.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * @brief One thread's event ring
+ *
+ * Only the owning thread writes events and head. head counts every event
+ * ever recorded and is published with a release store after the event, so
+ * a dump reading it with an acquire load sees complete events below it.
+ */
+struct trace_ring {
+    uint64_t head;               // Events recorded (next slot: head % TRACE_RING_EVENTS)
+    int owned;                   // Non-zero while a live thread records into the ring
+    struct trace_ring *next;     // Next ring ever created
+    struct trace_event events[TRACE_RING_EVENTS];
+};
+
+int trace_on;
+
+// Every ring ever created; rings are recycled, never freed, and pushed with a release store
+static struct trace_ring *rings;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t rings_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static __thread struct trace_ring *self;
+static __thread uint32_t self_tid;
+
+// Staging copy of one ring, so a dump allocates nothing; dumping guards it
+static struct trace_event dump_copy[TRACE_RING_EVENTS];
+static int dumping;
+
+// Clock pair taken when tracing is first enabled
+static uint64_t base_tsc;
+static uint64_t base_ns;
+static int base_taken;
+
+/*******************************************************************************
+ * Clocks
+ ******************************************************************************/
+
+/**
+ * @brief Reads the time-stamp counter
+ * @return Counter value: TSC on x86, the virtual counter on AArch64, nanoseconds elsewhere
+ */
+static inline uint64_t trace_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t v;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(v));
+    return v;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief Monotonic clock in nanoseconds
+ * @return Current CLOCK_MONOTONIC time
+ */
+static uint64_t trace_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*******************************************************************************
+ * Rings
+ ******************************************************************************/
+
+/**
+ * @brief Thread exit destructor: frees the ring for reuse
+ * @param arg The exiting thread's ring
+ */
+static void ring_release(void *arg)
+{
+    struct trace_ring *ring = arg;
+    __atomic_store_n(&ring->owned, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Creates the thread-exit key
+ */
+static void ring_key_create(void)
+{
+    pthread_key_create(&ring_key, ring_release);
+}
+
+/**
+ * @brief Returns the calling thread's ring, claiming one on first use
+ * @return Ring, or NULL if none could be allocated
+ *
+ * Takes the ring list lock once per thread; recording afterwards is lock-free.
+ */
+static struct trace_ring *ring_self(void)
+{
+    if (__builtin_expect(self != NULL, 1))
+        return self;
+
+    pthread_once(&rings_once, ring_key_create);
+    pthread_mutex_lock(&rings_lock);
+    struct trace_ring *ring;
+    for (ring = rings; ring; ring = ring->next) {
+        if (!__atomic_load_n(&ring->owned, __ATOMIC_ACQUIRE))
+            break;
+    }
+    if (!ring) {
+        ring = calloc(1, sizeof(*ring));
+        if (ring) {
+            // Dumps walk the list without the lock
+            ring->next = rings;
+            __atomic_store_n(&rings, ring, __ATOMIC_RELEASE);
+        }
+    }
+    if (ring)
+        ring->owned = 1;
+    pthread_mutex_unlock(&rings_lock);
+
+    if (ring) {
+        pthread_setspecific(ring_key, ring);
+        self_tid = (uint32_t)syscall(SYS_gettid);
+        self = ring;
+    }
+    return ring;
+}
+
+/**
+ * @brief Claims the next event slot of the calling thread's ring
+ * @param ring Calling thread's ring
+ * @return Zeroed slot; publish it with ring_commit()
+ */
+static inline struct trace_event *ring_slot(struct trace_ring *ring)
+{
+    struct trace_event *ev = &ring->events[ring->head & (TRACE_RING_EVENTS - 1)];
+    memset(ev, 0, sizeof(*ev));
+    ev->tid = self_tid;
+    return ev;
+}
+
+/**
+ * @brief Publishes the event claimed by ring_slot()
+ * @param ring Calling thread's ring
+ */
+static inline void ring_commit(struct trace_ring *ring)
+{
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/*******************************************************************************
+ * Recording
+ ******************************************************************************/
+
+/**
+ * @brief Records send-side events for a chain of WRs
+ * @param type TRACE_POST_SEND (one event per WR) or TRACE_DOORBELL (one per chain)
+ * @param qp_num QP the chain is posted to
+ * @param wr First WR of the chain
+ */
+void trace_record_sends(trace_type_t type, uint32_t qp_num, const struct ibv_send_wr *wr)
+{
+    struct trace_ring *ring = ring_self();
+    if (!ring || !wr) return;
+
+    uint64_t tsc = trace_tsc();
+    if (type == TRACE_DOORBELL) {
+        struct trace_event *ev = ring_slot(ring);
+        ev->tsc = tsc;
+        ev->type = type;
+        ev->qp_num = qp_num;
+        ev->wr_id = wr->wr_id;
+        ev->opcode = wr->opcode;
+        for (const struct ibv_send_wr *w = wr; w; w = w->next)
+            ev->value++;
+        ring_commit(ring);
+        return;
+    }
+
+    for (; wr; wr = wr->next) {
+        struct trace_event *ev = ring_slot(ring);
+        ev->tsc = tsc;
+        ev->type = type;
+        ev->qp_num = qp_num;
+        ev->wr_id = wr->wr_id;
+        ev->opcode = wr->opcode;
+        ev->flags = wr->send_flags;
+        for (int i = 0; i < wr->num_sge; i++)
+            ev->value += wr->sg_list[i].length;
+        ring_commit(ring);
+    }
+}
+
+/**
+ * @brief Records one event for a chain of receive WRs
+ * @param type TRACE_POST_RECV or TRACE_RECV_REPOST
+ * @param qp_num QP the chain is posted to (0 for an SRQ)
+ * @param wr First WR of the chain
+ */
+void trace_record_recvs(trace_type_t type, uint32_t qp_num, const struct ibv_recv_wr *wr)
+{
+    struct trace_ring *ring = ring_self();
+    if (!ring || !wr) return;
+
+    struct trace_event *ev = ring_slot(ring);
+    ev->tsc = trace_tsc();
+    ev->type = type;
+    ev->qp_num = qp_num;
+    ev->wr_id = wr->wr_id;
+    for (; wr; wr = wr->next)
+        ev->value++;
+    ring_commit(ring);
+}
+
+/**
+ * @brief Records a reaped completion
+ * @param wc Completion
+ */
+void trace_record_cqe(const struct ibv_wc *wc)
+{
+    struct trace_ring *ring = ring_self();
+    if (!ring) return;
+
+    struct trace_event *ev = ring_slot(ring);
+    ev->tsc = trace_tsc();
+    ev->type = TRACE_CQE;
+    ev->qp_num = wc->qp_num;
+    ev->wr_id = wc->wr_id;
+    ev->opcode = wc->opcode;
+    ev->status = wc->status;
+    ev->value = wc->byte_len;
+    ring_commit(ring);
+}
+
+/**
+ * @brief Records a QP state transition
+ * @param qp_num QP
+ * @param state New enum ibv_qp_state
+ */
+void trace_record_state(uint32_t qp_num, int state)
+{
+    struct trace_ring *ring = ring_self();
+    if (!ring) return;
+
+    struct trace_event *ev = ring_slot(ring);
+    ev->tsc = trace_tsc();
+    ev->type = TRACE_QP_STATE;
+    ev->qp_num = qp_num;
+    ev->opcode = state;
+    ring_commit(ring);
+}
+
+/**
+ * @brief Records a lambda server request reaching a stage
+ * @param qp_num QP the request arrived on
+ * @param stage Stage reached
+ * @param value Bytes involved (see trace_lambda_stage_t)
+ * @param result Function result (TRACE_LAMBDA_EXEC, 0 otherwise)
+ */
+void trace_record_lambda(uint32_t qp_num, trace_lambda_stage_t stage, uint32_t value, int64_t result)
+{
+    struct trace_ring *ring = ring_self();
+    if (!ring) return;
+
+    struct trace_event *ev = ring_slot(ring);
+    ev->tsc = trace_tsc();
+    ev->type = TRACE_LAMBDA;
+    ev->qp_num = qp_num;
+    ev->opcode = stage;
+    ev->value = value;
+    ev->wr_id = (uint64_t)result;
+    ring_commit(ring);
+}
+
+/*******************************************************************************
+ * Control
+ ******************************************************************************/
+
+/**
+ * @brief Turns recording on or off
+ * @param on Non-zero to record
+ *
+ * The first enable takes the clock pair dumps convert timestamps with; only
+ * atomics are used, so this may run in a signal handler.
+ */
+void trace_enable(int on)
+{
+    if (on && !__atomic_exchange_n(&base_taken, 1, __ATOMIC_ACQ_REL)) {
+        base_ns = trace_now_ns();
+        base_tsc = trace_tsc();
+    }
+    __atomic_store_n(&trace_on, on ? 1 : 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Writes a whole buffer to a file descriptor
+ * @param fd Open file
+ * @param buf Data
+ * @param len Bytes to write
+ * @return 0 on success, -1 on error
+ */
+static int dump_write(int fd, const void *buf, size_t len)
+{
+    for (size_t done = 0; done < len;) {
+        ssize_t n = write(fd, (const char *)buf + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        done += n;
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes every ring to a file
+ * @param path Output file
+ * @return 0 on success, -1 on failure (errno set) or while another dump runs
+ *
+ * Only open, write, close and clock reads are used, with no lock and no
+ * allocation, so a signal handler may dump. Nothing is logged; the caller
+ * reports the result.
+ */
+int trace_dump(const char *path)
+{
+    if (__atomic_exchange_n(&dumping, 1, __ATOMIC_ACQUIRE)) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    int saved_errno = 0;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        __atomic_store_n(&dumping, 0, __ATOMIC_RELEASE);
+        return -1;
+    }
+
+    struct trace_file_header hdr = {
+        .magic = TRACE_MAGIC,
+        .version = TRACE_VERSION,
+        .event_size = sizeof(struct trace_event),
+        .base_tsc = base_tsc,
+        .base_ns = base_ns,
+        .dump_ns = trace_now_ns(),
+        .dump_tsc = trace_tsc(),
+    };
+    int ok = dump_write(fd, &hdr, sizeof(hdr)) == 0;
+
+    for (struct trace_ring *ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring && ok; ring = ring->next) {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t first = head > TRACE_RING_EVENTS ? head - TRACE_RING_EVENTS : 0;
+        for (uint64_t i = first; i < head; i++)
+            dump_copy[i - first] = ring->events[i & (TRACE_RING_EVENTS - 1)];
+
+        // The owner may have kept recording: drop the slots it reused under the copy,
+        // including slot now, which it may be writing this very moment
+        uint64_t now = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t start = now >= TRACE_RING_EVENTS ? now + 1 - TRACE_RING_EVENTS : 0;
+        if (start < first)
+            start = first;
+        if (start > head)
+            start = head;
+        size_t n = head - start;
+        if (n && dump_write(fd, dump_copy + (start - first), n * sizeof(struct trace_event)))
+            ok = 0;
+    }
+
+    if (!ok)
+        saved_errno = errno;
+    if (close(fd) != 0 && ok) {
+        ok = 0;
+        saved_errno = errno;
+    }
+    __atomic_store_n(&dumping, 0, __ATOMIC_RELEASE);
+    if (!ok) {
+        errno = saved_errno;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,183 @@
+/**
+ * @file trace.h
+ * @brief Work request lifecycle tracing interface
+ *
+ * Records timestamped binary events into a per-thread ring buffer: send WRs
+ * handed to the library, doorbells (ibv_post_send calls), receive posts and
+ * reposts, completions and QP state transitions. Recording takes no lock and
+ * makes no system call: a thread writes only its own ring, stamps events with
+ * the CPU's time-stamp counter, and overwrites its oldest events when full.
+ *
+ * Tracing is off unless trace_enable() turns it on, and can be toggled at any
+ * time while the program runs; when off, each hook costs one relaxed load and
+ * a predicted branch. trace_dump() writes every ring to a file, which the
+ * rdma-trace-decode tool (`make tools`) converts to Chrome trace JSON for
+ * chrome://tracing or Perfetto.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/**
+ * Trace Configuration
+ * TRACE_RING_EVENTS: Events kept per thread (power of two); older ones are overwritten
+ * TRACE_MAGIC: First eight bytes of a dump file
+ * TRACE_VERSION: Dump format version, bumped on any change to the structures below
+ */
+#define TRACE_RING_EVENTS (1 << 16)
+#define TRACE_MAGIC "RDMATRC"
+#define TRACE_VERSION 2
+
+/**
+ * Trace Event Types
+ * TRACE_POST_SEND: A send WR was handed to the library (queued for a doorbell when batching)
+ * TRACE_DOORBELL: ibv_post_send rang the doorbell for a chain of WRs
+ * TRACE_POST_RECV: A receive WR was posted
+ * TRACE_RECV_REPOST: Consumed receive ring or SRQ slots were reposted as one chain
+ * TRACE_CQE: A completion was reaped
+ * TRACE_QP_STATE: A QP moved to a new state
+ * TRACE_LAMBDA: A lambda server request reached a stage (trace_lambda_stage_t)
+ */
+typedef enum trace_type {
+	TRACE_POST_SEND,
+	TRACE_DOORBELL,
+	TRACE_POST_RECV,
+	TRACE_RECV_REPOST,
+	TRACE_CQE,
+	TRACE_QP_STATE,
+	TRACE_LAMBDA,
+	TRACE_TYPE_MAX
+} trace_type_t;
+
+/**
+ * Lambda Request Stages (opcode of TRACE_LAMBDA)
+ * TRACE_LAMBDA_META: Metadata received; value is the announced code size
+ * TRACE_LAMBDA_CODE: Code copied to the executable region; value is its size
+ * TRACE_LAMBDA_INPUT: Input received; value is its size
+ * TRACE_LAMBDA_EXEC: Function returned; value is the output size, wr_id the result
+ * TRACE_LAMBDA_RESULT: Result written back to the client; value is its size
+ */
+typedef enum trace_lambda_stage {
+	TRACE_LAMBDA_META,
+	TRACE_LAMBDA_CODE,
+	TRACE_LAMBDA_INPUT,
+	TRACE_LAMBDA_EXEC,
+	TRACE_LAMBDA_RESULT
+} trace_lambda_stage_t;
+
+/**
+ * Trace Event
+ * 32 bytes, two per cache line. Fields not listed for a type are zero.
+ */
+struct trace_event {
+	uint64_t tsc;                // Time-stamp counter when recorded
+	uint64_t wr_id;              // WR id (posts, CQEs), function result (lambda exec)
+	uint32_t qp_num;             // QP the event belongs to (0 for SRQ reposts)
+	uint32_t value;              // Bytes (posts, CQEs, lambda), WRs (doorbells, reposts)
+	uint32_t tid;                // Kernel thread id of the recording thread
+	uint8_t type;                // trace_type_t
+	uint8_t opcode;              // ibv_wr_opcode (posts), ibv_wc_opcode (CQEs), ibv_qp_state (transitions),
+	                             // trace_lambda_stage_t (lambda)
+	uint8_t status;              // ibv_wc_status (CQEs)
+	uint8_t flags;               // ibv_send_flags (send posts)
+};
+
+/**
+ * Dump File Header
+ * Followed by events, unordered across threads, until the end of the file.
+ * The two clock pairs convert time-stamp counter ticks to nanoseconds.
+ */
+struct trace_file_header {
+	char magic[8];               // TRACE_MAGIC
+	uint32_t version;            // TRACE_VERSION
+	uint32_t event_size;         // sizeof(struct trace_event)
+	uint64_t base_tsc;           // Time-stamp counter when tracing was first enabled
+	uint64_t base_ns;            // CLOCK_MONOTONIC at the same moment
+	uint64_t dump_tsc;           // Time-stamp counter when the dump was taken
+	uint64_t dump_ns;            // CLOCK_MONOTONIC at the same moment
+};
+
+struct ibv_send_wr;
+struct ibv_recv_wr;
+struct ibv_wc;
+
+// Runtime switch; read through trace_enabled()
+extern int trace_on;
+
+/**
+ * @brief Whether hooks record events
+ * @return Non-zero while tracing is enabled
+ */
+static inline int trace_enabled(void)
+{
+    return __builtin_expect(__atomic_load_n(&trace_on, __ATOMIC_RELAXED), 0);
+}
+
+/**
+ * Control Functions
+ * trace_enable: Turns recording on (non-zero) or off; async-signal-safe, so a signal
+ *               handler may toggle it. Events already recorded are kept.
+ * trace_dump: Writes every thread's ring to path; returns 0 on success, -1 on failure
+ *             (errno set). Safe while other threads record: events overwritten during
+ *             the copy are left out. Async-signal-safe (open/write/close only, no lock
+ *             or allocation) and logs nothing, so a shutdown signal handler may call it.
+ */
+void trace_enable(int on);
+int trace_dump(const char *path);
+
+/**
+ * Recording Functions (called by the hooks below; the calling thread's ring only)
+ */
+void trace_record_sends(trace_type_t type, uint32_t qp_num, const struct ibv_send_wr *wr);
+void trace_record_recvs(trace_type_t type, uint32_t qp_num, const struct ibv_recv_wr *wr);
+void trace_record_cqe(const struct ibv_wc *wc);
+void trace_record_state(uint32_t qp_num, int state);
+void trace_record_lambda(uint32_t qp_num, trace_lambda_stage_t stage, uint32_t value, int64_t result);
+
+/**
+ * Hooks
+ * trace_on_post_send: One TRACE_POST_SEND per WR of a chain the library accepted
+ * trace_on_doorbell: One TRACE_DOORBELL for a chain passed to ibv_post_send
+ * trace_on_post_recv / trace_on_recv_repost: One event for a receive chain
+ * trace_on_completion: One TRACE_CQE
+ * trace_on_qp_state: One TRACE_QP_STATE
+ * trace_on_lambda: One TRACE_LAMBDA
+ */
+static inline void trace_on_post_send(uint32_t qp_num, const struct ibv_send_wr *wr)
+{
+    if (trace_enabled()) trace_record_sends(TRACE_POST_SEND, qp_num, wr);
+}
+
+static inline void trace_on_doorbell(uint32_t qp_num, const struct ibv_send_wr *wr)
+{
+    if (trace_enabled()) trace_record_sends(TRACE_DOORBELL, qp_num, wr);
+}
+
+static inline void trace_on_post_recv(uint32_t qp_num, const struct ibv_recv_wr *wr)
+{
+    if (trace_enabled()) trace_record_recvs(TRACE_POST_RECV, qp_num, wr);
+}
+
+static inline void trace_on_recv_repost(uint32_t qp_num, const struct ibv_recv_wr *wr)
+{
+    if (trace_enabled()) trace_record_recvs(TRACE_RECV_REPOST, qp_num, wr);
+}
+
+static inline void trace_on_completion(const struct ibv_wc *wc)
+{
+    if (trace_enabled()) trace_record_cqe(wc);
+}
+
+static inline void trace_on_qp_state(uint32_t qp_num, int state)
+{
+    if (trace_enabled()) trace_record_state(qp_num, state);
+}
+
+static inline void trace_on_lambda(uint32_t qp_num, trace_lambda_stage_t stage, uint32_t value, int64_t result)
+{
+    if (trace_enabled()) trace_record_lambda(qp_num, stage, value, result);
+}
+
+#endif // TRACE_H